@@ -0,0 +1,253 @@
+/*
+ *  areas.c
+ *
+ *  Reads the list of Squish areas from a Husky fidoconfig or a Squish
+ *  SQUISH.CFG-style areas file.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  Area lines look like
+ *
+ *    EchoArea FIDONEWS /var/spool/fido/fidonews -b Squish -p 30
+ *    EchoArea FIDONEWS /var/spool/fido/fidonews -$ -p30
+ *
+ *  The first form is fidoconfig, the second SQUISH.CFG.  NetmailArea,
+ *  LocalArea, BadArea and DupeArea lines are read the same way.  An area
+ *  is taken to be Squish if it has "-b Squish" or a "-$" option, or if it
+ *  has no -b option and an earlier EchoAreaDefaults line said "-b Squish"
+ *  (this doesn't apply to netmail areas).  Include lines are followed.
+ *  Everything from a '#' or ';' at the start of a word is a comment.
+ *  Environment variables in fidoconfig files are not expanded.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "areas.h"
+
+#define MAX_LINE    1024
+#define MAX_TOKENS  64
+#define MAX_INCLUDE 8
+
+static int str_ieq(const char *a, const char *b)
+{
+    while (*a != '\0' && tolower((unsigned char) *a) == tolower((unsigned char) *b))
+    {
+        a++;
+        b++;
+    }
+
+    return *a == '\0' && *b == '\0';
+}
+
+static char *str_dup(const char *str)
+{
+    char *p;
+
+    p = malloc(strlen(str) + 1);
+    assert(p != NULL);
+    strcpy(p, str);
+
+    return p;
+}
+
+static int tokenize(char *line, char **tok)
+{
+    char *p;
+    int n;
+
+    n = 0;
+    p = line;
+
+    for (;;)
+    {
+        while (isspace((unsigned char) *p))
+        {
+            p++;
+        }
+
+        if (*p == '\0' || *p == '#' || *p == ';' || n == MAX_TOKENS)
+        {
+            break;
+        }
+
+        if (*p == '"')
+        {
+            p++;
+            tok[n++] = p;
+
+            while (*p != '\0' && *p != '"')
+            {
+                p++;
+            }
+        }
+        else
+        {
+            tok[n++] = p;
+
+            while (*p != '\0' && !isspace((unsigned char) *p))
+            {
+                p++;
+            }
+        }
+
+        if (*p != '\0')
+        {
+            *p++ = '\0';
+        }
+    }
+
+    return n;
+}
+
+/*
+ *  Returns 1 if the options in tok say the area is Squish, 0 if they say
+ *  it's something else, or dflt if they don't say.
+ */
+
+static int is_squish(char **tok, int n, int dflt)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (strncmp(tok[i], "-$", 2) == 0)
+        {
+            return 1;
+        }
+
+        if (str_ieq(tok[i], "-b") && i + 1 < n)
+        {
+            return str_ieq(tok[i + 1], "squish");
+        }
+    }
+
+    return dflt;
+}
+
+static void add_area(AREALIST *list, const char *name, const char *path)
+{
+    AREA *a;
+    size_t len;
+
+    if (list->count == list->size)
+    {
+        list->size = list->size != 0 ? list->size * 2 : 64;
+        list->areas = realloc(list->areas, sizeof *list->areas * (size_t) list->size);
+        assert(list->areas != NULL);
+    }
+
+    a = &list->areas[list->count++];
+    a->name = str_dup(name);
+    a->path = str_dup(path);
+
+    /* fidoconfig paths have no extension, but allow for one */
+
+    len = strlen(a->path);
+
+    if (len > 4 && str_ieq(a->path + len - 4, ".sqd"))
+    {
+        a->path[len - 4] = '\0';
+    }
+}
+
+static int read_file(AREALIST *list, const char *filename, int depth, int *echo_default)
+{
+    FILE *fp;
+    char line[MAX_LINE], *tok[MAX_TOKENS];
+    int n;
+
+    fp = fopen(filename, "r");
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    while (fgets(line, sizeof line, fp) != NULL)
+    {
+        n = tokenize(line, tok);
+
+        if (n == 0)
+        {
+            continue;
+        }
+
+        if (str_ieq(tok[0], "include") && n > 1)
+        {
+            if (depth < MAX_INCLUDE)
+            {
+                read_file(list, tok[1], depth + 1, echo_default);
+            }
+        }
+        else if (str_ieq(tok[0], "EchoAreaDefaults"))
+        {
+            *echo_default = is_squish(tok + 1, n - 1, 0);
+        }
+        else if (n >= 3 && !str_ieq(tok[2], "passthrough"))
+        {
+            int squish;
+
+            if (str_ieq(tok[0], "EchoArea") || str_ieq(tok[0], "LocalArea") ||
+              str_ieq(tok[0], "BadArea") || str_ieq(tok[0], "DupeArea"))
+            {
+                squish = is_squish(tok + 3, n - 3, *echo_default);
+            }
+            else if (str_ieq(tok[0], "NetmailArea"))
+            {
+                squish = is_squish(tok + 3, n - 3, 0);
+            }
+            else
+            {
+                squish = 0;
+            }
+
+            if (squish)
+            {
+                add_area(list, tok[1], tok[2]);
+            }
+        }
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+void areas_init(AREALIST *list)
+{
+    list->areas = NULL;
+    list->count = 0;
+    list->size = 0;
+}
+
+/*
+ *  Adds the Squish areas in filename to list.  Returns 0, or -1 with errno
+ *  set if the file can't be opened.
+ */
+
+int areas_read(AREALIST *list, const char *filename)
+{
+    int echo_default;
+
+    echo_default = 0;
+
+    return read_file(list, filename, 0, &echo_default);
+}
+
+void areas_free(AREALIST *list)
+{
+    int i;
+
+    for (i = 0; i < list->count; i++)
+    {
+        free(list->areas[i].name);
+        free(list->areas[i].path);
+    }
+
+    free(list->areas);
+    areas_init(list);
+}
@@ -0,0 +1,41 @@
+/*
+ *  areas.h
+ *
+ *  Reads the list of Squish areas from a Husky fidoconfig or a Squish
+ *  SQUISH.CFG-style areas file.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __AREAS_H__
+#define __AREAS_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+    char *name;                      /* area tag */
+    char *path;                      /* base path, without the .sqd */
+}
+AREA;
+
+typedef struct
+{
+    AREA *areas;
+    int count;
+    int size;
+}
+AREALIST;
+
+void areas_init(AREALIST *list);
+int areas_read(AREALIST *list, const char *filename);
+void areas_free(AREALIST *list);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
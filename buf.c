@@ -0,0 +1,103 @@
+/*
+ *  buf.c
+ *
+ *  Growable output buffer.  Running out of memory is fatal.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+
+#include "buf.h"
+
+void buf_init(BUF *b)
+{
+    b->data = NULL;
+    b->len = 0;
+    b->size = 0;
+}
+
+void buf_free(BUF *b)
+{
+    free(b->data);
+    buf_init(b);
+}
+
+/*
+ *  Makes room for at least len more bytes.
+ */
+
+void buf_reserve(BUF *b, size_t len)
+{
+    size_t size;
+
+    if (b->size - b->len >= len)
+    {
+        return;
+    }
+
+    size = b->size != 0 ? b->size : 4096;
+
+    while (size - b->len < len)
+    {
+        size *= 2;
+    }
+
+    b->data = realloc(b->data, size);
+    assert(b->data != NULL);
+    b->size = size;
+}
+
+void buf_write(BUF *b, const void *p, size_t len)
+{
+    /* an empty BUF has no data to copy to, even nothing */
+
+    if (len == 0)
+    {
+        return;
+    }
+
+    buf_reserve(b, len);
+    memcpy(b->data + b->len, p, len);
+    b->len += len;
+}
+
+void buf_puts(BUF *b, const char *str)
+{
+    buf_write(b, str, strlen(str));
+}
+
+void buf_putc(BUF *b, int c)
+{
+    buf_reserve(b, 1);
+    b->data[b->len++] = (char) c;
+}
+
+void buf_printf(BUF *b, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    buf_reserve(b, 256);
+
+    va_start(args, fmt);
+    len = vsnprintf(b->data + b->len, b->size - b->len, fmt, args);
+    va_end(args);
+
+    assert(len >= 0);
+
+    if ((size_t) len >= b->size - b->len)
+    {
+        buf_reserve(b, (size_t) len + 1);
+
+        va_start(args, fmt);
+        len = vsnprintf(b->data + b->len, b->size - b->len, fmt, args);
+        va_end(args);
+    }
+
+    b->len += (size_t) len;
+}
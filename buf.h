@@ -0,0 +1,39 @@
+/*
+ *  buf.h
+ *
+ *  Growable output buffer.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __BUF_H__
+#define __BUF_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t size;
+}
+BUF;
+
+void buf_init(BUF *b);
+void buf_free(BUF *b);
+void buf_reserve(BUF *b, size_t len);
+void buf_write(BUF *b, const void *p, size_t len);
+void buf_puts(BUF *b, const char *str);
+void buf_putc(BUF *b, int c);
+void buf_printf(BUF *b, const char *fmt, ...);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
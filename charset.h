@@ -0,0 +1,39 @@
+/*
+ *  charset.h
+ *
+ *  Converts text in FidoNet character sets to UTF-8.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __CHARSET_H__
+#define __CHARSET_H__
+
+#include <stddef.h>
+
+#include "buf.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+    const char *name;                /* MIME name, eg. "IBM437" */
+    const unsigned short *ucs;       /* code points of 0x80-0xff; NULL for UTF-8 */
+    unsigned char utf8[128][4];      /* the same in UTF-8: length, then bytes */
+}
+CHARSET;
+
+const CHARSET *charset_find(const char *chrs, size_t len);
+const CHARSET *charset_default(void);
+void charset_to_utf8(BUF *out, const CHARSET *cs, const char *p, size_t len);
+
+#define charset_is_utf8(cs) ((cs)->ucs == NULL)
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+
+"""checkbases makes small Squish bases that are damaged, or have had
+messages deleted, and checks what the tools that recover messages or
+rewrite bases make of them: which messages they recover, and which they
+refuse.
+
+Usage: checkbases.py [directory with the programs]
+
+Written by Andrew Clarke and released to the public domain."""
+
+
+import sys
+import os
+import shutil
+import tempfile
+
+import sqtest
+from sqtest import Msg, make_base, run, check, count_lines
+
+
+def count_msgs(d, sqd):
+    """Returns how many messages the frame list of sqd holds."""
+
+    jsonl = os.path.join(d, "count.jsonl")
+
+    if os.path.exists(jsonl):
+        os.remove(jsonl)
+
+    rc, out, err = run("sqexport", "-q", sqd, "jsonl:" + jsonl)
+
+    return count_lines(jsonl, b"{") if rc == 0 else -1
+
+
+def check_salvage(d):
+    # every third message has empty control info, and message 20's
+    # doesn't start with a kludge, so it's taken for something else
+
+    msgs = [Msg(u, ctl=b"\0") if u % 3 == 0 else Msg(u) for u in range(1, 20)]
+    msgs.append(Msg(20, ctl=b"junk\0"))
+
+    links = [(i + 1 if i + 1 < len(msgs) else None, i - 1 if i > 0 else None)
+      for i in range(len(msgs))]
+    links[5] = (None, 4)
+
+    sqd = os.path.join(d, "broken.sqd")
+    new = os.path.join(d, "salvaged.sqd")
+    make_base(sqd, msgs, links)
+
+    rc, out, err = run("sqsalvage", sqd, new)
+    check("salvage: 19 of 20 messages recovered", rc == 0 and "19 messages recovered" in out)
+    check("salvage: the new base holds them", count_msgs(d, new) == 19)
+
+    rc, out, err = run("sqfsck", new)
+    check("salvage: the new base is sound", rc == 0)
+
+
+def check_undelete(d):
+    # messages 6 to 15 were deleted, leaving them as they were in frames
+    # on the free list; some have empty control info, some have bytes
+    # after a nul in their text, as stored messages can, and message 16's
+    # control info has been written over
+
+    msgs = []
+
+    for u in range(1, 17):
+        if u % 3 == 0:
+            msgs.append(Msg(u, ctl=b"\0"))
+        elif u % 3 == 1:
+            msgs.append(Msg(u, txt=b"hello\r\0left over\r"))
+        else:
+            msgs.append(Msg(u))
+
+    msgs[15] = Msg(16, ctl=b"junk\0")
+
+    sqd = os.path.join(d, "deleted.sqd")
+    make_base(sqd, msgs, free=range(5, 16))
+
+    rc, out, err = run("squndel", sqd)
+    check("undelete: 10 of 11 deleted messages recovered",
+      rc == 0 and "11 deleted messages found, 10 recovered" in err and
+      "1 written over" in err)
+
+    rc, out, err = run("squndel", "-r", sqd)
+    check("undelete: putting them back leaves 15 stored", rc == 0 and count_msgs(d, sqd) == 15)
+
+    rc, out, err = run("sqfsck", sqd)
+    check("undelete: the rewritten base is sound", rc == 0)
+
+
+def check_pack(d):
+    # a base with free frames, some messages with empty control info, and
+    # then the same with one message whose msg_len has no room for its
+    # XMSG, which the packed base mustn't inherit
+
+    msgs = [Msg(u, ctl=b"\0") if u % 3 == 0 else Msg(u) for u in range(1, 11)]
+
+    sqd = os.path.join(d, "pack.sqd")
+    make_base(sqd, msgs, free=(2, 5))
+
+    rc, out, err = run("sqpack", sqd)
+    check("pack: 8 messages kept", rc == 0 and "8 messages" in out and count_msgs(d, sqd) == 8)
+
+    rc, out, err = run("sqfsck", sqd)
+    check("pack: the packed base is sound, with no free frames",
+      rc == 0 and "OK, 8 messages, 0 free frames" in out)
+
+    msgs[4] = Msg(5, msg_len=10)
+    make_base(sqd, msgs, free=(2,))
+
+    with open(sqd, "rb") as f:
+        before = f.read()
+
+    rc, out, err = run("sqpack", sqd)
+
+    with open(sqd, "rb") as f:
+        after = f.read()
+
+    check("pack: a frame with a short msg_len is refused",
+      rc != 0 and "sqsalvage" in err and before == after)
+
+
+def main():
+    if len(sys.argv) > 2:
+        print(__doc__)
+        sys.exit(1)
+
+    if len(sys.argv) == 2:
+        sqtest.BIN = sys.argv[1]
+
+    d = tempfile.mkdtemp(prefix="checkbases")
+
+    try:
+        check_salvage(d)
+        check_undelete(d)
+        check_pack(d)
+    finally:
+        shutil.rmtree(d)
+
+    if sqtest.failures != 0:
+        print("%d checks failed" % sqtest.failures)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+
+"""checkloops makes Squish bases whose frame lists go round in a circle
+and checks that the tools built here stop the first time a frame comes
+round again, rather than going round until some count runs out.
+
+Each base holds a few messages and is padded to 1 MB, so a walk that
+isn't stopped shows up as thousands of them.
+
+Usage: checkloops.py [directory with the programs]
+
+Written by Andrew Clarke and released to the public domain."""
+
+
+import sys
+import os
+import shutil
+import tempfile
+
+import sqtest
+from sqtest import make_base, run, check, count_lines
+
+
+PAD_TO = 1048576
+
+
+def check_stored_loop(d, name, links, msgs):
+    sqd = os.path.join(d, name + ".sqd")
+    make_base(sqd, [1, 2], links, pad_to=PAD_TO)
+
+    mbox = os.path.join(d, name + ".mbox")
+    rc, out, err = run("squ2mbox", sqd, mbox)
+    check("%s: squ2mbox fails with %d written" % (name, msgs),
+      rc != 0 and count_lines(mbox, b"From ") == msgs)
+
+    jsonl = os.path.join(d, name + ".jsonl")
+    rc, out, err = run("sqexport", sqd, "jsonl:" + jsonl)
+    check("%s: sqexport fails with %d written" % (name, msgs),
+      rc != 0 and count_lines(jsonl, b"{") == msgs)
+
+    sqi = os.path.join(d, name + ".sqi")
+    rc, out, err = run("sqd2sqi", sqd, sqi)
+    check("%s: sqd2sqi fails and leaves no .sqi" % name, rc != 0 and not os.path.exists(sqi))
+
+    rc, out, err = run("sqget", sqd, "99")
+    check("%s: sqget stops looking" % name, rc != 0 and "loops" in err)
+
+    rc, out, err = run("sqpack", "-q", sqd)
+    check("%s: sqpack refuses it" % name, rc != 0 and "loops" in err)
+
+    rc, out, err = run("sqfsck", sqd)
+    check("%s: sqfsck reports it" % name, rc != 0 and "loops" in out + err)
+
+    rc, out, err = run("squid", sqd)
+    check("%s: squid reports it" % name, "loops" in out + err)
+
+
+def check_backward_loop(d):
+    sqd = os.path.join(d, "back.sqd")
+    make_base(sqd, [1, 2], [(1, 1), (None, 0)], pad_to=PAD_TO)
+
+    rc, out, err = run("sqidx", sqd[:-4])
+    check("back: sqidx fails with 2 written", rc != 0 and out.count("\n") == 2)
+
+
+def check_free_loop(d):
+    sqd = os.path.join(d, "free.sqd")
+    make_base(sqd, [1, 2, 3], [(None, None), (2, 2), (1, 1)], free=(1, 2), pad_to=PAD_TO)
+
+    rc, out, err = run("squndel", sqd)
+    check("free: squndel stops after 2 free frames",
+      "loops" in err and "2 free frames" in out + err)
+
+
+def main():
+    if len(sys.argv) > 2:
+        print(__doc__)
+        sys.exit(1)
+
+    if len(sys.argv) == 2:
+        sqtest.BIN = sys.argv[1]
+
+    d = tempfile.mkdtemp(prefix="checkloops")
+
+    try:
+        check_stored_loop(d, "fwd", [(1, None), (0, 0)], 2)
+        check_stored_loop(d, "self", [(0, None), (None, 0)], 1)
+        check_backward_loop(d)
+        check_free_loop(d)
+    finally:
+        shutil.rmtree(d)
+
+    if sqtest.failures != 0:
+        print("%d checks failed" % sqtest.failures)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
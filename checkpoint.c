@@ -0,0 +1,214 @@
+/*
+ *  checkpoint.c
+ *
+ *  Remembers how far through a Squish base an export has got, so that a
+ *  later run can carry on from there.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  A checkpoint is a small text file of "name value" lines.  It names the
+ *  last frame exported by its offset and umsgid and records the uid and
+ *  high_water of the SQBASE.  New messages are linked in after the last
+ *  frame, so while that frame is still there with the same umsgid the
+ *  export can carry on from its next_frame.  Packing a base moves its
+ *  frames and renumbering it resets uid or high_water, and either makes
+ *  the checkpoint useless.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+
+#define CKPT_HEADER "# squish-utils checkpoint"
+
+static const struct
+{
+    const char *name;
+    size_t ofs;
+}
+fields[] =
+{
+    { "frame", offsetof(CHECKPOINT, frame) },
+    { "umsgid", offsetof(CHECKPOINT, umsgid) },
+    { "uid", offsetof(CHECKPOINT, uid) },
+    { "high_water", offsetof(CHECKPOINT, high_water) },
+    { "msgs", offsetof(CHECKPOINT, msgs) },
+    { "out_size", offsetof(CHECKPOINT, out_size) },
+    { NULL, 0 }
+};
+
+#define NFIELDS (sizeof fields / sizeof *fields - 1)
+
+#define FIELD(ck, i) (*(unsigned long *) ((char *) (ck) + fields[i].ofs))
+
+/*
+ *  Reads a checkpoint from filename.  Returns 0, or -1 if the file can't
+ *  be opened or lacks any of the fields.
+ */
+
+int ckpt_read(CHECKPOINT *ck, const char *filename)
+{
+    FILE *fp;
+    char line[128], name[32];
+    unsigned long value;
+    int i, seen;
+
+    fp = fopen(filename, "r");
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    memset(ck, 0, sizeof *ck);
+    seen = 0;
+
+    while (fgets(line, sizeof line, fp) != NULL)
+    {
+        if (sscanf(line, "%31s %lu", name, &value) != 2)
+        {
+            continue;
+        }
+
+        for (i = 0; fields[i].name != NULL; i++)
+        {
+            if (strcmp(name, fields[i].name) == 0)
+            {
+                FIELD(ck, i) = value;
+                seen |= 1 << i;
+            }
+        }
+    }
+
+    fclose(fp);
+
+    return seen == (1 << NFIELDS) - 1 ? 0 : -1;
+}
+
+/*
+ *  Writes ck to filename, by way of a temporary file so that a crash
+ *  never leaves half a checkpoint behind.  Returns 0, or -1 with errno
+ *  set.
+ */
+
+int ckpt_write(const CHECKPOINT *ck, const char *filename)
+{
+    FILE *fp;
+    char *tmp;
+    int i, rc;
+
+    tmp = malloc(strlen(filename) + 5);
+
+    if (tmp == NULL)
+    {
+        return -1;
+    }
+
+    sprintf(tmp, "%s.tmp", filename);
+
+    fp = fopen(tmp, "w");
+
+    if (fp == NULL)
+    {
+        free(tmp);
+        return -1;
+    }
+
+    fprintf(fp, CKPT_HEADER "\n");
+
+    for (i = 0; fields[i].name != NULL; i++)
+    {
+        fprintf(fp, "%s %lu\n", fields[i].name, FIELD(ck, i));
+    }
+
+    rc = ferror(fp) ? -1 : 0;
+
+    if (fclose(fp) != 0)
+    {
+        rc = -1;
+    }
+
+    if (rc == 0)
+    {
+        rc = rename(tmp, filename);
+    }
+
+    if (rc != 0)
+    {
+        remove(tmp);
+    }
+
+    free(tmp);
+
+    return rc;
+}
+
+/*
+ *  Checks ck against the base in sq, whose SQBASE is sqb.  Returns 1 and
+ *  sets *ofs to the offset of the first frame not yet exported (0 if there
+ *  are none), or 0 if the base has been packed or renumbered since.
+ */
+
+int ckpt_resume(const CHECKPOINT *ck, SQFILE *sq, const SQBASE *sqb, unsigned long *ofs)
+{
+    SQMSG m;
+
+    if (sqb->uid < ck->uid || sqb->high_water < ck->high_water)
+    {
+        return 0;
+    }
+
+    if (ck->frame == 0)
+    {
+        /* nothing was exported last time */
+
+        if (ck->msgs != 0)
+        {
+            return 0;
+        }
+
+        *ofs = sqb->first_frame;
+        return 1;
+    }
+
+    if (ck->frame > sqb->end_frame ||
+      sq_read_frame(sq, ck->frame, &m) != SQ_OK ||
+      m.frame.frame_type != FRAME_NORMAL ||
+      sq_read_xmsg(sq, &m) != SQ_OK ||
+      m.xmsg.umsgid != ck->umsgid)
+    {
+        return 0;
+    }
+
+    *ofs = m.frame.next_frame;
+
+    return 1;
+}
+
+/*
+ *  Returns the size of filename, or -1 if it can't be found out.  An
+ *  export is carried on only if its output is still the size the
+ *  checkpoint says.
+ */
+
+long ckpt_file_size(const char *filename)
+{
+    FILE *fp;
+    long size;
+
+    fp = fopen(filename, "rb");
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    size = fseek(fp, 0, SEEK_END) == 0 ? ftell(fp) : -1;
+
+    fclose(fp);
+
+    return size;
+}
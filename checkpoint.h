@@ -0,0 +1,40 @@
+/*
+ *  checkpoint.h
+ *
+ *  Remembers how far through a Squish base an export has got, so that a
+ *  later run can carry on from there.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include "squish.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+    unsigned long frame;             /* offset of the last frame exported, or 0 */
+    unsigned long umsgid;            /* its umsgid */
+    unsigned long uid;               /* SQBASE uid at the time */
+    unsigned long high_water;        /* SQBASE high_water at the time */
+    unsigned long msgs;              /* frames exported so far */
+    unsigned long out_size;          /* size of the output file */
+}
+CHECKPOINT;
+
+int ckpt_read(CHECKPOINT *ck, const char *filename);
+int ckpt_write(const CHECKPOINT *ck, const char *filename);
+int ckpt_resume(const CHECKPOINT *ck, SQFILE *sq, const SQBASE *sqb, unsigned long *ofs);
+long ckpt_file_size(const char *filename);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,140 @@
+/*
+ *  csvfmt.c
+ *
+ *  Renders Squish message headers as lines of the CSV index made by
+ *  sqidx.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  The lines are the same as sqidx.py's, byte for byte: names are taken
+ *  to be CP437 and written as UTF-8, quotes are doubled and backslashes
+ *  escaped, and the hashes are over the decoded characters.  See sqidx.c
+ *  for the fields.
+ */
+
+#include <stdio.h>
+
+#include "csvfmt.h"
+#include "charset.h"
+
+/*  str_hash():
+ *
+ *  http://www.cs.berkeley.edu/~smcpeak/elkhound/sources/smbase/strhash.cc
+ *
+ *  Adapted from glib's g_str_hash().
+ *  Investigation by Karl Nelson <kenelson@ece.ucdavis.edu>.
+ *  Do a web search for "g_str_hash X31_HASH" if you want to know more.
+ *  update: this is the same function as that described in Kernighan and Pike,
+ *  "The Practice of Programming", section 2.9
+ *
+ *  As in sqidx.py, it's taken over the characters of the CP437 string
+ *  rather than its bytes, and kept to 32 bits.
+ */
+
+static unsigned long str_hash(const CHARSET *cs, const char *key)
+{
+    const unsigned char *p;
+    unsigned long h;
+
+    h = 0;
+
+    for (p = (const unsigned char *) key; *p != '\0'; p++)
+    {
+        h = ((h << 5) - h + (*p < 0x80 ? *p : cs->ucs[*p - 0x80])) & 0xffffffffUL;
+    }
+
+    return h;
+}
+
+/*
+ *  Adds str to out in quotes, as UTF-8, with quotes doubled and
+ *  backslashes escaped.
+ */
+
+static void put_field(BUF *out, const CHARSET *cs, const char *str)
+{
+    const unsigned char *p, *run;
+
+    buf_putc(out, '\"');
+
+    run = (const unsigned char *) str;
+
+    for (p = run; *p != '\0'; p++)
+    {
+        if (*p < 0x80 && *p != '\"' && *p != '\\')
+        {
+            continue;
+        }
+
+        buf_write(out, run, (size_t) (p - run));
+
+        if (*p >= 0x80)
+        {
+            buf_write(out, cs->utf8[*p - 0x80] + 1, cs->utf8[*p - 0x80][0]);
+        }
+        else
+        {
+            buf_putc(out, *p);
+            buf_putc(out, *p);
+        }
+
+        run = p + 1;
+    }
+
+    buf_write(out, run, (size_t) (p - run));
+    buf_putc(out, '\"');
+}
+
+/*
+ *  The time in the DOS date and time fields of a header.  Fields that are
+ *  out of range carry over into the next as mktime() would.  Unlike
+ *  sqdate_dos(), years after 2027 are left alone, as sqidx.py does.
+ */
+
+static time_t dos_time(unsigned short date, unsigned short time)
+{
+    long days;
+
+    days = sqdate_days(((date >> 9) & 0x7f) + 1980L, (date >> 5) & 0x0f, date & 0x1f);
+
+    return (time_t) days * 86400 + ((time >> 11) & 0x1f) * 3600L +
+      ((time >> 5) & 0x3f) * 60L + (time & 0x1f) * 2L;
+}
+
+/*
+ *  Adds the index line for the message with the header x at frame offset
+ *  ofs to out, and stores what went into it in *line.  This may be called
+ *  from several threads at once, each with its own dc.
+ */
+
+void csv_format_line(BUF *out, const SQXMSG *x, unsigned long ofs, SQDATE_CACHE *dc,
+  CSVLINE *line)
+{
+    const CHARSET *cs;
+    char date[SQDATE_ISO_LEN];
+
+    cs = charset_default();
+
+    line->date = dos_time(x->date_written, x->time_written);
+    sqdate_fmt_iso(dc, line->date, date);
+
+    /* "FrameOfs","Hash","From","To","Subject","Date" */
+
+    /* calculate hashes of the date & (from + to + subject) */
+
+    line->date_hash = str_hash(cs, date);
+    line->name_hash = (str_hash(cs, x->from) + str_hash(cs, x->to) + str_hash(cs, x->subj)) &
+      0xffffffffUL;
+
+    buf_printf(out, "\"%lu\",\"%08lx%08lx\",", ofs, line->date_hash, line->name_hash);
+
+    put_field(out, cs, x->from);
+    buf_putc(out, ',');
+    put_field(out, cs, x->to);
+    buf_putc(out, ',');
+    put_field(out, cs, x->subj);
+    buf_putc(out, ',');
+    buf_putc(out, '\"');
+    buf_puts(out, date);
+    buf_puts(out, "\"\n");
+}
@@ -0,0 +1,41 @@
+/*
+ *  csvfmt.h
+ *
+ *  Renders Squish message headers as lines of the CSV index made by
+ *  sqidx.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __CSVFMT_H__
+#define __CSVFMT_H__
+
+#include <time.h>
+
+#include "squish.h"
+#include "buf.h"
+#include "sqdate.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* what csv_format_line() worked out for a message */
+
+typedef struct
+{
+    time_t date;                     /* DateTime, in seconds since 1970 */
+    unsigned long date_hash;         /* the two halves of Hash */
+    unsigned long name_hash;
+}
+CSVLINE;
+
+void csv_format_line(BUF *out, const SQXMSG *x, unsigned long ofs, SQDATE_CACHE *dc,
+  CSVLINE *line);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,597 @@
+/*
+ *  dateidx.c
+ *
+ *  A sparse index of the dates of the messages in a Squish base (.sqt),
+ *  for finding the messages written or received between two dates
+ *  without reading every header.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  Messages are mostly linked in the order they arrive, so their dates
+ *  mostly rise along the frame list, but not always: echomail turns up
+ *  late, clocks are wrong, and bases get merged.  The index cuts the
+ *  frame list into blocks of DI_STRIDE messages and keeps, for each, the
+ *  offset of its first frame and the earliest and latest date written
+ *  and arrived among its messages.  di_collect() uses those ranges to
+ *  skip the blocks that can't hold a match and reads the headers of the
+ *  rest, so a date that's out of order is never missed; it only costs
+ *  its block being read.
+ *
+ *  The file is little-endian.  It starts with a 64-byte header of 32-bit
+ *  numbers
+ *
+ *     0  "SQDT"
+ *     4  version (1)
+ *     8  header size (64)
+ *    12  messages per block (DI_STRIDE)
+ *    16  number of messages
+ *    20  number of blocks
+ *    24  uid, num_msg, high_water, end_frame and first_frame from the
+ *        SQBASE when the index was last brought up to date
+ *    44  frame offset and umsgid of the last message
+ *    52  reserved (0)
+ *
+ *  followed by 20 bytes for each block: the frame offset, the earliest
+ *  and latest date written, and the earliest and latest date arrived,
+ *  the dates as signed numbers.  A message with no date counts as 0.
+ *
+ *  di_update() keeps the index up to date the way hc_update() does the
+ *  header cache: messages added since are put in the last block and new
+ *  ones after it, and if the base has been packed, renumbered or had
+ *  older messages deleted the index is built again from scratch.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "dateidx.h"
+#include "sqdate.h"
+#include "checkpoint.h"
+#include "buf.h"
+
+#define DI_MAGIC   "SQDT"
+#define DI_VERSION 1
+#define DI_HDRSIZE 64
+#define DI_RECSIZE 20
+
+static long get_sl(const unsigned char *p)
+{
+    unsigned long n;
+
+    n = r2ul(p);
+
+    return n & 0x80000000UL ? -(long) (0xffffffffUL - n) - 1 : (long) n;
+}
+
+/*
+ *  Gets the dates of the message in x, written as sqdate_written() has
+ *  it; a message with no date counts as 0.
+ */
+
+static void msg_dates(const SQXMSG *x, long *date)
+{
+    time_t t;
+
+    if (sqdate_written(x, &t) != 0)
+    {
+        t = 0;
+    }
+
+    date[DI_WRITTEN] = sqdate_s32(t);
+    date[DI_ARRIVED] = x->date_arrived != 0 ? sqdate_s32(sqdate_dos(x->date_arrived,
+      x->time_arrived)) : 0;
+}
+
+static void reset(DATEIDX *di)
+{
+    free(di->block);
+    memset(di, 0, sizeof *di);
+}
+
+void di_free(DATEIDX *di)
+{
+    reset(di);
+}
+
+/*
+ *  Reads the index in filename into di.  Returns 0, or -1 if it can't be
+ *  read or isn't an index.
+ */
+
+int di_read(DATEIDX *di, const char *filename)
+{
+    FILE *fp;
+    unsigned char hdr[DI_HDRSIZE], rec[DI_RECSIZE];
+    unsigned long i;
+    int j, ok;
+
+    memset(di, 0, sizeof *di);
+
+    fp = fopen(filename, "rb");
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    ok = fread(hdr, sizeof hdr, 1, fp) == 1 && memcmp(hdr, DI_MAGIC, 4) == 0 &&
+      r2ul(hdr + 4) == DI_VERSION && r2ul(hdr + 8) == DI_HDRSIZE &&
+      r2ul(hdr + 12) == DI_STRIDE;
+
+    if (ok)
+    {
+        di->msgs = r2ul(hdr + 16);
+        di->blocks = r2ul(hdr + 20);
+        di->uid = r2ul(hdr + 24);
+        di->num_msg = r2ul(hdr + 28);
+        di->high_water = r2ul(hdr + 32);
+        di->end_frame = r2ul(hdr + 36);
+        di->first_frame = r2ul(hdr + 40);
+        di->last_frame = r2ul(hdr + 44);
+        di->last_umsgid = r2ul(hdr + 48);
+
+        ok = di->blocks == (di->msgs + DI_STRIDE - 1) / DI_STRIDE;
+    }
+
+    if (ok)
+    {
+        di->block = malloc(sizeof *di->block * (di->blocks != 0 ? di->blocks : 1));
+        assert(di->block != NULL);
+    }
+
+    for (i = 0; ok && i < di->blocks; i++)
+    {
+        ok = fread(rec, sizeof rec, 1, fp) == 1;
+
+        di->block[i].frame = r2ul(rec);
+
+        for (j = 0; j < 2; j++)
+        {
+            di->block[i].lo[j] = get_sl(rec + 4 + j * 8);
+            di->block[i].hi[j] = get_sl(rec + 8 + j * 8);
+        }
+    }
+
+    fclose(fp);
+
+    if (!ok)
+    {
+        reset(di);
+        return -1;
+    }
+
+    return 0;
+}
+
+int di_fresh(const DATEIDX *di, const SQBASE *sqb)
+{
+    return di->uid == sqb->uid && di->num_msg == sqb->num_msg &&
+      di->high_water == sqb->high_water && di->end_frame == sqb->end_frame &&
+      di->first_frame == sqb->first_frame;
+}
+
+/*
+ *  Writes di to filename, by way of a temporary file.  Returns 0, or -1
+ *  with errno set.
+ */
+
+static int write_index(const DATEIDX *di, const char *filename)
+{
+    FILE *fp;
+    BUF out;
+    unsigned char *p;
+    char *tmp;
+    unsigned long i;
+    int j, rc;
+
+    buf_init(&out);
+    buf_reserve(&out, DI_HDRSIZE + DI_RECSIZE * di->blocks);
+
+    p = (unsigned char *) out.data;
+    memset(p, 0, DI_HDRSIZE);
+    memcpy(p, DI_MAGIC, 4);
+    put_ul(p + 4, DI_VERSION);
+    put_ul(p + 8, DI_HDRSIZE);
+    put_ul(p + 12, DI_STRIDE);
+    put_ul(p + 16, di->msgs);
+    put_ul(p + 20, di->blocks);
+    put_ul(p + 24, di->uid);
+    put_ul(p + 28, di->num_msg);
+    put_ul(p + 32, di->high_water);
+    put_ul(p + 36, di->end_frame);
+    put_ul(p + 40, di->first_frame);
+    put_ul(p + 44, di->last_frame);
+    put_ul(p + 48, di->last_umsgid);
+
+    for (i = 0; i < di->blocks; i++)
+    {
+        p = (unsigned char *) out.data + DI_HDRSIZE + DI_RECSIZE * i;
+        put_ul(p, di->block[i].frame);
+
+        for (j = 0; j < 2; j++)
+        {
+            put_ul(p + 4 + j * 8, (unsigned long) di->block[i].lo[j] & 0xffffffffUL);
+            put_ul(p + 8 + j * 8, (unsigned long) di->block[i].hi[j] & 0xffffffffUL);
+        }
+    }
+
+    out.len = DI_HDRSIZE + DI_RECSIZE * di->blocks;
+
+    tmp = malloc(strlen(filename) + 5);
+    assert(tmp != NULL);
+    sprintf(tmp, "%s.tmp", filename);
+
+    rc = -1;
+    fp = fopen(tmp, "wb");
+
+    if (fp != NULL)
+    {
+        rc = fwrite(out.data, out.len, 1, fp) == 1 ? 0 : -1;
+
+        if (fclose(fp) != 0)
+        {
+            rc = -1;
+        }
+
+        if (rc == 0)
+        {
+            rc = rename(tmp, filename);
+        }
+
+        if (rc != 0)
+        {
+            remove(tmp);
+        }
+    }
+
+    free(tmp);
+    buf_free(&out);
+
+    return rc;
+}
+
+/*
+ *  Adds the messages in list to the end of di, reading their headers in
+ *  the order they lie in the file.  Returns SQ_END, or the error that
+ *  stopped it with the offset of the bad frame in *err_ofs.
+ */
+
+static int add_msgs(DATEIDX *di, SQFILE *sq, const SQOFS *list, unsigned long *err_ofs)
+{
+    unsigned long *order, blocks, i;
+    int rc;
+
+    if (list->count == 0)
+    {
+        return SQ_END;
+    }
+
+    blocks = (di->msgs + list->count + DI_STRIDE - 1) / DI_STRIDE;
+
+    di->block = realloc(di->block, sizeof *di->block * blocks);
+    assert(di->block != NULL);
+
+    for (i = di->blocks; i < blocks; i++)
+    {
+        DI_BLOCK *b;
+
+        b = &di->block[i];
+        b->frame = list->ofs[i * DI_STRIDE - di->msgs];
+        b->lo[DI_WRITTEN] = b->lo[DI_ARRIVED] = LONG_MAX;
+        b->hi[DI_WRITTEN] = b->hi[DI_ARRIVED] = LONG_MIN;
+    }
+
+    order = sq_physical_order(list->ofs, list->count);
+    sq_advise(sq, SQ_ADV_SEQUENTIAL);
+
+    rc = SQ_END;
+
+    for (i = 0; i < list->count; i++)
+    {
+        DI_BLOCK *b;
+        SQMSG m;
+        long date[2];
+        unsigned long j;
+        int k;
+
+        j = order[i];
+        rc = sq_read_frame(sq, list->ofs[j], &m);
+
+        if (rc == SQ_OK)
+        {
+            rc = sq_read_xmsg(sq, &m);
+        }
+
+        if (rc != SQ_OK)
+        {
+            *err_ofs = list->ofs[j];
+            break;
+        }
+
+        msg_dates(&m.xmsg, date);
+        b = &di->block[(di->msgs + j) / DI_STRIDE];
+
+        for (k = 0; k < 2; k++)
+        {
+            if (date[k] < b->lo[k])
+            {
+                b->lo[k] = date[k];
+            }
+
+            if (date[k] > b->hi[k])
+            {
+                b->hi[k] = date[k];
+            }
+        }
+
+        if (j + 1 == list->count)
+        {
+            di->last_umsgid = m.xmsg.umsgid;
+        }
+
+        rc = SQ_END;
+    }
+
+    sq_advise(sq, SQ_ADV_NORMAL);
+    free(order);
+
+    di->blocks = blocks;
+    di->msgs += list->count;
+    di->last_frame = list->ofs[list->count - 1];
+
+    return rc;
+}
+
+/*
+ *  Brings di up to date with the base in sq, whose SQBASE is sqb, using
+ *  the index in filename as far as it still holds, and writes it back if
+ *  it changed.  Returns 0 with res->saved clear if it couldn't be written,
+ *  which leaves di usable all the same, or -1 if the frame list couldn't
+ *  be read, with the reason in res->rc and res->err_ofs.
+ */
+
+int di_update(DATEIDX *di, const char *filename, SQFILE *sq, const SQBASE *sqb, DI_RESULT *res)
+{
+    CHECKPOINT ck;
+    SQOFS list;
+    unsigned long ofs;
+    int append, rc;
+
+    res->action = DI_REBUILT;
+    res->added = 0;
+    res->rc = SQ_END;
+    res->err_ofs = 0;
+    res->saved = 1;
+
+    append = 0;
+
+    if (di_read(di, filename) == 0)
+    {
+        if (di_fresh(di, sqb))
+        {
+            res->action = DI_UPTODATE;
+            return 0;
+        }
+
+        ck.frame = di->last_frame;
+        ck.umsgid = di->last_umsgid;
+        ck.uid = di->uid;
+        ck.high_water = di->high_water;
+        ck.msgs = di->msgs;
+        ck.out_size = 0;
+
+        append = ckpt_resume(&ck, sq, sqb, &ofs) &&
+          (di->msgs == 0 || di->first_frame == sqb->first_frame);
+    }
+
+    sq_ofs_init(&list);
+
+    rc = sq_collect(sq, append ? ofs : sqb->first_frame, 0, SQ_COLLECT_SKIP, &list,
+      &res->err_ofs);
+
+    /* if older messages have been deleted it has to start again */
+
+    if (rc == SQ_END && append && di->msgs + list.count != sqb->num_msg)
+    {
+        append = 0;
+        sq_ofs_free(&list);
+        rc = sq_collect(sq, sqb->first_frame, 0, SQ_COLLECT_SKIP, &list, &res->err_ofs);
+    }
+
+    if (!append)
+    {
+        reset(di);
+    }
+
+    if (rc == SQ_END)
+    {
+        rc = add_msgs(di, sq, &list, &res->err_ofs);
+    }
+
+    res->action = append ? DI_APPENDED : DI_REBUILT;
+    res->added = list.count;
+    res->rc = rc;
+
+    sq_ofs_free(&list);
+
+    if (rc != SQ_END)
+    {
+        reset(di);
+        return -1;
+    }
+
+    di->uid = sqb->uid;
+    di->num_msg = sqb->num_msg;
+    di->high_water = sqb->high_water;
+    di->end_frame = sqb->end_frame;
+    di->first_frame = sqb->first_frame;
+
+    res->saved = write_index(di, filename) == 0;
+
+    return 0;
+}
+
+/*
+ *  Puts in list the offsets of the messages in sq whose date (which is
+ *  DI_WRITTEN or DI_ARRIVED) is from since to until inclusive, in frame
+ *  list order, and if nums isn't NULL their numbers in the frame list,
+ *  counting from 1.  di must be up to date.  Returns SQ_END, or the error
+ *  that stopped it with the offset of the bad frame in *err_ofs.
+ *
+ *  The blocks before the first whose running latest date reaches since
+ *  can't hold a match, nor can those from the first after which no block
+ *  has a date as early as until; both are found by binary search.  In
+ *  between, blocks whose range misses since..until are passed over.
+ */
+
+int di_collect(const DATEIDX *di, SQFILE *sq, int which, time_t since, time_t until,
+  SQOFS *list, SQOFS *nums, unsigned long *err_ofs)
+{
+    long *run_hi, *run_lo;
+    unsigned long first, last, lo, hi, i;
+    int rc;
+
+    if (di->blocks == 0 || since > until)
+    {
+        return SQ_END;
+    }
+
+    /* run_hi[i] is the latest date in blocks 0..i, run_lo[i] the earliest
+       in blocks i..end; both only ever rise */
+
+    run_hi = malloc(sizeof *run_hi * di->blocks * 2);
+    assert(run_hi != NULL);
+    run_lo = run_hi + di->blocks;
+
+    for (i = 0; i < di->blocks; i++)
+    {
+        run_hi[i] = di->block[i].hi[which];
+
+        if (i > 0 && run_hi[i - 1] > run_hi[i])
+        {
+            run_hi[i] = run_hi[i - 1];
+        }
+    }
+
+    for (i = di->blocks; i-- > 0; )
+    {
+        run_lo[i] = di->block[i].lo[which];
+
+        if (i + 1 < di->blocks && run_lo[i + 1] < run_lo[i])
+        {
+            run_lo[i] = run_lo[i + 1];
+        }
+    }
+
+    lo = 0;
+    hi = di->blocks;
+
+    while (lo < hi)
+    {
+        i = lo + (hi - lo) / 2;
+
+        if (run_hi[i] < since)
+        {
+            lo = i + 1;
+        }
+        else
+        {
+            hi = i;
+        }
+    }
+
+    first = lo;
+    hi = di->blocks;
+
+    while (lo < hi)
+    {
+        i = lo + (hi - lo) / 2;
+
+        if (run_lo[i] <= until)
+        {
+            lo = i + 1;
+        }
+        else
+        {
+            hi = i;
+        }
+    }
+
+    last = lo;
+
+    free(run_hi);
+
+    rc = SQ_END;
+
+    for (i = first; i < last && rc == SQ_END; i++)
+    {
+        const DI_BLOCK *b;
+        SQITER it;
+        SQMSG m;
+        unsigned long n, count;
+
+        b = &di->block[i];
+
+        if (b->hi[which] < since || b->lo[which] > until)
+        {
+            continue;
+        }
+
+        count = i + 1 < di->blocks ? DI_STRIDE : di->msgs - i * DI_STRIDE;
+        n = 0;
+
+        sq_iter_init(&it, sq, b->frame, 0);
+
+        while (n < count && (rc = sq_iter_next(&it, &m)) == SQ_OK)
+        {
+            long date[2];
+
+            if (m.frame.frame_type != FRAME_NORMAL)
+            {
+                continue;
+            }
+
+            rc = sq_read_xmsg(sq, &m);
+
+            if (rc == SQ_OK)
+            {
+                rc = sq_check_msg(sq, &m);
+            }
+
+            if (rc != SQ_OK)
+            {
+                break;
+            }
+
+            msg_dates(&m.xmsg, date);
+
+            if (date[which] >= since && date[which] <= until)
+            {
+                sq_ofs_add(list, m.ofs);
+
+                if (nums != NULL)
+                {
+                    sq_ofs_add(nums, i * DI_STRIDE + n + 1);
+                }
+            }
+
+            n++;
+        }
+
+        sq_iter_free(&it);
+
+        if (rc == SQ_OK)
+        {
+            rc = SQ_END;
+        }
+        else if (rc != SQ_END)
+        {
+            *err_ofs = m.ofs;
+        }
+    }
+
+    return rc;
+}
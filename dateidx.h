@@ -0,0 +1,98 @@
+/*
+ *  dateidx.h
+ *
+ *  A sparse index of the dates of the messages in a Squish base (.sqt),
+ *  for finding the messages written or received between two dates
+ *  without reading every header.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __DATEIDX_H__
+#define __DATEIDX_H__
+
+#include <time.h>
+
+#include "squish.h"
+#include "sqorder.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* messages per block */
+
+#define DI_STRIDE 256
+
+/* which date di_collect() goes by */
+
+#define DI_WRITTEN 0
+#define DI_ARRIVED 1
+
+/* what di_update() did */
+
+#define DI_UPTODATE 0
+#define DI_APPENDED 1
+#define DI_REBUILT  2
+
+/*
+ *  A block is DI_STRIDE messages in a row in the frame list (the last
+ *  one may be short), known by the frame of the first of them, with the
+ *  earliest and latest dates of all of them.  Dates are seconds since
+ *  1970 in the writer's zone, as in hdrcache.h, indexed by DI_WRITTEN or
+ *  DI_ARRIVED.
+ */
+
+typedef struct
+{
+    unsigned long frame;
+    long lo[2];
+    long hi[2];
+}
+DI_BLOCK;
+
+typedef struct
+{
+    unsigned long msgs;
+    unsigned long blocks;
+
+    /* SQBASE fields when the index was last brought up to date */
+
+    unsigned long uid;
+    unsigned long num_msg;
+    unsigned long high_water;
+    unsigned long end_frame;
+    unsigned long first_frame;
+
+    unsigned long last_frame;        /* frame offset of the last message */
+    unsigned long last_umsgid;
+
+    DI_BLOCK *block;
+}
+DATEIDX;
+
+/* the outcome of di_update() */
+
+typedef struct
+{
+    int action;                      /* DI_UPTODATE etc. */
+    unsigned long added;             /* headers read from the .sqd */
+    int rc;                          /* SQ_END, or why the frame list walk stopped */
+    unsigned long err_ofs;           /* the bad frame, if it did */
+    int saved;                       /* the file was written, if it needed to be */
+}
+DI_RESULT;
+
+int di_read(DATEIDX *di, const char *filename);
+void di_free(DATEIDX *di);
+int di_fresh(const DATEIDX *di, const SQBASE *sqb);
+int di_update(DATEIDX *di, const char *filename, SQFILE *sq, const SQBASE *sqb, DI_RESULT *res);
+int di_collect(const DATEIDX *di, SQFILE *sq, int which, time_t since, time_t until,
+  SQOFS *list, SQOFS *nums, unsigned long *err_ofs);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,440 @@
+/*
+ *  export.c
+ *
+ *  Reads a Squish base once and hands every message to several output
+ *  sinks, each running in a thread of its own.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  The frame list is walked once.  Each message is read whole and copied
+ *  into a batch, and every full batch is passed to all the sinks at once;
+ *  it's freed for reuse when the last of them is done with it.  Each sink
+ *  has a queue of QUEUE_BATCHES batches, so a sink that's slow for a
+ *  while (a Maildir creating files, say) doesn't hold up the others until
+ *  it's that far behind; after that the reader waits for it, which keeps
+ *  the memory used bounded.  Without HAVE_PTHREAD the sinks are called in
+ *  turn as each batch fills up.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "export.h"
+#include "buf.h"
+
+/* messages per batch */
+
+#define BATCH_MSGS 256
+
+/* batches queued for each sink */
+
+#define QUEUE_BATCHES 8
+
+typedef struct batch
+{
+    SQMSG *msgs;
+    unsigned long *nums;             /* numbers in the frame list */
+    size_t *pos;                     /* where each one's control info is in data */
+    unsigned long count;
+    BUF data;                        /* the control info and text, copied */
+    int refs;                        /* sinks still to finish with it */
+    struct batch *next;              /* on the free list */
+}
+BATCH;
+
+struct engine;
+
+/* a sink and its queue */
+
+typedef struct
+{
+    EXPORT_SINK *sink;
+    struct engine *e;
+#ifdef HAVE_PTHREAD
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t data;             /* a batch was queued, or closing */
+    pthread_cond_t space;            /* a queued batch was done with */
+    BATCH *queue[QUEUE_BATCHES];
+    unsigned long head;              /* batches queued */
+    unsigned long tail;              /* batches done with */
+    int closing;
+#endif
+}
+LANE;
+
+typedef struct engine
+{
+    LANE *lanes;
+    int nlanes;
+    BATCH *free_list;
+    int complete;                    /* the walk reached the end of the list */
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t lock;            /* for refs and free_list */
+#endif
+}
+ENGINE;
+
+static BATCH *get_batch(ENGINE *e)
+{
+    BATCH *b;
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&e->lock);
+#endif
+
+    b = e->free_list;
+
+    if (b != NULL)
+    {
+        e->free_list = b->next;
+    }
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&e->lock);
+#endif
+
+    if (b == NULL)
+    {
+        b = malloc(sizeof *b);
+        assert(b != NULL);
+
+        b->msgs = malloc(sizeof *b->msgs * BATCH_MSGS);
+        b->nums = malloc(sizeof *b->nums * BATCH_MSGS);
+        b->pos = malloc(sizeof *b->pos * BATCH_MSGS);
+        assert(b->msgs != NULL && b->nums != NULL && b->pos != NULL);
+
+        buf_init(&b->data);
+    }
+
+    b->count = 0;
+    b->data.len = 0;
+    b->next = NULL;
+
+    return b;
+}
+
+static void release_batch(ENGINE *e, BATCH *b)
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&e->lock);
+#endif
+
+    if (--b->refs == 0)
+    {
+        b->next = e->free_list;
+        e->free_list = b;
+    }
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&e->lock);
+#endif
+}
+
+static void free_batches(ENGINE *e)
+{
+    BATCH *b;
+
+    while ((b = e->free_list) != NULL)
+    {
+        e->free_list = b->next;
+        buf_free(&b->data);
+        free(b->pos);
+        free(b->nums);
+        free(b->msgs);
+        free(b);
+    }
+}
+
+/*
+ *  Copies the message in m, read with sq_read_msg(), into b.
+ */
+
+static void add_msg(BATCH *b, const SQMSG *m, unsigned long num)
+{
+    b->msgs[b->count] = *m;
+    b->nums[b->count] = num;
+    b->pos[b->count] = b->data.len;
+
+    buf_write(&b->data, m->ctl, m->ctl_len);
+    buf_write(&b->data, m->txt, m->txt_len);
+
+    b->count++;
+}
+
+/*
+ *  Points the messages in b at their copies, now that data won't move.
+ */
+
+static void seal_batch(BATCH *b)
+{
+    unsigned long i;
+
+    for (i = 0; i < b->count; i++)
+    {
+        b->msgs[i].ctl = b->data.data + b->pos[i];
+        b->msgs[i].txt = b->msgs[i].ctl + b->msgs[i].ctl_len;
+    }
+}
+
+static void deliver(LANE *l, const BATCH *b)
+{
+    unsigned long i;
+
+    for (i = 0; i < b->count && !l->sink->failed; i++)
+    {
+        if (l->sink->msg(l->sink->arg, &b->msgs[i], b->nums[i]) != 0)
+        {
+            l->sink->failed = 1;
+        }
+        else
+        {
+            l->sink->msgs++;
+        }
+    }
+}
+
+static void finish(LANE *l)
+{
+    if (l->sink->end(l->sink->arg, l->e->complete) != 0)
+    {
+        l->sink->failed = 1;
+    }
+}
+
+#ifdef HAVE_PTHREAD
+
+static void *lane_thread(void *arg)
+{
+    LANE *l;
+    BATCH *b;
+
+    l = arg;
+
+    pthread_mutex_lock(&l->lock);
+
+    for (;;)
+    {
+        while (l->head == l->tail && !l->closing)
+        {
+            pthread_cond_wait(&l->data, &l->lock);
+        }
+
+        if (l->head == l->tail)
+        {
+            break;
+        }
+
+        b = l->queue[l->tail % QUEUE_BATCHES];
+        pthread_mutex_unlock(&l->lock);
+
+        deliver(l, b);
+        release_batch(l->e, b);
+
+        pthread_mutex_lock(&l->lock);
+        l->tail++;
+        pthread_cond_signal(&l->space);
+    }
+
+    pthread_mutex_unlock(&l->lock);
+
+    finish(l);
+
+    return NULL;
+}
+
+#endif
+
+/*
+ *  Hands b to every sink.
+ */
+
+static void send_batch(ENGINE *e, BATCH *b)
+{
+    int i;
+
+    seal_batch(b);
+    b->refs = e->nlanes;
+
+    for (i = 0; i < e->nlanes; i++)
+    {
+        LANE *l;
+
+        l = &e->lanes[i];
+
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&l->lock);
+
+        if (l->head - l->tail == QUEUE_BATCHES)
+        {
+            l->sink->stalls++;
+
+            while (l->head - l->tail == QUEUE_BATCHES)
+            {
+                pthread_cond_wait(&l->space, &l->lock);
+            }
+        }
+
+        l->queue[l->head % QUEUE_BATCHES] = b;
+        l->head++;
+
+        pthread_cond_signal(&l->data);
+        pthread_mutex_unlock(&l->lock);
+#else
+        deliver(l, b);
+        release_batch(e, b);
+#endif
+    }
+}
+
+/*
+ *  Walks the frame list of the base in sq, whose SQBASE is sqb, and hands
+ *  each message that passes filter (which may be NULL) to the nsinks
+ *  sinks.  Messages are numbered by their place in the frame list whether
+ *  they pass or not.  Returns 0, or -1 if the walk stopped at a bad frame;
+ *  the sinks still get what was read before it.  Sinks that failed have
+ *  their failed flag set.
+ */
+
+int export_run(SQFILE *sq, const SQBASE *sqb, const FILTER *filter, EXPORT_SINK *sinks,
+  int nsinks, EXPORT_RESULT *res)
+{
+    ENGINE e;
+    SQITER it;
+    SQMSG m;
+    BATCH *b;
+    int i, rc;
+
+    memset(&e, 0, sizeof e);
+
+    e.nlanes = nsinks;
+    e.lanes = malloc(sizeof *e.lanes * (size_t) (nsinks != 0 ? nsinks : 1));
+    assert(e.lanes != NULL);
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&e.lock, NULL);
+#endif
+
+    for (i = 0; i < nsinks; i++)
+    {
+        LANE *l;
+
+        l = &e.lanes[i];
+        memset(l, 0, sizeof *l);
+        l->sink = &sinks[i];
+        l->e = &e;
+
+        sinks[i].failed = 0;
+        sinks[i].msgs = 0;
+        sinks[i].stalls = 0;
+
+#ifdef HAVE_PTHREAD
+        pthread_mutex_init(&l->lock, NULL);
+        pthread_cond_init(&l->data, NULL);
+        pthread_cond_init(&l->space, NULL);
+        assert(pthread_create(&l->tid, NULL, lane_thread, l) == 0);
+#endif
+    }
+
+    res->msgs = 0;
+    res->passed = 0;
+    res->err_ofs = 0;
+
+    b = get_batch(&e);
+
+    sq_iter_init(&it, sq, sqb->first_frame, 0);
+
+    while ((rc = sq_iter_next(&it, &m)) == SQ_OK)
+    {
+        if (m.frame.frame_type != FRAME_NORMAL)
+        {
+            continue;
+        }
+
+        rc = sq_read_xmsg(sq, &m);
+
+        if (rc != SQ_OK)
+        {
+            break;
+        }
+
+        res->msgs++;
+
+        if (filter != NULL && !filter_match(filter, &m.xmsg))
+        {
+            continue;
+        }
+
+        rc = sq_read_msg(sq, &m);
+
+        if (rc != SQ_OK)
+        {
+            break;
+        }
+
+        add_msg(b, &m, res->msgs);
+        res->passed++;
+
+        if (b->count == BATCH_MSGS)
+        {
+            send_batch(&e, b);
+            b = get_batch(&e);
+        }
+    }
+
+    sq_iter_free(&it);
+
+    if (rc != SQ_END)
+    {
+        res->err_ofs = m.ofs;
+    }
+
+    res->rc = rc;
+    e.complete = rc == SQ_END;
+
+    if (b->count != 0)
+    {
+        send_batch(&e, b);
+    }
+    else
+    {
+        b->refs = 1;
+        release_batch(&e, b);
+    }
+
+    for (i = 0; i < nsinks; i++)
+    {
+        LANE *l;
+
+        l = &e.lanes[i];
+
+#ifdef HAVE_PTHREAD
+        pthread_mutex_lock(&l->lock);
+        l->closing = 1;
+        pthread_cond_signal(&l->data);
+        pthread_mutex_unlock(&l->lock);
+
+        pthread_join(l->tid, NULL);
+
+        pthread_mutex_destroy(&l->lock);
+        pthread_cond_destroy(&l->data);
+        pthread_cond_destroy(&l->space);
+#else
+        finish(l);
+#endif
+    }
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_destroy(&e.lock);
+#endif
+
+    free_batches(&e);
+    free(e.lanes);
+
+    return rc == SQ_END ? 0 : -1;
+}
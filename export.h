@@ -0,0 +1,65 @@
+/*
+ *  export.h
+ *
+ *  Reads a Squish base once and hands every message to several output
+ *  sinks, each running in a thread of its own.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __EXPORT_H__
+#define __EXPORT_H__
+
+#include "squish.h"
+#include "filter.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ *  An output.  msg() is called for each message in frame list order,
+ *  with num its number in the list counting from 1, and then end() once,
+ *  with complete 1 if the whole frame list was read or 0 if the walk
+ *  stopped at a bad frame; an output that has to cover the whole base
+ *  shouldn't be kept then.  Both are called from the sink's own thread
+ *  and return 0, or -1 if the output failed.  After a failure the sink is
+ *  sent nothing more but end(), and the others carry on.  The SQMSG, with
+ *  its control info and text, is only good until msg() returns.
+ */
+
+typedef struct
+{
+    const char *name;                /* for messages, eg. "mbox" */
+    void *arg;                       /* passed to msg() and end() */
+    int (*msg)(void *arg, const SQMSG *m, unsigned long num);
+    int (*end)(void *arg, int complete);
+
+    /* filled in by export_run() */
+
+    int failed;                      /* msg() or end() returned -1 */
+    unsigned long msgs;              /* messages msg() took */
+    unsigned long stalls;            /* times the reader waited for it */
+}
+EXPORT_SINK;
+
+/* the outcome of export_run() */
+
+typedef struct
+{
+    unsigned long msgs;              /* messages read from the base */
+    unsigned long passed;            /* ... and handed to the sinks */
+    int rc;                          /* SQ_END, or why the frame list walk stopped */
+    unsigned long err_ofs;           /* the bad frame, if it did */
+}
+EXPORT_RESULT;
+
+int export_run(SQFILE *sq, const SQBASE *sqb, const FILTER *filter, EXPORT_SINK *sinks,
+  int nsinks, EXPORT_RESULT *res);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
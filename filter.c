@@ -0,0 +1,492 @@
+/*
+ *  filter.c
+ *
+ *  Picking out messages by their headers alone.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  Every test here is on the 238-byte XMSG, so a message that doesn't
+ *  pass costs only the read of its header: its control info and text
+ *  are never touched.  The terms are
+ *
+ *     from, to, subj  a glob with * and ?, matched without regard to
+ *                     case, or with HAVE_REGEX an extended regular
+ *                     expression between slashes, eg. /^re: /.  The
+ *                     names are taken to be CP437 and matched as UTF-8;
+ *                     a regular expression sees the UTF-8 as bytes.
+ *     orig, dest      an address zone:net/node.point, where any part can
+ *                     be * and the parts after a * can be left off, eg.
+ *                     2:* for a whole zone or 3:633/267.* for a node and
+ *                     its points.  A node without a point is point 0.
+ *     attr            a list of attribute names separated by commas, each
+ *                     of which must be set, or clear if it starts with !,
+ *                     eg. pvt,!rcvd.  A number sets bits directly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#ifdef HAVE_REGEX
+#include <sys/types.h>
+#include <regex.h>
+#endif
+
+#include "filter.h"
+#include "charset.h"
+
+static const char * const field_name[FILTER_FIELDS] =
+{
+    "from", "to", "subj", "orig", "dest", "attr"
+};
+
+/* the XMSG attribute bits, as the MSGAPI names them */
+
+static const struct
+{
+    const char *name;
+    unsigned long bit;
+}
+attr_name[] =
+{
+    { "pvt", 0x0001UL },
+    { "crash", 0x0002UL },
+    { "rcvd", 0x0004UL },
+    { "sent", 0x0008UL },
+    { "file", 0x0010UL },
+    { "fwd", 0x0020UL },
+    { "orphan", 0x0040UL },
+    { "kill", 0x0080UL },
+    { "local", 0x0100UL },
+    { "hold", 0x0200UL },
+    { "frq", 0x0800UL },
+    { "rrq", 0x1000UL },
+    { "cpt", 0x2000UL },
+    { "arq", 0x4000UL },
+    { "urq", 0x8000UL },
+    { "scanned", 0x10000UL },
+    { NULL, 0 }
+};
+
+void filter_init(FILTER *f)
+{
+    f->terms = NULL;
+    f->count = 0;
+    f->size = 0;
+}
+
+/*
+ *  Parses an address pattern into addr.  Returns 0, or -1 if it isn't
+ *  one.
+ */
+
+static int parse_addr(const char *s, long *addr)
+{
+    static const char sep[] = ":/.";
+    int i, wild;
+
+    wild = 0;
+
+    for (i = 0; i < 4; i++)
+    {
+        if (*s == '*')
+        {
+            addr[i] = -1;
+            wild = 1;
+            s++;
+        }
+        else if (isdigit((unsigned char) *s))
+        {
+            char *end;
+
+            addr[i] = strtol(s, &end, 10);
+            wild = 0;
+            s = end;
+
+            if (addr[i] > 65535)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            return -1;
+        }
+
+        if (*s == '\0')
+        {
+            break;
+        }
+
+        if (i == 3 || *s != sep[i])
+        {
+            return -1;
+        }
+
+        s++;
+    }
+
+    if (i == 3)
+    {
+        return 0;
+    }
+
+    /* what's left off is anything after a *, and point 0 after a node */
+
+    if (!wild && i != 2)
+    {
+        return -1;
+    }
+
+    for (i++; i < 4; i++)
+    {
+        addr[i] = wild ? -1 : 0;
+    }
+
+    return 0;
+}
+
+/*
+ *  Parses a list of attribute names.  Returns 0, or -1 if there's one it
+ *  doesn't know.
+ */
+
+static int parse_attr(const char *s, unsigned long *on, unsigned long *off)
+{
+    *on = *off = 0;
+
+    while (*s != '\0')
+    {
+        unsigned long bit;
+        size_t len;
+        int neg, i;
+
+        neg = *s == '!';
+        s += neg;
+        len = strcspn(s, ",");
+
+        if (isdigit((unsigned char) *s))
+        {
+            char *end;
+
+            bit = strtoul(s, &end, 0);
+
+            if (end != s + len)
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            for (i = 0; attr_name[i].name != NULL; i++)
+            {
+                if (strlen(attr_name[i].name) == len && strncmp(s, attr_name[i].name, len) == 0)
+                {
+                    break;
+                }
+            }
+
+            if (attr_name[i].name == NULL)
+            {
+                return -1;
+            }
+
+            bit = attr_name[i].bit;
+        }
+
+        if (neg)
+        {
+            *off |= bit;
+        }
+        else
+        {
+            *on |= bit;
+        }
+
+        s += len;
+        s += *s == ',';
+    }
+
+    return 0;
+}
+
+/*
+ *  Adds a term on the field called name ("from", "to", "subj", "orig",
+ *  "dest" or "attr") with the pattern arg.  Returns 0, -1 if arg can't be
+ *  made sense of, or 1 if name isn't a field.
+ */
+
+int filter_add(FILTER *f, const char *name, const char *arg)
+{
+    FILTER_TERM t;
+    size_t len;
+    int field;
+
+    for (field = 0; field < FILTER_FIELDS; field++)
+    {
+        if (strcmp(name, field_name[field]) == 0)
+        {
+            break;
+        }
+    }
+
+    if (field == FILTER_FIELDS)
+    {
+        return 1;
+    }
+
+    memset(&t, 0, sizeof t);
+    t.field = field;
+    len = strlen(arg);
+
+    if (field == FILTER_ORIG || field == FILTER_DEST)
+    {
+        if (parse_addr(arg, t.addr) != 0)
+        {
+            return -1;
+        }
+    }
+    else if (field == FILTER_ATTR)
+    {
+        if (parse_attr(arg, &t.attr_on, &t.attr_off) != 0)
+        {
+            return -1;
+        }
+    }
+    else if (len >= 2 && arg[0] == '/' && arg[len - 1] == '/')
+    {
+#ifdef HAVE_REGEX
+        char *re;
+        int rc;
+
+        re = malloc(len - 1);
+        t.re = malloc(sizeof (regex_t));
+        assert(re != NULL && t.re != NULL);
+
+        memcpy(re, arg + 1, len - 2);
+        re[len - 2] = '\0';
+
+        rc = regcomp(t.re, re, REG_EXTENDED | REG_ICASE | REG_NOSUB);
+        free(re);
+
+        if (rc != 0)
+        {
+            free(t.re);
+            return -1;
+        }
+#else
+        return -1;
+#endif
+    }
+    else
+    {
+        t.glob = malloc(len + 1);
+        assert(t.glob != NULL);
+        strcpy(t.glob, arg);
+    }
+
+    if (f->count == f->size)
+    {
+        f->size = f->size != 0 ? f->size * 2 : 8;
+        f->terms = realloc(f->terms, sizeof *f->terms * (size_t) f->size);
+        assert(f->terms != NULL);
+    }
+
+    f->terms[f->count++] = t;
+
+    return 0;
+}
+
+void filter_free(FILTER *f)
+{
+    int i;
+
+    for (i = 0; i < f->count; i++)
+    {
+        free(f->terms[i].glob);
+
+#ifdef HAVE_REGEX
+        if (f->terms[i].re != NULL)
+        {
+            regfree(f->terms[i].re);
+            free(f->terms[i].re);
+        }
+#endif
+    }
+
+    free(f->terms);
+    filter_init(f);
+}
+
+/* length of the UTF-8 sequence starting with c */
+
+static int seq_len(unsigned char c)
+{
+    return c < 0xc0 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+}
+
+/*
+ *  Matches the UTF-8 string s against the glob p without regard to the
+ *  case of ASCII letters.  ? stands for one character.
+ */
+
+static int glob_match(const char *p, const char *s)
+{
+    const char *star, *resume;
+
+    star = resume = NULL;
+
+    while (*s != '\0')
+    {
+        if (*p == '*')
+        {
+            star = ++p;
+            resume = s;
+        }
+        else if (*p == '?')
+        {
+            p++;
+            s += seq_len((unsigned char) *s);
+        }
+        else if (*p != '\0' && tolower((unsigned char) *p) == tolower((unsigned char) *s))
+        {
+            p++;
+            s++;
+        }
+        else if (star != NULL)
+        {
+            p = star;
+            resume += seq_len((unsigned char) *resume);
+            s = resume;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    while (*p == '*')
+    {
+        p++;
+    }
+
+    return *p == '\0';
+}
+
+/* converts the CP437 string s to UTF-8 in buf, which holds len bytes */
+
+static void to_utf8(const char *s, char *buf, size_t len)
+{
+    const CHARSET *cs;
+    size_t n;
+
+    cs = charset_default();
+    n = 0;
+
+    for (; *s != '\0'; s++)
+    {
+        unsigned char c;
+
+        c = (unsigned char) *s;
+
+        if (c < 0x80)
+        {
+            if (n + 1 >= len)
+            {
+                break;
+            }
+
+            buf[n++] = (char) c;
+        }
+        else
+        {
+            if (n + cs->utf8[c - 0x80][0] >= len)
+            {
+                break;
+            }
+
+            memcpy(buf + n, cs->utf8[c - 0x80] + 1, cs->utf8[c - 0x80][0]);
+            n += cs->utf8[c - 0x80][0];
+        }
+    }
+
+    buf[n] = '\0';
+}
+
+static int match_addr(const long *addr, unsigned short zone, unsigned short net,
+  unsigned short node, unsigned short point)
+{
+    return (addr[0] == -1 || addr[0] == zone) && (addr[1] == -1 || addr[1] == net) &&
+      (addr[2] == -1 || addr[2] == node) && (addr[3] == -1 || addr[3] == point);
+}
+
+static int match_term(const FILTER_TERM *t, const SQXMSG *x)
+{
+    char text[73 * 3 + 1];
+
+    switch (t->field)
+    {
+    case FILTER_ORIG:
+        return match_addr(t->addr, x->orig_zone, x->orig_net, x->orig_node, x->orig_point);
+    case FILTER_DEST:
+        return match_addr(t->addr, x->dest_zone, x->dest_net, x->dest_node, x->dest_point);
+    case FILTER_ATTR:
+        return (x->attr & t->attr_on) == t->attr_on && (x->attr & t->attr_off) == 0;
+    }
+
+    to_utf8(t->field == FILTER_FROM ? x->from : t->field == FILTER_TO ? x->to : x->subj,
+      text, sizeof text);
+
+#ifdef HAVE_REGEX
+    if (t->re != NULL)
+    {
+        return regexec(t->re, text, 0, NULL, 0) == 0;
+    }
+#endif
+
+    return glob_match(t->glob, text);
+}
+
+/*
+ *  Returns 1 if the message with the header x passes f, or 0 if it
+ *  doesn't.
+ */
+
+int filter_match(const FILTER *f, const SQXMSG *x)
+{
+    int have[FILTER_FIELDS], hit[FILTER_FIELDS];
+    int i;
+
+    if (f->count == 0)
+    {
+        return 1;
+    }
+
+    memset(have, 0, sizeof have);
+    memset(hit, 0, sizeof hit);
+
+    for (i = 0; i < f->count; i++)
+    {
+        const FILTER_TERM *t;
+
+        t = &f->terms[i];
+        have[t->field] = 1;
+
+        if (!hit[t->field] && match_term(t, x))
+        {
+            hit[t->field] = 1;
+        }
+    }
+
+    for (i = 0; i < FILTER_FIELDS; i++)
+    {
+        if (have[i] && !hit[i])
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
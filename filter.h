@@ -0,0 +1,63 @@
+/*
+ *  filter.h
+ *
+ *  Picking out messages by their headers alone.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include "squish.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* what a term looks at */
+
+#define FILTER_FROM   0
+#define FILTER_TO     1
+#define FILTER_SUBJ   2
+#define FILTER_ORIG   3
+#define FILTER_DEST   4
+#define FILTER_ATTR   5
+#define FILTER_FIELDS 6
+
+typedef struct
+{
+    int field;                       /* FILTER_FROM etc. */
+    char *glob;                      /* from, to, subj: a glob ... */
+    void *re;                        /* ... or a compiled regex_t */
+    long addr[4];                    /* orig, dest: zone, net, node, point, or -1 for any */
+    unsigned long attr_on;           /* attr: bits that must be set */
+    unsigned long attr_off;          /* ... and bits that must be clear */
+}
+FILTER_TERM;
+
+/*
+ *  A message passes if, for each field with terms, at least one of them
+ *  matches it: terms on the same field are alternatives and terms on
+ *  different fields must all hold.  No terms passes everything.
+ */
+
+typedef struct
+{
+    FILTER_TERM *terms;
+    int count;
+    int size;
+}
+FILTER;
+
+void filter_init(FILTER *f);
+int filter_add(FILTER *f, const char *name, const char *arg);
+int filter_match(const FILTER *f, const SQXMSG *x);
+void filter_free(FILTER *f);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,961 @@
+/*
+ *  hdrcache.c
+ *
+ *  A cache of the message headers of a Squish base, kept column by
+ *  column in a file (.sqh) that can be mapped into memory.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  Answering "who wrote what, when, to whom" from the .sqd means walking
+ *  the frame list and decoding a 238-byte XMSG for every message.  The
+ *  cache holds the same facts as fixed-width arrays, one per field, so a
+ *  question about one field reads one array from start to end.  The
+ *  names and subjects are stored once each in a pool of strings, and the
+ *  from, to and subj columns hold their numbers.
+ *
+ *  The file is little-endian.  It starts with a 512-byte header of
+ *  32-bit numbers
+ *
+ *     0  "SQHC"
+ *     4  version (1)
+ *     8  header size (512)
+ *    12  number of messages
+ *    16  number of strings
+ *    20  uid, num_msg, high_water, end_frame and first_frame from the
+ *        SQBASE when the cache was last brought up to date
+ *    40  frame offset and umsgid of the last message
+ *    48  number of sections (18)
+ *    64  for each section: its offset in the file and its length in
+ *        bytes, each as a low word then a high word
+ *
+ *  and the sections follow, each starting on an 8-byte boundary: the
+ *  columns in the order they're listed in HDRCACHE, then str_ofs, then
+ *  the pool.  Dates are 32-bit signed seconds since 1970, in the writer's
+ *  own zone as Squish keeps them, and 0 if unknown.  Addresses are 16-bit.
+ *
+ *  On little-endian hosts built with HAVE_MMAP the file is mapped and
+ *  used as it is.  Otherwise it's read into memory, and byte-swapped if
+ *  need be.
+ *
+ *  hc_update() adds messages written since the cache was last updated,
+ *  if the last message it has is still there and no older ones have been
+ *  deleted, and otherwise builds it from scratch.  Rows already in the
+ *  cache are never read again, so their attributes are as they were when
+ *  the rows were added; a rebuild is the only way to refresh them.
+ *  Either way the new cache is written to a temporary file and renamed
+ *  over the old one, so anyone with the old one mapped can carry on using
+ *  it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifdef HAVE_MMAP
+#include <sys/types.h>
+#include <sys/mman.h>
+#endif
+
+#include "hdrcache.h"
+#include "sqorder.h"
+#include "sqdate.h"
+#include "checkpoint.h"
+#include "buf.h"
+
+#define HC_MAGIC   "SQHC"
+#define HC_VERSION 1
+#define HC_HDRSIZE 512
+#define HC_ALIGN   8
+
+/* what a section's length counts */
+
+#define PER_MSG    0
+#define PER_STRING 1
+#define PER_BYTE   2
+
+static const struct
+{
+    size_t member;                   /* where its pointer goes in HDRCACHE */
+    size_t width;
+    int per;
+}
+sections[] =
+{
+    { offsetof(HDRCACHE, frame), 4, PER_MSG },
+    { offsetof(HDRCACHE, umsgid), 4, PER_MSG },
+    { offsetof(HDRCACHE, written), 4, PER_MSG },
+    { offsetof(HDRCACHE, arrived), 4, PER_MSG },
+    { offsetof(HDRCACHE, attr), 4, PER_MSG },
+    { offsetof(HDRCACHE, from), 4, PER_MSG },
+    { offsetof(HDRCACHE, to), 4, PER_MSG },
+    { offsetof(HDRCACHE, subj), 4, PER_MSG },
+    { offsetof(HDRCACHE, orig_zone), 2, PER_MSG },
+    { offsetof(HDRCACHE, orig_net), 2, PER_MSG },
+    { offsetof(HDRCACHE, orig_node), 2, PER_MSG },
+    { offsetof(HDRCACHE, orig_point), 2, PER_MSG },
+    { offsetof(HDRCACHE, dest_zone), 2, PER_MSG },
+    { offsetof(HDRCACHE, dest_net), 2, PER_MSG },
+    { offsetof(HDRCACHE, dest_node), 2, PER_MSG },
+    { offsetof(HDRCACHE, dest_point), 2, PER_MSG },
+    { offsetof(HDRCACHE, str_ofs), 4, PER_STRING },
+    { offsetof(HDRCACHE, pool), 1, PER_BYTE }
+};
+
+#define SECTIONS    (sizeof sections / sizeof *sections)
+#define COLUMNS     16
+#define SEC_STR_OFS 16
+#define SEC_POOL    17
+
+/* the columns as they're filled in */
+
+#define C_FRAME   0
+#define C_UMSGID  1
+#define C_WRITTEN 2
+#define C_ARRIVED 3
+#define C_ATTR    4
+#define C_FROM    5
+#define C_TO      6
+#define C_SUBJ    7
+#define C_ORIG    8
+#define C_DEST    12
+
+/* the new rows and strings of a cache being written */
+
+typedef struct
+{
+    const HDRCACHE *old;             /* the rows before these, or NULL */
+    unsigned long old_strings;
+    unsigned long old_pool;
+    void *col[COLUMNS];
+    BUF pool;                        /* new strings */
+    HC_U32 *str_ofs;                 /* of the new strings, in the whole pool */
+    unsigned long strings;
+    unsigned long str_size;
+    unsigned long *table;            /* string number + 1, or 0 if empty */
+    unsigned long table_size;
+}
+BUILD;
+
+static int little_endian(void)
+{
+    unsigned int one;
+
+    one = 1;
+
+    return *(unsigned char *) &one == 1;
+}
+
+static void swap(void *p, size_t width, size_t n)
+{
+    unsigned char *q, t;
+    size_t i;
+
+    q = p;
+
+    for (i = 0; i < n; i++, q += width)
+    {
+        if (width == 2)
+        {
+            t = q[0]; q[0] = q[1]; q[1] = t;
+        }
+        else if (width == 4)
+        {
+            t = q[0]; q[0] = q[3]; q[3] = t;
+            t = q[1]; q[1] = q[2]; q[2] = t;
+        }
+    }
+}
+
+/* a 64-bit offset or length, as two words */
+
+static size_t get_size(const unsigned char *p)
+{
+    size_t n;
+
+    n = r2ul(p);
+
+    if (sizeof n > 4)
+    {
+        n |= (size_t) r2ul(p + 4) << 16 << 16;
+    }
+    else if (r2ul(p + 4) != 0)
+    {
+        n = (size_t) -1;
+    }
+
+    return n;
+}
+
+static void put_size(unsigned char *p, size_t n)
+{
+    put_ul(p, (unsigned long) (n & 0xffffffffUL));
+    put_ul(p + 4, sizeof n > 4 ? (unsigned long) (n >> 16 >> 16) : 0);
+}
+
+static size_t section_len(const HDRCACHE *hc, size_t sec)
+{
+    switch (sections[sec].per)
+    {
+    case PER_MSG:
+        return sections[sec].width * hc->count;
+    case PER_STRING:
+        return sections[sec].width * hc->strings;
+    default:
+        return hc->pool_size;
+    }
+}
+
+static const void *section(const HDRCACHE *hc, size_t sec)
+{
+    const void *p;
+
+    memcpy(&p, (const char *) hc + sections[sec].member, sizeof p);
+
+    return p;
+}
+
+/*
+ *  Finds the sections of the file in hc->data and checks that they hang
+ *  together.  Returns 0, or -1 if they don't.
+ */
+
+static int parse(HDRCACHE *hc)
+{
+    const unsigned char *p;
+    size_t i;
+
+    p = hc->data;
+
+    if (hc->size < HC_HDRSIZE || memcmp(p, HC_MAGIC, 4) != 0 || r2ul(p + 4) != HC_VERSION ||
+      r2ul(p + 8) != HC_HDRSIZE || r2ul(p + 48) != SECTIONS)
+    {
+        return -1;
+    }
+
+    hc->count = r2ul(p + 12);
+    hc->strings = r2ul(p + 16);
+    hc->uid = r2ul(p + 20);
+    hc->num_msg = r2ul(p + 24);
+    hc->high_water = r2ul(p + 28);
+    hc->end_frame = r2ul(p + 32);
+    hc->first_frame = r2ul(p + 36);
+    hc->last_frame = r2ul(p + 40);
+    hc->last_umsgid = r2ul(p + 44);
+    hc->pool_size = (unsigned long) get_size(p + 64 + SEC_POOL * 16 + 8);
+
+    for (i = 0; i < SECTIONS; i++)
+    {
+        size_t ofs, len;
+        const void *q;
+
+        ofs = get_size(p + 64 + i * 16);
+        len = get_size(p + 64 + i * 16 + 8);
+
+        if (ofs < HC_HDRSIZE || ofs % HC_ALIGN != 0 || ofs > hc->size ||
+          len > hc->size - ofs || len != section_len(hc, i))
+        {
+            return -1;
+        }
+
+        q = (const char *) hc->data + ofs;
+        memcpy((char *) hc + sections[i].member, &q, sizeof q);
+
+        if (!little_endian())
+        {
+            swap((char *) hc->data + ofs, sections[i].width, len / sections[i].width);
+        }
+    }
+
+    if (hc->pool_size != 0 ? hc->pool[hc->pool_size - 1] != '\0' : hc->strings != 0)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < hc->strings; i++)
+    {
+        if (hc->str_ofs[i] >= hc->pool_size)
+        {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < hc->count; i++)
+    {
+        if (hc->from[i] >= hc->strings || hc->to[i] >= hc->strings || hc->subj[i] >= hc->strings)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ *  Opens the cache in filename.  Returns 0, or -1 if it can't be read or
+ *  isn't a usable cache.
+ */
+
+int hc_open(HDRCACHE *hc, const char *filename)
+{
+    FILE *fp;
+    long size;
+
+    memset(hc, 0, sizeof *hc);
+
+    if (sizeof(HC_U32) != 4 || sizeof(HC_S32) != 4 || sizeof(HC_U16) != 2)
+    {
+        return -1;
+    }
+
+    fp = fopen(filename, "rb");
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    size = -1L;
+
+    if (fseek(fp, 0, SEEK_END) == 0)
+    {
+        size = ftell(fp);
+    }
+
+    if (size < HC_HDRSIZE || fseek(fp, 0, SEEK_SET) != 0)
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    hc->size = (size_t) size;
+
+#ifdef HAVE_MMAP
+    if (little_endian())
+    {
+        void *map;
+
+        map = mmap(NULL, hc->size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+
+        if (map != MAP_FAILED)
+        {
+            hc->data = map;
+            hc->mapped = 1;
+        }
+    }
+#endif
+
+    if (hc->data == NULL)
+    {
+        hc->data = malloc(hc->size);
+
+        if (hc->data == NULL || fread(hc->data, hc->size, 1, fp) != 1)
+        {
+            free(hc->data);
+            hc->data = NULL;
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    fclose(fp);
+
+    if (parse(hc) != 0)
+    {
+        hc_close(hc);
+        return -1;
+    }
+
+    return 0;
+}
+
+void hc_close(HDRCACHE *hc)
+{
+#ifdef HAVE_MMAP
+    if (hc->mapped)
+    {
+        munmap(hc->data, hc->size);
+        hc->data = NULL;
+    }
+#endif
+
+    free(hc->data);
+    memset(hc, 0, sizeof *hc);
+}
+
+/*
+ *  Returns 1 if the cache is up to date with a base whose SQBASE is sqb,
+ *  going by the fields that change whenever a message is added or
+ *  deleted, or 0 if it isn't.  Changes to a message's attributes don't
+ *  show up in them.
+ */
+
+int hc_fresh(const HDRCACHE *hc, const SQBASE *sqb)
+{
+    return hc->uid == sqb->uid && hc->num_msg == sqb->num_msg &&
+      hc->high_water == sqb->high_water && hc->end_frame == sqb->end_frame &&
+      hc->first_frame == sqb->first_frame;
+}
+
+static unsigned long str_hash(const char *s)
+{
+    unsigned long h;
+
+    h = 2166136261UL;
+
+    while (*s != '\0')
+    {
+        h = ((h ^ (unsigned char) *s++) * 16777619UL) & 0xffffffffUL;
+    }
+
+    return h;
+}
+
+static const char *build_str(const BUILD *b, unsigned long n)
+{
+    if (n < b->old_strings)
+    {
+        return hc_str(b->old, n);
+    }
+
+    return b->pool.data + (b->str_ofs[n - b->old_strings] - b->old_pool);
+}
+
+static void table_add(BUILD *b, unsigned long n)
+{
+    unsigned long i;
+
+    i = str_hash(build_str(b, n)) & (b->table_size - 1);
+
+    while (b->table[i] != 0)
+    {
+        i = (i + 1) & (b->table_size - 1);
+    }
+
+    b->table[i] = n + 1;
+}
+
+static void table_grow(BUILD *b)
+{
+    unsigned long n, total;
+
+    total = b->old_strings + b->strings;
+
+    free(b->table);
+
+    b->table_size = b->table_size != 0 ? b->table_size * 2 : 4096;
+
+    while (b->table_size < total * 2)
+    {
+        b->table_size *= 2;
+    }
+
+    b->table = calloc(b->table_size, sizeof *b->table);
+    assert(b->table != NULL);
+
+    for (n = 0; n < total; n++)
+    {
+        table_add(b, n);
+    }
+}
+
+/*
+ *  Returns the number of the string s, adding it to the pool if it's new.
+ */
+
+static unsigned long intern(BUILD *b, const char *s)
+{
+    unsigned long i, n;
+
+    i = str_hash(s) & (b->table_size - 1);
+
+    while (b->table[i] != 0)
+    {
+        if (strcmp(build_str(b, b->table[i] - 1), s) == 0)
+        {
+            return b->table[i] - 1;
+        }
+
+        i = (i + 1) & (b->table_size - 1);
+    }
+
+    if (b->strings == b->str_size)
+    {
+        b->str_size = b->str_size != 0 ? b->str_size * 2 : 1024;
+        b->str_ofs = realloc(b->str_ofs, sizeof *b->str_ofs * b->str_size);
+        assert(b->str_ofs != NULL);
+    }
+
+    n = b->old_strings + b->strings;
+    b->str_ofs[b->strings++] = (HC_U32) (b->old_pool + b->pool.len);
+    buf_write(&b->pool, s, strlen(s) + 1);
+
+    b->table[i] = n + 1;
+
+    if ((n + 1) * 2 >= b->table_size)
+    {
+        table_grow(b);
+    }
+
+    return n;
+}
+
+static void add_row(BUILD *b, unsigned long row, const SQMSG *m)
+{
+    const SQXMSG *x;
+    time_t t;
+
+    x = &m->xmsg;
+
+    ((HC_U32 *) b->col[C_FRAME])[row] = (HC_U32) m->ofs;
+    ((HC_U32 *) b->col[C_UMSGID])[row] = (HC_U32) x->umsgid;
+    ((HC_U32 *) b->col[C_ATTR])[row] = (HC_U32) x->attr;
+
+    if (sqdate_written(x, &t) != 0)
+    {
+        t = 0;
+    }
+
+    ((HC_S32 *) b->col[C_WRITTEN])[row] = (HC_S32) sqdate_s32(t);
+    ((HC_S32 *) b->col[C_ARRIVED])[row] = x->date_arrived != 0 ?
+      (HC_S32) sqdate_s32(sqdate_dos(x->date_arrived, x->time_arrived)) : 0;
+
+    ((HC_U32 *) b->col[C_FROM])[row] = (HC_U32) intern(b, x->from);
+    ((HC_U32 *) b->col[C_TO])[row] = (HC_U32) intern(b, x->to);
+    ((HC_U32 *) b->col[C_SUBJ])[row] = (HC_U32) intern(b, x->subj);
+
+    ((HC_U16 *) b->col[C_ORIG])[row] = x->orig_zone;
+    ((HC_U16 *) b->col[C_ORIG + 1])[row] = x->orig_net;
+    ((HC_U16 *) b->col[C_ORIG + 2])[row] = x->orig_node;
+    ((HC_U16 *) b->col[C_ORIG + 3])[row] = x->orig_point;
+    ((HC_U16 *) b->col[C_DEST])[row] = x->dest_zone;
+    ((HC_U16 *) b->col[C_DEST + 1])[row] = x->dest_net;
+    ((HC_U16 *) b->col[C_DEST + 2])[row] = x->dest_node;
+    ((HC_U16 *) b->col[C_DEST + 3])[row] = x->dest_point;
+}
+
+/*
+ *  Reads the headers of the messages in list into b, in the order they
+ *  lie in the file.  Returns SQ_END, or the error that stopped it with the
+ *  offset of the bad frame in *err_ofs.
+ */
+
+static int read_rows(BUILD *b, SQFILE *sq, const SQOFS *list, unsigned long *err_ofs)
+{
+    unsigned long *order, i;
+    int rc;
+
+    order = sq_physical_order(list->ofs, list->count);
+    sq_advise(sq, SQ_ADV_SEQUENTIAL);
+
+    rc = SQ_END;
+
+    for (i = 0; i < list->count; i++)
+    {
+        SQMSG m;
+        unsigned long j;
+
+        j = order[i];
+        rc = sq_read_frame(sq, list->ofs[j], &m);
+
+        if (rc == SQ_OK)
+        {
+            rc = sq_read_xmsg(sq, &m);
+        }
+
+        if (rc != SQ_OK)
+        {
+            *err_ofs = list->ofs[j];
+            break;
+        }
+
+        add_row(b, j, &m);
+        rc = SQ_END;
+    }
+
+    free(order);
+
+    return rc;
+}
+
+/*
+ *  Writes n items of width bytes from p to fp, little-endian.  Returns 0,
+ *  or -1 on an error.
+ */
+
+static int write_items(FILE *fp, const void *p, size_t width, size_t n)
+{
+    unsigned char buf[4096];
+    const unsigned char *q;
+    size_t len, chunk;
+
+    q = p;
+    len = width * n;
+
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    if (width == 1 || little_endian())
+    {
+        return fwrite(q, len, 1, fp) == 1 ? 0 : -1;
+    }
+
+    while (len != 0)
+    {
+        chunk = len < sizeof buf ? len : sizeof buf;
+        memcpy(buf, q, chunk);
+        swap(buf, width, chunk / width);
+
+        if (fwrite(buf, chunk, 1, fp) != 1)
+        {
+            return -1;
+        }
+
+        q += chunk;
+        len -= chunk;
+    }
+
+    return 0;
+}
+
+static int write_cache(FILE *fp, const BUILD *b, unsigned long rows, const SQBASE *sqb)
+{
+    unsigned char hdr[HC_HDRSIZE];
+    static const char zeros[HC_ALIGN];
+    unsigned long old_rows;
+    size_t i, pos;
+
+    old_rows = b->old != NULL ? b->old->count : 0;
+
+    memset(hdr, 0, sizeof hdr);
+
+    if (fwrite(hdr, sizeof hdr, 1, fp) != 1)
+    {
+        return -1;
+    }
+
+    pos = HC_HDRSIZE;
+
+    for (i = 0; i < SECTIONS; i++)
+    {
+        size_t start, pad;
+        int rc;
+
+        pad = (HC_ALIGN - pos % HC_ALIGN) % HC_ALIGN;
+
+        if (pad != 0 && fwrite(zeros, pad, 1, fp) != 1)
+        {
+            return -1;
+        }
+
+        pos += pad;
+        start = pos;
+
+        if (b->old != NULL)
+        {
+            pos += section_len(b->old, i);
+
+            if (write_items(fp, section(b->old, i), sections[i].width,
+              section_len(b->old, i) / sections[i].width) != 0)
+            {
+                return -1;
+            }
+        }
+
+        if (i == SEC_POOL)
+        {
+            rc = write_items(fp, b->pool.data, 1, b->pool.len);
+            pos += b->pool.len;
+        }
+        else if (i == SEC_STR_OFS)
+        {
+            rc = write_items(fp, b->str_ofs, 4, b->strings);
+            pos += 4 * b->strings;
+        }
+        else
+        {
+            rc = write_items(fp, b->col[i], sections[i].width, rows - old_rows);
+            pos += sections[i].width * (rows - old_rows);
+        }
+
+        if (rc != 0)
+        {
+            return -1;
+        }
+
+        put_size(hdr + 64 + i * 16, start);
+        put_size(hdr + 64 + i * 16 + 8, pos - start);
+    }
+
+    memcpy(hdr, HC_MAGIC, 4);
+    put_ul(hdr + 4, HC_VERSION);
+    put_ul(hdr + 8, HC_HDRSIZE);
+    put_ul(hdr + 12, rows);
+    put_ul(hdr + 16, b->old_strings + b->strings);
+    put_ul(hdr + 20, sqb->uid);
+    put_ul(hdr + 24, sqb->num_msg);
+    put_ul(hdr + 28, sqb->high_water);
+    put_ul(hdr + 32, sqb->end_frame);
+    put_ul(hdr + 36, sqb->first_frame);
+
+    if (rows > old_rows)
+    {
+        put_ul(hdr + 40, ((HC_U32 *) b->col[C_FRAME])[rows - old_rows - 1]);
+        put_ul(hdr + 44, ((HC_U32 *) b->col[C_UMSGID])[rows - old_rows - 1]);
+    }
+    else if (rows != 0)
+    {
+        put_ul(hdr + 40, b->old->last_frame);
+        put_ul(hdr + 44, b->old->last_umsgid);
+    }
+
+    put_ul(hdr + 48, SECTIONS);
+
+    if (fseek(fp, 0, SEEK_SET) != 0 || fwrite(hdr, sizeof hdr, 1, fp) != 1)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ *  Writes the cache to filename by way of a temporary file.  Returns 0,
+ *  or -1 with errno set.
+ */
+
+static int save_cache(const char *filename, const BUILD *b, unsigned long rows,
+  const SQBASE *sqb)
+{
+    FILE *fp;
+    char *tmp;
+    int rc;
+
+    if (b->old_pool + b->pool.len > 0xffffffffUL)
+    {
+        errno = EFBIG;
+        return -1;
+    }
+
+    tmp = malloc(strlen(filename) + 5);
+    assert(tmp != NULL);
+    sprintf(tmp, "%s.tmp", filename);
+
+    fp = fopen(tmp, "wb");
+
+    if (fp == NULL)
+    {
+        free(tmp);
+        return -1;
+    }
+
+    rc = write_cache(fp, b, rows, sqb);
+
+    if (fclose(fp) != 0)
+    {
+        rc = -1;
+    }
+
+    if (rc == 0)
+    {
+        rc = rename(tmp, filename);
+    }
+
+    if (rc != 0)
+    {
+        remove(tmp);
+    }
+
+    free(tmp);
+
+    return rc;
+}
+
+static void free_build(BUILD *b)
+{
+    size_t i;
+
+    for (i = 0; i < COLUMNS; i++)
+    {
+        free(b->col[i]);
+    }
+
+    free(b->table);
+    free(b->str_ofs);
+    buf_free(&b->pool);
+}
+
+/*
+ *  Brings the cache in filename up to date with the base open in sq,
+ *  whose SQBASE is sqb, and says what it did in res.  With rebuild set
+ *  it's built from scratch however up to date it looks.  Returns 0, or -1
+ *  if the frame list couldn't be walked (res->rc isn't SQ_END) or the
+ *  cache couldn't be written (errno is set).
+ */
+
+int hc_update(const char *filename, SQFILE *sq, const SQBASE *sqb, int rebuild,
+  HC_RESULT *res)
+{
+    HDRCACHE old;
+    CHECKPOINT ck;
+    SQOFS list;
+    BUILD b;
+    unsigned long ofs;
+    size_t i;
+    int have_old, append, rc;
+
+    res->action = HC_REBUILT;
+    res->added = 0;
+    res->rc = SQ_END;
+    res->err_ofs = 0;
+
+    have_old = !rebuild && hc_open(&old, filename) == 0;
+
+    if (have_old && hc_fresh(&old, sqb))
+    {
+        hc_close(&old);
+        res->action = HC_UPTODATE;
+        return 0;
+    }
+
+    append = 0;
+
+    if (have_old)
+    {
+        ck.frame = old.last_frame;
+        ck.umsgid = old.last_umsgid;
+        ck.uid = old.uid;
+        ck.high_water = old.high_water;
+        ck.msgs = old.count;
+        ck.out_size = 0;
+
+        append = ckpt_resume(&ck, sq, sqb, &ofs) &&
+          (old.count == 0 || old.first_frame == sqb->first_frame);
+    }
+
+    sq_ofs_init(&list);
+
+    rc = sq_collect(sq, append ? ofs : sqb->first_frame, 0, SQ_COLLECT_SKIP, &list,
+      &res->err_ofs);
+
+    /* if older messages have been deleted it has to start again */
+
+    if (rc == SQ_END && append && old.count + list.count != sqb->num_msg)
+    {
+        append = 0;
+        sq_ofs_free(&list);
+        rc = sq_collect(sq, sqb->first_frame, 0, SQ_COLLECT_SKIP, &list, &res->err_ofs);
+    }
+
+    memset(&b, 0, sizeof b);
+    buf_init(&b.pool);
+
+    if (append)
+    {
+        res->action = HC_APPENDED;
+        b.old = &old;
+        b.old_strings = old.strings;
+        b.old_pool = old.pool_size;
+    }
+
+    table_grow(&b);
+
+    for (i = 0; i < COLUMNS; i++)
+    {
+        b.col[i] = malloc(sections[i].width * (list.count != 0 ? list.count : 1));
+        assert(b.col[i] != NULL);
+    }
+
+    if (rc == SQ_END)
+    {
+        rc = read_rows(&b, sq, &list, &res->err_ofs);
+    }
+
+    res->rc = rc;
+    rc = rc == SQ_END ? 0 : -1;
+
+    if (rc == 0)
+    {
+        rc = save_cache(filename, &b, (append ? old.count : 0) + list.count, sqb);
+    }
+
+    res->added = list.count;
+
+    free_build(&b);
+    sq_ofs_free(&list);
+
+    if (have_old)
+    {
+        hc_close(&old);
+    }
+
+    return rc;
+}
+
+/*
+ *  Building a cache from messages handed over one at a time, for a tool
+ *  that reads the base itself: the export engine in export.c, say.
+ */
+
+struct hc_build
+{
+    BUILD b;
+    unsigned long rows;
+    unsigned long size;              /* rows there's room for */
+};
+
+HC_BUILD *hc_build_new(void)
+{
+    HC_BUILD *hb;
+
+    hb = malloc(sizeof *hb);
+    assert(hb != NULL);
+
+    memset(hb, 0, sizeof *hb);
+    buf_init(&hb->b.pool);
+    table_grow(&hb->b);
+
+    return hb;
+}
+
+/*
+ *  Adds the message in m, whose XMSG header has been read, as the next
+ *  row.
+ */
+
+void hc_build_add(HC_BUILD *hb, const SQMSG *m)
+{
+    size_t i;
+
+    if (hb->rows == hb->size)
+    {
+        hb->size = hb->size != 0 ? hb->size * 2 : 4096;
+
+        for (i = 0; i < COLUMNS; i++)
+        {
+            hb->b.col[i] = realloc(hb->b.col[i], sections[i].width * hb->size);
+            assert(hb->b.col[i] != NULL);
+        }
+    }
+
+    add_row(&hb->b, hb->rows++, m);
+}
+
+/*
+ *  Writes the rows added so far to filename as the cache of the base
+ *  whose SQBASE is sqb.  Returns 0, or -1 with errno set.
+ */
+
+int hc_build_save(HC_BUILD *hb, const char *filename, const SQBASE *sqb)
+{
+    return save_cache(filename, &hb->b, hb->rows, sqb);
+}
+
+void hc_build_free(HC_BUILD *hb)
+{
+    free_build(&hb->b);
+    free(hb);
+}
@@ -0,0 +1,119 @@
+/*
+ *  hdrcache.h
+ *
+ *  A cache of the message headers of a Squish base, kept column by
+ *  column in a file (.sqh) that can be mapped into memory.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __HDRCACHE_H__
+#define __HDRCACHE_H__
+
+#include <stddef.h>
+
+#include "squish.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* the widths of the columns; hc_open() fails if these aren't right */
+
+typedef unsigned int HC_U32;
+typedef int HC_S32;
+typedef unsigned short HC_U16;
+
+/* what hc_update() did */
+
+#define HC_UPTODATE 0                /* the cache matched the base */
+#define HC_APPENDED 1                /* new messages were added to it */
+#define HC_REBUILT  2                /* it was built from scratch */
+
+/*
+ *  An open cache.  Row i of every column is the i'th message in frame
+ *  list order.  The columns point into the mapped file and are read-only.
+ *  from, to and subj are string numbers; use hc_str() to get the string.
+ *
+ *  attr is a snapshot taken when the row was added.  Squish rewrites the
+ *  attributes in place, when a message is read say, and that leaves the
+ *  SQBASE alone, so the cache still counts as up to date; rebuild it to
+ *  bring attr up to date.
+ */
+
+typedef struct
+{
+    unsigned long count;             /* messages */
+    unsigned long strings;           /* distinct from/to/subject strings */
+    unsigned long pool_size;
+
+    /* SQBASE fields when the cache was last brought up to date */
+
+    unsigned long uid;
+    unsigned long num_msg;
+    unsigned long high_water;
+    unsigned long end_frame;
+    unsigned long first_frame;
+
+    unsigned long last_frame;        /* frame offset of the last message */
+    unsigned long last_umsgid;
+
+    const HC_U32 *frame;
+    const HC_U32 *umsgid;
+    const HC_S32 *written;           /* seconds since 1970, as written */
+    const HC_S32 *arrived;
+    const HC_U32 *attr;
+    const HC_U32 *from;
+    const HC_U32 *to;
+    const HC_U32 *subj;
+    const HC_U16 *orig_zone;
+    const HC_U16 *orig_net;
+    const HC_U16 *orig_node;
+    const HC_U16 *orig_point;
+    const HC_U16 *dest_zone;
+    const HC_U16 *dest_net;
+    const HC_U16 *dest_node;
+    const HC_U16 *dest_point;
+    const HC_U32 *str_ofs;           /* where each string starts in pool */
+    const char *pool;                /* nul-terminated, as in the XMSG */
+
+    void *data;                      /* the file, mapped or read in */
+    size_t size;
+    int mapped;
+}
+HDRCACHE;
+
+/* the outcome of hc_update() */
+
+typedef struct
+{
+    int action;                      /* HC_UPTODATE etc. */
+    unsigned long added;             /* headers read from the .sqd */
+    int rc;                          /* SQ_END, or why the frame list walk stopped */
+    unsigned long err_ofs;           /* the bad frame, if it did */
+}
+HC_RESULT;
+
+/* a cache being built a message at a time */
+
+typedef struct hc_build HC_BUILD;
+
+#define hc_str(hc, n) ((hc)->pool + (hc)->str_ofs[n])
+
+int hc_open(HDRCACHE *hc, const char *filename);
+void hc_close(HDRCACHE *hc);
+int hc_fresh(const HDRCACHE *hc, const SQBASE *sqb);
+int hc_update(const char *filename, SQFILE *sq, const SQBASE *sqb, int rebuild,
+  HC_RESULT *res);
+
+HC_BUILD *hc_build_new(void);
+void hc_build_add(HC_BUILD *hb, const SQMSG *m);
+int hc_build_save(HC_BUILD *hb, const char *filename, const SQBASE *sqb);
+void hc_build_free(HC_BUILD *hb);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
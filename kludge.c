@@ -0,0 +1,164 @@
+/*
+ *  kludge.c
+ *
+ *  Splits the control info of a message into its ^A kludge lines.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  The control info is scanned once, nothing is copied and nothing is
+ *  allocated.  It ends at the first nul, if there is one.  Empty lines
+ *  (two ^As in a row) are skipped.
+ */
+
+#include <string.h>
+
+#include "kludge.h"
+
+static const struct
+{
+    const char *tag;
+    size_t len;
+}
+known[KL_KNOWN] =
+{
+    { "MSGID", 5 },
+    { "REPLY", 5 },
+    { "CHRS", 4 },
+    { "TZUTC", 5 },
+    { "PID", 3 }
+};
+
+static void split_line(KLUDGE *k)
+{
+    const char *p, *end;
+    int i;
+
+    p = k->line;
+    end = k->line + k->line_len;
+
+    while (p != end && *p != ':' && *p != ' ')
+    {
+        p++;
+    }
+
+    k->tag = k->line;
+    k->tag_len = (size_t) (p - k->line);
+
+    if (p != end && *p == ':')
+    {
+        p++;
+    }
+
+    if (p != end && *p == ' ')
+    {
+        p++;
+    }
+
+    k->value = p;
+    k->value_len = (size_t) (end - p);
+
+    k->id = KL_OTHER;
+
+    if (k->tag_len < (size_t) (end - k->line) && k->line[k->tag_len] == ':')
+    {
+        for (i = 0; i < KL_KNOWN; i++)
+        {
+            if (k->tag_len == known[i].len && memcmp(k->tag, known[i].tag, known[i].len) == 0)
+            {
+                k->id = i;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ *  Finds the next kludge line at or after *p and before end, and stores
+ *  it in k.  Returns 1 and advances *p past it, or 0 if there are no more.
+ *  Set end to the end of the control info and *p to its start before the
+ *  first call.
+ */
+
+int kludge_next(const char **p, const char *end, KLUDGE *k)
+{
+    const char *q;
+
+    while (*p != end && **p == '\1')
+    {
+        (*p)++;
+    }
+
+    if (*p == end || **p == '\0')
+    {
+        *p = end;
+        return 0;
+    }
+
+    q = memchr(*p, '\1', (size_t) (end - *p));
+
+    if (q == NULL)
+    {
+        q = end;
+    }
+
+    k->line = *p;
+    k->line_len = (size_t) (q - *p);
+
+    /* a nul ends the control info */
+
+    end = memchr(k->line, '\0', k->line_len);
+
+    if (end != NULL)
+    {
+        k->line_len = (size_t) (end - k->line);
+        q = end;
+    }
+
+    split_line(k);
+
+    *p = q;
+
+    return 1;
+}
+
+/*
+ *  Splits len bytes of control info into the table k.
+ */
+
+void kludge_parse(KLUDGES *k, const char *ctl, size_t len)
+{
+    const char *p, *end;
+    KLUDGE line;
+    int i;
+
+    k->count = 0;
+    k->total = 0;
+
+    for (i = 0; i < KL_KNOWN; i++)
+    {
+        k->known[i].line = NULL;
+    }
+
+    if (ctl == NULL)
+    {
+        return;
+    }
+
+    p = ctl;
+    end = ctl + len;
+
+    while (kludge_next(&p, end, &line))
+    {
+        if (line.id != KL_OTHER && k->known[line.id].line == NULL)
+        {
+            k->known[line.id] = line;
+        }
+
+        if (k->count < KLUDGE_MAX)
+        {
+            k->line[k->count++] = line;
+        }
+
+        k->total++;
+    }
+}
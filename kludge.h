@@ -0,0 +1,68 @@
+/*
+ *  kludge.h
+ *
+ *  Splits the control info of a message into its ^A kludge lines.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __KLUDGE_H__
+#define __KLUDGE_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* kludges that kludge_parse() looks out for */
+
+#define KL_MSGID  0
+#define KL_REPLY  1
+#define KL_CHRS   2
+#define KL_TZUTC  3
+#define KL_PID    4
+#define KL_KNOWN  5
+#define KL_OTHER  KL_KNOWN
+
+/* lines kept in a KLUDGES table; any more are counted but not kept */
+
+#define KLUDGE_MAX 256
+
+/*
+ *  One kludge line.  All three are views into the control info, which
+ *  must outlive them; none are nul-terminated.  For "MSGID: 1:2/3 abcd"
+ *  the line is the whole thing, the tag is "MSGID" and the value is
+ *  "1:2/3 abcd".  For "Via 1:2/3 ..." the tag is "Via".
+ */
+
+typedef struct
+{
+    int id;                          /* KL_MSGID etc., or KL_OTHER */
+    const char *line;
+    size_t line_len;
+    const char *tag;
+    size_t tag_len;
+    const char *value;
+    size_t value_len;
+}
+KLUDGE;
+
+typedef struct
+{
+    KLUDGE line[KLUDGE_MAX];
+    int count;                       /* lines kept in line[] */
+    int total;                       /* lines found */
+    KLUDGE known[KL_KNOWN];          /* the first of each; line is NULL if none */
+}
+KLUDGES;
+
+int kludge_next(const char **p, const char *end, KLUDGE *k);
+void kludge_parse(KLUDGES *k, const char *ctl, size_t len);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
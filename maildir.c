@@ -0,0 +1,466 @@
+/*
+ *  maildir.c
+ *
+ *  Writes Squish messages into a Maildir, a file per message.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  A message's filename is made from its MSGID, so the same message gets
+ *  the same name however often it's exported, and a run into a Maildir
+ *  that's already been written to skips what's there (md_has()) instead
+ *  of adding copies.  A message without a MSGID is named from its
+ *  header and umsgid instead.  The names are 16 hex digits, the two
+ *  32-bit halves of the hash, and ".squish"; a message marked received
+ *  goes in cur with the seen flag, and the rest go in new.
+ *
+ *  Messages are written to tmp a batch at a time and moved into new or
+ *  cur together by md_batch_commit().  With sync set each batch is made
+ *  durable first: with HAVE_SYNCFS one syncfs() covers the whole batch,
+ *  and otherwise each file is fsync()ed, though only once all of them
+ *  have been written so the writes can overlap.  Either way the directory
+ *  is synced once per batch after the moves, rather than once per file.
+ */
+
+#ifdef HAVE_SYNCFS
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "maildir.h"
+#include "kludge.h"
+
+/* FNV-1a, with the offset basis given */
+
+static unsigned long fnv(unsigned long h, const void *p, size_t len)
+{
+    const unsigned char *s;
+
+    s = p;
+
+    while (len-- > 0)
+    {
+        h = ((h ^ *s++) * 16777619UL) & 0xffffffffUL;
+    }
+
+    return h;
+}
+
+/*
+ *  Puts the filename for the message in m, read with sq_read_msg(), in
+ *  name, which has room for MD_NAME_LEN bytes.
+ */
+
+void md_name(char *name, const SQMSG *m)
+{
+    KLUDGES kl;
+    BUF key;
+    unsigned long h1, h2;
+
+    buf_init(&key);
+    kludge_parse(&kl, m->ctl, (size_t) m->ctl_len);
+
+    if (kl.known[KL_MSGID].line != NULL)
+    {
+        buf_write(&key, kl.known[KL_MSGID].value, kl.known[KL_MSGID].value_len);
+    }
+    else
+    {
+        const SQXMSG *x;
+
+        /* the leading nul keeps these apart from any MSGID */
+
+        x = &m->xmsg;
+        buf_putc(&key, '\0');
+        buf_write(&key, x->from, strlen(x->from) + 1);
+        buf_write(&key, x->to, strlen(x->to) + 1);
+        buf_write(&key, x->subj, strlen(x->subj) + 1);
+        buf_write(&key, x->ftsc_date, strlen(x->ftsc_date) + 1);
+        buf_printf(&key, "%u:%u/%u.%u %lu", x->orig_zone, x->orig_net, x->orig_node,
+          x->orig_point, x->umsgid);
+    }
+
+    h1 = fnv(2166136261UL, key.data, key.len);
+    h2 = fnv(h1 ^ 0x5bd1e995UL, key.data, key.len);
+
+    sprintf(name, "%08lx%08lx.squish", h1, h2);
+
+    buf_free(&key);
+}
+
+static int make_dir(const char *path)
+{
+    struct stat st;
+
+    if (mkdir(path, 0777) == 0)
+    {
+        return 0;
+    }
+
+    if (errno == EEXIST && stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        return 0;
+    }
+
+    return -1;
+}
+
+/*
+ *  Adds the names of the messages in the subdirectory sub to md->names.
+ *  Flags after a colon aren't part of the name.
+ */
+
+static int read_names(MAILDIR *md, const char *sub, unsigned long *size)
+{
+    DIR *dir;
+    struct dirent *de;
+    char *path;
+
+    path = malloc(strlen(md->path) + strlen(sub) + 2);
+    assert(path != NULL);
+    sprintf(path, "%s/%s", md->path, sub);
+
+    dir = opendir(path);
+    free(path);
+
+    if (dir == NULL)
+    {
+        return -1;
+    }
+
+    while ((de = readdir(dir)) != NULL)
+    {
+        char *name;
+        size_t len;
+
+        if (de->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        len = strcspn(de->d_name, ":");
+
+        if (md->count == *size)
+        {
+            *size = *size != 0 ? *size * 2 : 256;
+            md->names = realloc(md->names, sizeof *md->names * *size);
+            assert(md->names != NULL);
+        }
+
+        name = malloc(len + 1);
+        assert(name != NULL);
+        memcpy(name, de->d_name, len);
+        name[len] = '\0';
+
+        md->names[md->count++] = name;
+    }
+
+    closedir(dir);
+
+    return 0;
+}
+
+static int cmp_name(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+ *  Opens the Maildir path, creating it and its subdirectories if need
+ *  be, and notes what's in it already.  Returns 0, or -1 with errno set
+ *  if it can't.
+ */
+
+int md_open(MAILDIR *md, const char *path, int sync)
+{
+    static const char * const sub[3] = { "tmp", "new", "cur" };
+    unsigned long size;
+    char *p;
+    int i;
+
+    md->path = malloc(strlen(path) + 1);
+    assert(md->path != NULL);
+    strcpy(md->path, path);
+
+    md->sync = sync;
+    md->names = NULL;
+    md->count = 0;
+
+    p = malloc(strlen(path) + 5);
+    assert(p != NULL);
+
+    for (i = -1; i < 3; i++)
+    {
+        if (i == -1)
+        {
+            strcpy(p, path);
+        }
+        else
+        {
+            sprintf(p, "%s/%s", path, sub[i]);
+        }
+
+        if (make_dir(p) != 0)
+        {
+            free(p);
+            md_close(md);
+            return -1;
+        }
+    }
+
+    free(p);
+
+    size = 0;
+
+    if (read_names(md, "new", &size) != 0 || read_names(md, "cur", &size) != 0)
+    {
+        md_close(md);
+        return -1;
+    }
+
+    if (md->count != 0)
+    {
+        qsort(md->names, md->count, sizeof *md->names, cmp_name);
+    }
+
+    return 0;
+}
+
+void md_close(MAILDIR *md)
+{
+    unsigned long i;
+
+    for (i = 0; i < md->count; i++)
+    {
+        free(md->names[i]);
+    }
+
+    free(md->names);
+    free(md->path);
+
+    md->names = NULL;
+    md->path = NULL;
+    md->count = 0;
+}
+
+/*
+ *  Returns 1 if there was a message called name in the Maildir when it
+ *  was opened, or 0 if there wasn't.
+ */
+
+int md_has(const MAILDIR *md, const char *name)
+{
+    return md->count != 0 &&
+      bsearch(&name, md->names, md->count, sizeof *md->names, cmp_name) != NULL;
+}
+
+void md_batch_init(MD_BATCH *b, MAILDIR *md, unsigned long id)
+{
+    b->md = md;
+    b->id = id;
+    b->count = 0;
+    buf_init(&b->names);
+}
+
+void md_batch_free(MD_BATCH *b)
+{
+    buf_free(&b->names);
+}
+
+/* where the batch entry at p is written, and where it's moved to */
+
+static void tmp_path(const MD_BATCH *b, const char *p, char *path)
+{
+    sprintf(path, "%s/tmp/%s.%lu", b->md->path, p + 1, b->id);
+}
+
+static void final_path(const MD_BATCH *b, const char *p, char *path)
+{
+    sprintf(path, "%s/%s/%s%s", b->md->path, *p == 'S' ? "cur" : "new", p + 1,
+      *p == 'S' ? ":2,S" : "");
+}
+
+/*
+ *  Writes data, len bytes, to tmp as the message called name, which has
+ *  been read if seen is set.  Returns 0, 1 if a message by that name is
+ *  already in the batch, or -1 with errno set if it can't be written.
+ */
+
+int md_batch_add(MD_BATCH *b, const char *name, int seen, const char *data, size_t len)
+{
+    FILE *fp;
+    char *path;
+    const char *p;
+    unsigned long i;
+    int failed;
+
+    for (i = 0, p = b->names.data; i < b->count; i++, p += strlen(p) + 1)
+    {
+        if (strcmp(p + 1, name) == 0)
+        {
+            return 1;
+        }
+    }
+
+    path = malloc(strlen(b->md->path) + strlen(name) + 32);
+    assert(path != NULL);
+
+    buf_putc(&b->names, seen ? 'S' : '-');
+    buf_puts(&b->names, name);
+    buf_putc(&b->names, '\0');
+
+    tmp_path(b, b->names.data + b->names.len - strlen(name) - 2, path);
+
+    fp = fopen(path, "wb");
+
+    if (fp == NULL)
+    {
+        b->names.len -= strlen(name) + 2;
+        free(path);
+        return -1;
+    }
+
+    failed = len != 0 && fwrite(data, len, 1, fp) != 1;
+    failed |= fclose(fp) != 0;
+
+    if (failed)
+    {
+        remove(path);
+        b->names.len -= strlen(name) + 2;
+        free(path);
+        return -1;
+    }
+
+    free(path);
+    b->count++;
+
+    return 0;
+}
+
+static int sync_path(const char *path)
+{
+    int fd, rc;
+
+    fd = open(path, O_RDONLY);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+#ifdef HAVE_SYNCFS
+    rc = syncfs(fd);
+#else
+    rc = fsync(fd);
+#endif
+
+    close(fd);
+
+    return rc;
+}
+
+static int sync_dir(const MAILDIR *md, const char *sub)
+{
+    char *path;
+    int fd, rc;
+
+    path = malloc(strlen(md->path) + strlen(sub) + 2);
+    assert(path != NULL);
+    sprintf(path, "%s/%s", md->path, sub);
+
+    fd = open(path, O_RDONLY);
+    free(path);
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    rc = fsync(fd);
+    close(fd);
+
+    return rc;
+}
+
+/*
+ *  Moves the messages in b into new or cur, making them durable first if
+ *  the Maildir was opened with sync set, and empties b.  Returns 0, or -1
+ *  with errno set if a message couldn't be moved or synced; the ones that
+ *  couldn't be moved are left in tmp.
+ */
+
+int md_batch_commit(MD_BATCH *b)
+{
+    char *tmp, *dst;
+    const char *p;
+    unsigned long i;
+    int rc, got_new, got_cur;
+
+    if (b->count == 0)
+    {
+        return 0;
+    }
+
+    tmp = malloc(strlen(b->md->path) + MD_NAME_LEN + 32);
+    dst = malloc(strlen(b->md->path) + MD_NAME_LEN + 32);
+    assert(tmp != NULL && dst != NULL);
+
+    rc = 0;
+
+    if (b->md->sync)
+    {
+#ifdef HAVE_SYNCFS
+        sprintf(tmp, "%s/tmp", b->md->path);
+        rc = sync_path(tmp);
+#else
+        for (i = 0, p = b->names.data; i < b->count && rc == 0; i++, p += strlen(p) + 1)
+        {
+            tmp_path(b, p, tmp);
+            rc = sync_path(tmp);
+        }
+#endif
+    }
+
+    got_new = got_cur = 0;
+
+    for (i = 0, p = b->names.data; i < b->count && rc == 0; i++, p += strlen(p) + 1)
+    {
+        tmp_path(b, p, tmp);
+        final_path(b, p, dst);
+
+        rc = rename(tmp, dst);
+
+        got_cur |= *p == 'S';
+        got_new |= *p != 'S';
+    }
+
+    if (rc == 0 && b->md->sync)
+    {
+        if (got_new)
+        {
+            rc = sync_dir(b->md, "new");
+        }
+
+        if (rc == 0 && got_cur)
+        {
+            rc = sync_dir(b->md, "cur");
+        }
+    }
+
+    free(dst);
+    free(tmp);
+
+    b->names.len = 0;
+    b->count = 0;
+
+    return rc == 0 ? 0 : -1;
+}
@@ -0,0 +1,64 @@
+/*
+ *  maildir.h
+ *
+ *  Writes Squish messages into a Maildir, a file per message.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __MAILDIR_H__
+#define __MAILDIR_H__
+
+#include <stddef.h>
+
+#include "squish.h"
+#include "buf.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* room for a name from md_name(), with its nul */
+
+#define MD_NAME_LEN 32
+
+typedef struct
+{
+    char *path;
+    int sync;                        /* make each batch durable before it's moved in */
+    char **names;                    /* the messages already there, sorted */
+    unsigned long count;
+}
+MAILDIR;
+
+/*
+ *  Messages written to tmp, waiting for md_batch_commit() to move them
+ *  into new or cur.  A batch belongs to one thread, but batches can be
+ *  written to the same Maildir from several threads at once.
+ */
+
+typedef struct
+{
+    MAILDIR *md;
+    unsigned long id;                /* makes the tmp names unique between batches */
+    BUF names;                       /* the tmp and final name of each, nul-terminated */
+    unsigned long count;
+}
+MD_BATCH;
+
+int md_open(MAILDIR *md, const char *path, int sync);
+void md_close(MAILDIR *md);
+void md_name(char *name, const SQMSG *m);
+int md_has(const MAILDIR *md, const char *name);
+
+void md_batch_init(MD_BATCH *b, MAILDIR *md, unsigned long id);
+int md_batch_add(MD_BATCH *b, const char *name, int seen, const char *data, size_t len);
+int md_batch_commit(MD_BATCH *b);
+void md_batch_free(MD_BATCH *b);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
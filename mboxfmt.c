@@ -0,0 +1,352 @@
+/*
+ *  mboxfmt.c
+ *
+ *  Renders Squish messages as mbox records.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  This is the rendering done by squ2mbox, shared so that other tools
+ *  give the same result for a message.  The header's names, subject and
+ *  text are converted to UTF-8 from the character set in the CHRS kludge
+ *  (charset.c), and MSGID and REPLY become Message-ID and In-Reply-To.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mboxfmt.h"
+#include "kludge.h"
+#include "scan.h"
+#include "charset.h"
+
+#define HOSTNAME "localhost"
+#define USERNAME "fidonet"
+
+/*
+ *  Generates a Message-ID for a message that doesn't have one.  The ID is
+ *  made from the time the conversion started and the message number, so
+ *  it doesn't depend on the order in which messages are rendered.
+ */
+
+static void gen_msgid(char *buf, const struct tm *start, unsigned long msg_num)
+{
+    sprintf(buf, "%d%02d%02d%02d%02d%02d.G%c%lu@%s",
+        start->tm_year + 1900, start->tm_mon + 1, start->tm_mday,
+        start->tm_hour, start->tm_min, start->tm_sec,
+        (char) ('A' + (msg_num - 1) % 26), msg_num - 1, HOSTNAME);
+}
+
+/*
+ *  Outputs a MSGID or REPLY kludge as a Message-ID style header, turning
+ *  "1:2/3 abcd" into "<1:2/3@abcd>".
+ */
+
+static void output_msgid(BUF *out, const char *header, const KLUDGE *k)
+{
+    const char *p, *end;
+
+    buf_printf(out, "%s: <", header);
+
+    buf_reserve(out, k->value_len);
+
+    for (p = k->value, end = k->value + k->value_len; p != end; p++)
+    {
+        if (*p == '@')
+        {
+            out->data[out->len++] = '#';
+        }
+        else if (*p == ' ')
+        {
+            out->data[out->len++] = '@';
+        }
+        else
+        {
+            out->data[out->len++] = *p;
+        }
+    }
+
+    buf_puts(out, ">\n");
+}
+
+static int has_prefix(const char *p, const char *end, const char *prefix, size_t len)
+{
+    return (size_t) (end - p) >= len && memcmp(p, prefix, len) == 0;
+}
+
+/*
+ *  Outputs the message text, which is in character set cs.  Lines are
+ *  CR-terminated; control lines are dropped, as are SEEN-BY lines after
+ *  the origin line.  The bytes of each line are scanned in bulk (see
+ *  scan.c) and copied a whole span at a time up to the CR or to a byte
+ *  that needs converting or escaping.
+ */
+
+static void output_msg_txt(BUF *out, int text_mode, int maildir, const char *txt, size_t len,
+  const CHARSET *cs)
+{
+    const char *p, *end;
+    int got_origin, raw;
+
+    raw = text_mode == MBOX_RAW || (text_mode == MBOX_UTF8 && charset_is_utf8(cs));
+
+    /* the text ends at the first nul, if there is one; anything after the
+       last CR is not a complete line and is dropped */
+
+    end = memchr(txt, '\0', len);
+
+    if (end == NULL)
+    {
+        end = txt + len;
+    }
+
+    while (end != txt && end[-1] != '\r')
+    {
+        end--;
+    }
+
+    got_origin = 0;
+
+    p = txt;
+
+    while (p != end)
+    {
+        /* p is at the start of a line, which ends with a CR before end */
+
+        if (*p == '\n')
+        {
+            p++;
+        }
+
+        if (*p == 0x01 || (got_origin && has_prefix(p, end, "SEEN-BY: ", 9)))
+        {
+            p = (const char *) memchr(p, '\r', (size_t) (end - p)) + 1;
+            continue;
+        }
+
+        if (has_prefix(p, end, " * Origin: ", 11))
+        {
+            got_origin = 1;
+        }
+
+        if (!maildir && has_prefix(p, end, "From ", 5))
+        {
+            buf_putc(out, '>');
+        }
+
+        for (;;)
+        {
+            size_t n;
+            unsigned char c;
+
+            if (raw)
+            {
+                n = (size_t) ((const char *) memchr(p, '\r', (size_t) (end - p)) - p);
+            }
+            else
+            {
+                n = scan_body(p, (size_t) (end - p));
+            }
+
+            buf_write(out, p, n);
+            p += n;
+
+            if (*p == '\r')
+            {
+                buf_putc(out, '\n');
+                p++;
+                break;
+            }
+
+            c = (unsigned char) *p++;
+
+            if (text_mode == MBOX_UTF8)
+            {
+                if (c == 0x7f)
+                {
+                    buf_putc(out, (char) c);
+                }
+                else
+                {
+                    const unsigned char *u;
+
+                    u = cs->utf8[c - 0x80];
+                    buf_write(out, u + 1, u[0]);
+                }
+
+                continue;
+            }
+
+            /* a byte above 0x7e, written as =NNN */
+
+            buf_reserve(out, 4);
+            out->data[out->len++] = '=';
+            out->data[out->len++] = (char) ('0' + c / 100);
+            out->data[out->len++] = (char) ('0' + c / 10 % 10);
+            out->data[out->len++] = (char) ('0' + c % 10);
+        }
+    }
+
+    if (!maildir)
+    {
+        buf_putc(out, '\n');
+    }
+}
+
+/*
+ *  Outputs a header line whose value is in character set cs.
+ */
+
+static void output_header(BUF *out, int text_mode, const char *name, const char *value,
+  const char *suffix, const CHARSET *cs)
+{
+    buf_puts(out, name);
+    buf_puts(out, ": ");
+
+    if (text_mode == MBOX_UTF8)
+    {
+        charset_to_utf8(out, cs, value, strlen(value));
+    }
+    else
+    {
+        buf_puts(out, value);
+    }
+
+    buf_puts(out, suffix);
+}
+
+/*
+ *  Renders the message in m, already read with sq_read_msg(), as an mbox
+ *  record, the way f says.  msg_num is its number in the base, counting
+ *  from 1; it's used to make up a Message-ID if it has no MSGID.  This
+ *  may be called from several threads at once, each with its own dc.
+ */
+
+void mbox_format(BUF *out, const MBOXFMT *f, const SQMSG *m, unsigned long msg_num,
+  SQDATE_CACHE *dc)
+{
+    const char *from, *to, *subject;
+    char date[SQDATE_RFC_LEN], mboxdate[SQDATE_MBOX_LEN], zone[SQDATE_ZONE_LEN];
+    KLUDGES kl;
+    const CHARSET *cs;
+    time_t msg_time;
+    int tz;
+
+    from = m->xmsg.from;
+    to = m->xmsg.to;
+    subject = m->xmsg.subj;
+
+    kludge_parse(&kl, m->ctl, (size_t) m->ctl_len);
+
+    /* the DOS date is the writer's local time, and TZUTC says what zone
+       that was in; without it the time is taken to be UTC */
+
+    sqdate_written(&m->xmsg, &msg_time);
+
+    if (kl.known[KL_TZUTC].line == NULL ||
+      sqdate_tzutc(kl.known[KL_TZUTC].value, kl.known[KL_TZUTC].value_len, &tz) != 0)
+    {
+        tz = 0;
+    }
+
+    /* Thu Oct 03 08:21:13 2002, in UTC */
+    sqdate_fmt_mbox(dc, msg_time - tz * 60L, mboxdate);
+
+    /* Thu, 03 Oct 2002 18:21:13 +1000 */
+    sqdate_fmt_rfc(dc, msg_time, date);
+    sqdate_fmt_zone(tz, zone);
+
+    if (!f->maildir)
+    {
+        buf_printf(out, "From localhost %s\n", mboxdate);
+    }
+
+    cs = NULL;
+
+    if (kl.known[KL_CHRS].line != NULL)
+    {
+        cs = charset_find(kl.known[KL_CHRS].value, kl.known[KL_CHRS].value_len);
+    }
+
+    if (cs == NULL)
+    {
+        cs = charset_default();
+    }
+
+    output_header(out, f->text_mode, "From", from, " <" USERNAME "@" HOSTNAME ">\n", cs);
+    output_header(out, f->text_mode, "To", to, " <" USERNAME "@" HOSTNAME ">\n", cs);
+
+    if (*subject != '\0')
+    {
+        output_header(out, f->text_mode, "Subject", subject, "\n", cs);
+    }
+
+    buf_printf(out, "Date: %s %s\n", date, zone);
+
+    switch (f->text_mode)
+    {
+    case MBOX_UTF8:
+        buf_puts(out, "Content-Type: text/plain; charset=UTF-8\n");
+        buf_puts(out, "Content-Transfer-Encoding: 8bit\n");
+        break;
+
+    case MBOX_RAW:
+        buf_printf(out, "Content-Type: text/plain; charset=%s\n", cs->name);
+        buf_puts(out, "Content-Transfer-Encoding: 8bit\n");
+        break;
+
+    default:
+        buf_puts(out, "Content-Type: text/plain;\n");
+        break;
+    }
+
+    buf_printf(out, "X-Converted-by: %s\n", f->converter);
+
+    if (kl.known[KL_MSGID].line != NULL)
+    {
+        output_msgid(out, "Message-ID", &kl.known[KL_MSGID]);
+    }
+    else
+    {
+        char buf[127];
+
+        gen_msgid(buf, &f->start, msg_num);
+        buf_printf(out, "Message-ID: <%s>\n", buf);
+    }
+
+    if (kl.known[KL_REPLY].line != NULL)
+    {
+        output_msgid(out, "In-Reply-To", &kl.known[KL_REPLY]);
+    }
+
+    if (f->ctl_lines)
+    {
+        const char *p, *end;
+        KLUDGE k;
+
+        p = m->ctl;
+        end = m->ctl + m->ctl_len;
+
+        while (kludge_next(&p, end, &k))
+        {
+            buf_puts(out, "\n\1");
+            buf_write(out, k.line, k.line_len);
+        }
+    }
+
+    if (m->ctl_len == 0)
+    {
+        buf_putc(out, '\n');
+    }
+
+    buf_putc(out, '\n');
+
+    if (m->txt_len != 0)
+    {
+        output_msg_txt(out, f->text_mode, f->maildir, m->txt, (size_t) m->txt_len, cs);
+    }
+    else if (!f->maildir)
+    {
+        buf_putc(out, '\n');
+    }
+}
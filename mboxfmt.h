@@ -0,0 +1,47 @@
+/*
+ *  mboxfmt.h
+ *
+ *  Renders Squish messages as mbox records.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __MBOXFMT_H__
+#define __MBOXFMT_H__
+
+#include <time.h>
+
+#include "squish.h"
+#include "buf.h"
+#include "sqdate.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* what to do with 8-bit text: convert it to UTF-8, write it as =NNN, or
+   write it as-is */
+
+#define MBOX_UTF8   0
+#define MBOX_ESCAPE 1
+#define MBOX_RAW    2
+
+typedef struct
+{
+    int text_mode;                   /* MBOX_UTF8 etc. */
+    int ctl_lines;                   /* copy the kludge lines after the headers */
+    const char *converter;           /* X-Converted-by, eg. "squ2mbox 1.21" */
+    struct tm start;                 /* when the run started, in UTC, for made-up Message-IDs */
+    int maildir;                     /* a message file: no "From " lines and no blank line after */
+}
+MBOXFMT;
+
+void mbox_format(BUF *out, const MBOXFMT *f, const SQMSG *m, unsigned long msg_num,
+  SQDATE_CACHE *dc);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
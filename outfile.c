@@ -0,0 +1,529 @@
+/*
+ *  outfile.c
+ *
+ *  Output file that is optionally compressed with gzip or zstd on the way
+ *  out.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  All output goes through out_write(), whatever the format.  Raw output
+ *  is simply passed to fwrite().  Compressed output is gathered into
+ *  blocks which are handed to a thread of their own, so the compressor
+ *  runs while the caller is busy producing the next block; only a few
+ *  blocks are queued at once.  Without HAVE_PTHREAD the blocks are
+ *  compressed as they fill up.
+ *
+ *  gzip needs HAVE_ZLIB (link with -lz) and zstd needs HAVE_ZSTD (link
+ *  with -lzstd).  Appending to an existing compressed file adds a new
+ *  gzip member or zstd frame, which both formats allow.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "buf.h"
+#include "outfile.h"
+
+/* compressed output is queued in blocks of about this size */
+
+#define BLOCK_SIZE (256 * 1024)
+
+/* blocks queued for the compressor thread */
+
+#define QUEUE_BLOCKS 4
+
+#define GZIP_LEVEL 6
+#define ZSTD_LEVEL 3
+
+struct outfile
+{
+    FILE *fp;
+    int format;
+    int error;                       /* a write or the compressor failed; under
+                                        lock while the compressor thread runs */
+    BUF cur;                         /* block being filled */
+    unsigned char *zbuf;             /* compressed data on its way to fp */
+    size_t zbuf_size;
+#ifdef HAVE_ZLIB
+    z_stream z;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zc;
+#endif
+#ifdef HAVE_PTHREAD
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t data;             /* a block was queued, or closing */
+    pthread_cond_t space;            /* a queued block was compressed */
+    BUF queue[QUEUE_BLOCKS];
+    unsigned long head;              /* blocks queued */
+    unsigned long tail;              /* blocks compressed */
+    int closing;
+#endif
+};
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+
+static int write_zbuf(OUTFILE *o, size_t len)
+{
+    return len != 0 && fwrite(o->zbuf, len, 1, o->fp) != 1 ? -1 : 0;
+}
+
+#endif
+
+#ifdef HAVE_ZLIB
+
+static int gzip_block(OUTFILE *o, const char *p, size_t len, int finish)
+{
+    int rc;
+
+    o->z.next_in = (Bytef *) p;
+    o->z.avail_in = (uInt) len;
+
+    do
+    {
+        o->z.next_out = o->zbuf;
+        o->z.avail_out = (uInt) o->zbuf_size;
+
+        rc = deflate(&o->z, finish ? Z_FINISH : Z_NO_FLUSH);
+
+        if (rc == Z_STREAM_ERROR || write_zbuf(o, o->zbuf_size - o->z.avail_out) != 0)
+        {
+            return -1;
+        }
+    }
+    while (o->z.avail_out == 0 || (finish && rc != Z_STREAM_END));
+
+    return 0;
+}
+
+#endif
+
+#ifdef HAVE_ZSTD
+
+static int zstd_block(OUTFILE *o, const char *p, size_t len, int finish)
+{
+    ZSTD_inBuffer in;
+    ZSTD_outBuffer out;
+    size_t left;
+
+    in.src = p;
+    in.size = len;
+    in.pos = 0;
+
+    do
+    {
+        out.dst = o->zbuf;
+        out.size = o->zbuf_size;
+        out.pos = 0;
+
+        left = ZSTD_compressStream2(o->zc, &out, &in, finish ? ZSTD_e_end : ZSTD_e_continue);
+
+        if (ZSTD_isError(left) || write_zbuf(o, out.pos) != 0)
+        {
+            return -1;
+        }
+    }
+    while (in.pos != in.size || (finish && left != 0));
+
+    return 0;
+}
+
+#endif
+
+/*
+ *  Compresses len bytes at p and writes the result.  With finish set
+ *  this also ends the stream.  Returns 0, or -1 if the compressor or the
+ *  write failed.  It leaves o->error to the caller, which may be the
+ *  compressor thread.
+ */
+
+static int compress_block(OUTFILE *o, const char *p, size_t len, int finish)
+{
+    switch (o->format)
+    {
+#ifdef HAVE_ZLIB
+    case OUT_GZIP:
+        return gzip_block(o, p, len, finish);
+#endif
+
+#ifdef HAVE_ZSTD
+    case OUT_ZSTD:
+        return zstd_block(o, p, len, finish);
+#endif
+
+    default:
+        (void) o;
+        (void) p;
+        (void) len;
+        (void) finish;
+        return -1;
+    }
+}
+
+#ifdef HAVE_PTHREAD
+
+static void *compressor(void *arg)
+{
+    OUTFILE *o;
+    BUF *b;
+    int rc;
+
+    o = arg;
+
+    pthread_mutex_lock(&o->lock);
+
+    for (;;)
+    {
+        while (o->head == o->tail && !o->closing)
+        {
+            pthread_cond_wait(&o->data, &o->lock);
+        }
+
+        if (o->head == o->tail)
+        {
+            break;
+        }
+
+        b = &o->queue[o->tail % QUEUE_BLOCKS];
+        pthread_mutex_unlock(&o->lock);
+
+        rc = compress_block(o, b->data, b->len, 0);
+        b->len = 0;
+
+        pthread_mutex_lock(&o->lock);
+
+        if (rc != 0)
+        {
+            o->error = 1;
+        }
+
+        o->tail++;
+        pthread_cond_signal(&o->space);
+    }
+
+    pthread_mutex_unlock(&o->lock);
+
+    return NULL;
+}
+
+#endif
+
+/*
+ *  Passes the block being filled to the compressor.
+ */
+
+static void flush_block(OUTFILE *o)
+{
+#ifdef HAVE_PTHREAD
+    BUF tmp;
+
+    pthread_mutex_lock(&o->lock);
+
+    while (o->head - o->tail == QUEUE_BLOCKS)
+    {
+        pthread_cond_wait(&o->space, &o->lock);
+    }
+
+    /* swap in the emptied buffer of the slot so its memory is reused */
+
+    tmp = o->queue[o->head % QUEUE_BLOCKS];
+    o->queue[o->head % QUEUE_BLOCKS] = o->cur;
+    o->cur = tmp;
+    o->head++;
+
+    pthread_cond_signal(&o->data);
+    pthread_mutex_unlock(&o->lock);
+#else
+    if (compress_block(o, o->cur.data, o->cur.len, 0) != 0)
+    {
+        o->error = 1;
+    }
+
+    o->cur.len = 0;
+#endif
+}
+
+/*
+ *  Returns the OUT_ format called name ("gzip", "zstd", "none"), or -1 if
+ *  there isn't one or it wasn't compiled in.
+ */
+
+int out_format(const char *name)
+{
+#ifdef HAVE_ZLIB
+    if (strcmp(name, "gzip") == 0 || strcmp(name, "gz") == 0)
+    {
+        return OUT_GZIP;
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    if (strcmp(name, "zstd") == 0 || strcmp(name, "zst") == 0)
+    {
+        return OUT_ZSTD;
+    }
+#endif
+
+    if (strcmp(name, "none") == 0)
+    {
+        return OUT_RAW;
+    }
+
+    return -1;
+}
+
+/*
+ *  Returns the usual filename suffix for format, eg. ".gz".
+ */
+
+const char *out_suffix(int format)
+{
+    switch (format)
+    {
+    case OUT_GZIP:
+        return ".gz";
+
+    case OUT_ZSTD:
+        return ".zst";
+
+    default:
+        return "";
+    }
+}
+
+/*
+ *  Picks the format to write filename in from its suffix.  Returns the
+ *  OUT_ format, OUT_RAW if the suffix isn't one of theirs, or -1 if it
+ *  belongs to a format that wasn't compiled in.
+ */
+
+int out_guess_format(const char *filename)
+{
+    size_t len;
+    int format;
+
+    len = strlen(filename);
+
+    for (format = OUT_GZIP; format <= OUT_ZSTD; format++)
+    {
+        const char *suffix;
+
+        suffix = out_suffix(format);
+
+        if (len > strlen(suffix) && strcmp(filename + len - strlen(suffix), suffix) == 0)
+        {
+            return out_format(suffix + 1);
+        }
+    }
+
+    return OUT_RAW;
+}
+
+/*
+ *  Opens filename for writing in format.  mode is "wb" or "ab", as for
+ *  fopen().  Returns NULL with errno set if the file can't be opened, or
+ *  to EINVAL if format wasn't compiled in.
+ */
+
+OUTFILE *out_open(const char *filename, const char *mode, int format)
+{
+    OUTFILE *o;
+
+    if (format != OUT_RAW && (format < OUT_GZIP || format > OUT_ZSTD ||
+      out_format(out_suffix(format) + 1) != format))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    o = malloc(sizeof *o);
+    assert(o != NULL);
+    memset(o, 0, sizeof *o);
+
+    o->fp = fopen(filename, mode);
+
+    if (o->fp == NULL)
+    {
+        free(o);
+        return NULL;
+    }
+
+    o->format = format;
+
+    buf_init(&o->cur);
+
+    if (format == OUT_RAW)
+    {
+        return o;
+    }
+
+    o->zbuf_size = BLOCK_SIZE;
+    o->zbuf = malloc(o->zbuf_size);
+    assert(o->zbuf != NULL);
+
+#ifdef HAVE_ZLIB
+    if (format == OUT_GZIP)
+    {
+        /* 16 + 15 asks for a gzip header and trailer around a 32k window */
+
+        assert(deflateInit2(&o->z, GZIP_LEVEL, Z_DEFLATED, 16 + 15, 8,
+          Z_DEFAULT_STRATEGY) == Z_OK);
+    }
+#endif
+
+#ifdef HAVE_ZSTD
+    if (format == OUT_ZSTD)
+    {
+        o->zc = ZSTD_createCCtx();
+        assert(o->zc != NULL);
+        ZSTD_CCtx_setParameter(o->zc, ZSTD_c_compressionLevel, ZSTD_LEVEL);
+    }
+#endif
+
+    buf_reserve(&o->cur, BLOCK_SIZE);
+
+#ifdef HAVE_PTHREAD
+    {
+        int i;
+
+        for (i = 0; i < QUEUE_BLOCKS; i++)
+        {
+            buf_init(&o->queue[i]);
+        }
+
+        pthread_mutex_init(&o->lock, NULL);
+        pthread_cond_init(&o->data, NULL);
+        pthread_cond_init(&o->space, NULL);
+        assert(pthread_create(&o->tid, NULL, compressor, o) == 0);
+    }
+#endif
+
+    return o;
+}
+
+/*
+ *  Writes len bytes at p.  Returns 0, or -1 if this or an earlier write
+ *  failed.
+ */
+
+int out_write(OUTFILE *o, const void *p, size_t len)
+{
+    int error;
+
+    if (o->format == OUT_RAW)
+    {
+        if (len != 0 && fwrite(p, len, 1, o->fp) != 1)
+        {
+            o->error = 1;
+        }
+
+        return o->error ? -1 : 0;
+    }
+
+    buf_write(&o->cur, p, len);
+
+    if (o->cur.len >= BLOCK_SIZE)
+    {
+        flush_block(o);
+    }
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&o->lock);
+    error = o->error;
+    pthread_mutex_unlock(&o->lock);
+#else
+    error = o->error;
+#endif
+
+    return error ? -1 : 0;
+}
+
+/*
+ *  Finishes the compressed stream, if any, and closes the file.  Returns
+ *  0, or -1 if anything went wrong writing it.
+ */
+
+int out_close(OUTFILE *o)
+{
+    int rc;
+
+    if (o->format != OUT_RAW)
+    {
+#ifdef HAVE_PTHREAD
+        int i;
+
+        flush_block(o);
+
+        pthread_mutex_lock(&o->lock);
+        o->closing = 1;
+        pthread_cond_signal(&o->data);
+        pthread_mutex_unlock(&o->lock);
+
+        pthread_join(o->tid, NULL);
+
+        pthread_mutex_destroy(&o->lock);
+        pthread_cond_destroy(&o->data);
+        pthread_cond_destroy(&o->space);
+
+        for (i = 0; i < QUEUE_BLOCKS; i++)
+        {
+            buf_free(&o->queue[i]);
+        }
+
+        /* the thread is gone, so o->error is ours again */
+
+        if (compress_block(o, NULL, 0, 1) != 0)
+        {
+            o->error = 1;
+        }
+#else
+        if (compress_block(o, o->cur.data, o->cur.len, 1) != 0)
+        {
+            o->error = 1;
+        }
+#endif
+
+#ifdef HAVE_ZLIB
+        if (o->format == OUT_GZIP)
+        {
+            deflateEnd(&o->z);
+        }
+#endif
+
+#ifdef HAVE_ZSTD
+        if (o->format == OUT_ZSTD)
+        {
+            ZSTD_freeCCtx(o->zc);
+        }
+#endif
+    }
+
+    rc = o->error ? -1 : 0;
+
+    if (fclose(o->fp) != 0)
+    {
+        rc = -1;
+    }
+
+    buf_free(&o->cur);
+    free(o->zbuf);
+    free(o);
+
+    return rc;
+}
@@ -0,0 +1,37 @@
+/*
+ *  outfile.h
+ *
+ *  Output file that is optionally compressed with gzip or zstd on the way
+ *  out.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __OUTFILE_H__
+#define __OUTFILE_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define OUT_RAW  0
+#define OUT_GZIP 1
+#define OUT_ZSTD 2
+
+typedef struct outfile OUTFILE;
+
+OUTFILE *out_open(const char *filename, const char *mode, int format);
+int out_write(OUTFILE *o, const void *p, size_t len);
+int out_close(OUTFILE *o);
+int out_format(const char *name);
+const char *out_suffix(int format);
+int out_guess_format(const char *filename);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ *  pool.c
+ *
+ *  Fixed-size pool of worker threads.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  Jobs are run in the order they were submitted by whichever worker is
+ *  free.  If max_queued is non-zero, pool_submit() blocks while that many
+ *  jobs are waiting for a worker.  Without HAVE_PTHREAD (or with a pool of
+ *  zero threads) pool_submit() simply runs the job before returning.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "pool.h"
+
+struct pool
+{
+    int threads;
+    int max_queued;
+    int queued;
+    int running;
+    int quit;
+    POOL_JOB *head;
+    POOL_JOB *tail;
+#ifdef HAVE_PTHREAD
+    pthread_t *tids;
+    pthread_mutex_t lock;
+    pthread_cond_t work;      /* a job was queued, or the pool is quitting */
+    pthread_cond_t space;     /* a queued job was taken by a worker */
+    pthread_cond_t done;      /* a job finished */
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+
+static void *worker(void *arg)
+{
+    POOL *p;
+    POOL_JOB *job;
+
+    p = arg;
+
+    pthread_mutex_lock(&p->lock);
+
+    for (;;)
+    {
+        while (p->head == NULL && !p->quit)
+        {
+            pthread_cond_wait(&p->work, &p->lock);
+        }
+
+        if (p->head == NULL)
+        {
+            break;
+        }
+
+        job = p->head;
+        p->head = job->next;
+
+        if (p->head == NULL)
+        {
+            p->tail = NULL;
+        }
+
+        p->queued--;
+        p->running++;
+        pthread_cond_signal(&p->space);
+        pthread_mutex_unlock(&p->lock);
+
+        job->fn(job->arg);
+
+        pthread_mutex_lock(&p->lock);
+        job->done = 1;
+        p->running--;
+        pthread_cond_broadcast(&p->done);
+    }
+
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+#endif
+
+POOL *pool_new(int threads, int max_queued)
+{
+    POOL *p;
+
+    p = malloc(sizeof *p);
+    assert(p != NULL);
+
+    p->threads = 0;
+    p->max_queued = max_queued;
+    p->queued = 0;
+    p->running = 0;
+    p->quit = 0;
+    p->head = NULL;
+    p->tail = NULL;
+
+#ifdef HAVE_PTHREAD
+    p->tids = NULL;
+
+    if (threads > 0)
+    {
+        p->tids = malloc(sizeof *p->tids * (size_t) threads);
+        assert(p->tids != NULL);
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->work, NULL);
+    pthread_cond_init(&p->space, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    while (p->threads < threads)
+    {
+        if (pthread_create(&p->tids[p->threads], NULL, worker, p) != 0)
+        {
+            break;
+        }
+
+        p->threads++;
+    }
+#else
+    (void) threads;
+#endif
+
+    return p;
+}
+
+void pool_submit(POOL *p, POOL_JOB *job, void (*fn)(void *arg), void *arg)
+{
+    job->fn = fn;
+    job->arg = arg;
+    job->done = 0;
+    job->next = NULL;
+
+    if (p->threads == 0)
+    {
+        fn(arg);
+        job->done = 1;
+        return;
+    }
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&p->lock);
+
+    while (p->max_queued != 0 && p->queued >= p->max_queued)
+    {
+        pthread_cond_wait(&p->space, &p->lock);
+    }
+
+    if (p->tail != NULL)
+    {
+        p->tail->next = job;
+    }
+    else
+    {
+        p->head = job;
+    }
+
+    p->tail = job;
+    p->queued++;
+    pthread_cond_signal(&p->work);
+    pthread_mutex_unlock(&p->lock);
+#endif
+}
+
+void pool_wait_job(POOL *p, POOL_JOB *job)
+{
+#ifdef HAVE_PTHREAD
+    if (p->threads != 0)
+    {
+        pthread_mutex_lock(&p->lock);
+
+        while (!job->done)
+        {
+            pthread_cond_wait(&p->done, &p->lock);
+        }
+
+        pthread_mutex_unlock(&p->lock);
+    }
+#else
+    (void) p;
+    (void) job;
+#endif
+}
+
+/*
+ *  Waits until every submitted job has finished.
+ */
+
+void pool_wait(POOL *p)
+{
+#ifdef HAVE_PTHREAD
+    if (p->threads != 0)
+    {
+        pthread_mutex_lock(&p->lock);
+
+        while (p->head != NULL || p->running != 0)
+        {
+            pthread_cond_wait(&p->done, &p->lock);
+        }
+
+        pthread_mutex_unlock(&p->lock);
+    }
+#else
+    (void) p;
+#endif
+}
+
+void pool_free(POOL *p)
+{
+#ifdef HAVE_PTHREAD
+    int i;
+
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->work);
+    pthread_mutex_unlock(&p->lock);
+
+    for (i = 0; i < p->threads; i++)
+    {
+        pthread_join(p->tids[i], NULL);
+    }
+
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->work);
+    pthread_cond_destroy(&p->space);
+    pthread_cond_destroy(&p->done);
+    free(p->tids);
+#endif
+
+    free(p);
+}
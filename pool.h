@@ -0,0 +1,38 @@
+/*
+ *  pool.h
+ *
+ *  Fixed-size pool of worker threads.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct pool_job
+{
+    void (*fn)(void *arg);
+    void *arg;
+    int done;
+    struct pool_job *next;
+}
+POOL_JOB;
+
+typedef struct pool POOL;
+
+POOL *pool_new(int threads, int max_queued);
+void pool_submit(POOL *p, POOL_JOB *job, void (*fn)(void *arg), void *arg);
+void pool_wait_job(POOL *p, POOL_JOB *job);
+void pool_wait(POOL *p);
+void pool_free(POOL *p);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
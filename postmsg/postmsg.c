@@ -16,6 +16,7 @@
 #include "prseaddr.h"
 #include "llist.h"
 #include "msgapi.h"
+#include "sqdate.h"
 
 #define VERSION  "2.0"
 
@@ -317,33 +318,12 @@ static void input(void)
 }
 
 
-static int isleap(int year)
-{
-    return year % 400 == 0 || (year % 4 == 0 && year % 100 != 0);
-}
-
-
 static unsigned long unixtime(const struct tm *tm)
 {
-    int year, i;
     unsigned long result;
 
-    result = 0UL;
-    year = tm->tm_year + 1900;
-
-    /* traverse through each year */
-
-    for (i = 1970; i < year; i++)
-    {
-        result += 31536000UL;  /* 60s * 60m * 24h * 365d = 31536000s */
-        if (isleap(i))
-        {
-            /* it was a leap year; add a day's worth of seconds */
-            result += 86400UL;  /* 60s * 60m * 24h = 86400s */
-        }
-    }
-
-    result += 86400UL * tm->tm_yday;
+    result = 86400UL * (unsigned long) sqdate_days(tm->tm_year + 1900L, tm->tm_mon + 1L,
+      tm->tm_mday);
     result += 3600UL * tm->tm_hour;
     result += 60UL * tm->tm_min;
     result += (unsigned long) tm->tm_sec;
@@ -0,0 +1,143 @@
+/*
+ *  scan.c
+ *
+ *  Fast byte scanning used on message text.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  These look at 32 bytes at a time with AVX2 or 16 with SSE2 where the
+ *  compiler targets them (__AVX2__, __SSE2__), and fall back to plain C
+ *  elsewhere.  They all return the same results.
+ */
+
+#include <stddef.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "scan.h"
+
+/*
+ *  Returns the offset of the first byte in p[0..len) that is a CR or is
+ *  above 0x7e, or len if there isn't one.
+ */
+
+size_t scan_body(const char *p, size_t len)
+{
+    size_t i;
+
+    i = 0;
+
+#if defined(__AVX2__)
+    {
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i flip = _mm256_set1_epi8((char) 0x80);
+        const __m256i limit = _mm256_set1_epi8((char) (0x7e ^ 0x80));
+
+        for (; i + 32 <= len; i += 32)
+        {
+            __m256i v;
+            unsigned int mask;
+
+            v = _mm256_loadu_si256((const __m256i *) (p + i));
+
+            /* unsigned v > 0x7e, done as a signed compare */
+
+            mask = (unsigned int) _mm256_movemask_epi8(_mm256_or_si256(
+              _mm256_cmpeq_epi8(v, cr),
+              _mm256_cmpgt_epi8(_mm256_xor_si256(v, flip), limit)));
+
+            if (mask != 0)
+            {
+                return i + (size_t) __builtin_ctz(mask);
+            }
+        }
+    }
+#endif
+
+#if defined(__SSE2__)
+    {
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i flip = _mm_set1_epi8((char) 0x80);
+        const __m128i limit = _mm_set1_epi8((char) (0x7e ^ 0x80));
+
+        for (; i + 16 <= len; i += 16)
+        {
+            __m128i v;
+            unsigned int mask;
+
+            v = _mm_loadu_si128((const __m128i *) (p + i));
+
+            mask = (unsigned int) _mm_movemask_epi8(_mm_or_si128(
+              _mm_cmpeq_epi8(v, cr),
+              _mm_cmpgt_epi8(_mm_xor_si128(v, flip), limit)));
+
+            if (mask != 0)
+            {
+                return i + (size_t) __builtin_ctz(mask);
+            }
+        }
+    }
+#endif
+
+    for (; i < len; i++)
+    {
+        if (p[i] == '\r' || (unsigned char) p[i] > 0x7e)
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+
+/*
+ *  Returns the offset of the first byte in p[0..len) that is above 0x7f,
+ *  or len if there isn't one.
+ */
+
+size_t scan_ascii(const char *p, size_t len)
+{
+    size_t i;
+
+    i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 32 <= len; i += 32)
+    {
+        unsigned int mask;
+
+        mask = (unsigned int) _mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *) (p + i)));
+
+        if (mask != 0)
+        {
+            return i + (size_t) __builtin_ctz(mask);
+        }
+    }
+#endif
+
+#if defined(__SSE2__)
+    for (; i + 16 <= len; i += 16)
+    {
+        unsigned int mask;
+
+        mask = (unsigned int) _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (p + i)));
+
+        if (mask != 0)
+        {
+            return i + (size_t) __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for (; i < len; i++)
+    {
+        if ((unsigned char) p[i] > 0x7f)
+        {
+            break;
+        }
+    }
+
+    return i;
+}
@@ -0,0 +1,26 @@
+/*
+ *  scan.h
+ *
+ *  Fast byte scanning used on message text.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+size_t scan_body(const char *p, size_t len);
+size_t scan_ascii(const char *p, size_t len);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,385 @@
+/*
+ *  sqd2sqi.c
+ *
+ *  Creates a new Squish .sqi index from an existing .sqd file, or checks
+ *  that an existing one matches it.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  Useful if your .sqi file becomes corrupt, or you don't actually have
+ *  one.  Some mail readers (eg. GoldED) won't read a Squish base if the
+ *  .sqi file is missing.  This does the same job as sqd2sqi.py, but
+ *  computes the hash the way the Squish MSGAPI does (see sq_hash()) and
+ *  sets its top bit for messages that have been read.
+ *
+ *  Each .sqi record is 12 bytes: the offset of the frame, its umsgid and
+ *  the hash of the to-name, in frame list order.
+ */
+
+#define PROGRAM "sqd2sqi"
+#define VERSION "1.0"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "squish.h"
+#include "buf.h"
+
+/* output is written in blocks of about this size */
+
+#define OUTPUT_BUFSIZE 65536
+
+/* mismatches listed per base before the rest are just counted */
+
+#define MAX_REPORT 10
+
+/*
+ *  Opens the .sqd and checks its SQBASE.  Prints a message and returns
+ *  NULL if it can't be used.
+ */
+
+static SQFILE *open_sqd(const char *filename, SQBASE *sqb)
+{
+    SQFILE *sq;
+
+    sq = sq_open(filename);
+
+    if (sq == NULL)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s\n", filename,
+          strerror(errno));
+        return NULL;
+    }
+
+    if (sq_read_base(sq, sqb) != SQ_OK || sqb->sz_sqbase != SQBASE_SIZE ||
+      sqb->sz_sqhdr != SQFRAME_SIZE)
+    {
+        fprintf(stderr, PROGRAM ": `%s` is not a Squish base\n", filename);
+        sq_close(sq);
+        return NULL;
+    }
+
+    return sq;
+}
+
+static int build(const char *sqd_filename, const char *sqi_filename)
+{
+    SQFILE *sq;
+    SQBASE sqb;
+    SQITER it;
+    SQMSG m;
+    FILE *ofp;
+    BUF out;
+    unsigned char rec[SQIDX_SIZE];
+    int rc, failed;
+
+    ofp = fopen(sqi_filename, "rb");
+
+    if (ofp != NULL)
+    {
+        fclose(ofp);
+        fprintf(stderr, PROGRAM ": Output file `%s` already exists. Delete it before continuing.\n",
+          sqi_filename);
+        return EXIT_FAILURE;
+    }
+
+    sq = open_sqd(sqd_filename, &sqb);
+
+    if (sq == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    ofp = fopen(sqi_filename, "wb");
+
+    if (ofp == NULL)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for writing: %s\n", sqi_filename,
+          strerror(errno));
+        sq_close(sq);
+        return EXIT_FAILURE;
+    }
+
+    buf_init(&out);
+    failed = 0;
+
+    sq_iter_init(&it, sq, sqb.first_frame, 0);
+
+    while ((rc = sq_iter_next(&it, &m)) == SQ_OK && (rc = sq_read_xmsg(sq, &m)) == SQ_OK)
+    {
+        put_ul(rec, m.ofs);
+        put_ul(rec + 4, m.xmsg.umsgid);
+        put_ul(rec + 8, sq_index_hash(&m.xmsg));
+        buf_write(&out, rec, SQIDX_SIZE);
+
+        if (out.len >= OUTPUT_BUFSIZE)
+        {
+            failed |= fwrite(out.data, out.len, 1, ofp) != 1;
+            out.len = 0;
+        }
+    }
+
+    sq_iter_free(&it);
+
+    if (out.len != 0)
+    {
+        failed |= fwrite(out.data, out.len, 1, ofp) != 1;
+    }
+
+    failed |= fclose(ofp) != 0;
+
+    if (failed)
+    {
+        fprintf(stderr, PROGRAM ": Error writing `%s`: %s\n", sqi_filename, strerror(errno));
+    }
+    else if (rc != SQ_END)
+    {
+        fprintf(stderr, PROGRAM ": Frame at 0x%08lx: %s\n", m.ofs, sq_strerror(rc));
+        failed = 1;
+    }
+
+    if (failed)
+    {
+        remove(sqi_filename);
+    }
+    else
+    {
+        printf("%s: %lu messages indexed\n", sqi_filename, it.count);
+    }
+
+    buf_free(&out);
+    sq_close(sq);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ *  Reads the whole of filename into a malloc()ed buffer.  Returns NULL
+ *  with errno set if it can't.
+ */
+
+static unsigned char *read_file(const char *filename, unsigned long *size)
+{
+    FILE *fp;
+    unsigned char *data;
+    long len;
+
+    fp = fopen(filename, "rb");
+
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+
+    len = -1L;
+
+    if (fseek(fp, 0, SEEK_END) == 0)
+    {
+        len = ftell(fp);
+    }
+
+    if (len == -1L || fseek(fp, 0, SEEK_SET) != 0)
+    {
+        fclose(fp);
+        return NULL;
+    }
+
+    data = malloc((size_t) len + 1);
+    assert(data != NULL);
+
+    if (len != 0 && fread(data, (size_t) len, 1, fp) != 1)
+    {
+        free(data);
+        fclose(fp);
+        return NULL;
+    }
+
+    fclose(fp);
+
+    *size = (unsigned long) len;
+
+    return data;
+}
+
+static void mismatch(const char *filename, unsigned long *bad, unsigned long rec,
+  const char *field, const char *fmt, unsigned long got, unsigned long want)
+{
+    if (++*bad <= MAX_REPORT)
+    {
+        printf("%s: record %lu: %s ", filename, rec, field);
+        printf(fmt, got);
+        printf(", should be ");
+        printf(fmt, want);
+        putchar('\n');
+    }
+}
+
+/*
+ *  Checks the .sqi next to sqd_filename against the frame list.  Returns
+ *  0 if it matches, or 1 if it doesn't or can't be checked.
+ */
+
+static int verify(const char *sqd_filename)
+{
+    SQFILE *sq;
+    SQBASE sqb;
+    SQITER it;
+    SQMSG m;
+    char *sqi_filename;
+    unsigned char *idx;
+    unsigned long size, records, bad;
+    size_t len;
+    int rc;
+
+    len = strlen(sqd_filename);
+
+    if (len < 4 || sqd_filename[len - 4] != '.')
+    {
+        fprintf(stderr, PROGRAM ": `%s` doesn't end in .sqd\n", sqd_filename);
+        return 1;
+    }
+
+    sq_names(sqd_filename, NULL, &sqi_filename);
+
+    idx = read_file(sqi_filename, &size);
+
+    if (idx == NULL)
+    {
+        printf("%s: cannot read: %s\n", sqi_filename, strerror(errno));
+        free(sqi_filename);
+        return 1;
+    }
+
+    sq = open_sqd(sqd_filename, &sqb);
+
+    if (sq == NULL)
+    {
+        free(idx);
+        free(sqi_filename);
+        return 1;
+    }
+
+    records = size / SQIDX_SIZE;
+    bad = 0;
+
+    if (size % SQIDX_SIZE != 0)
+    {
+        printf("%s: %lu bytes left over after the last record\n", sqi_filename,
+          size % SQIDX_SIZE);
+        bad++;
+    }
+
+    sq_iter_init(&it, sq, sqb.first_frame, 0);
+
+    while ((rc = sq_iter_next(&it, &m)) == SQ_OK && (rc = sq_read_xmsg(sq, &m)) == SQ_OK)
+    {
+        const unsigned char *p;
+        unsigned long n, hash;
+
+        n = it.count - 1;
+
+        if (n >= records)
+        {
+            continue;
+        }
+
+        p = idx + n * SQIDX_SIZE;
+        hash = sq_index_hash(&m.xmsg);
+
+        if (r2ul(p) != m.ofs)
+        {
+            mismatch(sqi_filename, &bad, n, "frame_ofs", "0x%08lx", r2ul(p), m.ofs);
+        }
+
+        if (r2ul(p + 4) != m.xmsg.umsgid)
+        {
+            mismatch(sqi_filename, &bad, n, "umsgid", "%lu", r2ul(p + 4), m.xmsg.umsgid);
+        }
+
+        if (r2ul(p + 8) != hash)
+        {
+            mismatch(sqi_filename, &bad, n, "hash", "0x%08lx", r2ul(p + 8), hash);
+        }
+    }
+
+    if (rc != SQ_END)
+    {
+        printf("%s: frame at 0x%08lx: %s\n", sqd_filename, m.ofs, sq_strerror(rc));
+        bad++;
+    }
+    else if (it.count != records)
+    {
+        printf("%s: %lu records, but %lu messages in the frame list\n", sqi_filename,
+          records, it.count);
+        bad++;
+    }
+
+    if (bad == 0)
+    {
+        printf("%s: OK, %lu records\n", sqi_filename, records);
+    }
+    else if (bad > MAX_REPORT)
+    {
+        printf("%s: %lu problems in all\n", sqi_filename, bad);
+    }
+
+    sq_iter_free(&it);
+    sq_close(sq);
+    free(idx);
+    free(sqi_filename);
+
+    return bad != 0;
+}
+
+static int usage(void)
+{
+    fprintf(
+      stderr,
+      PROGRAM " " VERSION "\n"
+      "\n"
+      "Creates a new Squish .sqi file from an existing .sqd file.\n"
+      "Written by Andrew Clarke and released to the public domain.\n"
+      "\n"
+      "Usage: " PROGRAM " input.sqd output.sqi\n"
+      "       " PROGRAM " --verify input.sqd ...\n"
+      "\n"
+      "  --verify   Check the .sqi next to each .sqd against its frame list\n"
+      "             and report records with the wrong frame offset, umsgid\n"
+      "             or hash; the exit status is non-zero if any are wrong\n"
+    );
+
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2 && (strcmp(argv[1], "--verify") == 0 || strcmp(argv[1], "-v") == 0))
+    {
+        int i, failures;
+
+        failures = 0;
+
+        for (i = 2; i < argc; i++)
+        {
+            failures += verify(argv[i]);
+        }
+
+        return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (argc != 3)
+    {
+        return usage();
+    }
+
+    if (strcmp(argv[1], argv[2]) == 0)
+    {
+        fprintf(stderr, PROGRAM ": Output filename must not be the same as input filename.\n");
+        return EXIT_FAILURE;
+    }
+
+    return build(argv[1], argv[2]);
+}
@@ -0,0 +1,453 @@
+/*
+ *  sqdate.c
+ *
+ *  Date and time conversions for Squish and FidoNet message headers.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  Everything here is plain arithmetic on the proleptic Gregorian
+ *  calendar (after Howard Hinnant's days_from_civil/civil_from_days), so
+ *  there are no calls into the C library's time zone code and nothing is
+ *  shared between threads.  Times are seconds since 1970-01-01 00:00:00
+ *  of whatever zone they were written in; the DOS dates in a Squish
+ *  header are the writer's local time, and TZUTC says what zone that was.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "sqdate.h"
+
+static const char wday_name[7][4] =
+{
+    "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+
+static const char mon_name[12][4] =
+{
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+/* floor(a / b) for b > 0 */
+
+static long floor_div(long a, long b)
+{
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+/*
+ *  Returns the number of days from 1970-01-01 to y-m-d.  Out-of-range
+ *  months and days are carried into the year and month the way mktime()
+ *  does it, so month 0 is December of the year before and day 0 is the
+ *  last day of the month before.
+ */
+
+long sqdate_days(long y, long m, long d)
+{
+    long era, yoe, doy, doe;
+
+    y += floor_div(m - 1, 12);
+    m -= floor_div(m - 1, 12) * 12;
+
+    y -= m <= 2;
+    era = floor_div(y, 400);
+    yoe = y - era * 400;
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return era * 146097 + doe - 719468;
+}
+
+/*
+ *  The reverse of sqdate_days().
+ */
+
+void sqdate_civil(long days, long *y, int *m, int *d)
+{
+    long era, doe, yoe, doy, mp;
+
+    days += 719468;
+    era = floor_div(days, 146097);
+    doe = days - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+
+    *d = (int) (doy - (153 * mp + 2) / 5 + 1);
+    *m = (int) (mp < 10 ? mp + 3 : mp - 9);
+    *y = yoe + era * 400 + (*m <= 2);
+}
+
+/*
+ *  Converts a packed DOS date and time to seconds since 1970.  The 7-bit
+ *  year counts from 1980, except that values that would land after 2027
+ *  are taken as 1900-1979, as some software wrote them that way.
+ */
+
+time_t sqdate_dos(unsigned short date, unsigned short time)
+{
+    long year, days;
+
+    year = ((date >> 9) & 0x7f) + 1980;
+
+    if (year > 2027)
+    {
+        year -= 128;
+    }
+
+    days = sqdate_days(year, (date >> 5) & 0x0f, date & 0x1f);
+
+    return (time_t) days * 86400 + ((time >> 11) & 0x1f) * 3600L +
+      ((time >> 5) & 0x3f) * 60L + (time & 0x1f) * 2L;
+}
+
+/*
+ *  Clamps t to a signed 32-bit number of seconds, as the date index and
+ *  the header cache store dates.
+ */
+
+long sqdate_s32(time_t t)
+{
+    if (t < -2147483647L - 1)
+    {
+        return -2147483647L - 1;
+    }
+
+    if (t > 2147483647L)
+    {
+        return 2147483647L;
+    }
+
+    return (long) t;
+}
+
+/*
+ *  Parses the ASCII date of a FidoNet message: "01 Jan 86  02:34:56"
+ *  (FTS-0001) or "Mon  1 Jan 86 02:34" (SEAdog).  Two-digit years before
+ *  80 are taken as 20xx.  Returns 0 and stores the time in *t, or -1 if
+ *  the date can't be made sense of.
+ */
+
+int sqdate_ftsc(const char *str, time_t *t)
+{
+    char mon[4];
+    int day, year, hour, min, sec, i;
+
+    while (*str == ' ')
+    {
+        str++;
+    }
+
+    /* skip the SEAdog day of the week */
+
+    if (isalpha((unsigned char) *str))
+    {
+        while (isalpha((unsigned char) *str))
+        {
+            str++;
+        }
+    }
+
+    sec = 0;
+
+    if (sscanf(str, "%d %3s %d %d:%d:%d", &day, mon, &year, &hour, &min, &sec) < 5)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < 12; i++)
+    {
+        if (toupper((unsigned char) mon[0]) == mon_name[i][0] &&
+          tolower((unsigned char) mon[1]) == mon_name[i][1] &&
+          tolower((unsigned char) mon[2]) == mon_name[i][2])
+        {
+            break;
+        }
+    }
+
+    if (i == 12 || day < 1 || day > 31 || hour > 23 || min > 59 || sec > 59 ||
+      hour < 0 || min < 0 || sec < 0 || year < 0 || year > 9999)
+    {
+        return -1;
+    }
+
+    if (year < 100)
+    {
+        year += year < 80 ? 2000 : 1900;
+    }
+
+    *t = (time_t) sqdate_days(year, i + 1, day) * 86400 + hour * 3600L + min * 60L + sec;
+
+    return 0;
+}
+
+/*
+ *  Works out when the message with header x was written: from its DOS
+ *  date, or if it has none (some software only fills in the ASCII one)
+ *  from its ASCII date.  Returns 0 and stores the time in *t, or -1 if
+ *  neither says, in which case *t is the empty DOS date taken as it is,
+ *  which is how squ2mbox has always shown such a message.
+ */
+
+int sqdate_written(const SQXMSG *x, time_t *t)
+{
+    if (x->date_written != 0)
+    {
+        *t = sqdate_dos(x->date_written, x->time_written);
+        return 0;
+    }
+
+    if (sqdate_ftsc(x->ftsc_date, t) == 0)
+    {
+        return 0;
+    }
+
+    *t = sqdate_dos(x->date_written, x->time_written);
+
+    return -1;
+}
+
+/*
+ *  Parses the value of a TZUTC kludge, eg. "1000" or "-0500", which is
+ *  not nul-terminated.  Returns 0 and stores the offset from UTC in
+ *  minutes in *minutes, or -1 if it isn't one.
+ */
+
+int sqdate_tzutc(const char *str, size_t len, int *minutes)
+{
+    size_t i;
+    int sign, n;
+
+    i = 0;
+    sign = 1;
+
+    if (i < len && (str[i] == '-' || str[i] == '+'))
+    {
+        sign = str[i] == '-' ? -1 : 1;
+        i++;
+    }
+
+    if (len - i < 3 || len - i > 4)
+    {
+        return -1;
+    }
+
+    n = 0;
+
+    for (; i < len; i++)
+    {
+        if (!isdigit((unsigned char) str[i]))
+        {
+            return -1;
+        }
+
+        n = n * 10 + (str[i] - '0');
+    }
+
+    if (n % 100 > 59 || n / 100 > 14)
+    {
+        return -1;
+    }
+
+    *minutes = sign * (n / 100 * 60 + n % 100);
+
+    return 0;
+}
+
+/*
+ *  Parses a date given on a command line: "2002-10-03", "2002-10-03
+ *  18:21" or "2002-10-03 18:21:13", with a T allowed in place of the
+ *  space.  Parts left off are taken as the start of the day or minute, or
+ *  with end set as its last second, so that a range given as two dates
+ *  takes in the whole of both.  Returns 0 and stores the time in *t, or
+ *  -1 if str isn't a date.
+ */
+
+int sqdate_parse(const char *str, int end, time_t *t)
+{
+    int y, mo, d, h, mi, s, n, len;
+
+    n = sscanf(str, "%4d-%2d-%2d%n", &y, &mo, &d, &len);
+
+    if (n != 3 || mo < 1 || mo > 12 || d < 1 || d > 31)
+    {
+        return -1;
+    }
+
+    h = end ? 23 : 0;
+    mi = end ? 59 : 0;
+    s = end ? 59 : 0;
+    str += len;
+
+    if (*str == ' ' || *str == 'T')
+    {
+        n = sscanf(str + 1, "%2d:%2d%n", &h, &mi, &len);
+
+        if (n != 2 || h > 23 || mi > 59 || h < 0 || mi < 0)
+        {
+            return -1;
+        }
+
+        str += 1 + len;
+
+        if (*str == ':')
+        {
+            n = sscanf(str + 1, "%2d%n", &s, &len);
+
+            if (n != 1 || s < 0 || s > 59)
+            {
+                return -1;
+            }
+
+            str += 1 + len;
+        }
+    }
+
+    if (*str != '\0')
+    {
+        return -1;
+    }
+
+    *t = (time_t) sqdate_days(y, mo, d) * 86400 + h * 3600L + mi * 60L + s;
+
+    return 0;
+}
+
+void sqdate_cache_init(SQDATE_CACHE *dc)
+{
+    dc->day = -1;
+    dc->rfc[0] = '\0';
+}
+
+static void put2(char *p, int n)
+{
+    p[0] = (char) ('0' + n / 10);
+    p[1] = (char) ('0' + n % 10);
+}
+
+/*
+ *  Makes sure the cache holds the day of t, and leaves the seconds since
+ *  midnight in *secs.  t must be within the years 0 to 9999.
+ */
+
+static void set_day(SQDATE_CACHE *dc, time_t t, long *secs)
+{
+    long days, y;
+    int m, d, wday;
+
+    days = (long) (t / 86400);
+
+    if (t % 86400 < 0)
+    {
+        days--;
+    }
+
+    *secs = (long) (t - (time_t) days * 86400);
+
+    if (days == dc->day && dc->rfc[0] != '\0')
+    {
+        return;
+    }
+
+    sqdate_civil(days, &y, &m, &d);
+    wday = (int) (days - floor_div(days + 4, 7) * 7 + 4);
+
+    dc->day = days;
+
+    sprintf(dc->rfc, "%s, %02d %s %04ld ", wday_name[wday], d, mon_name[m - 1], y);
+    sprintf(dc->mbox, "%s %s %02d ", wday_name[wday], mon_name[m - 1], d);
+    sprintf(dc->year, " %04ld", y);
+    sprintf(dc->iso, "%04ld-%02d-%02d ", y, m, d);
+}
+
+static size_t put_time(char *p, long secs)
+{
+    put2(p, (int) (secs / 3600));
+    p[2] = ':';
+    put2(p + 3, (int) (secs / 60 % 60));
+    p[5] = ':';
+    put2(p + 6, (int) (secs % 60));
+
+    return 8;
+}
+
+/*
+ *  Writes t to buf as an RFC 2822 date without the zone, eg. "Thu, 03 Oct
+ *  2002 18:21:13".  buf needs room for SQDATE_RFC_LEN.  Returns the length.
+ */
+
+size_t sqdate_fmt_rfc(SQDATE_CACHE *dc, time_t t, char *buf)
+{
+    size_t len;
+    long secs;
+
+    set_day(dc, t, &secs);
+
+    len = strlen(dc->rfc);
+    memcpy(buf, dc->rfc, len);
+    len += put_time(buf + len, secs);
+    buf[len] = '\0';
+
+    return len;
+}
+
+/*
+ *  Writes t to buf as in an mbox "From " line, eg. "Thu Oct 03 18:21:13
+ *  2002".  buf needs room for SQDATE_MBOX_LEN.  Returns the length.
+ */
+
+size_t sqdate_fmt_mbox(SQDATE_CACHE *dc, time_t t, char *buf)
+{
+    size_t len;
+    long secs;
+
+    set_day(dc, t, &secs);
+
+    len = strlen(dc->mbox);
+    memcpy(buf, dc->mbox, len);
+    len += put_time(buf + len, secs);
+    strcpy(buf + len, dc->year);
+
+    return len + strlen(dc->year);
+}
+
+/*
+ *  Writes t to buf as "2002-10-03 18:21:13".  buf needs room for
+ *  SQDATE_ISO_LEN.  Returns the length.
+ */
+
+size_t sqdate_fmt_iso(SQDATE_CACHE *dc, time_t t, char *buf)
+{
+    size_t len;
+    long secs;
+
+    set_day(dc, t, &secs);
+
+    len = strlen(dc->iso);
+    memcpy(buf, dc->iso, len);
+    len += put_time(buf + len, secs);
+    buf[len] = '\0';
+
+    return len;
+}
+
+/*
+ *  Writes an offset from UTC in minutes as "+1000" or "-0500".  buf needs
+ *  room for SQDATE_ZONE_LEN.  Returns the length.
+ */
+
+size_t sqdate_fmt_zone(int minutes, char *buf)
+{
+    int n;
+
+    n = minutes < 0 ? -minutes : minutes;
+
+    buf[0] = minutes < 0 ? '-' : '+';
+    put2(buf + 1, n / 60 % 100);
+    put2(buf + 3, n % 60);
+    buf[5] = '\0';
+
+    return 5;
+}
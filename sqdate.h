@@ -0,0 +1,64 @@
+/*
+ *  sqdate.h
+ *
+ *  Date and time conversions for Squish and FidoNet message headers.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __SQDATE_H__
+#define __SQDATE_H__
+
+#include <stddef.h>
+#include <time.h>
+
+#include "squish.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* longest strings written by the sqdate_fmt_ functions, plus the nul */
+
+#define SQDATE_RFC_LEN   26          /* Thu, 03 Oct 2002 18:21:13 */
+#define SQDATE_MBOX_LEN  25          /* Thu Oct 03 18:21:13 2002 */
+#define SQDATE_ISO_LEN   20          /* 2002-10-03 18:21:13 */
+#define SQDATE_ZONE_LEN  6           /* +1000 */
+
+/*
+ *  The parts of a formatted date that only change once a day.  Each
+ *  thread keeps its own; messages in a base are mostly in date order so
+ *  these are rarely rebuilt.
+ */
+
+typedef struct
+{
+    long day;                        /* days since 1970-01-01 */
+    char rfc[32];                    /* "Thu, 03 Oct 2002 " */
+    char mbox[16];                   /* "Thu Oct 03 " */
+    char year[16];                   /* " 2002" */
+    char iso[32];                    /* "2002-10-03 " */
+}
+SQDATE_CACHE;
+
+long sqdate_days(long y, long m, long d);
+void sqdate_civil(long days, long *y, int *m, int *d);
+time_t sqdate_dos(unsigned short date, unsigned short time);
+long sqdate_s32(time_t t);
+int sqdate_ftsc(const char *str, time_t *t);
+int sqdate_written(const SQXMSG *x, time_t *t);
+int sqdate_tzutc(const char *str, size_t len, int *minutes);
+int sqdate_parse(const char *str, int end, time_t *t);
+
+void sqdate_cache_init(SQDATE_CACHE *dc);
+size_t sqdate_fmt_rfc(SQDATE_CACHE *dc, time_t t, char *buf);
+size_t sqdate_fmt_mbox(SQDATE_CACHE *dc, time_t t, char *buf);
+size_t sqdate_fmt_iso(SQDATE_CACHE *dc, time_t t, char *buf);
+size_t sqdate_fmt_zone(int minutes, char *buf);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
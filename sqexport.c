@@ -0,0 +1,859 @@
+/*
+ *  sqexport.c
+ *
+ *  Exports a Squish base to several formats at once.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  Each output is given as type:path, and the base is read only once
+ *  however many there are (see export.c).  The types are
+ *
+ *     mbox     an mbox, as squ2mbox writes it; compressed if the path
+ *              ends in .gz or .zst
+ *     maildir  a Maildir, created if need be, with a file per message
+ *              named from its MSGID, as squ2mbox -m writes it; messages
+ *              already there are skipped (see maildir.c)
+ *     jsonl    a JSON object per line for each message, with the header,
+ *              the kludges and the text, all in UTF-8
+ *     csv      the index sqidx lists
+ *     sqi      a .sqi index, as sqd2sqi makes it
+ *     sqh      a header cache, as sqhdr keeps it
+ *
+ *  All but sqi and sqh can be limited to some messages with the same
+ *  --from, --to etc. options squ2mbox takes.  Messages are numbered by
+ *  their place in the base either way, which is what a made-up
+ *  Message-ID is based on.
+ */
+
+#define PROGRAM "sqexport"
+#define VERSION "1.0"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+
+#include "squish.h"
+#include "buf.h"
+#include "kludge.h"
+#include "charset.h"
+#include "sqdate.h"
+#include "outfile.h"
+#include "mboxfmt.h"
+#include "csvfmt.h"
+#include "hdrcache.h"
+#include "sqorder.h"
+#include "filter.h"
+#include "maildir.h"
+#include "export.h"
+
+/* output is written in blocks of about this size */
+
+#define OUTPUT_BUFSIZE 65536
+
+/* Maildir messages moved in at a time */
+
+#define MAILDIR_BATCH 256
+
+/* the types of output */
+
+#define SINK_MBOX    0
+#define SINK_MAILDIR 1
+#define SINK_JSONL   2
+#define SINK_CSV     3
+#define SINK_SQI     4
+#define SINK_SQH     5
+#define SINK_TYPES   6
+
+static const char * const type_name[SINK_TYPES] =
+{
+    "mbox", "maildir", "jsonl", "csv", "sqi", "sqh"
+};
+
+/* one output */
+
+typedef struct
+{
+    int type;                        /* SINK_MBOX etc. */
+    const char *path;
+    BUF out;                         /* waiting to be written */
+    BUF tmp;                         /* scratch */
+    SQDATE_CACHE dc;
+    OUTFILE *ofp;                    /* mbox */
+    FILE *fp;                        /* jsonl, csv, sqi */
+    size_t *lines;                   /* csv: where each line starts in out */
+    unsigned long line_count;
+    unsigned long line_size;
+    HC_BUILD *hb;                    /* sqh */
+    MAILDIR md;                      /* maildir */
+    MD_BATCH batch;
+}
+SINK;
+
+static SQBASE sqb;
+static MBOXFMT mbox_fmt = { MBOX_UTF8, 0, PROGRAM " " VERSION, { 0 }, 0 };
+static MBOXFMT maildir_fmt = { MBOX_UTF8, 0, PROGRAM " " VERSION, { 0 }, 1 };
+static FILTER filter;
+
+static int write_error(SINK *s)
+{
+    fprintf(stderr, PROGRAM ": Error writing `%s`: %s\n", s->path, strerror(errno));
+    return -1;
+}
+
+/*
+ *  Writes out what's in s->out to fp or ofp.  Returns 0, or -1 if it
+ *  can't.
+ */
+
+static int flush(SINK *s)
+{
+    int rc;
+
+    if (s->out.len == 0)
+    {
+        return 0;
+    }
+
+    if (s->ofp != NULL)
+    {
+        rc = out_write(s->ofp, s->out.data, s->out.len);
+    }
+    else
+    {
+        rc = fwrite(s->out.data, s->out.len, 1, s->fp) == 1 ? 0 : -1;
+    }
+
+    s->out.len = 0;
+
+    return rc == 0 ? 0 : write_error(s);
+}
+
+/* length of the valid UTF-8 sequence at p, which has len bytes, or 0 */
+
+static size_t utf8_len(const unsigned char *p, size_t len)
+{
+    size_t n, i;
+
+    if (p[0] < 0xc2 || p[0] > 0xf4)
+    {
+        return 0;
+    }
+
+    n = p[0] < 0xe0 ? 2 : p[0] < 0xf0 ? 3 : 4;
+
+    if (n > len)
+    {
+        return 0;
+    }
+
+    for (i = 1; i < n; i++)
+    {
+        if ((p[i] & 0xc0) != 0x80)
+        {
+            return 0;
+        }
+    }
+
+    /* overlong forms, surrogates and anything above U+10FFFF */
+
+    if ((p[0] == 0xe0 && p[1] < 0xa0) || (p[0] == 0xed && p[1] >= 0xa0) ||
+      (p[0] == 0xf0 && p[1] < 0x90) || (p[0] == 0xf4 && p[1] >= 0x90))
+    {
+        return 0;
+    }
+
+    return n;
+}
+
+/*
+ *  Adds the UTF-8 in p, len bytes, to out escaped for a JSON string.
+ *  Bytes that aren't valid UTF-8, which a message labelled UTF-8 can
+ *  still have, become U+FFFD.
+ */
+
+static void json_escape(BUF *out, const char *p, size_t len)
+{
+    const unsigned char *u, *end;
+
+    u = (const unsigned char *) p;
+    end = u + len;
+
+    while (u != end)
+    {
+        const unsigned char *run;
+        size_t n;
+
+        for (run = u; u != end && *u >= 0x20 && *u < 0x80 && *u != '"' && *u != '\\'; u++)
+        {
+        }
+
+        buf_write(out, run, (size_t) (u - run));
+
+        if (u == end)
+        {
+            break;
+        }
+
+        if (*u >= 0x80)
+        {
+            n = utf8_len(u, (size_t) (end - u));
+
+            if (n != 0)
+            {
+                buf_write(out, u, n);
+                u += n;
+            }
+            else
+            {
+                buf_puts(out, "\xef\xbf\xbd");
+                u++;
+            }
+
+            continue;
+        }
+
+        switch (*u)
+        {
+        case '"':
+            buf_puts(out, "\\\"");
+            break;
+        case '\\':
+            buf_puts(out, "\\\\");
+            break;
+        case '\n':
+            buf_puts(out, "\\n");
+            break;
+        case '\t':
+            buf_puts(out, "\\t");
+            break;
+        default:
+            buf_printf(out, "\\u%04x", *u);
+            break;
+        }
+
+        u++;
+    }
+}
+
+/*
+ *  Adds p, len bytes in character set cs, to out as a JSON string.  tmp
+ *  is scratch space for the UTF-8.
+ */
+
+static void json_str(BUF *out, BUF *tmp, const CHARSET *cs, const char *p, size_t len)
+{
+    tmp->len = 0;
+    charset_to_utf8(tmp, cs, p, len);
+
+    buf_putc(out, '"');
+    json_escape(out, tmp->data, tmp->len);
+    buf_putc(out, '"');
+}
+
+/*
+ *  Adds the text of m to out as a JSON string, with its lines ended by LF
+ *  instead of CR.  The text ends at the first nul, if there is one.
+ */
+
+static void json_text(BUF *out, BUF *tmp, const CHARSET *cs, const SQMSG *m)
+{
+    const char *p, *end;
+
+    p = m->txt;
+    end = memchr(m->txt, '\0', (size_t) m->txt_len);
+
+    if (end == NULL)
+    {
+        end = m->txt + m->txt_len;
+    }
+
+    buf_putc(out, '"');
+
+    while (p != end)
+    {
+        const char *eol;
+
+        if (*p == '\n')
+        {
+            p++;
+            continue;
+        }
+
+        eol = memchr(p, '\r', (size_t) (end - p));
+
+        if (eol == NULL)
+        {
+            eol = end;
+        }
+
+        tmp->len = 0;
+        charset_to_utf8(tmp, cs, p, (size_t) (eol - p));
+        json_escape(out, tmp->data, tmp->len);
+
+        if (eol != end)
+        {
+            buf_puts(out, "\\n");
+            eol++;
+        }
+
+        p = eol;
+    }
+
+    buf_putc(out, '"');
+}
+
+static void json_addr(BUF *out, const char *name, unsigned short zone, unsigned short net,
+  unsigned short node, unsigned short point)
+{
+    buf_printf(out, ",\"%s\":\"%u:%u/%u.%u\"", name, zone, net, node, point);
+}
+
+static void format_json(SINK *s, const SQMSG *m, unsigned long num)
+{
+    const SQXMSG *x;
+    const CHARSET *cs;
+    KLUDGES kl;
+    KLUDGE k;
+    const char *p, *end;
+    char date[SQDATE_ISO_LEN], zone[SQDATE_ZONE_LEN];
+    time_t t;
+    int tz, first;
+
+    x = &m->xmsg;
+
+    kludge_parse(&kl, m->ctl, (size_t) m->ctl_len);
+
+    cs = NULL;
+
+    if (kl.known[KL_CHRS].line != NULL)
+    {
+        cs = charset_find(kl.known[KL_CHRS].value, kl.known[KL_CHRS].value_len);
+    }
+
+    if (cs == NULL)
+    {
+        cs = charset_default();
+    }
+
+    sqdate_written(x, &t);
+
+    sqdate_fmt_iso(&s->dc, t, date);
+
+    buf_printf(&s->out, "{\"num\":%lu,\"frame\":%lu,\"umsgid\":%lu,\"from\":", num, m->ofs,
+      x->umsgid);
+    json_str(&s->out, &s->tmp, cs, x->from, strlen(x->from));
+    json_addr(&s->out, "orig", x->orig_zone, x->orig_net, x->orig_node, x->orig_point);
+    buf_puts(&s->out, ",\"to\":");
+    json_str(&s->out, &s->tmp, cs, x->to, strlen(x->to));
+    json_addr(&s->out, "dest", x->dest_zone, x->dest_net, x->dest_node, x->dest_point);
+    buf_puts(&s->out, ",\"subj\":");
+    json_str(&s->out, &s->tmp, cs, x->subj, strlen(x->subj));
+    buf_printf(&s->out, ",\"date\":\"%s\"", date);
+
+    if (kl.known[KL_TZUTC].line != NULL &&
+      sqdate_tzutc(kl.known[KL_TZUTC].value, kl.known[KL_TZUTC].value_len, &tz) == 0)
+    {
+        sqdate_fmt_zone(tz, zone);
+        buf_printf(&s->out, ",\"zone\":\"%s\"", zone);
+    }
+
+    buf_printf(&s->out, ",\"attr\":%lu", x->attr);
+
+    if (kl.known[KL_MSGID].line != NULL)
+    {
+        buf_puts(&s->out, ",\"msgid\":");
+        json_str(&s->out, &s->tmp, cs, kl.known[KL_MSGID].value, kl.known[KL_MSGID].value_len);
+    }
+
+    if (kl.known[KL_REPLY].line != NULL)
+    {
+        buf_puts(&s->out, ",\"reply\":");
+        json_str(&s->out, &s->tmp, cs, kl.known[KL_REPLY].value, kl.known[KL_REPLY].value_len);
+    }
+
+    buf_puts(&s->out, ",\"kludges\":[");
+
+    p = m->ctl;
+    end = m->ctl + m->ctl_len;
+    first = 1;
+
+    while (kludge_next(&p, end, &k))
+    {
+        if (!first)
+        {
+            buf_putc(&s->out, ',');
+        }
+
+        json_str(&s->out, &s->tmp, cs, k.line, k.line_len);
+        first = 0;
+    }
+
+    buf_puts(&s->out, "],\"text\":");
+    json_text(&s->out, &s->tmp, cs, m);
+    buf_puts(&s->out, "}\n");
+}
+
+/*
+ *  Writes m to a file of its own in the Maildir, unless it's there
+ *  already.  They're moved in from tmp a batch at a time.
+ */
+
+static int write_maildir(SINK *s, const SQMSG *m, unsigned long num)
+{
+    char name[MD_NAME_LEN];
+
+    md_name(name, m);
+
+    if (md_has(&s->md, name))
+    {
+        return 0;
+    }
+
+    s->out.len = 0;
+    mbox_format(&s->out, &maildir_fmt, m, num, &s->dc);
+
+    if (md_batch_add(&s->batch, name, (m->xmsg.attr & XMSG_READ) != 0, s->out.data,
+      s->out.len) == -1)
+    {
+        s->out.len = 0;
+        return write_error(s);
+    }
+
+    s->out.len = 0;
+
+    if (s->batch.count == MAILDIR_BATCH && md_batch_commit(&s->batch) != 0)
+    {
+        return write_error(s);
+    }
+
+    return 0;
+}
+
+static int sink_msg(void *arg, const SQMSG *m, unsigned long num)
+{
+    SINK *s;
+    CSVLINE line;
+
+    s = arg;
+
+    switch (s->type)
+    {
+    case SINK_MBOX:
+        mbox_format(&s->out, &mbox_fmt, m, num, &s->dc);
+        break;
+
+    case SINK_MAILDIR:
+        return write_maildir(s, m, num);
+
+    case SINK_JSONL:
+        format_json(s, m, num);
+        break;
+
+    case SINK_CSV:
+        if (s->line_count == s->line_size)
+        {
+            s->line_size = s->line_size != 0 ? s->line_size * 2 : 1024;
+            s->lines = realloc(s->lines, sizeof *s->lines * s->line_size);
+            assert(s->lines != NULL);
+        }
+
+        s->lines[s->line_count++] = s->out.len;
+        csv_format_line(&s->out, &m->xmsg, m->ofs, &s->dc, &line);
+
+        /* kept whole until end(), as it's written newest first */
+        return 0;
+
+    case SINK_SQI:
+        {
+            unsigned char rec[SQIDX_SIZE];
+
+            put_ul(rec, m->ofs);
+            put_ul(rec + 4, m->xmsg.umsgid);
+            put_ul(rec + 8, sq_index_hash(&m->xmsg));
+            buf_write(&s->out, rec, SQIDX_SIZE);
+        }
+        break;
+
+    case SINK_SQH:
+        hc_build_add(s->hb, m);
+        return 0;
+    }
+
+    return s->out.len >= OUTPUT_BUFSIZE ? flush(s) : 0;
+}
+
+/*
+ *  Finishes the output.  The sqi and sqh outputs index the whole base, so
+ *  if the frame list couldn't be read to the end they're thrown away, as
+ *  sqd2sqi and sqhdr do, rather than left looking complete.
+ */
+
+static int sink_end(void *arg, int complete)
+{
+    SINK *s;
+    int rc;
+
+    s = arg;
+    rc = 0;
+
+    switch (s->type)
+    {
+    case SINK_MBOX:
+        rc = flush(s);
+
+        if (out_close(s->ofp) != 0 && rc == 0)
+        {
+            rc = write_error(s);
+        }
+
+        s->ofp = NULL;
+        break;
+
+    case SINK_CSV:
+        {
+            unsigned long i;
+            size_t end;
+
+            end = s->out.len;
+
+            for (i = s->line_count; rc == 0 && i-- > 0; )
+            {
+                if (fwrite(s->out.data + s->lines[i], end - s->lines[i], 1, s->fp) != 1)
+                {
+                    rc = write_error(s);
+                }
+
+                end = s->lines[i];
+            }
+
+            s->out.len = 0;
+        }
+
+        /* fall through */
+
+    case SINK_JSONL:
+    case SINK_SQI:
+        if (rc == 0)
+        {
+            rc = flush(s);
+        }
+
+        if (fclose(s->fp) != 0 && rc == 0)
+        {
+            rc = write_error(s);
+        }
+
+        s->fp = NULL;
+
+        if (s->type == SINK_SQI && !complete)
+        {
+            fprintf(stderr, PROGRAM ": %s: removed, as the frame list is broken\n", s->path);
+            remove(s->path);
+        }
+        break;
+
+    case SINK_MAILDIR:
+        if (md_batch_commit(&s->batch) != 0)
+        {
+            rc = write_error(s);
+        }
+        break;
+
+    case SINK_SQH:
+        if (!complete)
+        {
+            fprintf(stderr, PROGRAM ": %s: not written, as the frame list is broken\n", s->path);
+        }
+        else if (hc_build_save(s->hb, s->path, &sqb) != 0)
+        {
+            rc = write_error(s);
+        }
+        break;
+    }
+
+    return rc;
+}
+
+/*
+ *  Parses spec, type:path, into s and opens the output.  Returns 0, or
+ *  -1 if it can't.
+ */
+
+static int open_sink(SINK *s, const char *spec)
+{
+    const char *colon;
+
+    memset(s, 0, sizeof *s);
+
+    colon = strchr(spec, ':');
+
+    for (s->type = 0; colon != NULL && s->type < SINK_TYPES; s->type++)
+    {
+        if (strlen(type_name[s->type]) == (size_t) (colon - spec) &&
+          strncmp(spec, type_name[s->type], (size_t) (colon - spec)) == 0)
+        {
+            break;
+        }
+    }
+
+    if (colon == NULL || s->type == SINK_TYPES || colon[1] == '\0')
+    {
+        fprintf(stderr, PROGRAM ": Bad output `%s`; use type:path\n", spec);
+        return -1;
+    }
+
+    s->path = colon + 1;
+
+    if (filter.count != 0 && (s->type == SINK_SQI || s->type == SINK_SQH))
+    {
+        fprintf(stderr, PROGRAM ": A %s output covers the whole base and can't be filtered\n",
+          type_name[s->type]);
+        return -1;
+    }
+
+    buf_init(&s->out);
+    buf_init(&s->tmp);
+    sqdate_cache_init(&s->dc);
+
+    switch (s->type)
+    {
+    case SINK_MBOX:
+        s->ofp = out_open(s->path, "wb", out_guess_format(s->path));
+
+        if (s->ofp == NULL)
+        {
+            break;
+        }
+
+        return 0;
+
+    case SINK_MAILDIR:
+        if (md_open(&s->md, s->path, 0) != 0)
+        {
+            fprintf(stderr, PROGRAM ": Cannot open Maildir `%s`: %s\n", s->path,
+              strerror(errno));
+            return -1;
+        }
+
+        md_batch_init(&s->batch, &s->md, 0);
+        return 0;
+
+    case SINK_SQH:
+        s->hb = hc_build_new();
+        return 0;
+
+    default:
+        s->fp = fopen(s->path, "wb");
+
+        if (s->fp == NULL)
+        {
+            break;
+        }
+
+        return 0;
+    }
+
+    fprintf(stderr, PROGRAM ": Cannot open `%s` for writing: %s\n", s->path, strerror(errno));
+    return -1;
+}
+
+static void free_sink(SINK *s)
+{
+    if (s->ofp != NULL)
+    {
+        out_close(s->ofp);
+    }
+
+    if (s->fp != NULL)
+    {
+        fclose(s->fp);
+    }
+
+    if (s->hb != NULL)
+    {
+        hc_build_free(s->hb);
+    }
+
+    buf_free(&s->out);
+    buf_free(&s->tmp);
+    if (s->md.path != NULL)
+    {
+        md_batch_free(&s->batch);
+        md_close(&s->md);
+    }
+
+    free(s->lines);
+}
+
+static int usage(void)
+{
+    fprintf(
+      stderr,
+      PROGRAM " " VERSION "\n"
+      "\n"
+      "Exports a Squish base to several formats in one pass.\n"
+      "Written by Andrew Clarke and released to the public domain.\n"
+      "\n"
+      "Usage: " PROGRAM " [options] base[.sqd] type:path ...\n"
+      "\n"
+      "  The types are\n"
+      "\n"
+      "  mbox:file    An mbox, as squ2mbox writes it (.gz or .zst to compress)\n"
+      "  maildir:dir  A Maildir with a file per message\n"
+      "  jsonl:file   A JSON object per message, one to a line\n"
+      "  csv:file     The index sqidx lists\n"
+      "  sqi:file     A .sqi index, as sqd2sqi makes it\n"
+      "  sqh:file     A header cache, as sqhdr keeps it\n"
+      "\n"
+      "  -q           Don't report what was written\n"
+      "\n"
+      "  Only export messages whose headers match (not for sqi and sqh):\n"
+      "\n"
+      "  --from name  ... from this name; * and ? are wildcards, /re/ is a\n"
+      "               regular expression\n"
+      "  --to name    ... to this name\n"
+      "  --subj text  ... with this subject\n"
+      "  --orig addr  ... from this address, eg. 2:* or 3:633/267.*\n"
+      "  --dest addr  ... to this address\n"
+      "  --attr flags ... with these attributes set, or clear if they start\n"
+      "               with !, eg. pvt,!rcvd\n"
+      "\n"
+      "  The same option given more than once matches any of them.\n"
+    );
+
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+    SQFILE *sq;
+    SINK *sinks;
+    EXPORT_SINK *es;
+    EXPORT_RESULT res;
+    char *sqd_fn;
+    time_t now;
+    int quiet, nsinks, i, rc, failed;
+
+    quiet = 0;
+    filter_init(&filter);
+
+    while (argc > 1 && argv[1][0] == '-')
+    {
+        if (strcmp(argv[1], "-q") == 0)
+        {
+            quiet = 1;
+            argc--;
+            argv++;
+            continue;
+        }
+
+        if (strncmp(argv[1], "--", 2) == 0 && argc > 2 &&
+          (rc = filter_add(&filter, argv[1] + 2, argv[2])) != 1)
+        {
+            if (rc != 0)
+            {
+                fprintf(stderr, PROGRAM ": Bad %s pattern `%s`\n", argv[1], argv[2]);
+                return EXIT_FAILURE;
+            }
+        }
+        else
+        {
+            return usage();
+        }
+
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc < 3)
+    {
+        return usage();
+    }
+
+    sq_names(argv[1], &sqd_fn, NULL);
+
+    sq = sq_open(sqd_fn);
+
+    if (sq == NULL)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s\n", sqd_fn, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (sq_read_base(sq, &sqb) != SQ_OK || sqb.sz_sqbase != SQBASE_SIZE)
+    {
+        fprintf(stderr, PROGRAM ": `%s` is not a Squish base\n", sqd_fn);
+        return EXIT_FAILURE;
+    }
+
+    sq_advise(sq, SQ_ADV_SEQUENTIAL);
+
+    now = time(NULL);
+    mbox_fmt.start = *gmtime(&now);
+    maildir_fmt.start = mbox_fmt.start;
+
+    nsinks = argc - 2;
+    sinks = malloc(sizeof *sinks * (size_t) nsinks);
+    es = malloc(sizeof *es * (size_t) nsinks);
+    assert(sinks != NULL && es != NULL);
+
+    for (i = 0; i < nsinks; i++)
+    {
+        if (open_sink(&sinks[i], argv[i + 2]) != 0)
+        {
+            while (i >= 0)
+            {
+                free_sink(&sinks[i--]);
+            }
+
+            return EXIT_FAILURE;
+        }
+
+        memset(&es[i], 0, sizeof es[i]);
+        es[i].name = argv[i + 2];
+        es[i].arg = &sinks[i];
+        es[i].msg = sink_msg;
+        es[i].end = sink_end;
+    }
+
+    rc = export_run(sq, &sqb, filter.count != 0 ? &filter : NULL, es, nsinks, &res);
+
+    failed = rc != 0;
+
+    if (rc != 0)
+    {
+        fprintf(stderr, PROGRAM ": Frame at 0x%08lx: %s\n", res.err_ofs, sq_strerror(res.rc));
+    }
+
+    if (!quiet)
+    {
+        fprintf(stderr, PROGRAM ": %lu messages read, %lu exported\n", res.msgs, res.passed);
+    }
+
+    for (i = 0; i < nsinks; i++)
+    {
+        if (es[i].failed)
+        {
+            fprintf(stderr, PROGRAM ": %s: failed after %lu messages\n", es[i].name, es[i].msgs);
+            failed = 1;
+        }
+        else if (!quiet)
+        {
+            fprintf(stderr, PROGRAM ": %s: %lu messages, reader waited %lu times\n", es[i].name,
+              es[i].msgs, es[i].stalls);
+        }
+
+        free_sink(&sinks[i]);
+    }
+
+    sq_close(sq);
+    filter_free(&filter);
+    free(es);
+    free(sinks);
+    free(sqd_fn);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
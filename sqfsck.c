@@ -0,0 +1,564 @@
+/*
+ *  sqfsck.c
+ *
+ *  Checks the structure of Squish message bases.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  The stored and free frame lists are each walked forwards from their
+ *  first frame and backwards from their last, reading only the 28-byte
+ *  frame headers and, for stored messages, the umsgid from the XMSG.
+ *  Every frame reached is noted in a hash set of offsets (squish.c; the
+ *  other tools' walks use one too), so a list that loops, or runs into
+ *  the other list, is caught the first time a frame comes round again,
+ *  and the walk takes time in proportion to the number of frames.  What's
+ *  checked:
+ *
+ *     - the SQBASE sizes, and that each list's first and last frames are
+ *       both set or both 0
+ *     - that every frame lies inside the file and has the frame id
+ *     - that each frame's prev_frame points back at the frame before it,
+ *       and that walking backwards from the last frame meets the same
+ *       frames as walking forwards
+ *     - the frame types: normal in the stored list, free in the free list
+ *     - frame_len against msg_len, and msg_len against the XMSG and
+ *       control info
+ *     - that umsgids go up along the stored list and are below the uid
+ *     - num_msg and high_msg against the length of the stored list
+ *     - that no two frames overlap, that end_frame is where the last
+ *       frame ends and inside the file, and the space between
+ *       frames that neither list accounts for
+ *
+ *  Every problem is reported, up to MAX_REPORT per base, and the rest are
+ *  counted; nothing stops the check but a file that can't be read.  The
+ *  exit status is non-zero if any base has problems, so it can be run
+ *  over thousands of areas from cron with -q and -c.
+ */
+
+#define PROGRAM "sqfsck"
+#define VERSION "1.0"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "squish.h"
+#include "areas.h"
+
+/* problems listed per base before the rest are just counted */
+
+#define MAX_REPORT 20
+
+/* the bytes a frame takes up */
+
+typedef struct
+{
+    unsigned long ofs;
+    unsigned long end;
+}
+SPAN;
+
+typedef struct
+{
+    const char *filename;
+    SQFILE *sq;
+    SQBASE sqb;
+    unsigned long problems;
+    SQOFSSET seen;                   /* frames reached by either list */
+    SPAN *spans;
+    unsigned long span_count;
+    unsigned long span_size;
+    unsigned long *order;            /* the list being checked, walking forwards */
+    unsigned long order_count;
+    unsigned long order_size;
+    unsigned long stored;            /* frames in the stored list */
+    unsigned long free_frames;       /* ... and in the free list */
+}
+CHECK;
+
+static int quiet = 0;
+
+static void problem(CHECK *ck, const char *fmt, ...)
+{
+    va_list args;
+
+    ck->problems++;
+
+    if (ck->problems > MAX_REPORT)
+    {
+        return;
+    }
+
+    printf("%s: ", ck->filename);
+
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+
+    putchar('\n');
+}
+
+static void add_span(CHECK *ck, unsigned long ofs, unsigned long end)
+{
+    if (ck->span_count == ck->span_size)
+    {
+        ck->span_size = ck->span_size != 0 ? ck->span_size * 2 : 1024;
+        ck->spans = realloc(ck->spans, sizeof *ck->spans * ck->span_size);
+        assert(ck->spans != NULL);
+    }
+
+    ck->spans[ck->span_count].ofs = ofs;
+    ck->spans[ck->span_count].end = end;
+    ck->span_count++;
+}
+
+/*
+ *  Returns 1 if a frame header at ofs would lie inside the file after the
+ *  SQBASE, or 0 if it wouldn't.
+ */
+
+static int in_file(const CHECK *ck, unsigned long ofs)
+{
+    return ofs >= SQBASE_SIZE && ofs <= ck->sq->size &&
+      ck->sq->size - ofs >= SQFRAME_SIZE;
+}
+
+/*
+ *  Checks the frame m, the n'th in its list counting from 0.
+ */
+
+static void check_frame(CHECK *ck, const char *list, int stored, const SQMSG *m,
+  unsigned long n, unsigned long *last_umsgid)
+{
+    const SQFRAME *f;
+    unsigned long room, end;
+
+    f = &m->frame;
+
+    /* a frame of the wrong type is more likely to belong to the other
+       list than to be damaged itself, so don't pick over its lengths */
+
+    if (f->frame_type != (stored ? FRAME_NORMAL : FRAME_FREE))
+    {
+        problem(ck, "%s frame 0x%08lx has frame type %u, not %s", list, m->ofs,
+          f->frame_type, stored ? "normal" : "free");
+        room = ck->sq->size - m->ofs - SQFRAME_SIZE;
+        add_span(ck, m->ofs, m->ofs + SQFRAME_SIZE + (f->frame_len < room ? f->frame_len : room));
+        return;
+    }
+
+    if (f->msg_len > f->frame_len)
+    {
+        problem(ck, "%s frame 0x%08lx: msg_len %lu is more than frame_len %lu", list, m->ofs,
+          f->msg_len, f->frame_len);
+    }
+
+    room = ck->sq->size - m->ofs - SQFRAME_SIZE;
+
+    if (f->frame_len > room)
+    {
+        problem(ck, "%s frame 0x%08lx: frame_len %lu runs %lu bytes past the end of the file",
+          list, m->ofs, f->frame_len, f->frame_len - room);
+        end = ck->sq->size;
+    }
+    else
+    {
+        end = m->ofs + SQFRAME_SIZE + f->frame_len;
+    }
+
+    add_span(ck, m->ofs, end);
+
+    if (!stored)
+    {
+        return;
+    }
+
+    if (f->msg_len < SQXMSG_SIZE || f->ctrl_len > f->msg_len - SQXMSG_SIZE)
+    {
+        problem(ck, "%s frame 0x%08lx: msg_len %lu can't hold the XMSG and %lu bytes of "
+          "control info", list, m->ofs, f->msg_len, f->ctrl_len);
+    }
+
+    if (room >= SQXMSG_SIZE)
+    {
+        SQMSG x;
+
+        x = *m;
+
+        if (sq_read_xmsg(ck->sq, &x) == SQ_OK)
+        {
+            if (n != 0 && x.xmsg.umsgid <= *last_umsgid)
+            {
+                problem(ck, "%s frame 0x%08lx: umsgid %lu doesn't follow %lu", list, m->ofs,
+                  x.xmsg.umsgid, *last_umsgid);
+            }
+
+            if (x.xmsg.umsgid >= ck->sqb.uid)
+            {
+                problem(ck, "%s frame 0x%08lx: umsgid %lu isn't below the base's uid %lu",
+                  list, m->ofs, x.xmsg.umsgid, ck->sqb.uid);
+            }
+
+            *last_umsgid = x.xmsg.umsgid;
+        }
+    }
+}
+
+/*
+ *  Walks the list from first to last, and then back again.  Returns the
+ *  number of frames found walking forwards.
+ */
+
+static unsigned long check_list(CHECK *ck, const char *list, int stored, unsigned long first,
+  unsigned long last)
+{
+    SQMSG m;
+    SQOFSSET back;
+    unsigned long ofs, prev, n, i, umsgid;
+
+    if ((first == 0) != (last == 0))
+    {
+        problem(ck, "%s list: first frame is 0x%08lx but last frame is 0x%08lx", list, first,
+          last);
+    }
+
+    ck->order_count = 0;
+    umsgid = 0;
+    prev = 0;
+
+    for (ofs = first; ofs != 0; ofs = m.frame.next_frame)
+    {
+        if (!in_file(ck, ofs))
+        {
+            problem(ck, "%s list: frame 0x%08lx, after 0x%08lx, is outside the file", list,
+              ofs, prev);
+            break;
+        }
+
+        if (!sq_set_add(&ck->seen, ofs))
+        {
+            problem(ck, "%s list: frame 0x%08lx, after 0x%08lx, has been reached already; "
+              "the list loops or runs into the other one", list, ofs, prev);
+            break;
+        }
+
+        if (sq_read_frame(ck->sq, ofs, &m) != SQ_OK)
+        {
+            problem(ck, "%s list: frame 0x%08lx, after 0x%08lx, has a bad frame id 0x%08lx",
+              list, ofs, prev, m.frame.frame_id);
+            break;
+        }
+
+        if (m.frame.prev_frame != prev)
+        {
+            problem(ck, "%s frame 0x%08lx: prev_frame is 0x%08lx, should be 0x%08lx", list, ofs,
+              m.frame.prev_frame, prev);
+        }
+
+        check_frame(ck, list, stored, &m, ck->order_count, &umsgid);
+
+        if (ck->order_count == ck->order_size)
+        {
+            ck->order_size = ck->order_size != 0 ? ck->order_size * 2 : 1024;
+            ck->order = realloc(ck->order, sizeof *ck->order * ck->order_size);
+            assert(ck->order != NULL);
+        }
+
+        ck->order[ck->order_count++] = ofs;
+        prev = ofs;
+    }
+
+    n = ck->order_count;
+
+    if (ofs == 0 && prev != last)
+    {
+        problem(ck, "%s list ends at frame 0x%08lx, but the SQBASE says 0x%08lx", list, prev,
+          last);
+    }
+
+    /* walk back from the last frame, which should meet the same frames in
+       reverse; count any that the forward walk didn't reach */
+
+    sq_set_init(&back);
+    i = n;
+
+    for (ofs = last; ofs != 0; ofs = m.frame.prev_frame)
+    {
+        if (!in_file(ck, ofs) || !sq_set_add(&back, ofs) ||
+          sq_read_frame(ck->sq, ofs, &m) != SQ_OK)
+        {
+            problem(ck, "%s list: walking back, frame 0x%08lx is outside the file, bad, or "
+              "reached already", list, ofs);
+            break;
+        }
+
+        if (i != 0 && ck->order[i - 1] == ofs)
+        {
+            i--;
+            continue;
+        }
+
+        if (i == n || i == 0 || ck->order[i - 1] != ofs)
+        {
+            problem(ck, "%s list: walking back, frame 0x%08lx %s", list, ofs,
+              sq_set_has(&ck->seen, ofs) ? "is out of order" :
+              "wasn't reached walking forwards");
+            break;
+        }
+    }
+
+    if (ofs == 0 && i != 0)
+    {
+        problem(ck, "%s list: walking back ends after %lu of %lu frames", list, n - i, n);
+    }
+
+    sq_set_free(&back);
+
+    return n;
+}
+
+static int cmp_span(const void *a, const void *b)
+{
+    const SPAN *x, *y;
+
+    x = a;
+    y = b;
+
+    return x->ofs < y->ofs ? -1 : x->ofs > y->ofs ? 1 : 0;
+}
+
+/*
+ *  Checks that the frames don't overlap and that end_frame is where the
+ *  last one ends, and adds up the space neither list accounts for.
+ */
+
+static void check_spans(CHECK *ck)
+{
+    const SPAN *last;
+    unsigned long i, pos, gaps, gap_bytes;
+
+    if (ck->span_count != 0)
+    {
+        qsort(ck->spans, ck->span_count, sizeof *ck->spans, cmp_span);
+    }
+
+    /* pos is where the frames so far reach, and last is the frame that
+       reaches there, which is the one any frame starting before pos
+       overlaps; it needn't be the frame just before */
+
+    last = NULL;
+    pos = SQBASE_SIZE;
+    gaps = gap_bytes = 0;
+
+    for (i = 0; i < ck->span_count; i++)
+    {
+        const SPAN *s;
+
+        s = &ck->spans[i];
+
+        if (s->ofs < pos && last != NULL)
+        {
+            problem(ck, "frames 0x%08lx and 0x%08lx overlap", last->ofs, s->ofs);
+        }
+        else if (s->ofs > pos)
+        {
+            gaps++;
+            gap_bytes += s->ofs - pos;
+        }
+
+        if (s->end > pos)
+        {
+            pos = s->end;
+            last = s;
+        }
+    }
+
+    if (gaps != 0)
+    {
+        problem(ck, "%lu bytes in %lu places aren't in either list", gap_bytes, gaps);
+    }
+
+    if (ck->sqb.end_frame > ck->sq->size)
+    {
+        problem(ck, "end_frame 0x%08lx is past the end of the file (0x%08lx)",
+          ck->sqb.end_frame, ck->sq->size);
+    }
+    else if (ck->sqb.end_frame != pos)
+    {
+        problem(ck, "end_frame is 0x%08lx, but the last frame ends at 0x%08lx",
+          ck->sqb.end_frame, pos);
+    }
+}
+
+/*
+ *  Checks the base in filename.  Returns 0 if it's sound, or 1 if it has
+ *  problems or can't be read.
+ */
+
+static int check(const char *filename)
+{
+    CHECK ck;
+
+    memset(&ck, 0, sizeof ck);
+    ck.filename = filename;
+    sq_set_init(&ck.seen);
+
+    ck.sq = sq_open(filename);
+
+    if (ck.sq == NULL)
+    {
+        printf("%s: cannot open: %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    if (sq_read_base(ck.sq, &ck.sqb) != SQ_OK)
+    {
+        printf("%s: too short to be a Squish base\n", filename);
+        sq_close(ck.sq);
+        return 1;
+    }
+
+    if (ck.sqb.sz_sqbase != SQBASE_SIZE || ck.sqb.sz_sqhdr != SQFRAME_SIZE)
+    {
+        problem(&ck, "sz_sqbase is %u and sz_sqhdr %u, should be %u and %u",
+          ck.sqb.sz_sqbase, ck.sqb.sz_sqhdr, SQBASE_SIZE, SQFRAME_SIZE);
+    }
+
+    ck.stored = check_list(&ck, "stored", 1, ck.sqb.first_frame, ck.sqb.last_frame);
+    ck.free_frames = check_list(&ck, "free", 0, ck.sqb.first_free_frame,
+      ck.sqb.last_free_frame);
+
+    if (ck.stored != ck.sqb.num_msg)
+    {
+        problem(&ck, "num_msg is %lu, but the stored list has %lu frames", ck.sqb.num_msg,
+          ck.stored);
+    }
+
+    if (ck.sqb.high_msg != ck.sqb.num_msg)
+    {
+        problem(&ck, "high_msg is %lu, but num_msg is %lu", ck.sqb.high_msg, ck.sqb.num_msg);
+    }
+
+    check_spans(&ck);
+
+    if (ck.problems > MAX_REPORT)
+    {
+        printf("%s: %lu problems in all\n", filename, ck.problems);
+    }
+    else if (ck.problems == 0 && !quiet)
+    {
+        printf("%s: OK, %lu messages, %lu free frames\n", filename, ck.stored,
+          ck.free_frames);
+    }
+
+    sq_set_free(&ck.seen);
+    free(ck.spans);
+    free(ck.order);
+    sq_close(ck.sq);
+
+    return ck.problems != 0;
+}
+
+static int usage(void)
+{
+    fprintf(
+      stderr,
+      PROGRAM " " VERSION "\n"
+      "\n"
+      "Checks the structure of Squish message bases.\n"
+      "Written by Andrew Clarke and released to the public domain.\n"
+      "\n"
+      "Usage: " PROGRAM " [-q] base.sqd ...\n"
+      "       " PROGRAM " [-q] -c config\n"
+      "\n"
+      "  -q         Only report bases with problems\n"
+      "  -c config  Check every Squish area in this Husky fidoconfig or\n"
+      "             areas file\n"
+      "\n"
+      "  The exit status is non-zero if any base has problems.\n"
+    );
+
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+    const char *config;
+    unsigned long bases, failures;
+    int i;
+
+    config = NULL;
+
+    while (argc > 1 && argv[1][0] == '-')
+    {
+        if (strcmp(argv[1], "-q") == 0)
+        {
+            quiet = 1;
+            argc--;
+            argv++;
+        }
+        else if (strcmp(argv[1], "-c") == 0 && argc > 2)
+        {
+            config = argv[2];
+            argc -= 2;
+            argv += 2;
+        }
+        else
+        {
+            return usage();
+        }
+    }
+
+    if (config != NULL ? argc != 1 : argc < 2)
+    {
+        return usage();
+    }
+
+    bases = failures = 0;
+
+    if (config != NULL)
+    {
+        AREALIST list;
+
+        areas_init(&list);
+
+        if (areas_read(&list, config) != 0)
+        {
+            fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s\n", config,
+              strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        for (i = 0; i < list.count; i++)
+        {
+            char *filename;
+
+            sq_names(list.areas[i].path, &filename, NULL);
+
+            failures += (unsigned long) check(filename);
+            bases++;
+
+            free(filename);
+        }
+
+        areas_free(&list);
+    }
+    else
+    {
+        for (i = 1; i < argc; i++)
+        {
+            failures += (unsigned long) check(argv[i]);
+            bases++;
+        }
+    }
+
+    if (bases > 1)
+    {
+        printf("%lu bases checked, %lu with problems\n", bases, failures);
+    }
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
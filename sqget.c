@@ -0,0 +1,496 @@
+/*
+ *  sqget.c
+ *
+ *  Fetches single messages from a Squish base, by umsgid, frame offset
+ *  or MSGID, and prints them as text or as mbox records.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  A umsgid is looked up with a binary search of the .sqi, which is in
+ *  umsgid order, so only a handful of index records and the one frame are
+ *  read.  If the .sqi is missing or doesn't agree with the .sqd the frame
+ *  list is searched instead.  A MSGID can only be found by searching the
+ *  frame list, which reads the control info of each message; every
+ *  message with that MSGID is printed.
+ *
+ *  The mbox output (-m) is the same as squ2mbox gives for the message,
+ *  except that a Message-ID made up for a message without a MSGID is
+ *  based on its umsgid.
+ */
+
+#define PROGRAM "sqget"
+#define VERSION "1.0"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+
+#include "squish.h"
+#include "buf.h"
+#include "kludge.h"
+#include "charset.h"
+#include "sqdate.h"
+#include "mboxfmt.h"
+#include "sqorder.h"
+
+/* what the keys on the command line are */
+
+#define KEY_UMSGID 0
+#define KEY_OFFSET 1
+#define KEY_MSGID  2
+
+static SQFILE *sq;
+static SQBASE sqb;
+static char *sqi_fn;
+static int mbox = 0;
+static MBOXFMT fmt = { MBOX_UTF8, 0, PROGRAM " " VERSION, { 0 }, 0 };
+static SQDATE_CACHE dc;
+
+static void divider(BUF *out)
+{
+    buf_puts(out, "------------------------------------------------------------------------------\n");
+}
+
+static const CHARSET *msg_charset(const KLUDGES *kl)
+{
+    const CHARSET *cs;
+
+    cs = NULL;
+
+    if (kl->known[KL_CHRS].line != NULL)
+    {
+        cs = charset_find(kl->known[KL_CHRS].value, kl->known[KL_CHRS].value_len);
+    }
+
+    return cs != NULL ? cs : charset_default();
+}
+
+/*
+ *  Renders the message in m as text: the header, the control info as
+ *  @-lines, then the text with its lines ended by LF instead of CR.  It's
+ *  all converted to UTF-8.
+ */
+
+static void format_text(BUF *out, const SQMSG *m)
+{
+    const SQXMSG *x;
+    const CHARSET *cs;
+    KLUDGES kl;
+    KLUDGE k;
+    const char *p, *end;
+    char date[SQDATE_ISO_LEN], zone[SQDATE_ZONE_LEN];
+    time_t t;
+    int tz;
+
+    x = &m->xmsg;
+
+    kludge_parse(&kl, m->ctl, (size_t) m->ctl_len);
+    cs = msg_charset(&kl);
+
+    sqdate_written(x, &t);
+
+    sqdate_fmt_iso(&dc, t, date);
+
+    buf_printf(out, "Frame   : 0x%08lx\n", m->ofs);
+    buf_printf(out, "Umsgid  : %lu\n", x->umsgid);
+    buf_puts(out, "From    : ");
+    charset_to_utf8(out, cs, x->from, strlen(x->from));
+    buf_printf(out, " (%u:%u/%u.%u)\n", x->orig_zone, x->orig_net, x->orig_node, x->orig_point);
+    buf_puts(out, "To      : ");
+    charset_to_utf8(out, cs, x->to, strlen(x->to));
+    buf_printf(out, " (%u:%u/%u.%u)\n", x->dest_zone, x->dest_net, x->dest_node, x->dest_point);
+    buf_puts(out, "Subject : ");
+    charset_to_utf8(out, cs, x->subj, strlen(x->subj));
+    buf_printf(out, "\nDate    : %s", date);
+
+    if (kl.known[KL_TZUTC].line != NULL &&
+      sqdate_tzutc(kl.known[KL_TZUTC].value, kl.known[KL_TZUTC].value_len, &tz) == 0)
+    {
+        sqdate_fmt_zone(tz, zone);
+        buf_printf(out, " %s", zone);
+    }
+
+    buf_printf(out, "\nAttr    : 0x%08lx\n", x->attr);
+    divider(out);
+
+    p = m->ctl;
+    end = m->ctl + m->ctl_len;
+
+    while (kludge_next(&p, end, &k))
+    {
+        buf_putc(out, '@');
+        charset_to_utf8(out, cs, k.line, k.line_len);
+        buf_putc(out, '\n');
+    }
+
+    /* the text ends at the first nul, if there is one */
+
+    p = m->txt;
+    end = memchr(m->txt, '\0', (size_t) m->txt_len);
+
+    if (end == NULL)
+    {
+        end = m->txt + m->txt_len;
+    }
+
+    while (p != end)
+    {
+        const char *eol;
+
+        if (*p == '\n')
+        {
+            p++;
+            continue;
+        }
+
+        eol = memchr(p, '\r', (size_t) (end - p));
+
+        if (eol == NULL)
+        {
+            eol = end;
+        }
+
+        if (*p == '\1')
+        {
+            buf_putc(out, '@');
+            p++;
+        }
+
+        charset_to_utf8(out, cs, p, (size_t) (eol - p));
+        buf_putc(out, '\n');
+
+        p = eol != end ? eol + 1 : end;
+    }
+
+    divider(out);
+}
+
+/*
+ *  Reads the message at ofs and prints it.  Returns 0, or -1 if it can't
+ *  be read.
+ */
+
+static int print_msg(unsigned long ofs)
+{
+    SQMSG m;
+    BUF out;
+    int rc;
+
+    rc = sq_read_frame(sq, ofs, &m);
+
+    if (rc == SQ_OK)
+    {
+        rc = sq_read_msg(sq, &m);
+    }
+
+    if (rc != SQ_OK)
+    {
+        fprintf(stderr, PROGRAM ": Frame at 0x%08lx: %s\n", ofs, sq_strerror(rc));
+        return -1;
+    }
+
+    if (m.frame.frame_type != FRAME_NORMAL)
+    {
+        fprintf(stderr, PROGRAM ": Frame at 0x%08lx is not a normal message (type %u)\n", ofs,
+          m.frame.frame_type);
+    }
+
+    buf_init(&out);
+
+    if (mbox)
+    {
+        mbox_format(&out, &fmt, &m, m.xmsg.umsgid, &dc);
+    }
+    else
+    {
+        format_text(&out, &m);
+    }
+
+    fwrite(out.data, out.len, 1, stdout);
+    buf_free(&out);
+
+    return 0;
+}
+
+/*
+ *  Looks for umsgid in the .sqi.  Returns the offset of its frame, or 0
+ *  if it isn't there or the .sqi can't be read.
+ */
+
+static unsigned long search_sqi(unsigned long umsgid)
+{
+    FILE *fp;
+    unsigned char rec[SQIDX_SIZE];
+    unsigned long lo, hi, mid, ofs;
+    long size;
+
+    fp = fopen(sqi_fn, "rb");
+
+    if (fp == NULL)
+    {
+        return 0;
+    }
+
+    size = fseek(fp, 0, SEEK_END) == 0 ? ftell(fp) : -1L;
+
+    lo = 0;
+    hi = size > 0 ? (unsigned long) size / SQIDX_SIZE : 0;
+    ofs = 0;
+
+    while (lo < hi)
+    {
+        unsigned long n;
+
+        mid = lo + (hi - lo) / 2;
+
+        if (fseek(fp, (long) (mid * SQIDX_SIZE), SEEK_SET) != 0 ||
+          fread(rec, sizeof rec, 1, fp) != 1)
+        {
+            break;
+        }
+
+        n = r2ul(rec + 4);
+
+        if (n == umsgid)
+        {
+            ofs = r2ul(rec);
+            break;
+        }
+
+        if (n < umsgid)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    fclose(fp);
+
+    return ofs;
+}
+
+/*
+ *  Returns 1 if the frame at ofs is the message umsgid, or 0 if not.
+ */
+
+static int is_umsgid(unsigned long ofs, unsigned long umsgid)
+{
+    SQMSG m;
+
+    return sq_read_frame(sq, ofs, &m) == SQ_OK && m.frame.frame_type == FRAME_NORMAL &&
+      sq_read_xmsg(sq, &m) == SQ_OK && m.xmsg.umsgid == umsgid;
+}
+
+static int get_umsgid(unsigned long umsgid)
+{
+    SQITER it;
+    SQMSG m;
+    unsigned long ofs;
+    int rc;
+
+    ofs = search_sqi(umsgid);
+
+    if (ofs != 0 && is_umsgid(ofs, umsgid))
+    {
+        return print_msg(ofs);
+    }
+
+    /* not in the .sqi, or it's out of date */
+
+    sq_iter_init(&it, sq, sqb.first_frame, 0);
+
+    while ((rc = sq_iter_next(&it, &m)) == SQ_OK && (rc = sq_read_xmsg(sq, &m)) == SQ_OK)
+    {
+        if (m.xmsg.umsgid == umsgid)
+        {
+            sq_iter_free(&it);
+            return print_msg(m.ofs);
+        }
+    }
+
+    sq_iter_free(&it);
+
+    if (rc != SQ_END)
+    {
+        fprintf(stderr, PROGRAM ": Frame at 0x%08lx: %s\n", m.ofs, sq_strerror(rc));
+    }
+
+    fprintf(stderr, PROGRAM ": No message with umsgid %lu\n", umsgid);
+
+    return -1;
+}
+
+static int get_msgid(const char *msgid)
+{
+    SQITER it;
+    SQMSG m;
+    size_t len;
+    int rc, found;
+
+    len = strlen(msgid);
+    found = 0;
+
+    sq_iter_init(&it, sq, sqb.first_frame, 0);
+
+    while ((rc = sq_iter_next(&it, &m)) == SQ_OK && (rc = sq_read_msg(sq, &m)) == SQ_OK)
+    {
+        const char *p, *end;
+        KLUDGE k;
+
+        p = m.ctl;
+        end = m.ctl + m.ctl_len;
+
+        while (kludge_next(&p, end, &k))
+        {
+            if (k.id == KL_MSGID)
+            {
+                if (k.value_len == len && memcmp(k.value, msgid, len) == 0 &&
+                  print_msg(m.ofs) == 0)
+                {
+                    found = 1;
+                }
+
+                break;
+            }
+        }
+    }
+
+    sq_iter_free(&it);
+
+    if (rc != SQ_END)
+    {
+        fprintf(stderr, PROGRAM ": Frame at 0x%08lx: %s\n", m.ofs, sq_strerror(rc));
+    }
+
+    if (!found)
+    {
+        fprintf(stderr, PROGRAM ": No message with MSGID %s\n", msgid);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int get(const char *key, int type)
+{
+    char *end;
+    unsigned long n;
+
+    if (type == KEY_MSGID)
+    {
+        return get_msgid(key);
+    }
+
+    errno = 0;
+    n = strtoul(key, &end, type == KEY_OFFSET ? 0 : 10);
+
+    if (*key == '\0' || *end != '\0' || errno != 0)
+    {
+        fprintf(stderr, PROGRAM ": `%s` is not a number\n", key);
+        return -1;
+    }
+
+    return type == KEY_OFFSET ? print_msg(n) : get_umsgid(n);
+}
+
+static int usage(void)
+{
+    fprintf(
+      stderr,
+      PROGRAM " " VERSION "\n"
+      "\n"
+      "Fetches messages from a Squish base.\n"
+      "Written by Andrew Clarke and released to the public domain.\n"
+      "\n"
+      "Usage: " PROGRAM " [-m] [-o | -i] base[.sqd] key ...\n"
+      "\n"
+      "  The keys are umsgids unless one of these is given:\n"
+      "\n"
+      "  -o   The keys are frame offsets, in decimal or 0x hex\n"
+      "  -i   The keys are MSGIDs, eg. \"2:280/464 4d3c2a1b\"\n"
+      "\n"
+      "  -m   Print the messages as mbox records, as squ2mbox would\n"
+    );
+
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+    char *sqd_fn;
+    time_t now;
+    int type, i, failures;
+
+    type = KEY_UMSGID;
+
+    while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0' && argv[1][2] == '\0' &&
+      strchr("moi", argv[1][1]) != NULL)
+    {
+        switch (argv[1][1])
+        {
+        case 'm':
+            mbox = 1;
+            break;
+        case 'o':
+            type = KEY_OFFSET;
+            break;
+        default:
+            type = KEY_MSGID;
+            break;
+        }
+
+        argc--;
+        argv++;
+    }
+
+    if (argc < 3)
+    {
+        return usage();
+    }
+
+    sq_names(argv[1], &sqd_fn, &sqi_fn);
+
+    sq = sq_open(sqd_fn);
+
+    if (sq == NULL)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s\n", sqd_fn, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (sq_read_base(sq, &sqb) != SQ_OK || sqb.sz_sqbase != SQBASE_SIZE)
+    {
+        fprintf(stderr, PROGRAM ": `%s` is not a Squish base\n", sqd_fn);
+        return EXIT_FAILURE;
+    }
+
+    /* random access; don't let the mapping read ahead */
+
+    sq_advise(sq, SQ_ADV_RANDOM);
+
+    now = time(NULL);
+    fmt.start = *gmtime(&now);
+    sqdate_cache_init(&dc);
+
+    failures = 0;
+
+    for (i = 2; i < argc; i++)
+    {
+        if (get(argv[i], type) != 0)
+        {
+            failures++;
+        }
+    }
+
+    sq_close(sq);
+    free(sqi_fn);
+    free(sqd_fn);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
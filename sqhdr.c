@@ -0,0 +1,286 @@
+/*
+ *  sqhdr.c
+ *
+ *  Builds and updates the header cache (.sqh) of Squish bases, and lists
+ *  what's in it.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  The cache is kept in base.sqh beside base.sqd; see hdrcache.c for what
+ *  it holds.  Run this after tossing to keep it up to date: only the new
+ *  messages are read.  The attributes of the messages already cached
+ *  aren't read again, so when readers have marked messages read since,
+ *  -f rebuilds the cache from scratch.  With -l the headers are listed
+ *  from the cache, one per line with tabs between the fields:
+ *
+ *  umsgid, date written, from, orig address, to, dest address, subject
+ *
+ *  With -t the people who wrote the most messages are listed instead.
+ */
+
+#define PROGRAM "sqhdr"
+#define VERSION "1.0"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "squish.h"
+#include "sqdate.h"
+#include "hdrcache.h"
+
+/* writers listed by -t */
+
+#define TOP_WRITERS 20
+
+static int quiet = 0;
+static int rebuild = 0;
+
+static char *make_filename(const char *base, const char *ext)
+{
+    char *filename;
+
+    filename = malloc(strlen(base) + strlen(ext) + 1);
+    assert(filename != NULL);
+
+    strcpy(filename, base);
+    strcat(filename, ext);
+
+    return filename;
+}
+
+/*
+ *  Brings base.sqh up to date.  Returns 0, or -1 if it couldn't be.
+ */
+
+static int update(const char *base)
+{
+    SQFILE *sq;
+    SQBASE sqb;
+    HC_RESULT res;
+    HDRCACHE hc;
+    char *sqd_fn, *sqh_fn;
+    int rc;
+
+    sqd_fn = make_filename(base, ".sqd");
+    sqh_fn = make_filename(base, ".sqh");
+
+    sq = sq_open(sqd_fn);
+
+    if (sq == NULL)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s\n", sqd_fn, strerror(errno));
+        free(sqh_fn);
+        free(sqd_fn);
+        return -1;
+    }
+
+    if (sq_read_base(sq, &sqb) != SQ_OK || sqb.sz_sqbase != SQBASE_SIZE)
+    {
+        fprintf(stderr, PROGRAM ": `%s` is not a Squish base\n", sqd_fn);
+        sq_close(sq);
+        free(sqh_fn);
+        free(sqd_fn);
+        return -1;
+    }
+
+    rc = hc_update(sqh_fn, sq, &sqb, rebuild, &res);
+
+    if (rc != 0 && res.rc != SQ_END)
+    {
+        fprintf(stderr, PROGRAM ": Frame at 0x%08lx: %s\n", res.err_ofs, sq_strerror(res.rc));
+    }
+    else if (rc != 0)
+    {
+        fprintf(stderr, PROGRAM ": Cannot write `%s`: %s\n", sqh_fn, strerror(errno));
+    }
+    else if (!quiet)
+    {
+        unsigned long count;
+
+        count = hc_open(&hc, sqh_fn) == 0 ? hc.count : 0;
+        hc_close(&hc);
+
+        switch (res.action)
+        {
+        case HC_UPTODATE:
+            printf("%s: up to date, %lu messages\n", sqh_fn, count);
+            break;
+        case HC_APPENDED:
+            printf("%s: added %lu messages, %lu in all\n", sqh_fn, res.added, count);
+            break;
+        default:
+            printf("%s: built, %lu messages\n", sqh_fn, count);
+            break;
+        }
+    }
+
+    sq_close(sq);
+    free(sqh_fn);
+    free(sqd_fn);
+
+    return rc;
+}
+
+static void list(const HDRCACHE *hc)
+{
+    SQDATE_CACHE dc;
+    char date[SQDATE_ISO_LEN];
+    unsigned long i;
+
+    sqdate_cache_init(&dc);
+
+    for (i = 0; i < hc->count; i++)
+    {
+        sqdate_fmt_iso(&dc, hc->written[i], date);
+
+        printf("%lu\t%s\t%s\t%u:%u/%u.%u\t%s\t%u:%u/%u.%u\t%s\n",
+          (unsigned long) hc->umsgid[i], date, hc_str(hc, hc->from[i]),
+          hc->orig_zone[i], hc->orig_net[i], hc->orig_node[i], hc->orig_point[i],
+          hc_str(hc, hc->to[i]),
+          hc->dest_zone[i], hc->dest_net[i], hc->dest_node[i], hc->dest_point[i],
+          hc_str(hc, hc->subj[i]));
+    }
+}
+
+static void top_writers(const HDRCACHE *hc)
+{
+    unsigned long *count, best[TOP_WRITERS], i;
+    int n, j;
+
+    count = calloc(hc->strings != 0 ? hc->strings : 1, sizeof *count);
+    assert(count != NULL);
+
+    for (i = 0; i < hc->count; i++)
+    {
+        count[hc->from[i]]++;
+    }
+
+    /* best[] holds string numbers, most messages first */
+
+    n = 0;
+
+    for (i = 0; i < hc->strings; i++)
+    {
+        if (count[i] == 0 || (n == TOP_WRITERS && count[i] <= count[best[n - 1]]))
+        {
+            continue;
+        }
+
+        if (n < TOP_WRITERS)
+        {
+            n++;
+        }
+
+        for (j = n - 1; j > 0 && count[best[j - 1]] < count[i]; j--)
+        {
+            best[j] = best[j - 1];
+        }
+
+        best[j] = i;
+    }
+
+    for (j = 0; j < n; j++)
+    {
+        printf("%8lu  %s\n", count[best[j]], hc_str(hc, best[j]));
+    }
+
+    free(count);
+}
+
+static int show(const char *base, int mode)
+{
+    HDRCACHE hc;
+    char *sqh_fn;
+
+    sqh_fn = make_filename(base, ".sqh");
+
+    if (hc_open(&hc, sqh_fn) != 0)
+    {
+        fprintf(stderr, PROGRAM ": Cannot read `%s`\n", sqh_fn);
+        free(sqh_fn);
+        return -1;
+    }
+
+    if (mode == 'l')
+    {
+        list(&hc);
+    }
+    else
+    {
+        top_writers(&hc);
+    }
+
+    hc_close(&hc);
+    free(sqh_fn);
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int mode, i, failures;
+
+    mode = 0;
+
+    while (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0' && argv[1][2] == '\0' &&
+      strchr("qflt", argv[1][1]) != NULL)
+    {
+        if (argv[1][1] == 'q')
+        {
+            quiet = 1;
+        }
+        else if (argv[1][1] == 'f')
+        {
+            rebuild = 1;
+        }
+        else
+        {
+            mode = argv[1][1];
+        }
+
+        argc--;
+        argv++;
+    }
+
+    if (argc < 2)
+    {
+        fprintf(
+          stderr,
+          PROGRAM " " VERSION "\n"
+          "\n"
+          "Builds and updates the header caches of Squish bases.\n"
+          "Written by Andrew Clarke and released to the public domain.\n"
+          "\n"
+          "Usage: " PROGRAM " [-q] [-f] [-l | -t] base ...\n"
+          "\n"
+          "  -q   Don't say what was done\n"
+          "  -f   Rebuild the cache from scratch.  The attributes of messages\n"
+          "       already cached are a snapshot taken when they were added,\n"
+          "       and aren't refreshed when a reader marks them read\n"
+          "  -l   List the headers in the cache after updating it\n"
+          "  -t   List the people who wrote the most messages\n"
+        );
+
+        return EXIT_FAILURE;
+    }
+
+    if (mode != 0)
+    {
+        quiet = 1;
+    }
+
+    failures = 0;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (update(argv[i]) != 0 || (mode != 0 && show(argv[i], mode) != 0))
+        {
+            failures++;
+        }
+    }
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
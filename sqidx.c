@@ -12,7 +12,8 @@
  *  Offset, Hash, FromName, ToName, Subject, DateTime
  *
  *  Offset: the offset in bytes to the beginning of the message frame
- *  Hash: a unique hex value of the hashed DateTime followed by the hashed FromName + ToName + Subject
+ *  Hash: the 32-bit hash of DateTime followed by the 32-bit sum of the
+ *        hashes of FromName, ToName and Subject, as 16 hex digits
  *  FromName: who wrote the message
  *  ToName: who the message is for
  *  Subject: the message subject
@@ -20,33 +21,139 @@
  *
  *  Example:
  *
- *  "4346","7e9aebf9c3a91be0e9104abd01d65","Josh Lewis","Jeff Roule","Help me","1996-06-23 01:21:20"
- *  "2498","7e9892d5506e99d85662b2ee464441be","Neil Walker","Richard Lionheart","help","1996-06-19 11:36:02"
- *  "256","7e9832a687c789c246ef9e25204ca286","Francois Blais","Leo V. Mironoff","Finished product?","1996-06-15 16:35:46"
+ *  "4346","c3a91be0abd01d65","Josh Lewis","Jeff Roule","Help me","1996-06-23 01:21:20"
+ *  "2498","506e99d8464441be","Neil Walker","Richard Lionheart","help","1996-06-19 11:36:02"
+ *  "256","87c789c2204ca286","Francois Blais","Leo V. Mironoff","Finished product?","1996-06-15 16:35:46"
+ *
+ *  The output is the same as sqidx.py's, byte for byte: names are taken
+ *  to be CP437 and written as UTF-8, quotes are doubled and backslashes
+ *  escaped, and the hashes are over the decoded characters.  sqidx.py
+ *  gives the same dates when run in UTC or a zone without summer time;
+ *  elsewhere its use of mktime() moves summer dates on by an hour, which
+ *  this doesn't copy.  There is no limit on the number of messages.  The
+ *  lines are made by csvfmt.c, which sqexport shares.
+ *
+ *  With -o the index is kept in a file instead, along with a binary
+ *  index that can be mapped into memory.  A later run adds only the
+ *  messages written since, or does nothing if the base hasn't changed.
+ *  The binary index is named after the CSV one, with .idx in place of
+ *  .csv.  It's made up of 32-bit little-endian numbers: a 64-byte header
+ *
+ *     0  "SQIX"
+ *     4  version (1)
+ *     8  record size (32)
+ *    12  number of records
+ *    16  uid, high_msg, high_water and end_frame from the SQBASE
+ *    32  frame offset and umsgid of the newest message indexed
+ *    40  size of the CSV file (low word, then high word)
+ *    48  reserved (0)
+ *
+ *  and then a 32-byte record for each message, oldest first, the
+ *  opposite order to the CSV:
+ *
+ *     0  frame offset
+ *     4  umsgid
+ *     8  DateTime, in seconds since 1970-01-01 00:00:00
+ *    12  the two halves of Hash
+ *    20  attributes
+ *    24  where the CSV line starts, in bytes back from the end of the file
+ *    28  length of the CSV line
+ *
+ *  The line offsets count from the end because new lines go at the start.
+ *
+ *  --since and --until list only the messages written between two dates.
+ *  They're found with the date index in base.sqt (see dateidx.c), which
+ *  is built or brought up to date as need be.
  */
 
 #define PROGRAM "sqidx"
-#define VERSION "1.3"
+#define VERSION "2.1"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <string.h>
-#include <ctype.h>
 #include <errno.h>
-#include <time.h>
 #include <assert.h>
 
-#define SQHDRID 0xafae4453UL
+#include "squish.h"
+#include "sqdate.h"
+#include "sqorder.h"
+#include "buf.h"
+#include "csvfmt.h"
+#include "pool.h"
+#include "checkpoint.h"
+#include "dateidx.h"
+
+/* output is written in blocks of about this size */
+
+#define OUTPUT_BUFSIZE 65536
+
+/* messages formatted by each job with -j or -p */
+
+#define CHUNK_MSGS 4096
+#define PHYSICAL_CHUNK_MSGS 16384
+
+/* the binary index written with -o */
+
+#define IDX_MAGIC   "SQIX"
+#define IDX_VERSION 1
+#define IDX_HDRSIZE 64
+#define IDX_RECSIZE 32
+
+/* what is kept about each message for the binary index */
+
+typedef struct
+{
+    unsigned long frame;
+    unsigned long umsgid;
+    unsigned long date;
+    unsigned long date_hash;
+    unsigned long name_hash;
+    unsigned long attr;
+    unsigned long line_ofs;          /* from the start of the new lines, at first */
+    unsigned long line_len;
+}
+IDXREC;
+
+/* the header of the binary index */
+
+typedef struct
+{
+    unsigned long count;
+    unsigned long uid;
+    unsigned long high_msg;
+    unsigned long high_water;
+    unsigned long end_frame;
+    unsigned long frame;
+    unsigned long umsgid;
+    unsigned long first_frame;       /* frame offset of the first record */
+    long csv_size;
+}
+IDXHDR;
 
-#define raw2ulong(x) \
-    (unsigned long) ( \
-    ((unsigned long) x[3] << 24) | ((unsigned long) x[2] << 16) | \
-    ((unsigned long) x[1] << 8) | (unsigned long) x[0])
+/* a run of messages formatted by one job */
 
-#define raw2ushort(x) \
-    (unsigned short) (((unsigned short) x[1] << 8) | (unsigned short) x[0])
+typedef struct
+{
+    POOL_JOB job;
+    const unsigned long *ofs;
+    unsigned long count;
+    unsigned long done;              /* lines formatted before any failure */
+    int rc;                          /* why message done couldn't be read */
+    BUF out;
+    IDXREC *recs;                    /* with -o, one for each message */
+}
+CHUNK;
 
-static FILE *ifp;
+static char *sqd_fn;
+static SQFILE *sq;
+static FILE *ofp;
+static int physical = 0;
+static int jobs = 1;
+static int dated = 0;
+static time_t since = -2147483647L - 1;
+static time_t until = 2147483647L;
 
 #ifdef PAUSE_ON_EXIT
 
@@ -69,223 +176,862 @@ static void pauseOnExit(void)
 
 #endif
 
-/*  strhash():
- *
- *  http://www.cs.berkeley.edu/~smcpeak/elkhound/sources/smbase/strhash.cc
- *
- *  Adapted from glib's g_str_hash().
- *  Investigation by Karl Nelson <kenelson@ece.ucdavis.edu>.
- *  Do a web search for "g_str_hash X31_HASH" if you want to know more.
- *  update: this is the same function as that described in Kernighan and Pike,
- *  "The Practice of Programming", section 2.9
+/*
+ *  Adds the index line for the message in m, whose XMSG header has been
+ *  read, to out.  If rec isn't NULL the line's details are stored there.
  */
 
-static unsigned long strhash(char * key)
+static void format_line(BUF *out, SQMSG *m, SQDATE_CACHE *dc, IDXREC *rec)
 {
-    unsigned long h;
+    CSVLINE line;
+    size_t start;
 
-    h = 0;
+    start = out->len;
 
-    if (key == NULL)
+    csv_format_line(out, &m->xmsg, m->ofs, dc, &line);
+
+    if (rec != NULL)
     {
-    	return h;
+        rec->frame = m->ofs;
+        rec->umsgid = m->xmsg.umsgid;
+        rec->date = (unsigned long) line.date & 0xffffffffUL;
+        rec->date_hash = line.date_hash;
+        rec->name_hash = line.name_hash;
+        rec->attr = m->xmsg.attr;
+        rec->line_len = (unsigned long) (out->len - start);
     }
+}
 
-    while (*key != '\0')
+static void write_buf(BUF *out)
+{
+    if (out->len != 0)
     {
-        h = (h << 5) - h + *key;  /* hash * 31 + *key */
-    	key++;
+        fwrite(out->data, out->len, 1, ofp);
+        out->len = 0;
     }
-
-    return h;
 }
 
-static char *escape_quotes(char *dest, const char *src)
+/*
+ *  Writes the lines for the frame list ending at frame_ofs, newest first.
+ *  Returns 0, or -1 if the list is broken.
+ */
+
+static int traverse_frame_list(unsigned long frame_ofs)
 {
-    while (*src != '\0')
+    SQITER it;
+    SQMSG m;
+    SQDATE_CACHE dc;
+    BUF out;
+    int rc;
+
+    sqdate_cache_init(&dc);
+    buf_init(&out);
+
+    /* traverse backwards through each frame in the base */
+
+    sq_iter_init(&it, sq, frame_ofs, 1);
+
+    while ((rc = sq_iter_next(&it, &m)) == SQ_OK)
     {
-        *dest = *src;
+        /* if this isn't a normal message frame (eg. it has been deleted),
+           skip over it */
 
-        if (*src == '\"')
+        if (m.frame.frame_type != FRAME_NORMAL)
         {
-            dest++;
-            *dest = '\"';
+            continue;
         }
-        else if (*src == '\\')
+
+        /* get from/to/subject lines and the time + date the message was
+           written */
+
+        rc = sq_read_xmsg(sq, &m);
+
+        if (rc != SQ_OK)
         {
-            dest++;
-            *dest = '\\';
+            break;
         }
 
-    	dest++;
-        src++;
+        format_line(&out, &m, &dc, NULL);
+
+        if (out.len >= OUTPUT_BUFSIZE)
+        {
+            write_buf(&out);
+        }
     }
 
-    *dest = '\0';
+    sq_iter_free(&it);
+    write_buf(&out);
+    buf_free(&out);
 
-    return dest;
+    if (rc != SQ_END && rc != SQ_OK)
+    {
+        fprintf(stderr, PROGRAM ": Frame at 0x%08lx: %s\n", m.ofs, sq_strerror(rc));
+        return -1;
+    }
+
+    return 0;
 }
 
-static void traverse_frame_list(unsigned long frame_ofs)
+static int read_header(SQFILE *in, unsigned long ofs, SQMSG *m)
 {
-    unsigned char tmp4[4], tmp2[2];
-
-    while (frame_ofs != 0)
-    {
-        unsigned long id;
-        unsigned long prev_frame;
-        unsigned short frame_type;
-        char from[37], to[37], subject[73], date[50], hash[80];
-        char escfrom[80], escto[80], escsubject[160];
-        unsigned char datewritten[4];
-        struct tm tm_msg, *tm_msg_new;
-        unsigned short idate, itime;
-        time_t msg_time;
-
-        assert(fseek(ifp, frame_ofs, SEEK_SET) == 0);
+    int rc;
 
-        /* validate this is a real frame */
+    rc = sq_read_frame(in, ofs, m);
 
-        assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-        id = raw2ulong(tmp4);
-        assert(id == SQHDRID);
+    return rc == SQ_OK ? sq_read_xmsg(in, m) : rc;
+}
 
-        /* get offset to the previous frame */
+/*
+ *  Formats the lines for one chunk.  With -p the headers are read in the
+ *  order they lie in the file, and the lines put back in list order.
+ */
 
-        assert(fseek(ifp, frame_ofs + 8, SEEK_SET) == 0);
-        assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-        prev_frame = raw2ulong(tmp4);
+static void format_chunk(void *arg)
+{
+    CHUNK *k;
+    SQFILE *in;
+    SQMSG m;
+    SQDATE_CACHE dc;
+    unsigned long i;
+    int rc;
 
-        /* if this isn't a normal message frame (eg. it has been deleted),
-           skip over it */
+    k = arg;
 
-        assert(fseek(ifp, frame_ofs + 24, SEEK_SET) == 0);
-        assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-        frame_type = raw2ushort(tmp2);
+    sqdate_cache_init(&dc);
 
-        if (frame_type == 0)
-        {
-            /* get from/to/subject lines */
+    /* a mapped file can be shared between threads; a buffered one can't */
 
-            from[sizeof from - 1] = '\0';
-            to[sizeof to - 1] = '\0';
-            subject[sizeof subject - 1] = '\0';
+    in = sq;
 
-            assert(fseek(ifp, frame_ofs + 28 + 4, SEEK_SET) == 0);
-            assert(fread(from, sizeof from - 1, 1, ifp) == 1);
-            assert(fread(to, sizeof to - 1, 1, ifp) == 1);
-            assert(fread(subject, sizeof subject - 1, 1, ifp) == 1);
+    if (in->map == NULL)
+    {
+        in = sq_open(sqd_fn);
+        assert(in != NULL);
+    }
 
-            /* get time + date the message was written */
+    k->done = k->count;
+    k->rc = SQ_OK;
 
-            assert(fseek(ifp, frame_ofs + 28 + 164, SEEK_SET) == 0);
-            assert(fread(datewritten, sizeof datewritten, 1, ifp) == 1);
+    if (physical)
+    {
+        unsigned long *order, *pos;
+        BUF tmp;
 
-            memset(&tm_msg, 0, sizeof tm_msg);
+        order = sq_physical_order(k->ofs, k->count);
+        pos = malloc(sizeof *pos * (k->count + 1) * 2);
+        assert(pos != NULL);
 
-            idate = (unsigned short)(((unsigned short)datewritten[1] << 8) | (unsigned short)datewritten[0]);
-            itime = (unsigned short)(((unsigned short)datewritten[3] << 8) | (unsigned short)datewritten[2]);
+        buf_init(&tmp);
 
-            tm_msg.tm_mday = idate & 0x1f;
-            tm_msg.tm_mon = ((idate >> 5) & 0x0f) - 1;
-            tm_msg.tm_year = ((idate >> 9) & 0x7f) + 80;
+        for (i = 0; i < k->count; i++)
+        {
+            unsigned long j;
 
-            /* fix for years prior to 1980 */
+            j = order[i];
+            pos[j * 2] = tmp.len;
+            rc = read_header(in, k->ofs[j], &m);
 
-            if (tm_msg.tm_year > 127)
+            if (rc == SQ_OK)
             {
-                tm_msg.tm_year -= 128;
+                format_line(&tmp, &m, &dc, k->recs != NULL ? &k->recs[j] : NULL);
+            }
+            else if (j < k->done)
+            {
+                k->done = j;
+                k->rc = rc;
             }
 
-            tm_msg.tm_hour = (itime >> 11) & 0x1f;
-            tm_msg.tm_min = (itime >> 5) & 0x3f;
-            tm_msg.tm_sec = (itime & 0x1f) << 1;
+            pos[j * 2 + 1] = tmp.len - pos[j * 2];
+        }
 
-            msg_time = mktime(&tm_msg);
+        buf_reserve(&k->out, tmp.len);
 
-            if (msg_time == -1)
-            {
-                msg_time = 0;
-            }
+        for (i = 0; i < k->done; i++)
+        {
+            buf_write(&k->out, tmp.data + pos[i * 2], pos[i * 2 + 1]);
+        }
 
-            tm_msg_new = localtime(&msg_time);
+        buf_free(&tmp);
+        free(pos);
+        free(order);
+    }
+    else
+    {
+        for (i = 0; i < k->count; i++)
+        {
+            rc = read_header(in, k->ofs[i], &m);
 
-            if (tm_msg_new != NULL)
+            if (rc != SQ_OK)
             {
-                strftime(date, sizeof date, "%Y-%m-%d %H:%M:%S", tm_msg_new);
+                k->done = i;
+                k->rc = rc;
+                break;
             }
-            else
+
+            format_line(&k->out, &m, &dc, k->recs != NULL ? &k->recs[i] : NULL);
+        }
+    }
+
+    if (in != sq)
+    {
+        sq_close(in);
+    }
+}
+
+/*
+ *  Formats the lines for the messages in list with a pool of threads and
+ *  writes them out in order.  If recs isn't NULL the details of each line
+ *  are stored there too.  Returns SQ_END, or the error that stopped it
+ *  with the offset of the bad frame in *err_ofs.
+ */
+
+static int format_list(const SQOFS *list, IDXREC *recs, unsigned long *err_ofs)
+{
+    POOL *pool;
+    CHUNK *chunks;
+    unsigned long n, nchunks, chunk_msgs, i, submitted;
+    int rc, failed;
+
+    n = list->count;
+    chunk_msgs = physical ? PHYSICAL_CHUNK_MSGS : CHUNK_MSGS;
+    nchunks = (n + chunk_msgs - 1) / chunk_msgs;
+
+    chunks = malloc(sizeof *chunks * (nchunks != 0 ? nchunks : 1));
+    assert(chunks != NULL);
+
+    for (i = 0; i < nchunks; i++)
+    {
+        chunks[i].ofs = list->ofs + i * chunk_msgs;
+        chunks[i].count = i + 1 < nchunks ? chunk_msgs : n - i * chunk_msgs;
+        chunks[i].recs = recs != NULL ? recs + i * chunk_msgs : NULL;
+        buf_init(&chunks[i].out);
+    }
+
+    if (physical)
+    {
+        sq_advise(sq, SQ_ADV_SEQUENTIAL);
+    }
+
+    pool = pool_new(jobs > 1 ? jobs : 0, 0);
+
+    submitted = 0;
+    failed = 0;
+    rc = SQ_END;
+
+    /* once a message can't be read, stop where the serial walk would, but
+       let the chunks already started finish */
+
+    for (i = 0; i < submitted || (!failed && i < nchunks); i++)
+    {
+        while (!failed && submitted < nchunks && submitted < i + (unsigned long) jobs * 2)
+        {
+            pool_submit(pool, &chunks[submitted].job, format_chunk, &chunks[submitted]);
+            submitted++;
+        }
+
+        pool_wait_job(pool, &chunks[i].job);
+
+        if (!failed)
+        {
+            write_buf(&chunks[i].out);
+
+            if (chunks[i].done != chunks[i].count)
             {
-                *date = '\0';
+                failed = 1;
+                rc = chunks[i].rc;
+                *err_ofs = chunks[i].ofs[chunks[i].done];
             }
+        }
+
+        buf_free(&chunks[i].out);
+    }
+
+    pool_free(pool);
+    free(chunks);
+
+    return rc;
+}
+
+/*
+ *  The same as traverse_frame_list() with -j or -p: the frame headers are
+ *  walked first to collect the offsets, then the lines are formatted by
+ *  format_list().  Returns 0, or -1 if the list is broken.
+ */
+
+static int traverse_parallel(unsigned long frame_ofs)
+{
+    SQOFS list;
+    unsigned long err_ofs, fmt_err_ofs;
+    int rc, fmt_rc;
+
+    sq_ofs_init(&list);
+
+    rc = sq_collect(sq, frame_ofs, 1, SQ_COLLECT_SKIP, &list, &err_ofs);
+    fmt_rc = format_list(&list, NULL, &fmt_err_ofs);
+
+    if (fmt_rc != SQ_END)
+    {
+        rc = fmt_rc;
+        err_ofs = fmt_err_ofs;
+    }
+
+    sq_ofs_free(&list);
+
+    if (rc != SQ_END)
+    {
+        fprintf(stderr, PROGRAM ": Frame at 0x%08lx: %s\n", err_ofs, sq_strerror(rc));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ *  With --since or --until: the messages written in the range are found
+ *  with the date index in base.sqt and formatted by format_list(), newest
+ *  first like the rest.  Returns 0, or -1 if the list is broken.
+ */
+
+static int traverse_dated(const SQBASE *sqb, const char *base)
+{
+    DATEIDX di;
+    DI_RESULT res;
+    SQOFS list;
+    char *sqt_fn;
+    unsigned long err_ofs, fmt_err_ofs, i, t;
+    int rc, fmt_rc;
+
+    sqt_fn = malloc(strlen(base) + 5);
+    assert(sqt_fn != NULL);
+    sprintf(sqt_fn, "%s.sqt", base);
+
+    sq_ofs_init(&list);
+
+    if (di_update(&di, sqt_fn, sq, sqb, &res) != 0)
+    {
+        rc = res.rc;
+        err_ofs = res.err_ofs;
+    }
+    else
+    {
+        if (!res.saved)
+        {
+            fprintf(stderr, PROGRAM ": Cannot write `%s`: %s\n", sqt_fn, strerror(errno));
+        }
+
+        rc = di_collect(&di, sq, DI_WRITTEN, since, until, &list, NULL, &err_ofs);
+        di_free(&di);
+    }
+
+    for (i = 0; i < list.count / 2; i++)
+    {
+        t = list.ofs[i];
+        list.ofs[i] = list.ofs[list.count - 1 - i];
+        list.ofs[list.count - 1 - i] = t;
+    }
+
+    fmt_rc = format_list(&list, NULL, &fmt_err_ofs);
+
+    if (fmt_rc != SQ_END)
+    {
+        rc = fmt_rc;
+        err_ofs = fmt_err_ofs;
+    }
+
+    sq_ofs_free(&list);
+    free(sqt_fn);
+
+    if (rc != SQ_END)
+    {
+        fprintf(stderr, PROGRAM ": Frame at 0x%08lx: %s\n", err_ofs, sq_strerror(rc));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ *  Reads the header of the binary index idx_fn into hdr.  Returns 0, or
+ *  -1 if there isn't one or it doesn't match its records or the CSV.
+ */
+
+static int read_idx_header(const char *idx_fn, const char *csv_fn, IDXHDR *hdr)
+{
+    FILE *fp;
+    unsigned char buf[IDX_HDRSIZE + 4];
+    size_t len;
+    long csv_size;
+
+    fp = fopen(idx_fn, "rb");
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    len = fread(buf, 1, sizeof buf, fp);
+    fclose(fp);
+
+    if (len < IDX_HDRSIZE || memcmp(buf, IDX_MAGIC, 4) != 0 || r2ul(buf + 4) != IDX_VERSION ||
+      r2ul(buf + 8) != IDX_RECSIZE)
+    {
+        return -1;
+    }
+
+    hdr->count = r2ul(buf + 12);
+    hdr->uid = r2ul(buf + 16);
+    hdr->high_msg = r2ul(buf + 20);
+    hdr->high_water = r2ul(buf + 24);
+    hdr->end_frame = r2ul(buf + 28);
+    hdr->frame = r2ul(buf + 32);
+    hdr->umsgid = r2ul(buf + 36);
+    hdr->csv_size = (long) r2ul(buf + 40);
 
-            /* calculate hashes of the date & (from + to + subject) */
+    if (sizeof(long) > 4)
+    {
+        hdr->csv_size |= (long) r2ul(buf + 44) << 16 << 16;
+    }
+
+    hdr->first_frame = hdr->count != 0 && len == sizeof buf ? r2ul(buf + IDX_HDRSIZE) : 0;
+
+    csv_size = ckpt_file_size(csv_fn);
+
+    if (csv_size != hdr->csv_size || (hdr->count != 0 && len != sizeof buf) ||
+      ckpt_file_size(idx_fn) != IDX_HDRSIZE + (long) hdr->count * IDX_RECSIZE)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int write_idx_header(FILE *fp, const IDXHDR *hdr)
+{
+    unsigned char buf[IDX_HDRSIZE];
+
+    memset(buf, 0, sizeof buf);
+    memcpy(buf, IDX_MAGIC, 4);
+    put_ul(buf + 4, IDX_VERSION);
+    put_ul(buf + 8, IDX_RECSIZE);
+    put_ul(buf + 12, hdr->count);
+    put_ul(buf + 16, hdr->uid);
+    put_ul(buf + 20, hdr->high_msg);
+    put_ul(buf + 24, hdr->high_water);
+    put_ul(buf + 28, hdr->end_frame);
+    put_ul(buf + 32, hdr->frame);
+    put_ul(buf + 36, hdr->umsgid);
+    put_ul(buf + 40, (unsigned long) hdr->csv_size & 0xffffffffUL);
+    put_ul(buf + 44, sizeof(long) > 4 ? (unsigned long) (hdr->csv_size >> 16 >> 16) : 0);
+
+    return fseek(fp, 0, SEEK_SET) == 0 && fwrite(buf, sizeof buf, 1, fp) == 1 ? 0 : -1;
+}
+
+/*
+ *  Writes the records for the n new messages in recs, which are newest
+ *  first, to fp oldest first.
+ */
+
+static int write_idx_records(FILE *fp, const IDXREC *recs, unsigned long n)
+{
+    unsigned char buf[IDX_RECSIZE];
+    unsigned long i;
+
+    for (i = n; i-- > 0; )
+    {
+        put_ul(buf, recs[i].frame);
+        put_ul(buf + 4, recs[i].umsgid);
+        put_ul(buf + 8, recs[i].date);
+        put_ul(buf + 12, recs[i].date_hash);
+        put_ul(buf + 16, recs[i].name_hash);
+        put_ul(buf + 20, recs[i].attr);
+        put_ul(buf + 24, recs[i].line_ofs);
+        put_ul(buf + 28, recs[i].line_len);
+
+        if (fwrite(buf, sizeof buf, 1, fp) != 1)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ *  Copies what's left of ifp to ofp.  Returns 0, or -1 on an error.
+ */
+
+static int copy_file(FILE *ifp, FILE *ofp)
+{
+    char buf[OUTPUT_BUFSIZE];
+    size_t len;
+
+    while ((len = fread(buf, 1, sizeof buf, ifp)) != 0)
+    {
+        if (fwrite(buf, len, 1, ofp) != 1)
+        {
+            return -1;
+        }
+    }
+
+    return ferror(ifp) ? -1 : 0;
+}
+
+/*
+ *  Writes the lines for the messages in list, which are newest first, to
+ *  tmp_fn followed by the old CSV in csv_fn if append is set.  Fills in
+ *  recs and hdr->csv_size.  Returns 0, or -1 on an error, which has been
+ *  reported.
+ */
+
+static int write_csv(const char *csv_fn, const char *tmp_fn, const SQOFS *list, IDXREC *recs,
+  int append, IDXHDR *hdr)
+{
+    FILE *ifp;
+    unsigned long i, pos, err_ofs;
+    int rc, failed;
+
+    ofp = fopen(tmp_fn, "wb");
 
-            sprintf(hash, "%08lx%08lx", strhash(date), strhash(from) + strhash(to) + strhash(subject));
+    if (ofp == NULL)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for writing: %s\n", tmp_fn, strerror(errno));
+        return -1;
+    }
+
+    rc = format_list(list, recs, &err_ofs);
+    failed = 0;
+
+    if (rc != SQ_END)
+    {
+        fprintf(stderr, PROGRAM ": Frame at 0x%08lx: %s\n", err_ofs, sq_strerror(rc));
+        failed = 1;
+    }
+
+    if (!failed && append)
+    {
+        ifp = fopen(csv_fn, "rb");
+        failed = ifp == NULL || copy_file(ifp, ofp) != 0;
+
+        if (ifp != NULL)
+        {
+            fclose(ifp);
+        }
+    }
 
-            /* "FrameOfs","Hash","From","To","Subject","Date" */
+    if (!failed)
+    {
+        hdr->csv_size = ftell(ofp);
+        failed = ferror(ofp) != 0;
+    }
 
-            escape_quotes(escfrom, from);
-            escape_quotes(escto, to);
-            escape_quotes(escsubject, subject);
+    if (fclose(ofp) != 0)
+    {
+        failed = 1;
+    }
 
-            printf(
-              "\"" "%lu" "\","
-              "\"" "%s" "\","
-              "\"" "%s" "\","
-              "\"" "%s" "\","
-              "\"" "%s" "\","
-              "\"" "%s" "\""
-              "\n", frame_ofs, hash, escfrom, escto, escsubject, date
-            );
+    ofp = stdout;
 
+    if (failed)
+    {
+        if (rc == SQ_END)
+        {
+            fprintf(stderr, PROGRAM ": Error writing `%s`: %s\n", tmp_fn, strerror(errno));
         }
-        frame_ofs = prev_frame;
+
+        remove(tmp_fn);
+        return -1;
+    }
+
+    /* the new lines are at the start, before any old ones */
+
+    pos = 0;
+
+    for (i = 0; i < list->count; i++)
+    {
+        recs[i].line_ofs = (unsigned long) hdr->csv_size - pos;
+        pos += recs[i].line_len;
     }
+
+    return 0;
 }
 
-static void get_sqbase(char *base)
+/*
+ *  -o: brings the CSV index in csv_fn and the binary index beside it up
+ *  to date.  Messages after the newest one indexed are added at the start
+ *  of the CSV and the end of the binary index.  Everything is indexed
+ *  afresh if the files are missing or don't match each other, if that
+ *  message is gone, or if anything older has been deleted.  Returns 0, or
+ *  -1 if the base couldn't be read or the files written.
+ */
+
+static int update_index(const SQBASE *sqb, const char *csv_fn)
 {
-    char sqd_fn[250];
-    unsigned short sz_sqbase;
-    unsigned char tmp4[4], tmp2[2];
-    unsigned long frame_ofs;
+    IDXHDR hdr;
+    CHECKPOINT ck;
+    SQOFS list;
+    IDXREC *recs;
+    FILE *fp;
+    char *idx_fn, *tmp_fn;
+    unsigned long ofs, err_ofs, i;
+    size_t len;
+    int rc, append, failed;
+
+    len = strlen(csv_fn);
+
+    idx_fn = malloc(len + 5);
+    tmp_fn = malloc(len + 5);
+    assert(idx_fn != NULL && tmp_fn != NULL);
+
+    strcpy(idx_fn, csv_fn);
+
+    if (len > 4 && strcmp(idx_fn + len - 4, ".csv") == 0)
+    {
+        idx_fn[len - 4] = '\0';
+    }
+
+    strcat(idx_fn, ".idx");
+
+    memset(&hdr, 0, sizeof hdr);
+
+    append = read_idx_header(idx_fn, csv_fn, &hdr) == 0;
+
+    if (append && hdr.uid == sqb->uid && hdr.high_msg == sqb->high_msg &&
+      hdr.high_water == sqb->high_water && hdr.end_frame == sqb->end_frame)
+    {
+        /* nothing has changed */
+
+        free(tmp_fn);
+        free(idx_fn);
+        return 0;
+    }
+
+    ck.frame = append ? hdr.frame : 0;
+    ck.umsgid = append ? hdr.umsgid : 0;
+    ck.uid = append ? hdr.uid : 0;
+    ck.high_water = append ? hdr.high_water : 0;
+    ck.msgs = append ? hdr.count : 0;
+
+    append = append && ckpt_resume(&ck, sq, sqb, &ofs) &&
+      (hdr.count == 0 || hdr.first_frame == sqb->first_frame);
+
+    sq_ofs_init(&list);
+
+    rc = sq_collect(sq, append ? ofs : sqb->first_frame, 0, SQ_COLLECT_SKIP, &list, &err_ofs);
+
+    /* if older messages have been deleted it has to start again */
+
+    if (rc == SQ_END && append && hdr.count + list.count != sqb->num_msg)
+    {
+        append = 0;
+        sq_ofs_free(&list);
+        rc = sq_collect(sq, sqb->first_frame, 0, SQ_COLLECT_SKIP, &list, &err_ofs);
+    }
+
+    if (rc != SQ_END)
+    {
+        fprintf(stderr, PROGRAM ": Frame at 0x%08lx: %s\n", err_ofs, sq_strerror(rc));
+        sq_ofs_free(&list);
+        free(tmp_fn);
+        free(idx_fn);
+        return -1;
+    }
+
+    if (!append)
+    {
+        hdr.count = 0;
+    }
+
+    /* the CSV is newest first */
+
+    for (i = 0; i < list.count / 2; i++)
+    {
+        ofs = list.ofs[i];
+        list.ofs[i] = list.ofs[list.count - 1 - i];
+        list.ofs[list.count - 1 - i] = ofs;
+    }
+
+    recs = malloc(sizeof *recs * (list.count != 0 ? list.count : 1));
+    assert(recs != NULL);
+
+    sprintf(tmp_fn, "%s.tmp", csv_fn);
+
+    failed = write_csv(csv_fn, tmp_fn, &list, recs, append, &hdr) != 0;
+
+    if (!failed && rename(tmp_fn, csv_fn) != 0)
+    {
+        fprintf(stderr, PROGRAM ": Cannot rename `%s`: %s\n", tmp_fn, strerror(errno));
+        remove(tmp_fn);
+        failed = 1;
+    }
+
+    if (!failed)
+    {
+        /* add the new records in place, or write a new file if starting
+           again; either way a header that doesn't match the records or
+           the CSV means starting again next time */
+
+        hdr.uid = sqb->uid;
+        hdr.high_msg = sqb->high_msg;
+        hdr.high_water = sqb->high_water;
+        hdr.end_frame = sqb->end_frame;
+
+        if (list.count != 0)
+        {
+            hdr.frame = recs[0].frame;
+            hdr.umsgid = recs[0].umsgid;
+        }
+        else if (hdr.count == 0)
+        {
+            hdr.frame = 0;
+            hdr.umsgid = 0;
+        }
+
+        sprintf(tmp_fn, "%s.tmp", idx_fn);
+
+        fp = fopen(append ? idx_fn : tmp_fn, append ? "r+b" : "wb");
+
+        failed = fp == NULL ||
+          fseek(fp, IDX_HDRSIZE + (long) hdr.count * IDX_RECSIZE, SEEK_SET) != 0 ||
+          write_idx_records(fp, recs, list.count) != 0;
+
+        hdr.count += list.count;
+
+        if (fp != NULL)
+        {
+            failed |= write_idx_header(fp, &hdr) != 0;
+            failed |= fclose(fp) != 0;
+        }
+
+        if (!failed && !append)
+        {
+            failed = rename(tmp_fn, idx_fn) != 0;
+        }
+
+        if (failed)
+        {
+            fprintf(stderr, PROGRAM ": Error writing `%s`: %s\n", idx_fn, strerror(errno));
+
+            if (!append)
+            {
+                remove(tmp_fn);
+            }
+        }
+    }
+
+    free(recs);
+    sq_ofs_free(&list);
+    free(tmp_fn);
+    free(idx_fn);
+
+    return failed ? -1 : 0;
+}
+
+static int get_sqbase(char *base, const char *csv_fn)
+{
+    SQBASE sqb;
+    int rc;
+
+    sqd_fn = malloc(strlen(base) + 5);
+    assert(sqd_fn != NULL);
 
     strcpy(sqd_fn, base);
     strcat(sqd_fn, ".sqd");
 
-    ifp = fopen(sqd_fn, "rb");
+    sq = sq_open(sqd_fn);
 
-    if (ifp == NULL)
+    if (sq == NULL)
     {
-        fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s", sqd_fn, strerror(errno));
-        return;
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s\n", sqd_fn, strerror(errno));
+        free(sqd_fn);
+        return -1;
     }
 
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    sz_sqbase = raw2ushort(tmp2);
-    assert(sz_sqbase == 256);
+    assert(sq_read_base(sq, &sqb) == SQ_OK);
+    assert(sqb.sz_sqbase == 256);
 
-    /* get offset to the last message frame in the base */
+    rc = 0;
 
-    assert(fseek(ifp, 108, SEEK_SET) == 0);
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    frame_ofs = raw2ulong(tmp4);
+    /* start from the last message frame in the base */
 
-    /* traverse backwards through each frame in the base */
+    if (csv_fn != NULL)
+    {
+        rc = update_index(&sqb, csv_fn);
+    }
+    else if (dated)
+    {
+        rc = traverse_dated(&sqb, base);
+    }
+    else if (physical || jobs > 1)
+    {
+        rc = traverse_parallel(sqb.last_frame);
+    }
+    else
+    {
+        rc = traverse_frame_list(sqb.last_frame);
+    }
 
-    traverse_frame_list(frame_ofs);
+    sq_close(sq);
+    free(sqd_fn);
 
-    fclose(ifp);
+    return rc;
 }
 
 int main(int argc, char **argv)
 {
+    char *csv_fn;
+
 #ifdef PAUSE_ON_EXIT
     pauseOnExit();
 #endif
 
-    if (argc != 2)
+    ofp = stdout;
+    csv_fn = NULL;
+
+    for (;;)
+    {
+        if (argc > 2 && strcmp(argv[1], "-p") == 0)
+        {
+            physical = 1;
+            argc--;
+            argv++;
+        }
+        else if (argc > 3 && strcmp(argv[1], "-j") == 0)
+        {
+            jobs = atoi(argv[2]);
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 3 && strcmp(argv[1], "-o") == 0)
+        {
+            csv_fn = argv[2];
+            argc -= 2;
+            argv += 2;
+        }
+        else if (argc > 3 && (strcmp(argv[1], "--since") == 0 ||
+          strcmp(argv[1], "--until") == 0))
+        {
+            int end;
+
+            end = argv[1][2] == 'u';
+
+            if (sqdate_parse(argv[2], end, end ? &until : &since) != 0)
+            {
+                fprintf(stderr, PROGRAM ": Bad date `%s`; use YYYY-MM-DD [HH:MM[:SS]]\n",
+                  argv[2]);
+                return EXIT_FAILURE;
+            }
+
+            dated = 1;
+            argc -= 2;
+            argv += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (argc != 2 || jobs < 1 || (dated && csv_fn != NULL))
     {
         fprintf(
           stderr,
@@ -293,7 +1039,19 @@ int main(int argc, char **argv)
           "\n"
           "Create indexes from a Squish message base.\n"
           "Written in 2003 by Andrew Clarke and released to the public domain.\n"
-          "\n" "Usage: " PROGRAM " base\n"
+          "\n" "Usage: " PROGRAM " [-p] [-j jobs] [-o index.csv] base\n"
+          "       " PROGRAM " [-p] [-j jobs] [--since date] [--until date] base\n"
+          "\n"
+          "  -p   Read the headers in the order they lie in the file rather\n"
+          "       than list order; the index is the same either way\n"
+          "  -j   Format the lines with this many threads\n"
+          "  -o   Keep the index in this file, with a binary index in the\n"
+          "       .idx file beside it, and only add new messages to it\n"
+          "\n"
+          "  --since, --until\n"
+          "       Only list messages written on or after, or on or before,\n"
+          "       this date (YYYY-MM-DD [HH:MM[:SS]]), found with the date\n"
+          "       index in base.sqt\n"
         );
 
         return EXIT_FAILURE;
@@ -301,7 +1059,5 @@ int main(int argc, char **argv)
 
     argv++;
 
-    get_sqbase(*argv);
-
-    return 0;
+    return get_sqbase(*argv, csv_fn) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
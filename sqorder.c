@@ -0,0 +1,271 @@
+/*
+ *  sqorder.c
+ *
+ *  Collects the frame offsets of a Squish base so that the frames can be
+ *  read in the order they lie in the file.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  After years of tossing, purging and packing, the frame list of a busy
+ *  base jumps all over the .sqd, and following it means a seek for every
+ *  message on a cold cache.  The offsets can be had cheaply, either from
+ *  the .sqi or by walking the list reading only the 28-byte frame
+ *  headers.  Sorted by offset they give an order in which the messages
+ *  can be read with one pass over the file; the caller puts its output
+ *  back in list order afterwards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#if defined(HAVE_MMAP) || defined(HAVE_FADVISE)
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_FADVISE
+#include <fcntl.h>
+#endif
+
+#include "sqorder.h"
+
+void sq_ofs_init(SQOFS *list)
+{
+    list->ofs = NULL;
+    list->count = 0;
+    list->size = 0;
+}
+
+void sq_ofs_add(SQOFS *list, unsigned long ofs)
+{
+    if (list->count == list->size)
+    {
+        list->size = list->size != 0 ? list->size * 2 : 1024;
+        list->ofs = realloc(list->ofs, sizeof *list->ofs * list->size);
+        assert(list->ofs != NULL);
+    }
+
+    list->ofs[list->count++] = ofs;
+}
+
+void sq_ofs_free(SQOFS *list)
+{
+    free(list->ofs);
+    sq_ofs_init(list);
+}
+
+/*
+ *  Walks the frame list from ofs, reading only the frame headers, and
+ *  adds the offset of each message frame to list.  Without
+ *  SQ_COLLECT_SKIP the walk stops at the first frame that isn't a message.
+ *  Returns SQ_END, or the error that stopped the walk with the offset of
+ *  the bad frame in *err_ofs.
+ */
+
+int sq_collect(SQFILE *sq, unsigned long ofs, int backwards, int flags, SQOFS *list,
+  unsigned long *err_ofs)
+{
+    SQITER it;
+    SQMSG m;
+    int rc;
+
+    sq_iter_init(&it, sq, ofs, backwards);
+
+    while ((rc = sq_iter_next(&it, &m)) == SQ_OK)
+    {
+        if (m.frame.frame_type != FRAME_NORMAL)
+        {
+            if (flags & SQ_COLLECT_SKIP)
+            {
+                continue;
+            }
+
+            rc = SQ_END;
+            break;
+        }
+
+        if (flags & SQ_COLLECT_CHECK)
+        {
+            rc = sq_check_msg(sq, &m);
+
+            if (rc != SQ_OK)
+            {
+                break;
+            }
+        }
+
+        sq_ofs_add(list, m.ofs);
+    }
+
+    if (rc != SQ_END)
+    {
+        *err_ofs = m.ofs;
+    }
+
+    sq_iter_free(&it);
+
+    return rc;
+}
+
+/*
+ *  Adds the frame offsets listed in the .sqi filename to list, in index
+ *  (umsgid) order.  Returns 0, or -1 if the file can't be read.  Nothing
+ *  here checks that the offsets are any good.
+ */
+
+int sq_read_sqi(const char *filename, SQOFS *list)
+{
+    FILE *fp;
+    unsigned char rec[SQIDX_SIZE];
+
+    fp = fopen(filename, "rb");
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    while (fread(rec, sizeof rec, 1, fp) == 1)
+    {
+        sq_ofs_add(list, r2ul(rec));
+    }
+
+    if (ferror(fp))
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+
+    return 0;
+}
+
+typedef struct
+{
+    unsigned long ofs;
+    unsigned long index;
+}
+ORDER;
+
+static int cmp_ofs(const void *a, const void *b)
+{
+    const ORDER *x, *y;
+
+    x = a;
+    y = b;
+
+    return x->ofs < y->ofs ? -1 : x->ofs > y->ofs ? 1 : 0;
+}
+
+/*
+ *  Returns a malloc()ed array of the indexes of ofs[0..count) sorted by
+ *  offset, ie. the order to read them in.
+ */
+
+unsigned long *sq_physical_order(const unsigned long *ofs, unsigned long count)
+{
+    ORDER *o;
+    unsigned long *order, i;
+
+    o = malloc(sizeof *o * (count != 0 ? count : 1));
+    order = malloc(sizeof *order * (count != 0 ? count : 1));
+    assert(o != NULL && order != NULL);
+
+    for (i = 0; i < count; i++)
+    {
+        o[i].ofs = ofs[i];
+        o[i].index = i;
+    }
+
+    qsort(o, (size_t) count, sizeof *o, cmp_ofs);
+
+    for (i = 0; i < count; i++)
+    {
+        order[i] = o[i].index;
+    }
+
+    free(o);
+
+    return order;
+}
+
+static int cmp_found(const void *a, const void *b)
+{
+    const SQFOUND *x, *y;
+
+    x = a;
+    y = b;
+
+    if (x->umsgid != y->umsgid)
+    {
+        return x->umsgid < y->umsgid ? -1 : 1;
+    }
+
+    return x->ofs < y->ofs ? -1 : x->ofs > y->ofs ? 1 : 0;
+}
+
+/*
+ *  Puts found[0..*count) in umsgid order, which is the order Squish
+ *  keeps messages in, and drops all but the first in the file of any
+ *  umsgid found more than once, updating *count.  Returns how many were
+ *  dropped.
+ */
+
+unsigned long sq_umsgid_order(SQFOUND *found, unsigned long *count)
+{
+    unsigned long i, n;
+
+    if (*count == 0)
+    {
+        return 0;
+    }
+
+    qsort(found, (size_t) *count, sizeof *found, cmp_found);
+
+    for (i = n = 1; i < *count; i++)
+    {
+        if (found[i].umsgid != found[n - 1].umsgid)
+        {
+            found[n++] = found[i];
+        }
+    }
+
+    i = *count - n;
+    *count = n;
+
+    return i;
+}
+
+/*
+ *  Tells the system how sq is about to be read, so it can read ahead
+ *  further (SQ_ADV_SEQUENTIAL) or not bother (SQ_ADV_RANDOM).  Needs
+ *  HAVE_MMAP for mapped files and HAVE_FADVISE for the others.
+ */
+
+void sq_advise(SQFILE *sq, int advice)
+{
+#ifdef HAVE_MMAP
+    if (sq->map != NULL)
+    {
+#if defined(MADV_SEQUENTIAL) && defined(MADV_RANDOM)
+        madvise((void *) sq->map, (size_t) sq->size, advice == SQ_ADV_SEQUENTIAL ?
+          MADV_SEQUENTIAL : advice == SQ_ADV_RANDOM ? MADV_RANDOM : MADV_NORMAL);
+#endif
+        return;
+    }
+#endif
+
+#ifdef HAVE_FADVISE
+    posix_fadvise(fileno(sq->fp), 0, 0, advice == SQ_ADV_SEQUENTIAL ?
+      POSIX_FADV_SEQUENTIAL : advice == SQ_ADV_RANDOM ? POSIX_FADV_RANDOM :
+      POSIX_FADV_NORMAL);
+#else
+    (void) sq;
+    (void) advice;
+#endif
+}
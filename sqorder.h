@@ -0,0 +1,65 @@
+/*
+ *  sqorder.h
+ *
+ *  Collects the frame offsets of a Squish base so that the frames can be
+ *  read in the order they lie in the file.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __SQORDER_H__
+#define __SQORDER_H__
+
+#include "squish.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* a list of frame offsets, in frame list order */
+
+typedef struct
+{
+    unsigned long *ofs;
+    unsigned long count;
+    unsigned long size;
+}
+SQOFS;
+
+/* a message found by searching a file rather than walking a list */
+
+typedef struct
+{
+    unsigned long umsgid;
+    unsigned long ofs;               /* of its frame header */
+}
+SQFOUND;
+
+/* flags for sq_collect() */
+
+#define SQ_COLLECT_SKIP  1  /* skip frames that aren't FRAME_NORMAL, rather than stop */
+#define SQ_COLLECT_CHECK 2  /* stop at messages that run past the end of the file */
+
+/* access patterns for sq_advise() */
+
+#define SQ_ADV_NORMAL     0
+#define SQ_ADV_SEQUENTIAL 1
+#define SQ_ADV_RANDOM     2
+
+void sq_ofs_init(SQOFS *list);
+void sq_ofs_add(SQOFS *list, unsigned long ofs);
+void sq_ofs_free(SQOFS *list);
+
+int sq_collect(SQFILE *sq, unsigned long ofs, int backwards, int flags, SQOFS *list,
+  unsigned long *err_ofs);
+int sq_read_sqi(const char *filename, SQOFS *list);
+unsigned long *sq_physical_order(const unsigned long *ofs, unsigned long count);
+unsigned long sq_umsgid_order(SQFOUND *found, unsigned long *count);
+void sq_advise(SQFILE *sq, int advice);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
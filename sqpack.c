@@ -0,0 +1,434 @@
+/*
+ *  sqpack.c
+ *
+ *  Packs Squish message bases, dropping free frames and slack.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  The stored messages are copied, in frame list order, into a new base
+ *  with frames exactly their size and no free list, and a new .sqi to
+ *  match (see sqwrite.c).  Umsgids and everything else in the SQBASE are
+ *  kept, so lastread pointers and replies still point where they did.
+ *
+ *  First the frame list is walked reading only the frame headers.  Then
+ *  the messages are copied a chunk at a time: a chunk is as many messages
+ *  in a row in the list as come to CHUNK_SIZE bytes, and they're read
+ *  into the chunk buffer in the order they lie in the file (sqorder.c),
+ *  so that on a base fragmented by years of tossing and purging the old
+ *  file is still read mostly sequentially, and then written out in list
+ *  order.  The new file is written sequentially too, so neither file is
+ *  sought about in much, and the memory used is the chunk buffer and an
+ *  offset per message whatever the size of the base.
+ *
+ *  The new files replace the old ones only once they're complete and
+ *  synced, and only if the old SQBASE hasn't changed meanwhile, which
+ *  would mean something wrote to the base while it was being packed.
+ *  Nothing else should use a base while it's packed, all the same.
+ */
+
+#define PROGRAM "sqpack"
+#define VERSION "1.0"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "squish.h"
+#include "buf.h"
+#include "areas.h"
+#include "sqorder.h"
+#include "sqwrite.h"
+
+/* messages are copied this many bytes at a time */
+
+#define CHUNK_SIZE 8388608UL
+
+static int quiet = 0;
+static int force = 0;
+
+/*
+ *  Reads the raw SQBASE of filename into p.  Returns 0, or -1 if it
+ *  can't.
+ */
+
+static int read_raw_base(const char *filename, unsigned char *p)
+{
+    FILE *fp;
+    int rc;
+
+    fp = fopen(filename, "rb");
+
+    if (fp == NULL)
+    {
+        return -1;
+    }
+
+    rc = fread(p, SQBASE_SIZE, 1, fp) == 1 ? 0 : -1;
+    fclose(fp);
+
+    return rc;
+}
+
+/*
+ *  Returns 1 if the message in the frame f has room for its XMSG and
+ *  control info, which sqw_add() needs, as it copies msg_len bytes.
+ */
+
+static int lengths_fit(const SQFRAME *f)
+{
+    return f->msg_len >= SQXMSG_SIZE && f->ctrl_len <= f->msg_len - SQXMSG_SIZE;
+}
+
+/*
+ *  Copies the messages at ofs[0..count), with their frame headers, to w.
+ *  Returns 0, -1 with errno set if a write failed, or 1 if a message
+ *  checked by pack() can't be read now, so the base has changed.
+ */
+
+static int copy_chunk(SQFILE *sq, SQWRITER *w, const unsigned long *ofs, unsigned long count,
+  BUF *chunk, size_t *pos)
+{
+    unsigned long *order, i;
+    int rc;
+
+    order = sq_physical_order(ofs, count);
+    chunk->len = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        SQMSG m;
+        const unsigned char *p;
+        unsigned long n;
+
+        n = order[i];
+
+        if (sq_read_frame(sq, ofs[n], &m) != SQ_OK || !lengths_fit(&m.frame) ||
+          (p = sq_read(sq, ofs[n], SQFRAME_SIZE + m.frame.msg_len)) == NULL)
+        {
+            free(order);
+            return 1;
+        }
+
+        pos[n] = chunk->len;
+        buf_write(chunk, p, (size_t) (SQFRAME_SIZE + m.frame.msg_len));
+    }
+
+    free(order);
+
+    rc = 0;
+
+    for (i = 0; i < count && rc == 0; i++)
+    {
+        const unsigned char *p;
+        SQFRAME f;
+        SQXMSG x;
+
+        p = (const unsigned char *) chunk->data + pos[i];
+        sq_decode_frame(&f, p);
+        sq_decode_xmsg(&x, p + SQFRAME_SIZE);
+
+        rc = sqw_add(w, &x, p + SQFRAME_SIZE, f.msg_len, f.ctrl_len);
+    }
+
+    return rc;
+}
+
+/*
+ *  Packs the base in filename.  Returns 0, or 1 if it couldn't be packed.
+ */
+
+static int pack(const char *filename)
+{
+    SQFILE *sq;
+    SQBASE sqb;
+    SQOFS list;
+    SQWRITER w;
+    BUF chunk;
+    unsigned char before[SQBASE_SIZE], after[SQBASE_SIZE];
+    unsigned long err_ofs, packed_size, old_size, i, start, len;
+    size_t *pos;
+    char *sqi_fn;
+    int rc;
+
+    sq = sq_open(filename);
+
+    if (sq == NULL)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s\n", filename,
+          strerror(errno));
+        return 1;
+    }
+
+    if (read_raw_base(filename, before) != 0 || sq_read_base(sq, &sqb) != SQ_OK ||
+      sqb.sz_sqbase != SQBASE_SIZE || sqb.sz_sqhdr != SQFRAME_SIZE)
+    {
+        fprintf(stderr, PROGRAM ": `%s` is not a Squish base\n", filename);
+        sq_close(sq);
+        return 1;
+    }
+
+    /* the offsets, and the size the packed base will be */
+
+    sq_ofs_init(&list);
+    rc = sq_collect(sq, sqb.first_frame, 0, SQ_COLLECT_CHECK, &list, &err_ofs);
+
+    if (rc != SQ_END || list.count != sqb.num_msg)
+    {
+        if (rc != SQ_END)
+        {
+            fprintf(stderr, PROGRAM ": %s: frame at 0x%08lx: %s\n", filename, err_ofs,
+              sq_strerror(rc));
+        }
+        else
+        {
+            fprintf(stderr, PROGRAM ": %s: the frame list has %lu messages but num_msg is %lu\n",
+              filename, list.count, sqb.num_msg);
+        }
+
+        fprintf(stderr, PROGRAM ": %s: not packed; check it with sqfsck\n", filename);
+        sq_ofs_free(&list);
+        sq_close(sq);
+        return 1;
+    }
+
+    /* and the messages must be whole, or the packed base would be
+       broken the same way */
+
+    packed_size = SQBASE_SIZE;
+
+    for (i = 0; i < list.count; i++)
+    {
+        SQMSG m;
+
+        rc = sq_read_frame(sq, list.ofs[i], &m);
+
+        if (rc != SQ_OK || !lengths_fit(&m.frame))
+        {
+            if (rc != SQ_OK)
+            {
+                fprintf(stderr, PROGRAM ": %s: frame at 0x%08lx: %s\n", filename, list.ofs[i],
+                  sq_strerror(rc));
+            }
+            else
+            {
+                fprintf(stderr, PROGRAM ": %s: frame at 0x%08lx: msg_len %lu has no room for "
+                  "the XMSG and %lu bytes of control info\n", filename, list.ofs[i],
+                  m.frame.msg_len, m.frame.ctrl_len);
+            }
+
+            fprintf(stderr, PROGRAM ": %s: not packed; check it with sqfsck, or recover it "
+              "with sqsalvage\n", filename);
+            sq_ofs_free(&list);
+            sq_close(sq);
+            return 1;
+        }
+
+        packed_size += SQFRAME_SIZE + m.frame.msg_len;
+    }
+
+    old_size = sq->size;
+
+    if (!force && packed_size == old_size && sqb.first_free_frame == 0)
+    {
+        if (!quiet)
+        {
+            printf("%s: %lu messages, already packed\n", filename, list.count);
+        }
+
+        sq_ofs_free(&list);
+        sq_close(sq);
+        return 0;
+    }
+
+    sq_names(filename, NULL, &sqi_fn);
+
+    if (sqw_open(&w, filename, sqi_fn, &sqb) != 0)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s.tmp` for writing: %s\n", filename,
+          strerror(errno));
+        free(sqi_fn);
+        sq_ofs_free(&list);
+        sq_close(sq);
+        return 1;
+    }
+
+    buf_init(&chunk);
+    pos = malloc(sizeof *pos * (list.count != 0 ? list.count : 1));
+    assert(pos != NULL);
+
+    sq_advise(sq, SQ_ADV_SEQUENTIAL);
+
+    rc = 0;
+    start = 0;
+    len = 0;
+
+    for (i = 0; i < list.count && rc == 0; i++)
+    {
+        SQMSG m;
+
+        if (sq_read_frame(sq, list.ofs[i], &m) != SQ_OK)
+        {
+            rc = 1;
+            break;
+        }
+
+        len += SQFRAME_SIZE + m.frame.msg_len;
+
+        if (len >= CHUNK_SIZE || i + 1 == list.count)
+        {
+            rc = copy_chunk(sq, &w, list.ofs + start, i + 1 - start, &chunk, pos + start);
+            start = i + 1;
+            len = 0;
+        }
+    }
+
+    free(pos);
+    buf_free(&chunk);
+    sq_ofs_free(&list);
+    sq_close(sq);
+
+    if (rc == -1)
+    {
+        fprintf(stderr, PROGRAM ": Error writing `%s.tmp`: %s\n", filename, strerror(errno));
+        sqw_abort(&w);
+        free(sqi_fn);
+        return 1;
+    }
+
+    /* a message that was checked but can't be read again means the same
+       as a changed SQBASE */
+
+    if (rc != 0 || read_raw_base(filename, after) != 0 ||
+      memcmp(before, after, SQBASE_SIZE) != 0)
+    {
+        fprintf(stderr, PROGRAM ": %s: the base changed while it was being packed; not "
+          "packed\n", filename);
+        sqw_abort(&w);
+        free(sqi_fn);
+        return 1;
+    }
+
+    if (sqw_close(&w) != 0)
+    {
+        fprintf(stderr, PROGRAM ": Error writing `%s`: %s\n", filename, strerror(errno));
+        free(sqi_fn);
+        return 1;
+    }
+
+    if (!quiet)
+    {
+        printf("%s: %lu messages, %lu bytes, was %lu (saved %lu)\n", filename,
+          sqb.num_msg, packed_size, old_size, old_size - packed_size);
+    }
+
+    free(sqi_fn);
+
+    return 0;
+}
+
+static int usage(void)
+{
+    fprintf(
+      stderr,
+      PROGRAM " " VERSION "\n"
+      "\n"
+      "Packs Squish message bases, dropping free frames and slack.\n"
+      "Written by Andrew Clarke and released to the public domain.\n"
+      "\n"
+      "Usage: " PROGRAM " [-q] [-f] base[.sqd] ...\n"
+      "       " PROGRAM " [-q] [-f] -c config\n"
+      "\n"
+      "  -q         Only report errors\n"
+      "  -f         Rewrite bases that are already packed\n"
+      "  -c config  Pack every Squish area in this Husky fidoconfig or\n"
+      "             areas file\n"
+      "\n"
+      "  Nothing else may use a base while it's packed.\n"
+    );
+
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+    const char *config;
+    unsigned long failures;
+    int i;
+
+    config = NULL;
+
+    while (argc > 1 && argv[1][0] == '-')
+    {
+        if (strcmp(argv[1], "-q") == 0 || strcmp(argv[1], "-f") == 0)
+        {
+            if (argv[1][1] == 'q')
+            {
+                quiet = 1;
+            }
+            else
+            {
+                force = 1;
+            }
+
+            argc--;
+            argv++;
+        }
+        else if (strcmp(argv[1], "-c") == 0 && argc > 2)
+        {
+            config = argv[2];
+            argc -= 2;
+            argv += 2;
+        }
+        else
+        {
+            return usage();
+        }
+    }
+
+    if (config != NULL ? argc != 1 : argc < 2)
+    {
+        return usage();
+    }
+
+    failures = 0;
+
+    if (config != NULL)
+    {
+        AREALIST list;
+
+        areas_init(&list);
+
+        if (areas_read(&list, config) != 0)
+        {
+            fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s\n", config,
+              strerror(errno));
+            return EXIT_FAILURE;
+        }
+
+        for (i = 0; i < list.count; i++)
+        {
+            char *fn;
+
+            sq_names(list.areas[i].path, &fn, NULL);
+            failures += (unsigned long) pack(fn);
+            free(fn);
+        }
+
+        areas_free(&list);
+    }
+    else
+    {
+        for (i = 1; i < argc; i++)
+        {
+            char *fn;
+
+            sq_names(argv[i], &fn, NULL);
+            failures += (unsigned long) pack(fn);
+            free(fn);
+        }
+    }
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,425 @@
+/*
+ *  sqsalvage.c
+ *
+ *  Recovers the messages of a Squish base whose frame list is broken, by
+ *  looking for frames in the raw .sqd, and writes them to a new base.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  The file is read once from start to end, SCAN_BLOCK bytes at a time,
+ *  with memchr() finding each byte that could start the frame id (the C
+ *  library's memchr() is the fastest search there is on most systems,
+ *  and most bytes of a base aren't 'S').  Each place the four bytes of
+ *  SQHDRID turn up is a candidate, and is kept only if it looks like a
+ *  stored message:
+ *
+ *     - the frame type is normal; free frames hold deleted messages
+ *     - msg_len has room for the XMSG and ctrl_len, is no more than
+ *       frame_len, and the message ends inside the file
+ *     - the umsgid isn't 0, the names, subject and date are text, and
+ *       the date and time written, if set, are real ones
+ *     - the control info, if any, starts with a kludge or is an empty
+ *       string, a lone nul
+ *     - it doesn't start inside a message already kept, where it would be
+ *       a copy of a frame id in some message's text
+ *
+ *  The messages kept are put in umsgid order, which is the order Squish
+ *  keeps them in, and written to a new base with a fresh frame list, no
+ *  free frames, and a matching .sqi (sqwrite.c).  If two have the same
+ *  umsgid only the first in the file is kept.  Everything else in the
+ *  SQBASE is copied from the old one if that's still readable.
+ */
+
+#define PROGRAM "sqsalvage"
+#define VERSION "1.0"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "squish.h"
+#include "sqorder.h"
+#include "sqwrite.h"
+
+/* the file is searched this many bytes at a time */
+
+#define SCAN_BLOCK 4194304UL
+
+/* why a candidate wasn't kept */
+
+#define R_TYPE   0
+#define R_LEN    1
+#define R_XMSG   2
+#define R_INSIDE 3
+#define R_DUP    4
+#define R_COUNT  5
+
+static const char * const reasons[R_COUNT] =
+{
+    "weren't normal frames",
+    "had impossible lengths",
+    "had headers that weren't plausible",
+    "were inside other messages",
+    "repeated an umsgid"
+};
+
+typedef struct
+{
+    SQFOUND *found;                  /* the messages that will be recovered */
+    unsigned long count;
+    unsigned long size;
+    unsigned long candidates;
+    unsigned long rejected[R_COUNT];
+    unsigned long covered;           /* where the last message kept ends */
+}
+SCAN;
+
+/*
+ *  Returns -1 if there's a stored message at ofs, or the reason there
+ *  isn't.
+ */
+
+static int check(SQFILE *sq, unsigned long ofs, SQMSG *m)
+{
+    const SQFRAME *f;
+    const unsigned char *p;
+
+    if (sq_read_frame(sq, ofs, m) != SQ_OK)
+    {
+        return R_LEN;
+    }
+
+    f = &m->frame;
+
+    if (f->frame_type != FRAME_NORMAL)
+    {
+        return R_TYPE;
+    }
+
+    if (f->msg_len > f->frame_len || f->msg_len < SQXMSG_SIZE ||
+      f->ctrl_len > f->msg_len - SQXMSG_SIZE || sq_check_msg(sq, m) != SQ_OK)
+    {
+        return R_LEN;
+    }
+
+    if (sq_read_xmsg(sq, m) != SQ_OK)
+    {
+        return R_LEN;
+    }
+
+    if (!sq_xmsg_plausible(&m->xmsg))
+    {
+        return R_XMSG;
+    }
+
+    if (f->ctrl_len != 0)
+    {
+        p = sq_read(sq, ofs + SQFRAME_SIZE + SQXMSG_SIZE, 1);
+
+        if (p == NULL || (*p != '\001' && *p != '\0'))
+        {
+            return R_XMSG;
+        }
+    }
+
+    return -1;
+}
+
+static void keep(SCAN *s, const SQMSG *m)
+{
+    if (s->count == s->size)
+    {
+        s->size = s->size != 0 ? s->size * 2 : 1024;
+        s->found = realloc(s->found, sizeof *s->found * s->size);
+        assert(s->found != NULL);
+    }
+
+    s->found[s->count].umsgid = m->xmsg.umsgid;
+    s->found[s->count].ofs = m->ofs;
+    s->count++;
+
+    s->covered = m->ofs + SQFRAME_SIZE + m->frame.msg_len;
+}
+
+/*
+ *  Finds the frame ids in the whole of sq and keeps the ones that are
+ *  stored messages.
+ */
+
+static void scan(SQFILE *sq, SCAN *s)
+{
+    SQOFS cand;
+    unsigned long pos, i;
+
+    sq_ofs_init(&cand);
+    sq_advise(sq, SQ_ADV_SEQUENTIAL);
+
+    for (pos = 0; pos < sq->size; pos += SCAN_BLOCK)
+    {
+        const unsigned char *data, *p, *end;
+        unsigned long len;
+
+        /* the blocks overlap by three bytes, so a frame id that straddles
+           two of them is found in the first */
+
+        len = sq->size - pos < SCAN_BLOCK + 3 ? sq->size - pos : SCAN_BLOCK + 3;
+        data = sq_read(sq, pos, len);
+
+        if (data == NULL)
+        {
+            break;
+        }
+
+        cand.count = 0;
+        p = data;
+        end = data + len;
+
+        while (end - p >= 4 && (p = memchr(p, 0x53, (size_t) (end - p - 3))) != NULL)
+        {
+            if (p[1] == 0x44 && p[2] == 0xae && p[3] == 0xaf &&
+              pos + (unsigned long) (p - data) >= SQBASE_SIZE)
+            {
+                sq_ofs_add(&cand, pos + (unsigned long) (p - data));
+            }
+
+            p++;
+        }
+
+        /* with the data in a buffer rather than mapped, reading a frame
+           overwrites it, so the candidates are only looked at now */
+
+        for (i = 0; i < cand.count; i++)
+        {
+            SQMSG m;
+            int why;
+
+            s->candidates++;
+
+            if (cand.ofs[i] < s->covered)
+            {
+                s->rejected[R_INSIDE]++;
+                continue;
+            }
+
+            why = check(sq, cand.ofs[i], &m);
+
+            if (why != -1)
+            {
+                s->rejected[why]++;
+                continue;
+            }
+
+            keep(s, &m);
+        }
+    }
+
+    sq_ofs_free(&cand);
+}
+
+/*
+ *  Prints how far the old frame list gets, for comparison.
+ */
+
+static void walk_list(SQFILE *sq, const SQBASE *sqb)
+{
+    SQITER it;
+    SQMSG m;
+    unsigned long n;
+    int rc;
+
+    n = 0;
+    sq_iter_init(&it, sq, sqb->first_frame, 0);
+
+    while ((rc = sq_iter_next(&it, &m)) == SQ_OK && m.frame.frame_type == FRAME_NORMAL &&
+      (rc = sq_check_msg(sq, &m)) == SQ_OK)
+    {
+        n++;
+    }
+
+    sq_iter_free(&it);
+
+    if (rc == SQ_END)
+    {
+        printf("  the frame list holds %lu messages, and is intact\n", n);
+    }
+    else if (rc == SQ_OK)
+    {
+        printf("  the frame list reaches %lu messages, then a frame of type %u at 0x%08lx\n",
+          n, m.frame.frame_type, m.ofs);
+    }
+    else
+    {
+        printf("  the frame list reaches %lu messages, then at 0x%08lx: %s\n", n, m.ofs,
+          sq_strerror(rc));
+    }
+}
+
+static int write_base(SQFILE *sq, const SQBASE *sqb, const SCAN *s, const char *sqd_fn,
+  const char *sqi_fn)
+{
+    SQWRITER w;
+    unsigned long i;
+
+    if (sqw_open(&w, sqd_fn, sqi_fn, sqb) != 0)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for writing: %s\n", sqd_fn,
+          strerror(errno));
+        return -1;
+    }
+
+    sq_advise(sq, SQ_ADV_NORMAL);
+
+    for (i = 0; i < s->count; i++)
+    {
+        SQMSG m;
+        const unsigned char *p;
+
+        /* checked by the scan, so these can't fail */
+
+        sq_read_frame(sq, s->found[i].ofs, &m);
+        sq_read_xmsg(sq, &m);
+        p = sq_read(sq, m.ofs + SQFRAME_SIZE, m.frame.msg_len);
+        assert(p != NULL);
+
+        if (sqw_add(&w, &m.xmsg, p, m.frame.msg_len, m.frame.ctrl_len) != 0)
+        {
+            fprintf(stderr, PROGRAM ": Error writing `%s`: %s\n", sqd_fn, strerror(errno));
+            sqw_abort(&w);
+            return -1;
+        }
+    }
+
+    if (sqw_close(&w) != 0)
+    {
+        fprintf(stderr, PROGRAM ": Error writing `%s`: %s\n", sqd_fn, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int usage(void)
+{
+    fprintf(
+      stderr,
+      PROGRAM " " VERSION "\n"
+      "\n"
+      "Recovers the messages of a damaged Squish base into a new one.\n"
+      "Written by Andrew Clarke and released to the public domain.\n"
+      "\n"
+      "Usage: " PROGRAM " [-n] base[.sqd] newbase[.sqd]\n"
+      "\n"
+      "  The .sqd is searched for frames instead of following its frame\n"
+      "  list, and the messages found are written to newbase.sqd and\n"
+      "  newbase.sqi, which mustn't exist already.\n"
+      "\n"
+      "  -n   Only report what would be recovered\n"
+    );
+
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+    SQFILE *sq;
+    SQBASE sqb;
+    SCAN s;
+    FILE *fp;
+    char *sqd_fn, *sqi_fn, *new_sqd_fn, *new_sqi_fn;
+    int dry_run, have_base, i, rc;
+
+    dry_run = 0;
+
+    if (argc > 1 && strcmp(argv[1], "-n") == 0)
+    {
+        dry_run = 1;
+        argc--;
+        argv++;
+    }
+
+    if (argc != 3)
+    {
+        return usage();
+    }
+
+    sq_names(argv[1], &sqd_fn, &sqi_fn);
+    sq_names(argv[2], &new_sqd_fn, &new_sqi_fn);
+
+    if (!dry_run)
+    {
+        fp = fopen(new_sqd_fn, "rb");
+
+        if (fp == NULL)
+        {
+            fp = fopen(new_sqi_fn, "rb");
+        }
+
+        if (fp != NULL)
+        {
+            fclose(fp);
+            fprintf(stderr, PROGRAM ": Output base `%s` already exists. Delete it before "
+              "continuing.\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    sq = sq_open(sqd_fn);
+
+    if (sq == NULL)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s\n", sqd_fn, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    have_base = sq_read_base(sq, &sqb) == SQ_OK && sqb.sz_sqbase == SQBASE_SIZE &&
+      sqb.sz_sqhdr == SQFRAME_SIZE;
+
+    memset(&s, 0, sizeof s);
+    scan(sq, &s);
+    s.rejected[R_DUP] += sq_umsgid_order(s.found, &s.count);
+
+    printf("%s: %lu frame ids found, %lu messages recovered\n", sqd_fn, s.candidates,
+      s.count);
+
+    for (i = 0; i < R_COUNT; i++)
+    {
+        if (s.rejected[i] != 0)
+        {
+            printf("  %lu %s\n", s.rejected[i], reasons[i]);
+        }
+    }
+
+    if (have_base)
+    {
+        walk_list(sq, &sqb);
+    }
+    else
+    {
+        printf("  the SQBASE is damaged; the new one will be blank\n");
+    }
+
+    rc = EXIT_SUCCESS;
+
+    if (!dry_run)
+    {
+        if (write_base(sq, have_base ? &sqb : NULL, &s, new_sqd_fn, new_sqi_fn) == 0)
+        {
+            printf("%s: %lu messages written\n", new_sqd_fn, s.count);
+        }
+        else
+        {
+            rc = EXIT_FAILURE;
+        }
+    }
+
+    free(s.found);
+    sq_close(sq);
+    free(new_sqi_fn);
+    free(new_sqd_fn);
+    free(sqi_fn);
+    free(sqd_fn);
+
+    return rc;
+}
@@ -0,0 +1,130 @@
+"""sqtest has what the check scripts share: a writer for small Squish
+bases laid out frame by frame, and a way to run the programs and count
+what passed.
+
+Written by Andrew Clarke and released to the public domain."""
+
+
+import os
+import struct
+import subprocess
+
+
+SQHDRID = 0xafae4453
+SQFRAME_SIZE = 28
+SQXMSG_SIZE = 238
+
+FRAME_NORMAL = 0
+FRAME_FREE = 1
+
+BIN = "."
+failures = 0
+
+
+class Msg:
+    """
+    A message to put in a frame.  ctl is its control info as stored,
+    nul and all, and txt its text.  msg_len, if given, is what the frame
+    header claims instead of the real length.
+    """
+
+    def __init__(self, umsgid, ctl=None, txt=b"hello\r", msg_len=None):
+        if ctl is None:
+            ctl = b"\x01MSGID: 1:2/3 %08x\0" % umsgid
+
+        self.umsgid = umsgid
+        self.ctl = ctl
+        self.txt = txt
+        self.msg_len = msg_len
+
+
+def xmsg(umsgid):
+    x = struct.pack("<L", 0)
+    x += b"Bob".ljust(36, b"\0") + b"All".ljust(36, b"\0") + b"Hi".ljust(72, b"\0")
+    x += struct.pack("<8H", 1, 2, 3, 0, 1, 2, 4, 0)
+    x += struct.pack("<5H", 0x5a21, 0x6000, 0x5a21, 0x6000, 0)
+    x += struct.pack("<L", 0) + b"\0" * 36 + struct.pack("<L", umsgid)
+    x += b"01 Jan 25  12:00:00".ljust(20, b"\0")
+    return x
+
+
+def make_base(path, msgs, links=None, free=(), pad_to=None):
+    """
+    Writes a base holding a message for each of msgs, one after another;
+    a plain umsgid stands for Msg(umsgid).  links gives each frame's
+    (next, prev) as frame numbers, or None for 0; without it the frames
+    not in free make up the stored list, and those in free the free
+    list, each in file order.  Either way the first frame of each list
+    heads it and the last ends it.  The file is padded with nuls to
+    pad_to bytes.  Returns the frame offsets.
+    """
+
+    msgs = [m if isinstance(m, Msg) else Msg(m) for m in msgs]
+    stored = [i for i in range(len(msgs)) if i not in free]
+    free = list(free)
+
+    if links is None:
+        links = [None] * len(msgs)
+
+        for chain in (stored, free):
+            for j, i in enumerate(chain):
+                links[i] = (chain[j + 1] if j + 1 < len(chain) else None,
+                  chain[j - 1] if j > 0 else None)
+
+    ofs = []
+    end = 256
+
+    for m in msgs:
+        ofs.append(end)
+        end += SQFRAME_SIZE + SQXMSG_SIZE + len(m.ctl) + len(m.txt)
+
+    def at(n):
+        return 0 if n is None else ofs[n]
+
+    data = b""
+
+    for i, m in enumerate(msgs):
+        body = xmsg(m.umsgid) + m.ctl + m.txt
+        nxt, prv = links[i]
+        frame_type = FRAME_FREE if i in free else FRAME_NORMAL
+        msg_len = m.msg_len if m.msg_len is not None else len(body)
+        data += struct.pack("<6L2H", SQHDRID, at(nxt), at(prv), len(body), msg_len,
+          len(m.ctl), frame_type, 0)
+        data += body
+
+    high = max(m.umsgid for m in msgs)
+
+    base = struct.pack("<2H5L", 256, 0, len(stored), len(stored), 0, high + 1, high + 1)
+    base += os.path.basename(path).encode().ljust(80, b"\0")[:80]
+    base += struct.pack("<5L", at(stored[0]) if stored else 0, at(stored[-1]) if stored else 0,
+      at(free[0]) if free else 0, at(free[-1]) if free else 0, end)
+    base += struct.pack("<L2H", 0, 0, SQFRAME_SIZE)
+    base += b"\0" * (256 - len(base))
+
+    with open(path, "wb") as f:
+        f.write(base + data)
+
+        if pad_to is not None:
+            f.write(b"\0" * (pad_to - len(base) - len(data)))
+
+    return ofs
+
+
+def run(*args):
+    cmd = [os.path.join(BIN, args[0])] + list(args[1:])
+    p = subprocess.run(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE, timeout=60)
+    return p.returncode, p.stdout.decode("latin-1"), p.stderr.decode("latin-1")
+
+
+def check(what, ok):
+    global failures
+
+    print("%-4s %s" % ("ok" if ok else "FAIL", what))
+
+    if not ok:
+        failures += 1
+
+
+def count_lines(path, prefix):
+    with open(path, "rb") as f:
+        return sum(1 for line in f if line.startswith(prefix))
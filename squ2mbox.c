@@ -9,6 +9,117 @@
  *  ChangeLog
  *  ---------
  *
+ *  1.25 2026-10-17:
+ *
+ *	Bug fix: a .gz or .zst output filename picked a compression this
+ *	build didn't have, and left an empty file.  It's now refused.
+ *
+ *	Bug fix: a conversion that stopped at a bad frame still said
+ *	"Finished." and exited 0.  It now says the output is incomplete
+ *	and exits non-zero, as it did when a bad frame tripped an assert.
+ *
+ *  1.24 2026-10-17:
+ *
+ *	Added -m, which writes a Maildir instead of an mbox: a file per
+ *	message, named from its MSGID so that running it again only adds
+ *	the messages that aren't there yet (see maildir.c).  The files are
+ *	written by a pool of threads, 4 unless -j says otherwise, so that
+ *	the time taken to create them overlaps.  With -s each batch of
+ *	files is synced to disk before it's moved into the Maildir, with
+ *	one sync of the directory per batch rather than one per file.
+ *
+ *  1.23 2026-10-17:
+ *
+ *	Added --from, --to, --subj, --orig, --dest and --attr to convert
+ *	only the messages whose headers match (see filter.c).  They're
+ *	tested on the XMSG alone, so a message that doesn't match costs
+ *	one header read and its control info and text are never read.
+ *
+ *  1.22 2026-10-17:
+ *
+ *	Added --since and --until to convert only the messages written
+ *	between two dates.  They're found with the sparse date index in
+ *	base.sqt (see dateidx.c), which is built on first use and brought
+ *	up to date on later ones, so only the part of the base around the
+ *	dates is read.  Messages keep the numbers they'd have in a full
+ *	conversion.
+ *
+ *  1.21 2026-10-17:
+ *
+ *	The rendering of messages has moved to mboxfmt.c so that other
+ *	tools can share it.  The output is unchanged.
+ *
+ *  1.20 2026-10-17:
+ *
+ *	Added -p, which reads the messages in the order they lie in the
+ *	.sqd instead of following the frame list, with the offsets taken
+ *	from the .sqi when it agrees with the frame list.
+ *
+ *  1.19 2026-10-16:
+ *
+ *	Dates are worked out with the arithmetic in sqdate.c instead of
+ *	mktime() and gmtime(), so the time zone of the machine running the
+ *	conversion no longer shifts them.  The Date header carries the
+ *	message's TZUTC offset, and the "From " line is in UTC.  Messages
+ *	with no DOS date fall back on the ASCII date.
+ *
+ *  1.18 2026-10-16:
+ *
+ *	The mbox can be written compressed with gzip or zstd (-z, or a
+ *	.gz or .zst output filename).  Compression runs in a thread of
+ *	its own alongside the conversion.
+ *
+ *  1.17 2026-10-16:
+ *
+ *	Added -a, which records how far the conversion got in a checkpoint
+ *	file next to the mbox and on later runs appends only the messages
+ *	added since.  The mbox is rebuilt if the base has been packed or
+ *	renumbered in the meantime.
+ *
+ *  1.16 2026-10-16:
+ *
+ *	Message text, From, To and Subject are converted to UTF-8 from the
+ *	character set given by the CHRS kludge (CP437 if there isn't one),
+ *	and labelled as such.  -7 gives the old =NNN escaping and -8 writes
+ *	the text unconverted with its character set in the Content-Type.
+ *
+ *  1.15 2026-10-16:
+ *
+ *	Message text is filtered a span at a time instead of a character at
+ *	a time, using SSE2/AVX2 where available to find line ends and bytes
+ *	that need escaping.
+ *
+ *  1.14 2026-10-16:
+ *
+ *	Control info is split with the single-pass kludge parser in
+ *	kludge.c instead of strtok() and repeated strcat() calls.
+ *
+ *  1.13 2026-10-16:
+ *
+ *	Added -c to convert every Squish area listed in a Husky fidoconfig
+ *	or areas file, several areas at once (see -j), with a summary at
+ *	the end.
+ *
+ *  1.12 2026-10-16:
+ *
+ *	Added -j to convert using several threads. Messages are rendered
+ *	into buffers in chunks and the chunks written out in order, so the
+ *	output is the same as a single-threaded run. Message IDs generated
+ *	for messages without a MSGID are now based on the message number.
+ *	Define HAVE_PTHREAD to enable threads.
+ *
+ *  1.11 2026-10-16:
+ *
+ *	Use the shared reader in squish.c.
+ *
+ *  1.10 2026-10-16:
+ *
+ *	Read each message with a single call instead of a dozen or so
+ *	fseek()/fread() calls. Define HAVE_MMAP to map the .sqd into memory
+ *	and decode frames straight from the mapping; if the file can't be
+ *	mapped, buffered reads are used instead. Frames that point past the
+ *	end of the file are reported instead of read.
+ *
  *  1.9  2002-10-30:
  *
  *	Bug fix: squ2mbox was not generating a date in the correct format for
@@ -61,9 +172,7 @@
  */
 
 #define PROGRAM "squ2mbox"
-#define VERSION "1.9"
-#define HOSTNAME "localhost"
-#define USERNAME "fidonet"
+#define VERSION "1.25"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -77,20 +186,96 @@
 #include <console.h>
 #endif
 
-#define SQHDRID 0xafae4453UL
+#include "squish.h"
+#include "buf.h"
+#include "pool.h"
+#include "areas.h"
+#include "checkpoint.h"
+#include "outfile.h"
+#include "sqdate.h"
+#include "sqorder.h"
+#include "mboxfmt.h"
+#include "dateidx.h"
+#include "filter.h"
+#include "maildir.h"
+
+/* output is written in blocks of about this size */
+
+#define OUTPUT_BUFSIZE 65536
+
+/* messages per chunk in parallel mode, and in physical order mode */
+
+#define CHUNK_MSGS 256
+#define PHYSICAL_CHUNK_MSGS 16384
+
+/* threads writing a Maildir, unless -j says otherwise */
+
+#define MAILDIR_WRITERS 4
+
+/* one conversion of a .sqd to an mbox */
+
+typedef struct
+{
+    char *sqd_filename;
+    char *mbox_filename;
+    SQFILE *sq;
+    OUTFILE *ofp;
+    int maildir;                   /* write a Maildir instead (-m) */
+    int sync;                      /* ... synced a batch at a time (-s) */
+    MAILDIR *md;                   /* ... which is this, while converting */
+    int jobs;                      /* threads to render messages with */
+    int physical;                  /* read frames in file order (-p) */
+    int quiet;                     /* don't show progress */
+    int format;                    /* OUT_RAW, OUT_GZIP or OUT_ZSTD */
+    int append;                    /* carry on from the checkpoint (-a) */
+    int resumed;                   /* ... and did so */
+    int dated;                     /* only messages written since..until */
+    time_t since, until;
+    const FILTER *filter;          /* only messages that pass, or NULL */
+    unsigned long start_ofs;       /* first frame not yet converted, if resumed */
+    unsigned long base_num;        /* messages converted by earlier runs */
+    SQBASE sqb;
+    unsigned long total_msgs;      /* num_msg from the SQBASE */
+    unsigned long msgs;            /* messages converted */
+    unsigned long skipped;         /* ... and already in the Maildir */
+    int write_errno;               /* why a Maildir couldn't be written, or 0 */
+    unsigned long last_ofs;        /* last frame converted, or 0 */
+    unsigned long last_umsgid;
+    int rc;                        /* SQ_OK, or why the conversion stopped */
+    char error[400];
+}
+CONVERT;
+
+/* how messages are rendered; -7 and -8 set the text mode */
+
+static MBOXFMT fmt = { MBOX_UTF8, 0, PROGRAM " " VERSION, { 0 }, 0 };
+
+/* write Maildirs instead of mboxes (-m), synced a batch at a time (-s) */
 
-#define raw2ulong(x) \
-    (unsigned long) ( \
-    ((unsigned long) x[3] << 24) | ((unsigned long) x[2] << 16) | \
-    ((unsigned long) x[1] << 8) | (unsigned long) x[0])
+static int maildir = 0;
+static int sync_batches = 0;
 
-#define raw2ushort(x) \
-    (unsigned short) (((unsigned short) x[1] << 8) | (unsigned short) x[0])
+/* only add new messages to existing mboxes (-a) */
 
-FILE *ifp, *ofp;
+static int incremental = 0;
 
-static int output_ctl_lines = 0;
-static int strip_high_bit = 1;
+/* read frames in file order (-p) */
+
+static int physical = 0;
+
+/* compress the mbox (-z); -1 means go by the filename */
+
+static int out_fmt = -1;
+
+/* convert only messages written in this range (--since, --until) */
+
+static int dated = 0;
+static time_t since = -2147483647L - 1;
+static time_t until = 2147483647L;
+
+/* convert only messages whose headers match (--from, --to etc.) */
+
+static FILTER filter;
 
 #ifdef PAUSE_ON_EXIT
 
@@ -113,427 +298,964 @@ static void pauseOnExit(void)
 
 #endif
 
-static char *gen_msgid(void)
+static void write_buf(CONVERT *c, BUF *out)
 {
-    static int MsgIdPfx = 'A';
-    static char buf[127];
-    static int fakepid = 0;
-    time_t now;
-    struct tm *tm;
-
-    now = time(NULL);
-    tm = gmtime(&now);
-
-    sprintf(buf, "%d%02d%02d%02d%02d%02d.G%c%d@%s",
-        tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour,
-        tm->tm_min, tm->tm_sec, (char) MsgIdPfx, fakepid, HOSTNAME);
+    if (out->len != 0)
+    {
+        assert(out_write(c->ofp, out->data, out->len) == 0);
+        out->len = 0;
+    }
+}
 
-    fakepid++;
+static void progress(CONVERT *c, unsigned long msg_num)
+{
+    if (!c->quiet)
+    {
+        printf("%lu/%lu\r", msg_num, c->total_msgs);
+    }
+}
 
-    MsgIdPfx = (MsgIdPfx == 'Z') ? 'A' : MsgIdPfx + 1;
+static void frame_error(CONVERT *c, unsigned long frame_ofs, int rc)
+{
+    c->rc = rc;
 
-    return buf;
+    if (!c->quiet)
+    {
+        fprintf(stderr, "\n" PROGRAM ": Frame at 0x%08lx: %s\n", frame_ofs, sq_strerror(rc));
+    }
 }
 
-static void escape_msgid_reply(char *p)
+static void traverse_frame_list(CONVERT *c, unsigned long frame_ofs)
 {
-    while (*p != '\0')
+    SQITER it;
+    SQMSG m;
+    SQDATE_CACHE dc;
+    BUF out;
+    int rc;
+
+    buf_init(&out);
+    sqdate_cache_init(&dc);
+
+    sq_iter_init(&it, c->sq, frame_ofs, 0);
+
+    while ((rc = sq_iter_next(&it, &m)) == SQ_OK)
     {
-        if (*p == '@')
+        progress(c, c->base_num + it.count);
+
+        if (m.frame.frame_type != FRAME_NORMAL)
         {
-            *p = '#';
+            break;
         }
-        else if (*p == ' ')
+
+        rc = sq_read_msg(c->sq, &m);
+
+        if (rc != SQ_OK)
         {
-            *p = '@';
+            break;
         }
-        p++;
+
+        mbox_format(&out, &fmt, &m, c->base_num + it.count, &dc);
+        c->msgs++;
+        c->last_ofs = m.ofs;
+        c->last_umsgid = m.xmsg.umsgid;
+
+        if (out.len >= OUTPUT_BUFSIZE)
+        {
+            write_buf(c, &out);
+        }
+    }
+
+    sq_iter_free(&it);
+    write_buf(c, &out);
+    buf_free(&out);
+
+    if (rc != SQ_END && rc != SQ_OK)
+    {
+        frame_error(c, m.ofs, rc);
     }
 }
 
-static void output_msg_txt(char *str, unsigned long msg_num)
+/*
+ *  Parallel conversion.  The frame list is walked once reading only the
+ *  frame headers, to collect the offset of every message.  The offsets are
+ *  then cut into chunks which are rendered by a pool of worker threads,
+ *  each into its own buffer, and the buffers are written out in order.
+ *  Only a few chunks per thread are in flight at once, so memory use is
+ *  bounded no matter how big the base is.
+ *
+ *  In physical order mode (-p) the offsets come from the .sqi if it
+ *  matches the frame list, the chunks are much bigger, and the messages
+ *  in each chunk are rendered in the order they lie in the file and then
+ *  put back in list order (see sqorder.c).
+ */
+
+typedef struct
 {
-    static int got_origin = 0;
-    static unsigned long old_msg_num = 0;
-    char *p;
+    POOL_JOB job;
+    CONVERT *c;
+    const unsigned long *ofs;      /* offsets of the frames in this chunk */
+    unsigned long count;
+    unsigned long first_num;       /* message number of the first frame */
+    const unsigned long *num;      /* or of each frame, if they aren't in a row */
+    BUF out;
+    unsigned long skipped;         /* Maildir: messages already there */
+    int write_errno;               /* ... or why they couldn't be written */
+}
+CHUNK;
 
-    assert(str != NULL);
+#define MSG_NUM(k, i) ((k)->num != NULL ? (k)->num[i] : (k)->first_num + (i))
 
-    if (msg_num != old_msg_num)
+/*
+ *  Maildir mode: writes each message in the chunk to a file of its own,
+ *  in file order with -p, skipping those already there, and then moves
+ *  them all into the Maildir together.
+ */
+
+static void write_maildir(CHUNK *k, SQFILE *in, SQDATE_CACHE *dc)
+{
+    MD_BATCH b;
+    SQMSG m;
+    char name[MD_NAME_LEN];
+    unsigned long *order, i;
+
+    order = k->c->physical ? sq_physical_order(k->ofs, k->count) : NULL;
+
+    md_batch_init(&b, k->c->md, k->first_num);
+
+    for (i = 0; i < k->count; i++)
+    {
+        unsigned long j;
+        int rc;
+
+        j = order != NULL ? order[i] : i;
+
+        assert(sq_read_frame(in, k->ofs[j], &m) == SQ_OK);
+        assert(sq_read_msg(in, &m) == SQ_OK);
+
+        md_name(name, &m);
+
+        if (md_has(k->c->md, name))
+        {
+            k->skipped++;
+            continue;
+        }
+
+        k->out.len = 0;
+        mbox_format(&k->out, &fmt, &m, MSG_NUM(k, j), dc);
+
+        rc = md_batch_add(&b, name, (m.xmsg.attr & XMSG_READ) != 0, k->out.data, k->out.len);
+
+        if (rc == -1)
+        {
+            k->write_errno = errno;
+            break;
+        }
+
+        k->skipped += (unsigned long) rc;
+    }
+
+    if (k->write_errno == 0 && md_batch_commit(&b) != 0)
     {
-        got_origin = 0;
+        k->write_errno = errno;
     }
 
-    old_msg_num = msg_num;
+    md_batch_free(&b);
+    free(order);
+
+    k->out.len = 0;
+}
+
+static void convert_chunk(void *arg)
+{
+    CHUNK *k;
+    SQFILE *in;
+    SQMSG m;
+    SQDATE_CACHE dc;
+    unsigned long i;
 
-    p = str;
+    k = arg;
 
-    if (*p == '\n')
+    sqdate_cache_init(&dc);
+
+    /* a mapped file can be shared between threads; a buffered one can't */
+
+    in = k->c->sq;
+
+    if (in->map == NULL)
     {
-        p++;
+        in = sq_open(k->c->sqd_filename);
+        assert(in != NULL);
     }
 
-    if (*p != 0x01)
+    if (k->c->md != NULL)
     {
-        if (got_origin && strncmp(p, "SEEN-BY: ", 9) == 0)
-        {
-            return;
-        }
+        write_maildir(k, in, &dc);
+    }
+    else if (k->c->physical)
+    {
+        unsigned long *order, *pos;
+        BUF tmp;
 
-        if (msg_num == old_msg_num && strncmp(p, " * Origin: ", 11) == 0)
+        /* render in file order into tmp, noting where each message went,
+           then copy them out in list order */
+
+        order = sq_physical_order(k->ofs, k->count);
+        pos = malloc(sizeof *pos * (k->count + 1) * 2);
+        assert(pos != NULL);
+
+        buf_init(&tmp);
+
+        for (i = 0; i < k->count; i++)
         {
-            got_origin = 1;
+            unsigned long j;
+
+            j = order[i];
+            pos[j * 2] = tmp.len;
+            assert(sq_read_frame(in, k->ofs[j], &m) == SQ_OK);
+            assert(sq_read_msg(in, &m) == SQ_OK);
+            mbox_format(&tmp, &fmt, &m, MSG_NUM(k, j), &dc);
+            pos[j * 2 + 1] = tmp.len - pos[j * 2];
         }
 
-        if (strncmp(p, "From ", 5) == 0)
+        buf_reserve(&k->out, tmp.len);
+
+        for (i = 0; i < k->count; i++)
         {
-            assert(fputc('>', ofp) != EOF);
+            buf_write(&k->out, tmp.data + pos[i * 2], pos[i * 2 + 1]);
         }
 
-        while (*p != '\0')
+        buf_free(&tmp);
+        free(pos);
+        free(order);
+    }
+    else
+    {
+        for (i = 0; i < k->count; i++)
         {
-            if (!strip_high_bit)
-            {
-                assert(fputc(*p, ofp) != EOF);
-            }
-            else if ((unsigned char) *p > 0x7e)
-            {
-                assert(fprintf(ofp, "=%d", (unsigned char) *p) != EOF);
-            }
-            else
-            {
-                assert(fputc(*p, ofp) != EOF);
-            }
-
-            p++;
+            assert(sq_read_frame(in, k->ofs[i], &m) == SQ_OK);
+            assert(sq_read_msg(in, &m) == SQ_OK);
+            mbox_format(&k->out, &fmt, &m, MSG_NUM(k, i), &dc);
         }
+    }
 
-        assert(fputc('\n', ofp) != EOF);
+    if (in != k->c->sq)
+    {
+        sq_close(in);
     }
 }
+/*
+ *  Reads the frame offsets from the .sqi next to the .sqd.  The index is
+ *  only used if it lists exactly the frames of the frame list, in the same
+ *  order; that is checked with a pass over the frame headers in file
+ *  order.  Returns 1 if list was filled in, or 0 if it wasn't.
+ */
 
-static void traverse_frame_list(unsigned long frame_ofs, unsigned long total_msgs)
+static int read_index(CONVERT *c, SQOFS *list)
 {
-    unsigned long next_frame, msg_num;
-    unsigned char tmp4[4], tmp2[2];
+    char *filename;
+    unsigned long *order, *next, i;
+    int ok;
+
+    sq_names(c->sqd_filename, NULL, &filename);
 
-    next_frame = frame_ofs;
+    ok = sq_read_sqi(filename, list) == 0 && list->count == c->sqb.num_msg &&
+      list->count != 0 && list->ofs[0] == c->sqb.first_frame;
 
-    msg_num = 0;
+    free(filename);
 
-    while (next_frame != 0)
+    if (!ok)
     {
-        unsigned long id, msg_len, ctl_len;
-        unsigned short frame_type;
-        char *ctl, *new_ctl, *msgid, *reply;
-        char from[36], to[36], subject[72], date[27], mboxdate[25];
-        unsigned char datewritten[4];
-        struct tm tm_msg, *tm_msg_new;
-        unsigned short idate, itime;
-        time_t msg_time;
+        sq_ofs_free(list);
+        return 0;
+    }
 
-        msg_num++;
+    order = sq_physical_order(list->ofs, list->count);
+    next = malloc(sizeof *next * list->count);
+    assert(next != NULL);
 
-        printf("%lu/%lu\r", msg_num, total_msgs);
+    for (i = 0; i < list->count && ok; i++)
+    {
+        SQMSG m;
+        unsigned long j;
 
-        assert(fseek(ifp, next_frame, SEEK_SET) == 0);
+        j = order[i];
 
-        assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-        id = raw2ulong(tmp4);
+        ok = sq_read_frame(c->sq, list->ofs[j], &m) == SQ_OK &&
+          m.frame.frame_type == FRAME_NORMAL && sq_check_msg(c->sq, &m) == SQ_OK;
 
-        assert(id == SQHDRID);
+        next[j] = m.frame.next_frame;
+    }
 
-        assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-        next_frame = raw2ulong(tmp4);
+    for (i = 0; i + 1 < list->count && ok; i++)
+    {
+        ok = next[i] == list->ofs[i + 1];
+    }
 
-        assert(fseek(ifp, 8, SEEK_CUR) == 0);
+    /* the last one must end the list, or be followed by a free frame */
 
-        assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-        msg_len = raw2ulong(tmp4);
+    if (ok && next[list->count - 1] != 0)
+    {
+        SQMSG m;
+        int rc;
 
-        assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-        ctl_len = raw2ulong(tmp4);
+        rc = sq_read_frame(c->sq, next[list->count - 1], &m);
+        ok = rc == SQ_OK && m.frame.frame_type != FRAME_NORMAL;
+    }
 
-        assert(fseek(ifp, 2, SEEK_CUR) == 0);
+    free(next);
+    free(order);
 
-        assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-        frame_type = raw2ushort(tmp2);
+    if (!ok)
+    {
+        sq_ofs_free(list);
+    }
 
-        if (frame_type != 0)
-        {
-            break;
-        }
+    return ok;
+}
 
-        assert(fseek(ifp, 4, SEEK_CUR) == 0);
+/*
+ *  Puts the offsets of the messages written from c->since to c->until in
+ *  list, and their message numbers in nums, using the date index in the
+ *  .sqt next to the .sqd.  The index is brought up to date first.
+ */
 
-        assert(fread(from, sizeof from, 1, ifp) == 1);
-        assert(fread(to, sizeof to, 1, ifp) == 1);
-        assert(fread(subject, sizeof subject, 1, ifp) == 1);
+static int collect_dated(CONVERT *c, SQOFS *list, SQOFS *nums, unsigned long *err_ofs)
+{
+    DATEIDX di;
+    DI_RESULT res;
+    char *filename;
+    size_t len;
+    int rc;
+
+    len = strlen(c->sqd_filename);
+    filename = malloc(len + 5);
+    assert(filename != NULL);
+    strcpy(filename, c->sqd_filename);
+
+    if (len >= 4 && c->sqd_filename[len - 4] == '.')
+    {
+        filename[len - 1] = filename[len - 1] == 'D' ? 'T' : 't';
+    }
+    else
+    {
+        strcat(filename, ".sqt");
+    }
 
-        assert(fseek(ifp, 16, SEEK_CUR) == 0);
+    if (di_update(&di, filename, c->sq, &c->sqb, &res) != 0)
+    {
+        *err_ofs = res.err_ofs;
+        free(filename);
+        return res.rc;
+    }
 
-        assert(fread(datewritten, sizeof datewritten, 1, ifp) == 1);
+    if (!res.saved && !c->quiet)
+    {
+        fprintf(stderr, PROGRAM ": Cannot write `%s`: %s\n", filename, strerror(errno));
+    }
 
-        assert(fseek(ifp, 70, SEEK_CUR) == 0);
+    rc = di_collect(&di, c->sq, DI_WRITTEN, c->since, c->until, list, nums, err_ofs);
 
-        memset(&tm_msg, 0, sizeof tm_msg);
+    di_free(&di);
+    free(filename);
 
-        idate = (unsigned short) (((unsigned short) datewritten[1] << 8) | (unsigned short) datewritten[0]);
-        itime = (unsigned short) (((unsigned short) datewritten[3] << 8) | (unsigned short) datewritten[2]);
+    return rc;
+}
 
-        tm_msg.tm_mday = idate & 0x1f;
-        tm_msg.tm_mon = ((idate >> 5) & 0x0f) - 1;
-        tm_msg.tm_year = ((idate >> 9) & 0x7f) + 80;
+/*
+ *  Drops the messages in list whose headers don't pass c->filter, and
+ *  leaves the numbers of the rest in nums, which already holds them if
+ *  the list came from the date index.  Only the headers are read, in file
+ *  order with -p.  The frames have all been checked by now.
+ */
 
-        /* fix for years prior to 1980 */
+static void filter_offsets(CONVERT *c, SQOFS *list, SQOFS *nums)
+{
+    unsigned long *order, i, j, n;
+    unsigned char *keep;
 
-        if (tm_msg.tm_year > 127)
+    if (!c->dated)
+    {
+        for (i = 0; i < list->count; i++)
         {
-            tm_msg.tm_year -= 128;
+            sq_ofs_add(nums, c->base_num + i + 1);
         }
+    }
 
-        tm_msg.tm_hour = (itime >> 11) & 0x1f;
-        tm_msg.tm_min = (itime >> 5) & 0x3f;
-        tm_msg.tm_sec = (itime & 0x1f) << 1;
+    keep = malloc(list->count + 1);
+    assert(keep != NULL);
 
-        msg_time = mktime(&tm_msg);
+    order = c->physical ? sq_physical_order(list->ofs, list->count) : NULL;
 
-        if (msg_time == -1)
-        {
-            msg_time = 0;
-        }
+    for (i = 0; i < list->count; i++)
+    {
+        SQMSG m;
 
-        tm_msg_new = gmtime(&msg_time);
+        j = order != NULL ? order[i] : i;
 
-        if (tm_msg_new != NULL)
-        {
-            /* Thu Oct  3 18:21:13 2002 */
-            strftime(mboxdate, sizeof mboxdate, "%a %b %d %H:%M:%S %Y", tm_msg_new);
+        assert(sq_read_frame(c->sq, list->ofs[j], &m) == SQ_OK);
+        assert(sq_read_xmsg(c->sq, &m) == SQ_OK);
 
-            /* Thu, 3 Oct 2002 18:21:14 +1000 */
-            strftime(date, sizeof date, "%a, %d %b %Y %H:%M:%S", tm_msg_new);
-        }
-        else
+        keep[j] = (unsigned char) filter_match(c->filter, &m.xmsg);
+    }
+
+    for (i = n = 0; i < list->count; i++)
+    {
+        if (keep[i])
         {
-            *date = '\0';
-            *mboxdate = '\0';
+            list->ofs[n] = list->ofs[i];
+            nums->ofs[n] = nums->ofs[i];
+            n++;
         }
+    }
 
-        assert(fprintf(ofp, "From localhost %s\n", mboxdate) != EOF);
-        assert(fprintf(ofp, "From: %s <" USERNAME "@" HOSTNAME ">\n", from) != EOF);
-        assert(fprintf(ofp, "To: %s <" USERNAME "@" HOSTNAME ">\n", to) != EOF);
+    list->count = nums->count = n;
 
-        if (*subject != '\0')
-        {
-            assert(fprintf(ofp, "Subject: %s\n", subject) != EOF);
-        }
+    free(order);
+    free(keep);
+}
 
-        if (*date != '\0')
-        {
-            assert(fprintf(ofp, "Date: %s +0000\n", date) != EOF);
-        }
+/*
+ *  Puts the offsets of the message frames from frame_ofs on in list, from
+ *  the .sqi if it can be trusted, and otherwise by walking the frame list
+ *  the way the serial conversion would.  With a date range or a filter
+ *  only the messages that pass are listed, and their numbers go in nums.
+ *  Returns SQ_END, or the error that stopped the walk with the offset of
+ *  the bad frame in *err_ofs.
+ */
 
-        assert(fprintf(ofp, "Content-Type: text/plain;\n") != EOF);
-        assert(fprintf(ofp, "X-Converted-by: %s %s\n", PROGRAM, VERSION) != EOF);
+static int collect_offsets(CONVERT *c, unsigned long frame_ofs, SQOFS *list, SQOFS *nums,
+  unsigned long *err_ofs)
+{
+    int rc;
 
-        ctl = NULL;
-        new_ctl = NULL;
-        msgid = NULL;
-        reply = NULL;
+    if (c->dated)
+    {
+        rc = collect_dated(c, list, nums, err_ofs);
+    }
+    else if (c->physical && !c->resumed && read_index(c, list))
+    {
+        rc = SQ_END;
+    }
+    else
+    {
+        rc = sq_collect(c->sq, frame_ofs, 0, SQ_COLLECT_CHECK, list, err_ofs);
+    }
 
-        if (ctl_len != 0)
-        {
-            char *p;
-            int ctls;
+    if (c->filter != NULL)
+    {
+        filter_offsets(c, list, nums);
+    }
 
-            ctl = malloc((size_t) ctl_len + 1);
-            assert(ctl != NULL);
-            assert(fread(ctl, (size_t) ctl_len, 1, ifp) == 1);
-            ctl[(size_t) ctl_len] = '\0';
+    return rc;
+}
 
-            ctls = 0;
-            p = ctl;
-            while (*p != '\0')
-            {
-                if (*p == '\1')
-                {
-                    ctls++;
-                }
-                p++;
-            }
+static void traverse_frame_list_parallel(CONVERT *c, unsigned long frame_ofs)
+{
+    SQOFS list, nums;
+    POOL *pool;
+    CHUNK *chunks;
+    unsigned long *ofs, n, nchunks, chunk_msgs, i, submitted, err_ofs;
+    int rc;
 
-            new_ctl = malloc((size_t) ctl_len + ctls + 1);
-            assert(new_ctl != NULL);
-            *new_ctl = '\0';
+    sq_ofs_init(&list);
+    sq_ofs_init(&nums);
 
-            p = strtok(ctl, "\1");
-            while (p != NULL)
-            {
-                if (msgid == NULL && strncmp(p, "MSGID: ", 7) == 0)
-                {
-                    msgid = malloc(strlen(p + 7) + 1);
-                    assert(msgid != NULL);
-                    strcpy(msgid, p + 7);
-                }
-
-                if (reply == NULL && strncmp(p, "REPLY: ", 7) == 0)
-                {
-                    reply = malloc(strlen(p + 7) + 1);
-                    assert(reply != NULL);
-                    strcpy(reply, p + 7);
-                }
-
-                strcat(new_ctl, "\n");
-                strcat(new_ctl, "\1");
-                strcat(new_ctl, p);
-                p = strtok(NULL, "\1");
-            }
-        }
+    rc = collect_offsets(c, frame_ofs, &list, &nums, &err_ofs);
 
-        if (msgid != NULL)
-        {
-            escape_msgid_reply(msgid);
-            assert(fprintf(ofp, "Message-ID: <%s>\n", msgid) != EOF);
-        }
-        else
-        {
-            assert(fprintf(ofp, "Message-ID: <%s>\n", gen_msgid()) != EOF);
-        }
+    ofs = list.ofs;
+    n = list.count;
 
-        if (reply != NULL)
-        {
-            escape_msgid_reply(reply);
-            assert(fprintf(ofp, "In-Reply-To: <%s>\n", reply) != EOF);
-        }
+    chunk_msgs = c->physical ? PHYSICAL_CHUNK_MSGS : CHUNK_MSGS;
+    nchunks = (n + chunk_msgs - 1) / chunk_msgs;
 
-        if (new_ctl != NULL)
-        {
-            if (output_ctl_lines)
-            {
-                assert(fprintf(ofp, "%s", new_ctl) != EOF);
-            }
-        }
+    chunks = malloc(sizeof *chunks * (nchunks != 0 ? nchunks : 1));
+    assert(chunks != NULL);
 
-        if (reply != NULL)
-        {
-            free(reply);
-        }
+    for (i = 0; i < nchunks; i++)
+    {
+        chunks[i].c = c;
+        chunks[i].ofs = ofs + i * chunk_msgs;
+        chunks[i].count = i + 1 < nchunks ? chunk_msgs : n - i * chunk_msgs;
+        chunks[i].first_num = c->base_num + i * chunk_msgs + 1;
+        chunks[i].num = c->dated || c->filter != NULL ? nums.ofs + i * chunk_msgs : NULL;
+        chunks[i].skipped = 0;
+        chunks[i].write_errno = 0;
+        buf_init(&chunks[i].out);
+    }
 
-        if (msgid != NULL)
-        {
-            free(msgid);
-        }
+    if (c->physical)
+    {
+        sq_advise(c->sq, SQ_ADV_SEQUENTIAL);
+    }
 
-        if (new_ctl != NULL)
-        {
-            free(new_ctl);
-        }
+    pool = pool_new(c->jobs > 1 ? c->jobs : 0, 0);
 
-        if (ctl != NULL)
-        {
-            free(ctl);
-        }
-        else
+    submitted = 0;
+
+    for (i = 0; i < nchunks; i++)
+    {
+        while (submitted < nchunks && submitted < i + (unsigned long) c->jobs * 2)
         {
-            assert(fputc('\n', ofp) != EOF);
+            pool_submit(pool, &chunks[submitted].job, convert_chunk, &chunks[submitted]);
+            submitted++;
         }
 
-        assert(fputc('\n', ofp) != EOF);
+        pool_wait_job(pool, &chunks[i].job);
 
-        if (msg_len != 0)
-        {
-            msg_len -= (ctl_len + 238);
-        }
+        write_buf(c, &chunks[i].out);
+        buf_free(&chunks[i].out);
 
-        if (msg_len == 0)
+        c->msgs += chunks[i].count - chunks[i].skipped;
+        c->skipped += chunks[i].skipped;
+
+        if (chunks[i].write_errno != 0 && c->write_errno == 0)
         {
-            assert(fputc('\n', ofp) != EOF);
+            c->write_errno = chunks[i].write_errno;
         }
-        else
-        {
-            char *txt, *p, *q;
+        progress(c, MSG_NUM(&chunks[i], chunks[i].count - 1));
+    }
 
-            txt = malloc((size_t) msg_len + 1);
-            assert(txt != NULL);
-            assert(fread(txt, (size_t) msg_len, 1, ifp) == 1);
-            txt[(size_t) msg_len] = '\0';
+    pool_free(pool);
+    free(chunks);
 
-            p = txt;
+    if (n != 0)
+    {
+        SQMSG last;
 
-            q = strchr(txt, '\r');
+        c->last_ofs = ofs[n - 1];
+        assert(sq_read_frame(c->sq, c->last_ofs, &last) == SQ_OK);
+        assert(sq_read_xmsg(c->sq, &last) == SQ_OK);
+        c->last_umsgid = last.xmsg.umsgid;
+    }
 
-            while (q != NULL)
-            {
-                char *str;
+    sq_ofs_free(&nums);
+    sq_ofs_free(&list);
 
-                *q = '\0';
+    if (rc != SQ_END)
+    {
+        frame_error(c, err_ofs, rc);
+    }
+}
 
-                str = malloc(strlen(p) + 1);
-                assert(str != NULL);
-                strcpy(str, p);
+static void get_sqbase(CONVERT *c)
+{
+    SQBASE sqb;
+    unsigned long ofs;
 
-                output_msg_txt(str, msg_num);
+    if (sq_read_base(c->sq, &sqb) != SQ_OK || sqb.sz_sqbase != 256)
+    {
+        c->rc = SQ_EBASE;
+        return;
+    }
 
-                free(str);
+    c->sqb = sqb;
+    c->total_msgs = sqb.num_msg;
 
-                p = q + 1;
-                q = strchr(p, '\r');
-            }
+    ofs = c->resumed ? c->start_ofs : sqb.first_frame;
 
-            if (txt != NULL)
-            {
-                free(txt);
-            }
+    if (c->jobs > 1 || c->physical || c->dated || c->filter != NULL || c->md != NULL)
+    {
+        traverse_frame_list_parallel(c, ofs);
+    }
+    else
+    {
+        traverse_frame_list(c, ofs);
+    }
 
-            assert(fputc('\n', ofp) != EOF);
-        }
+#ifdef CONVERT_FREE_FRAMES
+    if (sqb.first_frame != 0 && sqb.first_free_frame != 0 && !c->quiet)
+    {
+        putchar('\n');
     }
+
+    c->total_msgs = 0;
+    traverse_frame_list(c, sqb.first_free_frame);
+#endif
 }
 
-static void get_sqbase(void)
+/*
+ *  Incremental mode.  The checkpoint is kept next to the mbox, in
+ *  mboxfile.ckpt.  It is used if it still matches the base and the mbox
+ *  is the size it was left at; otherwise the mbox is rebuilt.
+ */
+
+static char *ckpt_filename(CONVERT *c)
 {
-    unsigned short sz_sqbase;
-    unsigned char tmp4[4], tmp2[2];
-    unsigned long total_msgs, first_frame;
+    char *filename;
 
-#ifdef CONVERT_FREE_FRAMES
-    unsigned long first_free_frame;
-#endif
+    filename = malloc(strlen(c->mbox_filename) + 6);
+    assert(filename != NULL);
+    sprintf(filename, "%s.ckpt", c->mbox_filename);
 
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    sz_sqbase = raw2ushort(tmp2);
+    return filename;
+}
 
-    assert(sz_sqbase == 256);
+static void resume(CONVERT *c)
+{
+    CHECKPOINT ck;
+    SQBASE sqb;
+    char *filename;
 
-    assert(fseek(ifp, 2, SEEK_CUR) == 0);
+    filename = ckpt_filename(c);
 
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    total_msgs = raw2ulong(tmp4);
+    if (ckpt_read(&ck, filename) == 0 &&
+      sq_read_base(c->sq, &sqb) == SQ_OK &&
+      ckpt_file_size(c->mbox_filename) == (long) ck.out_size &&
+      ckpt_resume(&ck, c->sq, &sqb, &c->start_ofs))
+    {
+        c->resumed = 1;
+        c->base_num = ck.msgs;
+        c->last_ofs = ck.frame;
+        c->last_umsgid = ck.umsgid;
+    }
+    else if (!c->quiet)
+    {
+        printf("No usable checkpoint in `%s`, converting the whole base.\n", filename);
+    }
 
-    assert(fseek(ifp, 104, SEEK_SET) == 0);
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    first_frame = raw2ulong(tmp4);
+    free(filename);
+}
 
-#ifdef CONVERT_FREE_FRAMES
-    assert(fseek(ifp, 112, SEEK_SET) == 0);
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    first_free_frame = raw2ulong(tmp4);
-#endif
+static void save_checkpoint(CONVERT *c)
+{
+    CHECKPOINT ck;
+    char *filename;
+    long size;
 
-    traverse_frame_list(first_frame, total_msgs);
+    ck.frame = c->last_ofs;
+    ck.umsgid = c->last_umsgid;
+    ck.uid = c->sqb.uid;
+    ck.high_water = c->sqb.high_water;
+    ck.msgs = c->base_num + c->msgs;
+    size = ckpt_file_size(c->mbox_filename);
+    ck.out_size = size != -1 ? (unsigned long) size : 0;
 
-#ifdef CONVERT_FREE_FRAMES
-    if (first_frame != 0 && first_free_frame != 0)
+    filename = ckpt_filename(c);
+
+    if (ckpt_write(&ck, filename) != 0)
     {
-        putchar('\n');
+        fprintf(stderr, PROGRAM ": Cannot write `%s`: %s\n", filename, strerror(errno));
     }
 
-    traverse_frame_list(first_free_frame, 0);
-#endif
+    free(filename);
+}
+
+/*
+ *  Converts c->sqd_filename to the Maildir c->mbox_filename, adding only
+ *  the messages that aren't in it already.  Returns 0, or -1 with a
+ *  message in c->error if the Maildir couldn't be opened or written.
+ */
+
+static int convert_maildir(CONVERT *c)
+{
+    MAILDIR md;
+
+    if (md_open(&md, c->mbox_filename, c->sync) != 0)
+    {
+        sprintf(c->error, "Cannot open Maildir `%.200s`: %.100s", c->mbox_filename,
+          strerror(errno));
+        sq_close(c->sq);
+        return -1;
+    }
+
+    c->md = &md;
+    get_sqbase(c);
+    c->md = NULL;
+
+    md_close(&md);
+    sq_close(c->sq);
+
+    if (c->write_errno != 0)
+    {
+        sprintf(c->error, "Error writing `%.200s`: %.100s", c->mbox_filename,
+          strerror(c->write_errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ *  Converts c->sqd_filename to c->mbox_filename, or with c->append set
+ *  adds the messages that are new since the last run to it.  Returns 0,
+ *  or -1 with a message in c->error if either file couldn't be opened.
+ */
+
+static int convert(CONVERT *c)
+{
+    c->sq = sq_open(c->sqd_filename);
+
+    if (c->sq == NULL)
+    {
+        sprintf(c->error, "Cannot open `%.200s` for reading: %.100s", c->sqd_filename,
+          strerror(errno));
+        return -1;
+    }
+
+    if (c->maildir)
+    {
+        return convert_maildir(c);
+    }
+
+    if (c->append)
+    {
+        resume(c);
+    }
+
+    c->ofp = out_open(c->mbox_filename, c->resumed ? "ab" : "wb", c->format);
+
+    if (c->ofp == NULL)
+    {
+        sprintf(c->error, "Cannot open `%.200s` for writing: %.100s", c->mbox_filename,
+          strerror(errno));
+        sq_close(c->sq);
+        return -1;
+    }
+
+    get_sqbase(c);
+
+    if (out_close(c->ofp) != 0 && c->rc == SQ_OK)
+    {
+        sprintf(c->error, "Error writing `%.200s`: %.100s", c->mbox_filename, strerror(errno));
+        sq_close(c->sq);
+        return -1;
+    }
+
+    if (c->append && c->rc != SQ_EBASE)
+    {
+        save_checkpoint(c);
+    }
+
+    sq_close(c->sq);
+
+    return 0;
+}
+
+/*
+ *  Batch mode: converts every Squish area listed in a fidoconfig or
+ *  areas file to outdir/AREA.mbox, several areas at a time.  The biggest
+ *  bases are started first so that a huge area found late in the list
+ *  doesn't keep the run going long after everything else has finished.
+ */
+
+typedef struct
+{
+    POOL_JOB job;
+    AREA *area;
+    long size;
+    CONVERT c;
+    int failed;
+}
+BATCH;
+
+static void convert_area(void *arg)
+{
+    BATCH *b;
+
+    b = arg;
+
+    b->failed = convert(&b->c) != 0;
+
+    printf("%s: %s\n", b->area->name, b->failed ? "failed" : "done");
+    fflush(stdout);
+}
+
+static int cmp_size(const void *a, const void *b)
+{
+    const BATCH *x, *y;
+
+    x = *(const BATCH * const *) a;
+    y = *(const BATCH * const *) b;
+
+    return x->size < y->size ? 1 : x->size > y->size ? -1 : 0;
+}
+
+static int batch(const char *config, const char *outdir, int threads)
+{
+    AREALIST list;
+    BATCH *batches, **order;
+    POOL *pool;
+    int i, failures;
+    unsigned long total;
+
+    areas_init(&list);
+
+    if (areas_read(&list, config) != 0)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s\n", config,
+          strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (list.count == 0)
+    {
+        fprintf(stderr, PROGRAM ": No Squish areas found in `%s`\n", config);
+        areas_free(&list);
+        return EXIT_FAILURE;
+    }
+
+    batches = malloc(sizeof *batches * (size_t) list.count);
+    order = malloc(sizeof *order * (size_t) list.count);
+    assert(batches != NULL && order != NULL);
+
+    for (i = 0; i < list.count; i++)
+    {
+        BATCH *b;
+        char *p;
+
+        b = &batches[i];
+        memset(b, 0, sizeof *b);
+        b->area = &list.areas[i];
+
+        b->c.sqd_filename = malloc(strlen(b->area->path) + 5);
+        b->c.mbox_filename = malloc(strlen(outdir) + strlen(b->area->name) + 11);
+        assert(b->c.sqd_filename != NULL && b->c.mbox_filename != NULL);
+
+        sprintf(b->c.sqd_filename, "%s.sqd", b->area->path);
+        sprintf(b->c.mbox_filename, "%s/%s%s%s", outdir, b->area->name, maildir ? "" : ".mbox",
+          maildir ? "" : out_suffix(b->c.format));
+
+        /* keep area tags with path separators inside outdir */
+
+        for (p = b->c.mbox_filename + strlen(outdir) + 1; *p != '\0'; p++)
+        {
+            if (*p == '/' || *p == '\\' || *p == ':')
+            {
+                *p = '_';
+            }
+        }
+
+        b->c.jobs = 1;
+        b->c.quiet = 1;
+        b->c.append = incremental;
+        b->c.maildir = maildir;
+        b->c.sync = sync_batches;
+        b->c.physical = physical;
+        b->c.dated = dated;
+        b->c.since = since;
+        b->c.until = until;
+        b->c.filter = filter.count != 0 ? &filter : NULL;
+        b->c.format = out_fmt != -1 ? out_fmt : OUT_RAW;
+        b->size = ckpt_file_size(b->c.sqd_filename);
+        order[i] = b;
+    }
+
+    qsort(order, (size_t) list.count, sizeof *order, cmp_size);
+
+    printf(PROGRAM ": Converting %d Squish areas to %s format using %d thread%s ...\n",
+      list.count, maildir ? "Maildir" : "mbox", threads, threads == 1 ? "" : "s");
+
+    pool = pool_new(threads > 1 ? threads : 0, 0);
+
+    for (i = 0; i < list.count; i++)
+    {
+        pool_submit(pool, &order[i]->job, convert_area, order[i]);
+    }
+
+    pool_wait(pool);
+    pool_free(pool);
+
+    printf("\n%-30s %10s  %s\n", "Area", "Messages", "Result");
+
+    failures = 0;
+    total = 0;
+
+    for (i = 0; i < list.count; i++)
+    {
+        BATCH *b;
+
+        b = &batches[i];
+
+        if (b->failed)
+        {
+            printf("%-30s %10s  %s\n", b->area->name, "-", b->c.error);
+            failures++;
+        }
+        else
+        {
+            printf("%-30s %10lu  %s\n", b->area->name, b->c.msgs,
+              b->c.rc == SQ_OK ? "OK" : sq_strerror(b->c.rc));
+
+            if (b->c.rc != SQ_OK)
+            {
+                failures++;
+            }
+        }
+
+        total += b->c.msgs;
+
+        free(b->c.sqd_filename);
+        free(b->c.mbox_filename);
+    }
+
+    printf("\n%d areas, %lu messages, %d with errors.\n", list.count, total, failures);
+
+    free(order);
+    free(batches);
+    areas_free(&list);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int usage(void)
+{
+    fprintf(
+      stderr,
+      PROGRAM " " VERSION "\n"
+      "\n"
+      "Converts Squish messagebases to UNIX mbox format.\n"
+      "Written by Andrew Clarke and released to the public domain.\n"
+      "\n"
+      "Usage: " PROGRAM " [options] sqdfile mboxfile\n"
+      "       " PROGRAM " [options] -c config outdir\n"
+      "\n"
+      "  -a           Only add messages that are new since the last -a run,\n"
+      "               as recorded in mboxfile.ckpt; convert the whole base\n"
+      "               if it has been packed or renumbered since\n"
+      "  -p           Read the messages in the order they lie in the file\n"
+      "               rather than list order, which saves seeking on\n"
+      "               fragmented bases; the mbox is the same either way\n"
+      "  -7           Write 8-bit characters as =NNN instead of converting\n"
+      "               them to UTF-8\n"
+      "  -8           Write 8-bit characters unconverted, labelled with the\n"
+      "               message's CHRS character set (default IBM437)\n"
+      "  -j threads   Convert using this many threads (default 1, or 4 with -m)\n"
+      "  -z method    Compress the mbox with gzip or zstd; otherwise a\n"
+      "               mboxfile ending in .gz or .zst is compressed to suit\n"
+      "  -m           Write mboxfile as a Maildir, a file per message named\n"
+      "               from its MSGID; messages already there are skipped\n"
+      "  -s           With -m, sync each batch of files to disk before\n"
+      "               moving them into the Maildir\n"
+      "  -c config    Convert every Squish area in this Husky fidoconfig or\n"
+      "               areas file to outdir/AREA.mbox, or outdir/AREA with -m,\n"
+      "               several areas at once\n"
+      "  --since date Only convert messages written on or after this date\n"
+      "               (YYYY-MM-DD [HH:MM[:SS]]), found with the date index\n"
+      "               in the .sqt beside the .sqd, built as needed\n"
+      "  --until date ... and on or before this date\n"
+      "  --from pattern, --to pattern, --subj pattern\n"
+      "               Only convert messages whose From, To or Subject match\n"
+      "               this glob, or this regular expression if it's given\n"
+      "               between slashes; case doesn't matter\n"
+      "  --orig addr, --dest addr\n"
+      "               ... sent from or to this address, eg. 3:633/267 or\n"
+      "               3:633/*\n"
+      "  --attr flags ... with these attributes set, or clear if they start\n"
+      "               with !, eg. pvt,!rcvd\n"
+      "               Options on the same field are alternatives; options on\n"
+      "               different fields must all match\n"
+    );
+
+    return EXIT_FAILURE;
 }
 
 int main(int argc, char **argv)
 {
+    CONVERT c;
+    time_t now;
+    const char *config;
+    int jobs, rc;
+
 #ifdef __THINK__
     argc = ccommand(&argv);
 #endif
@@ -542,20 +1264,135 @@ int main(int argc, char **argv)
     pauseOnExit();
 #endif
 
-    if (argc != 3)
+    jobs = 0;
+    config = NULL;
+
+    while (argc > 1 && argv[1][0] == '-')
     {
-        fprintf(
-          stderr,
-          PROGRAM " " VERSION "\n"
-          "\n"
-          "Converts Squish messagebases to UNIX mbox format.\n"
-          "Written by Andrew Clarke and released to the public domain.\n"
-          "\n"
-          "Usage: " PROGRAM " sqdfile mboxfile\n"
-        );
+        if (strcmp(argv[1], "-a") == 0 || strcmp(argv[1], "-p") == 0)
+        {
+            if (argv[1][1] == 'a')
+            {
+                incremental = 1;
+            }
+            else
+            {
+                physical = 1;
+            }
+
+            argc--;
+            argv++;
+            continue;
+        }
+
+        if (strcmp(argv[1], "-m") == 0 || strcmp(argv[1], "-s") == 0)
+        {
+            if (argv[1][1] == 'm')
+            {
+                maildir = 1;
+                fmt.maildir = 1;
+            }
+            else
+            {
+                sync_batches = 1;
+            }
+
+            argc--;
+            argv++;
+            continue;
+        }
+
+        if (strcmp(argv[1], "-7") == 0 || strcmp(argv[1], "-8") == 0)
+        {
+            fmt.text_mode = argv[1][1] == '7' ? MBOX_ESCAPE : MBOX_RAW;
+            argc--;
+            argv++;
+            continue;
+        }
+
+        if (strcmp(argv[1], "-j") == 0 && argc > 2)
+        {
+            jobs = atoi(argv[2]);
+        }
+        else if (strcmp(argv[1], "-z") == 0 && argc > 2)
+        {
+            out_fmt = out_format(argv[2]);
+
+            if (out_fmt == -1)
+            {
+                fprintf(stderr, PROGRAM ": Unknown or unsupported compression method `%s`\n",
+                  argv[2]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(argv[1], "-c") == 0 && argc > 2)
+        {
+            config = argv[2];
+        }
+        else if ((strcmp(argv[1], "--since") == 0 || strcmp(argv[1], "--until") == 0) &&
+          argc > 2)
+        {
+            int end;
+
+            end = argv[1][2] == 'u';
+
+            if (sqdate_parse(argv[2], end, end ? &until : &since) != 0)
+            {
+                fprintf(stderr, PROGRAM ": Bad date `%s`; use YYYY-MM-DD [HH:MM[:SS]]\n",
+                  argv[2]);
+                return EXIT_FAILURE;
+            }
+
+            dated = 1;
+        }
+        else if (strncmp(argv[1], "--", 2) == 0 && argc > 2 &&
+          (rc = filter_add(&filter, argv[1] + 2, argv[2])) != 1)
+        {
+            if (rc != 0)
+            {
+                fprintf(stderr, PROGRAM ": Bad %s pattern `%s`\n", argv[1], argv[2]);
+                return EXIT_FAILURE;
+            }
+        }
+        else
+        {
+            return usage();
+        }
+
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (jobs == 0)
+    {
+        jobs = maildir ? MAILDIR_WRITERS : 1;
+    }
+
+    if (argc != (config != NULL ? 2 : 3) || jobs < 1 || (sync_batches && !maildir))
+    {
+        return usage();
+    }
+
+    if (maildir && (incremental || out_fmt != -1))
+    {
+        fprintf(stderr, PROGRAM ": -a and -z can't be used with -m\n");
         return EXIT_FAILURE;
     }
 
+    if ((dated || filter.count != 0) && incremental)
+    {
+        fprintf(stderr, PROGRAM ": -a can't be used with dates or filters\n");
+        return EXIT_FAILURE;
+    }
+
+    now = time(NULL);
+    fmt.start = *gmtime(&now);
+
+    if (config != NULL)
+    {
+        return batch(config, argv[1], jobs);
+    }
+
     if (strcmp(argv[1], argv[2]) == 0)
     {
         fprintf(
@@ -566,33 +1403,48 @@ int main(int argc, char **argv)
         return EXIT_FAILURE;
     }
 
-    ifp = fopen(argv[1], "rb");
-
-    if (ifp == NULL)
+    memset(&c, 0, sizeof c);
+    c.sqd_filename = argv[1];
+    c.mbox_filename = argv[2];
+    c.jobs = jobs;
+    c.append = incremental;
+    c.maildir = maildir;
+    c.sync = sync_batches;
+    c.physical = physical;
+    c.dated = dated;
+    c.since = since;
+    c.until = until;
+    c.filter = filter.count != 0 ? &filter : NULL;
+    c.format = out_fmt != -1 ? out_fmt : out_guess_format(c.mbox_filename);
+
+    if (c.format == -1)
     {
-        fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s", argv[1],
-          strerror(errno));
+        fprintf(stderr, PROGRAM ": Compression for `%s` isn't supported by this build; "
+          "use -z none to write it uncompressed\n", c.mbox_filename);
         return EXIT_FAILURE;
     }
 
-    ofp = fopen(argv[2], "wb");
+    printf(
+      PROGRAM ": Converting Squish message base to %s format ...\n"
+      "Input: %s  Output: %s\n",
+      maildir ? "Maildir" : "mbox", argv[1], argv[2]);
 
-    if (ofp == NULL)
+    if (convert(&c) != 0)
     {
-        fprintf(stderr, PROGRAM ": Cannot open `%s` for writing: %s", argv[2],
-          strerror(errno));
+        fprintf(stderr, PROGRAM ": %s\n", c.error);
         return EXIT_FAILURE;
     }
 
-    printf(
-      PROGRAM ": Converting Squish message base to mbox format ...\n"
-      "Input: %s  Output: %s\n",
-      argv[1], argv[2]);
-
-    get_sqbase();
+    if (maildir)
+    {
+        printf("\n%lu messages written, %lu already in the Maildir.", c.msgs, c.skipped);
+    }
 
-    fclose(ofp);
-    fclose(ifp);
+    if (c.rc != SQ_OK)
+    {
+        fprintf(stderr, "\n" PROGRAM ": %s is incomplete: %s\n", argv[2], sq_strerror(c.rc));
+        return EXIT_FAILURE;
+    }
 
     puts("\n" "Finished.");
 
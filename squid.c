@@ -7,6 +7,22 @@
  *  Changelog
  *  ---------
  *
+ *  1.5  2026-10-17  ozzmosis
+ *
+ *  Added -s, which reads only the frame headers and sums up where the
+ *  space in the base goes: messages, slack, free frames and their sizes,
+ *  and how much packing would save.
+ *
+ *  1.4  2026-10-17  ozzmosis
+ *
+ *  A frame list that loops back on itself is reported instead of being
+ *  followed forever; sqfsck says where.
+ *
+ *  1.3  2026-10-16  ozzmosis
+ *
+ *  Use the shared reader in squish.c. A frame whose SQXMSG runs past the
+ *  end of the file is reported instead of aborting.
+ *
  *  1.2  2015-03-19  ozzmosis
  *
  *  Change hex style from DEADBEEFh to 0xdeafbeef in output.
@@ -27,68 +43,7 @@
 #include <time.h>
 #include <assert.h>
 
-#define SQHDRID 0xafae4453UL
-
-typedef struct
-{
-    unsigned short sz_sqbase;        /*   0 */
-    unsigned short rsvd1;            /*   2 */
-    unsigned long num_msg;           /*   4 */
-    unsigned long high_msg;          /*   8 */
-    unsigned long skip_msg;          /*  12 */
-    unsigned long high_water;        /*  16 */
-    unsigned long uid;               /*  20 */
-    char base[80];                   /*  24 */
-    unsigned long first_frame;       /* 104 */
-    unsigned long last_frame;        /* 108 */
-    unsigned long first_free_frame;  /* 112 */
-    unsigned long last_free_frame;   /* 116 */
-    unsigned long end_frame;         /* 120 */
-    unsigned long max_msg;           /* 124 */
-    unsigned short keep_days;        /* 128 */
-    unsigned short sz_sqhdr;         /* 130 */
-    unsigned char rsvd2[124];        /* 132 */
-}                                    /* 256 */
-SQBASE;
-
-typedef struct
-{
-    unsigned long frame_id;          /*   0 */
-    unsigned long next_frame;        /*   4 */
-    unsigned long prev_frame;        /*   8 */
-    unsigned long frame_len;         /*  12 */
-    unsigned long msg_len;           /*  16 */
-    unsigned long ctrl_len;          /*  20 */
-    unsigned short frame_type;       /*  24 */
-    unsigned short rsvd;             /*  26 */
-}                                    /*  28 */
-SQFRAME;
-
-typedef struct
-{
-    unsigned long attr;              /*   0 */
-    char from[36];                   /*   4 */
-    char to[36];                     /*  40 */
-    char subj[72];                   /*  76 */
-    unsigned short orig_zone;        /* 148 */
-    unsigned short orig_net;         /* 150 */
-    unsigned short orig_node;        /* 152 */
-    unsigned short orig_point;       /* 154 */
-    unsigned short dest_zone;        /* 156 */
-    unsigned short dest_net;         /* 158 */
-    unsigned short dest_node;        /* 160 */
-    unsigned short dest_point;       /* 162 */
-    unsigned short date_written;     /* 164 */
-    unsigned short time_written;     /* 166 */
-    unsigned short date_arrived;     /* 168 */
-    unsigned short time_arrived;     /* 170 */
-    unsigned short utc_ofs;          /* 172 */
-    unsigned long replyto;           /* 174 */
-    unsigned long see[9];            /* 178 */
-    unsigned long umsgid;            /* 214 */
-    char ftsc_date[20];              /* 218 */
-}                                    /* 238 */
-SQXMSG;
+#include "squish.h"
 
 #ifdef PAUSE_ON_EXIT
 
@@ -111,170 +66,7 @@ static void pauseOnExit(void)
 
 #endif
 
-#define r2ul(x) \
-    (unsigned long) ( \
-    ((unsigned long) x[3] << 24) | ((unsigned long) x[2] << 16) | \
-    ((unsigned long) x[1] << 8) | (unsigned long) x[0])
-
-#define r2us(x) \
-    (unsigned short) (((unsigned short) x[1] << 8) | (unsigned short) x[0])
-
-FILE *ifp;
-
-static void get_sqbase(SQBASE *x)
-{
-    unsigned char tmp4[4], tmp2[2];
-
-    memset(x, 0, sizeof *x);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->sz_sqbase = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->rsvd1 = r2us(tmp2);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->num_msg = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->high_msg = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->skip_msg = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->high_water = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->uid = r2ul(tmp4);
-
-    assert(fread(x->base, sizeof x->base, 1, ifp) == 1);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->first_frame = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->last_frame = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->first_free_frame = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->last_free_frame = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->end_frame = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->max_msg = r2ul(tmp4);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->keep_days = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->sz_sqhdr = r2us(tmp2);
-
-    assert(fread(x->rsvd2, sizeof x->rsvd2, 1, ifp) == 1);
-}
-
-static void get_sqframe(SQFRAME *x)
-{
-    unsigned char tmp4[4], tmp2[2];
-
-    memset(x, 0, sizeof *x);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->frame_id = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->next_frame = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->prev_frame = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->frame_len = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->msg_len = r2ul(tmp4);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->ctrl_len = r2ul(tmp4);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->frame_type = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->rsvd = r2us(tmp2);
-}
-
-static void get_sqxmsg(SQXMSG *x)
-{
-    unsigned char tmp4[4], tmp2[2];
-    int i;
-
-    memset(x, 0, sizeof *x);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->attr = r2ul(tmp4);
-
-    assert(fread(x->from, sizeof x->from, 1, ifp) == 1);
-    assert(fread(x->to, sizeof x->to, 1, ifp) == 1);
-    assert(fread(x->subj, sizeof x->subj, 1, ifp) == 1);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->orig_zone = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->orig_net = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->orig_node = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->orig_point = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->dest_zone = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->dest_net = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->dest_node = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->dest_point = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->date_written = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->time_written = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->date_arrived = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->time_arrived = r2us(tmp2);
-
-    assert(fread(tmp2, sizeof tmp2, 1, ifp) == 1);
-    x->utc_ofs = r2us(tmp2);
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->replyto = r2ul(tmp4);
-
-    for (i = 0; i < 9; i++)
-    {
-        assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-        x->see[i] = r2ul(tmp4);
-    }
-
-    assert(fread(tmp4, sizeof tmp4, 1, ifp) == 1);
-    x->umsgid = r2ul(tmp4);
-
-    assert(fread(x->ftsc_date, sizeof x->ftsc_date, 1, ifp) == 1);
-}
+static SQFILE *sq;
 
 static void divider(void)
 {
@@ -420,15 +212,9 @@ static void dump_sqxmsg(SQXMSG *x)
 
 static void traverse_frame_list(unsigned long frame_ofs, char *frame_type)
 {
-    unsigned long filesize;
-    SQFRAME sqf;
-    SQXMSG sqx;
-
-    assert(fseek(ifp, 0, SEEK_END) == 0);
-    filesize = (unsigned long) ftell(ifp);
-    assert((long) filesize != -1L);
-
-    assert(fseek(ifp, frame_ofs, SEEK_SET) == 0);
+    SQITER it;
+    SQMSG m;
+    int rc;
 
     if (frame_ofs == 0)
     {
@@ -436,59 +222,271 @@ static void traverse_frame_list(unsigned long frame_ofs, char *frame_type)
         return;
     }
 
-    while (frame_ofs != 0)
+    sq_iter_init(&it, sq, frame_ofs, 0);
+
+    while ((rc = sq_iter_next(&it, &m)) != SQ_END)
     {
-        if (frame_ofs > filesize)
+        if (rc == SQ_EOFS)
         {
             printf("\nFrame offset too high (Offset=0x%08lx Filesize=0x%08lx)\n",
-              frame_ofs, filesize);
-            return;
+              m.ofs, sq->size);
+            break;
+        }
+
+        if (rc == SQ_ELOOP)
+        {
+            printf("\n%s list loops back on itself; run sqfsck for details\n", frame_type);
+            break;
         }
 
-        printf("\n\nCurrent frame offset: 0x%08lx (%lu)\n", frame_ofs, frame_ofs);
-        assert(fseek(ifp, frame_ofs, SEEK_SET) == 0);
-        get_sqframe(&sqf);
-        dump_sqframe(&sqf);
-        frame_ofs = sqf.next_frame;
-        get_sqxmsg(&sqx);
-        dump_sqxmsg(&sqx);
+        printf("\n\nCurrent frame offset: 0x%08lx (%lu)\n", m.ofs, m.ofs);
+        dump_sqframe(&m.frame);
+
+        if (sq_read_xmsg(sq, &m) != SQ_OK)
+        {
+            printf("\nSQXMSG structure extends past the end of the file.\n");
+            continue;
+        }
+
+        dump_sqxmsg(&m.xmsg);
+    }
+
+    sq_iter_free(&it);
+}
+
+/* free frame sizes are counted in powers of two from 64 bytes to 1 MB */
+
+#define SIZE_BUCKETS 16
+
+typedef struct
+{
+    unsigned long frames;
+    double bytes;                    /* frame headers included */
+    double msg;
+    double ctrl;
+    double slack;                    /* frame_len less msg_len */
+    unsigned long slack_frames;
+    unsigned long largest;
+    unsigned long sizes[SIZE_BUCKETS];
+    double size_bytes[SIZE_BUCKETS];
+    int rc;                          /* how the walk ended */
+    unsigned long err_ofs;
+}
+LIST_STATS;
+
+static int size_bucket(unsigned long len)
+{
+    int i;
+
+    for (i = 0; i < SIZE_BUCKETS - 1 && len >= 64UL << i; i++)
+    {
+    }
+
+    return i;
+}
+
+static void sum_frame_list(unsigned long frame_ofs, LIST_STATS *st)
+{
+    SQITER it;
+    SQMSG m;
+
+    memset(st, 0, sizeof *st);
+
+    sq_iter_init(&it, sq, frame_ofs, 0);
+
+    while ((st->rc = sq_iter_next(&it, &m)) == SQ_OK)
+    {
+        const SQFRAME *f;
+        int b;
+
+        f = &m.frame;
+
+        st->frames++;
+        st->bytes += SQFRAME_SIZE + (double) f->frame_len;
+        st->msg += f->msg_len;
+        st->ctrl += f->ctrl_len;
+
+        if (f->frame_len > f->msg_len)
+        {
+            st->slack += f->frame_len - f->msg_len;
+            st->slack_frames++;
+        }
+
+        if (f->frame_len > st->largest)
+        {
+            st->largest = f->frame_len;
+        }
+
+        b = size_bucket(f->frame_len);
+        st->sizes[b]++;
+        st->size_bytes[b] += SQFRAME_SIZE + (double) f->frame_len;
+    }
+
+    st->err_ofs = m.ofs;
+    sq_iter_free(&it);
+}
+
+static double percent(double part, double whole)
+{
+    return whole > 0 ? part * 100 / whole : 0;
+}
+
+static void list_error(const char *frame_type, const LIST_STATS *st)
+{
+    if (st->rc != SQ_END)
+    {
+        printf("\n%s list stops at 0x%08lx: %s; the figures are for the frames before it\n",
+          frame_type, st->err_ofs, sq_strerror(st->rc));
+    }
+}
+
+static void print_stats(SQBASE *x)
+{
+    LIST_STATS st, fr;
+    double size, other, packed, text;
+    int i;
+
+    sum_frame_list(x->first_frame, &st);
+    sum_frame_list(x->first_free_frame, &fr);
+
+    size = sq->size;
+    other = size - SQBASE_SIZE - st.bytes - fr.bytes;
+    packed = SQBASE_SIZE + SQFRAME_SIZE * (double) st.frames + st.msg;
+    text = st.msg - SQXMSG_SIZE * (double) st.frames - st.ctrl;
+
+    printf("Space used by the frames\n");
+
+    divider();
+
+    printf("file size      : %.0f\n", size);
+    printf("stored frames  : %lu, %.0f bytes (%.1f%%)\n", st.frames, st.bytes,
+      percent(st.bytes, size));
+
+    if (st.frames != 0)
+    {
+        printf("  control info : %.0f bytes, %.0f per message\n", st.ctrl, st.ctrl / st.frames);
+        printf("  text         : %.0f bytes, %.0f per message\n", text, text / st.frames);
+        printf("  slack        : %.0f bytes (%.1f%%) in %lu frames\n", st.slack,
+          percent(st.slack, size), st.slack_frames);
+    }
+
+    printf("free frames    : %lu, %.0f bytes (%.1f%%)", fr.frames, fr.bytes,
+      percent(fr.bytes, size));
+
+    if (fr.frames != 0)
+    {
+        printf(", the largest %lu", fr.largest);
+    }
+
+    putchar('\n');
+
+    if (other != 0)
+    {
+        printf("in neither     : %.0f bytes (%.1f%%)\n", other, percent(other, size));
+    }
+
+    printf("packed size    : %.0f, saving %.0f bytes (%.1f%%)\n", packed, size - packed,
+      percent(size - packed, size));
+
+    list_error("Stored", &st);
+    list_error("Free", &fr);
+
+    if (fr.frames == 0)
+    {
+        return;
+    }
+
+    printf("\n\nFree frame sizes\n");
+
+    divider();
+
+    printf("frame_len          frames          bytes\n");
+
+    for (i = 0; i < SIZE_BUCKETS; i++)
+    {
+        char range[32];
+
+        if (fr.sizes[i] == 0)
+        {
+            continue;
+        }
+
+        if (i == 0)
+        {
+            sprintf(range, "< 64");
+        }
+        else if (i == SIZE_BUCKETS - 1)
+        {
+            sprintf(range, ">= %lu", 64UL << (i - 1));
+        }
+        else
+        {
+            sprintf(range, "%lu-%lu", 64UL << (i - 1), (64UL << i) - 1);
+        }
+
+        printf("%-16s %8lu %14.0f\n", range, fr.sizes[i], fr.size_bytes[i]);
     }
 }
 
 int main(int argc, char **argv)
 {
     SQBASE sqb;
+    int stats;
 
 #ifdef PAUSE_ON_EXIT
     pauseOnExit();
 #endif
 
+    stats = argc == 3 && strcmp(argv[1], "-s") == 0;
+
+    if (stats)
+    {
+        argc--;
+        argv++;
+    }
+
     if (argc != 2)
     {
         fprintf(stderr,
           "Displays information about a Squish message base.\n"
           "\n"
-          "usage: squid sqdfile\n"
+          "usage: squid [-s] sqdfile\n"
+          "\n"
+          "  -s   Only sum up the space used by the frames, reading just\n"
+          "       their headers\n"
         );
         return EXIT_FAILURE;
     }
 
-    ifp = fopen(argv[1], "rb");
+    sq = sq_open(argv[1]);
 
-    if (ifp == NULL)
+    if (sq == NULL)
     {
         fprintf(stderr, "squid: Cannot open `%s` for reading: %s\n", argv[1],
           strerror(errno));
         return EXIT_FAILURE;
     }
 
-    get_sqbase(&sqb);
-    dump_sqbase(&sqb);
+    if (sq_read_base(sq, &sqb) != SQ_OK)
+    {
+        fprintf(stderr, "squid: `%s` is too short to be a Squish base\n", argv[1]);
+        sq_close(sq);
+        return EXIT_FAILURE;
+    }
 
-    traverse_frame_list(sqb.first_frame, "Stored");
-    traverse_frame_list(sqb.first_free_frame, "Free");
+    if (stats)
+    {
+        print_stats(&sqb);
+    }
+    else
+    {
+        dump_sqbase(&sqb);
+
+        traverse_frame_list(sqb.first_frame, "Stored");
+        traverse_frame_list(sqb.first_free_frame, "Free");
+    }
 
-    fclose(ifp);
+    sq_close(sq);
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,681 @@
+/*
+ *  squish.c
+ *
+ *  Squish message base reader shared by the squish-utils tools.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  The .sqd is accessed through sq_read(), which hands back a pointer to
+ *  the requested bytes.  When built with HAVE_MMAP the whole file is
+ *  mapped and the pointer points straight into the mapping, so no data is
+ *  copied and no system calls are made per message.  Otherwise (or if the
+ *  file can't be mapped) the bytes are read into a reusable buffer with
+ *  one fseek/fread pair per call.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef HAVE_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include "squish.h"
+
+static void get_str(char *dest, const unsigned char *src, size_t len)
+{
+    memcpy(dest, src, len);
+    dest[len] = '\0';
+}
+
+/*
+ *  Store n little-endian at p, the way r2ul() and r2us() read it back.
+ */
+
+void put_ul(unsigned char *p, unsigned long n)
+{
+    p[0] = (unsigned char) (n & 0xff);
+    p[1] = (unsigned char) ((n >> 8) & 0xff);
+    p[2] = (unsigned char) ((n >> 16) & 0xff);
+    p[3] = (unsigned char) ((n >> 24) & 0xff);
+}
+
+void put_us(unsigned char *p, unsigned short n)
+{
+    p[0] = (unsigned char) (n & 0xff);
+    p[1] = (unsigned char) ((n >> 8) & 0xff);
+}
+
+void sq_decode_base(SQBASE *x, const unsigned char *p)
+{
+    x->sz_sqbase = r2us(p);
+    x->rsvd1 = r2us(p + 2);
+    x->num_msg = r2ul(p + 4);
+    x->high_msg = r2ul(p + 8);
+    x->skip_msg = r2ul(p + 12);
+    x->high_water = r2ul(p + 16);
+    x->uid = r2ul(p + 20);
+    get_str(x->base, p + 24, 80);
+    x->first_frame = r2ul(p + 104);
+    x->last_frame = r2ul(p + 108);
+    x->first_free_frame = r2ul(p + 112);
+    x->last_free_frame = r2ul(p + 116);
+    x->end_frame = r2ul(p + 120);
+    x->max_msg = r2ul(p + 124);
+    x->keep_days = r2us(p + 128);
+    x->sz_sqhdr = r2us(p + 130);
+    memcpy(x->rsvd2, p + 132, sizeof x->rsvd2);
+}
+
+void sq_decode_frame(SQFRAME *x, const unsigned char *p)
+{
+    x->frame_id = r2ul(p);
+    x->next_frame = r2ul(p + 4);
+    x->prev_frame = r2ul(p + 8);
+    x->frame_len = r2ul(p + 12);
+    x->msg_len = r2ul(p + 16);
+    x->ctrl_len = r2ul(p + 20);
+    x->frame_type = r2us(p + 24);
+    x->rsvd = r2us(p + 26);
+}
+
+void sq_decode_xmsg(SQXMSG *x, const unsigned char *p)
+{
+    int i;
+
+    x->attr = r2ul(p);
+    get_str(x->from, p + 4, 36);
+    get_str(x->to, p + 40, 36);
+    get_str(x->subj, p + 76, 72);
+    x->orig_zone = r2us(p + 148);
+    x->orig_net = r2us(p + 150);
+    x->orig_node = r2us(p + 152);
+    x->orig_point = r2us(p + 154);
+    x->dest_zone = r2us(p + 156);
+    x->dest_net = r2us(p + 158);
+    x->dest_node = r2us(p + 160);
+    x->dest_point = r2us(p + 162);
+    x->date_written = r2us(p + 164);
+    x->time_written = r2us(p + 166);
+    x->date_arrived = r2us(p + 168);
+    x->time_arrived = r2us(p + 170);
+    x->utc_ofs = r2us(p + 172);
+    x->replyto = r2ul(p + 174);
+
+    for (i = 0; i < 9; i++)
+    {
+        x->see[i] = r2ul(p + 178 + i * 4);
+    }
+
+    x->umsgid = r2ul(p + 214);
+    get_str(x->ftsc_date, p + 218, 20);
+}
+
+/*
+ *  Opens a .sqd for reading.  Returns NULL with errno set on failure.
+ */
+
+SQFILE *sq_open(const char *filename)
+{
+    SQFILE *sq;
+    long size;
+
+    sq = malloc(sizeof *sq);
+
+    if (sq == NULL)
+    {
+        return NULL;
+    }
+
+    memset(sq, 0, sizeof *sq);
+
+    sq->fp = fopen(filename, "rb");
+
+    if (sq->fp == NULL)
+    {
+        free(sq);
+        return NULL;
+    }
+
+    size = -1L;
+
+    if (fseek(sq->fp, 0, SEEK_END) == 0)
+    {
+        size = ftell(sq->fp);
+    }
+
+    if (size == -1L || fseek(sq->fp, 0, SEEK_SET) != 0)
+    {
+        fclose(sq->fp);
+        free(sq);
+        return NULL;
+    }
+
+    sq->size = (unsigned long) size;
+
+#ifdef HAVE_MMAP
+    if (sq->size != 0)
+    {
+        void *map;
+
+        map = mmap(NULL, (size_t) sq->size, PROT_READ, MAP_SHARED, fileno(sq->fp), 0);
+
+        if (map != MAP_FAILED)
+        {
+            sq->map = map;
+#ifdef MADV_SEQUENTIAL
+            madvise(map, (size_t) sq->size, MADV_SEQUENTIAL);
+#endif
+        }
+    }
+#endif
+
+    return sq;
+}
+
+void sq_close(SQFILE *sq)
+{
+#ifdef HAVE_MMAP
+    if (sq->map != NULL)
+    {
+        munmap((void *) sq->map, (size_t) sq->size);
+    }
+#endif
+
+    free(sq->buf);
+    fclose(sq->fp);
+    free(sq);
+}
+
+/*
+ *  Returns a pointer to len bytes at offset ofs in the file, or NULL if
+ *  that range lies outside the file or can't be read.  The data stays
+ *  valid until the next call.
+ */
+
+const unsigned char *sq_read(SQFILE *sq, unsigned long ofs, unsigned long len)
+{
+    if (ofs > sq->size || len > sq->size - ofs)
+    {
+        return NULL;
+    }
+
+    if (sq->map != NULL)
+    {
+        return sq->map + ofs;
+    }
+
+    if ((size_t) len + 1 > sq->buf_size)
+    {
+        free(sq->buf);
+        sq->buf_size = (size_t) len + 1;
+        sq->buf = malloc(sq->buf_size);
+
+        if (sq->buf == NULL)
+        {
+            sq->buf_size = 0;
+            return NULL;
+        }
+    }
+
+    if (fseek(sq->fp, (long) ofs, SEEK_SET) != 0)
+    {
+        return NULL;
+    }
+
+    if (len != 0 && fread(sq->buf, (size_t) len, 1, sq->fp) != 1)
+    {
+        return NULL;
+    }
+
+    return sq->buf;
+}
+
+int sq_read_base(SQFILE *sq, SQBASE *x)
+{
+    const unsigned char *p;
+
+    p = sq_read(sq, 0, SQBASE_SIZE);
+
+    if (p == NULL)
+    {
+        return SQ_EBASE;
+    }
+
+    sq_decode_base(x, p);
+
+    return SQ_OK;
+}
+
+/*
+ *  Prepares to walk the frame list starting at ofs, following next_frame
+ *  (or prev_frame if backwards is set).  sq_iter_free() frees what the
+ *  walk used, however it ended.
+ */
+
+void sq_iter_init(SQITER *it, SQFILE *sq, unsigned long ofs, int backwards)
+{
+    it->sq = sq;
+    it->next = ofs;
+    it->backwards = backwards;
+    it->count = 0;
+    sq_set_init(&it->seen);
+}
+
+/*
+ *  Reads the next frame header into m.  Returns SQ_OK, SQ_END at the end
+ *  of the list, or an error code.  A frame with a bad frame_id is still
+ *  decoded and its link followed, so the caller may choose to carry on.
+ *  SQ_ELOOP ends the walk: it's returned, with the offset in m->ofs, when
+ *  the list comes back to a frame it has already returned.
+ */
+
+int sq_iter_next(SQITER *it, SQMSG *m)
+{
+    int rc;
+
+    if (it->next == 0)
+    {
+        return SQ_END;
+    }
+
+    /* every frame returned is noted, so a list whose links go round in a
+       circle is stopped the first time one comes round again */
+
+    if (!sq_set_add(&it->seen, it->next))
+    {
+        memset(m, 0, sizeof *m);
+        m->ofs = it->next;
+        it->next = 0;
+        return SQ_ELOOP;
+    }
+
+    rc = sq_read_frame(it->sq, it->next, m);
+
+    if (rc == SQ_EOFS)
+    {
+        it->next = 0;
+        return rc;
+    }
+
+    it->next = it->backwards ? m->frame.prev_frame : m->frame.next_frame;
+    it->count++;
+
+    return rc;
+}
+
+void sq_iter_free(SQITER *it)
+{
+    sq_set_free(&it->seen);
+}
+
+/*
+ *  Reads the frame header at ofs into m, as sq_iter_next() does.
+ */
+
+int sq_read_frame(SQFILE *sq, unsigned long ofs, SQMSG *m)
+{
+    const unsigned char *p;
+
+    memset(m, 0, sizeof *m);
+
+    m->ofs = ofs;
+
+    p = sq_read(sq, ofs, SQFRAME_SIZE);
+
+    if (p == NULL)
+    {
+        return SQ_EOFS;
+    }
+
+    sq_decode_frame(&m->frame, p);
+
+    return m->frame.frame_id == SQHDRID ? SQ_OK : SQ_EID;
+}
+
+/*
+ *  Decodes the XMSG header of the frame in m.
+ */
+
+int sq_read_xmsg(SQFILE *sq, SQMSG *m)
+{
+    const unsigned char *p;
+
+    p = sq_read(sq, m->ofs + SQFRAME_SIZE, SQXMSG_SIZE);
+
+    if (p == NULL)
+    {
+        return SQ_ELEN;
+    }
+
+    sq_decode_xmsg(&m->xmsg, p);
+
+    return SQ_OK;
+}
+
+/*
+ *  Returns the number of bytes following the frame header that hold the
+ *  XMSG header, control info and text of the frame in m.
+ */
+
+static unsigned long msg_size(const SQMSG *m)
+{
+    unsigned long len;
+
+    len = SQXMSG_SIZE + m->frame.ctrl_len;
+
+    if (m->frame.msg_len > len)
+    {
+        len = m->frame.msg_len;
+    }
+
+    return len;
+}
+
+/*
+ *  Checks, without reading it, that the message in the frame in m lies
+ *  inside the file.
+ */
+
+int sq_check_msg(SQFILE *sq, const SQMSG *m)
+{
+    if (m->frame.ctrl_len > sq->size || m->ofs > sq->size ||
+      sq->size - m->ofs < SQFRAME_SIZE ||
+      msg_size(m) > sq->size - m->ofs - SQFRAME_SIZE)
+    {
+        return SQ_ELEN;
+    }
+
+    return SQ_OK;
+}
+
+/*
+ *  Decodes the XMSG header of the frame in m and points m->ctl and m->txt
+ *  at its control info and text, all fetched with a single read.  The
+ *  pointers stay valid until the next read from sq.
+ */
+
+int sq_read_msg(SQFILE *sq, SQMSG *m)
+{
+    const unsigned char *p;
+    unsigned long ctl_len, msg_len;
+
+    ctl_len = m->frame.ctrl_len;
+    msg_len = m->frame.msg_len;
+
+    if (sq_check_msg(sq, m) != SQ_OK)
+    {
+        return SQ_ELEN;
+    }
+
+    p = sq_read(sq, m->ofs + SQFRAME_SIZE, msg_size(m));
+
+    if (p == NULL)
+    {
+        return SQ_ELEN;
+    }
+
+    sq_decode_xmsg(&m->xmsg, p);
+
+    m->ctl = (const char *) p + SQXMSG_SIZE;
+    m->ctl_len = ctl_len;
+    m->txt = m->ctl + ctl_len;
+    m->txt_len = 0;
+
+    if (msg_len > SQXMSG_SIZE + ctl_len)
+    {
+        m->txt_len = msg_len - (SQXMSG_SIZE + ctl_len);
+    }
+
+    return SQ_OK;
+}
+
+static int is_text(const char *s)
+{
+    for (; *s != '\0'; s++)
+    {
+        if ((unsigned char) *s < 0x20 || *s == 0x7f)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ *  Returns 1 if the DOS-style date and time d and t could be real, or
+ *  were never set.
+ */
+
+static int is_dos_date(unsigned short d, unsigned short t)
+{
+    if (d != 0 && ((d & 31) == 0 || ((d >> 5) & 15) < 1 || ((d >> 5) & 15) > 12))
+    {
+        return 0;
+    }
+
+    return (t >> 11) <= 23 && ((t >> 5) & 63) <= 59 && (t & 31) <= 29;
+}
+
+/*
+ *  Returns 1 if x looks like the header of a real message: it has a
+ *  umsgid, its names, subject and ASCII date are text, and its dates and
+ *  times, where set, are real ones.  For telling messages from other data
+ *  when there's no frame list to go by.
+ */
+
+int sq_xmsg_plausible(const SQXMSG *x)
+{
+    return x->umsgid != 0 && is_text(x->from) && is_text(x->to) && is_text(x->subj) &&
+      is_text(x->ftsc_date) && is_dos_date(x->date_written, x->time_written) &&
+      is_dos_date(x->date_arrived, x->time_arrived);
+}
+
+/*
+ *  The hash of a to-name kept in the .sqi, as computed by SquishHash() in
+ *  the Squish MSGAPI (a variant of Weinberger's hashpjw()).  MSGAPI walks
+ *  the name through a plain char pointer, so on the usual compilers bytes
+ *  above 0x7f are sign-extended before they are added; that is kept here
+ *  so that indexes of names with accented letters match.
+ */
+
+unsigned long sq_hash(const char *name)
+{
+    unsigned long h, g;
+    const signed char *p;
+
+    h = 0;
+
+    for (p = (const signed char *) name; *p != 0; p++)
+    {
+        long c;
+
+        c = *p;
+
+        if (c >= 'A' && c <= 'Z')
+        {
+            c += 'a' - 'A';
+        }
+
+        h = ((h << 4) + (unsigned long) c) & 0xffffffffUL;
+        g = h & 0xf0000000UL;
+
+        if (g != 0)
+        {
+            h |= g >> 24;
+            h |= g;
+        }
+    }
+
+    return h & 0x7fffffffUL;
+}
+
+/*
+ *  The hash field of the .sqi record for the message with header x: the
+ *  hash of the to-name, with the top bit set once the message is read.
+ */
+
+unsigned long sq_index_hash(const SQXMSG *x)
+{
+    return sq_hash(x->to) | ((x->attr & XMSG_READ) ? SQIDX_READ : 0);
+}
+
+/*
+ *  Makes the .sqd and .sqi filenames of the base name, which may already
+ *  end in .sqd or .SQD; the .sqi name follows the case of the .sqd one.
+ *  Either of sqd_fn and sqi_fn may be NULL if that name isn't wanted.
+ *  The names are malloc()ed.
+ */
+
+void sq_names(const char *name, char **sqd_fn, char **sqi_fn)
+{
+    char *fn;
+    size_t len;
+
+    len = strlen(name);
+    fn = malloc(len + 5);
+    assert(fn != NULL);
+
+    strcpy(fn, name);
+
+    if (len < 4 || (strcmp(name + len - 4, ".sqd") != 0 && strcmp(name + len - 4, ".SQD") != 0))
+    {
+        strcat(fn, ".sqd");
+        len += 4;
+    }
+
+    if (sqi_fn != NULL)
+    {
+        *sqi_fn = malloc(len + 1);
+        assert(*sqi_fn != NULL);
+
+        strcpy(*sqi_fn, fn);
+        (*sqi_fn)[len - 1] = fn[len - 1] == 'D' ? 'I' : 'i';
+    }
+
+    if (sqd_fn != NULL)
+    {
+        *sqd_fn = fn;
+    }
+    else
+    {
+        free(fn);
+    }
+}
+
+void sq_set_init(SQOFSSET *set)
+{
+    set->slots = NULL;
+    set->size = 0;
+    set->count = 0;
+}
+
+void sq_set_free(SQOFSSET *set)
+{
+    free(set->slots);
+    sq_set_init(set);
+}
+
+static unsigned long slot(const SQOFSSET *set, unsigned long ofs)
+{
+    return ((ofs * 2654435761UL) ^ (ofs >> 16)) & (set->size - 1);
+}
+
+/*
+ *  Adds ofs, which mustn't be 0, to set.  Returns 1 if it wasn't there
+ *  before, or 0 if it was.
+ */
+
+int sq_set_add(SQOFSSET *set, unsigned long ofs)
+{
+    unsigned long i;
+
+    if (set->count * 2 >= set->size)
+    {
+        unsigned long *old, old_size;
+
+        old = set->slots;
+        old_size = set->size;
+
+        set->size = old_size != 0 ? old_size * 2 : 1024;
+        set->slots = calloc(set->size, sizeof *set->slots);
+        assert(set->slots != NULL);
+
+        for (i = 0; i < old_size; i++)
+        {
+            if (old[i] != 0)
+            {
+                unsigned long j;
+
+                for (j = slot(set, old[i]); set->slots[j] != 0; j = (j + 1) & (set->size - 1))
+                {
+                }
+
+                set->slots[j] = old[i];
+            }
+        }
+
+        free(old);
+    }
+
+    for (i = slot(set, ofs); set->slots[i] != 0; i = (i + 1) & (set->size - 1))
+    {
+        if (set->slots[i] == ofs)
+        {
+            return 0;
+        }
+    }
+
+    set->slots[i] = ofs;
+    set->count++;
+
+    return 1;
+}
+
+int sq_set_has(const SQOFSSET *set, unsigned long ofs)
+{
+    unsigned long i;
+
+    if (set->size == 0)
+    {
+        return 0;
+    }
+
+    for (i = slot(set, ofs); set->slots[i] != 0; i = (i + 1) & (set->size - 1))
+    {
+        if (set->slots[i] == ofs)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+const char *sq_strerror(int rc)
+{
+    switch (rc)
+    {
+    case SQ_OK:
+        return "No error";
+    case SQ_END:
+        return "End of frame list";
+    case SQ_EOFS:
+        return "Frame offset is past the end of the file";
+    case SQ_EID:
+        return "Bad frame id";
+    case SQ_ELEN:
+        return "Message extends past the end of the file";
+    case SQ_EBASE:
+        return "File is too short to be a Squish base";
+    case SQ_ELOOP:
+        return "Frame list loops back on itself";
+    default:
+        return "Unknown error";
+    }
+}
@@ -0,0 +1,214 @@
+/*
+ *  squish.h
+ *
+ *  Squish message base structures and a reader shared by the squish-utils
+ *  tools.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __SQUISH_H__
+#define __SQUISH_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define SQHDRID 0xafae4453UL
+
+/* on-disk sizes of the structures below */
+
+#define SQBASE_SIZE  256
+#define SQFRAME_SIZE  28
+#define SQXMSG_SIZE  238
+#define SQIDX_SIZE    12
+
+/* frame types */
+
+#define FRAME_NORMAL  0
+#define FRAME_FREE    1
+#define FRAME_LZSS    2
+#define FRAME_UPDATE  3
+
+/* the attribute bit that is copied into the top bit of the .sqi hash */
+
+#define XMSG_READ  0x0004UL
+#define SQIDX_READ 0x80000000UL
+
+/* little-endian integers as stored in the .sqd and .sqi */
+
+#define r2ul(x) \
+    (unsigned long) ( \
+    ((unsigned long) (x)[3] << 24) | ((unsigned long) (x)[2] << 16) | \
+    ((unsigned long) (x)[1] << 8) | (unsigned long) (x)[0])
+
+#define r2us(x) \
+    (unsigned short) (((unsigned short) (x)[1] << 8) | (unsigned short) (x)[0])
+
+void put_ul(unsigned char *p, unsigned long n);
+void put_us(unsigned char *p, unsigned short n);
+
+/*
+ *  The comments give the offset of each field on disk.  Character fields
+ *  have room for one more byte than is stored so that the decoded strings
+ *  are always nul-terminated.
+ */
+
+typedef struct
+{
+    unsigned short sz_sqbase;        /*   0 */
+    unsigned short rsvd1;            /*   2 */
+    unsigned long num_msg;           /*   4 */
+    unsigned long high_msg;          /*   8 */
+    unsigned long skip_msg;          /*  12 */
+    unsigned long high_water;        /*  16 */
+    unsigned long uid;               /*  20 */
+    char base[80 + 1];               /*  24 */
+    unsigned long first_frame;       /* 104 */
+    unsigned long last_frame;        /* 108 */
+    unsigned long first_free_frame;  /* 112 */
+    unsigned long last_free_frame;   /* 116 */
+    unsigned long end_frame;         /* 120 */
+    unsigned long max_msg;           /* 124 */
+    unsigned short keep_days;        /* 128 */
+    unsigned short sz_sqhdr;         /* 130 */
+    unsigned char rsvd2[124];        /* 132 */
+}                                    /* 256 */
+SQBASE;
+
+typedef struct
+{
+    unsigned long frame_id;          /*   0 */
+    unsigned long next_frame;        /*   4 */
+    unsigned long prev_frame;        /*   8 */
+    unsigned long frame_len;         /*  12 */
+    unsigned long msg_len;           /*  16 */
+    unsigned long ctrl_len;          /*  20 */
+    unsigned short frame_type;       /*  24 */
+    unsigned short rsvd;             /*  26 */
+}                                    /*  28 */
+SQFRAME;
+
+typedef struct
+{
+    unsigned long attr;              /*   0 */
+    char from[36 + 1];               /*   4 */
+    char to[36 + 1];                 /*  40 */
+    char subj[72 + 1];               /*  76 */
+    unsigned short orig_zone;        /* 148 */
+    unsigned short orig_net;         /* 150 */
+    unsigned short orig_node;        /* 152 */
+    unsigned short orig_point;       /* 154 */
+    unsigned short dest_zone;        /* 156 */
+    unsigned short dest_net;         /* 158 */
+    unsigned short dest_node;        /* 160 */
+    unsigned short dest_point;       /* 162 */
+    unsigned short date_written;     /* 164 */
+    unsigned short time_written;     /* 166 */
+    unsigned short date_arrived;     /* 168 */
+    unsigned short time_arrived;     /* 170 */
+    unsigned short utc_ofs;          /* 172 */
+    unsigned long replyto;           /* 174 */
+    unsigned long see[9];            /* 178 */
+    unsigned long umsgid;            /* 214 */
+    char ftsc_date[20 + 1];          /* 218 */
+}                                    /* 238 */
+SQXMSG;
+
+/* an open .sqd file */
+
+typedef struct
+{
+    FILE *fp;
+    const unsigned char *map;        /* the whole file, if it's mapped */
+    unsigned long size;
+    unsigned char *buf;              /* read buffer when it isn't */
+    size_t buf_size;
+}
+SQFILE;
+
+/* one frame, as returned by sq_iter_next() and filled in by sq_read_msg() */
+
+typedef struct
+{
+    unsigned long ofs;               /* offset of the frame in the file */
+    SQFRAME frame;
+    SQXMSG xmsg;
+    const char *ctl;                 /* control info; not nul-terminated */
+    unsigned long ctl_len;
+    const char *txt;                 /* message text; not nul-terminated */
+    unsigned long txt_len;
+}
+SQMSG;
+
+/* a set of frame offsets, open addressing; 0 is never a frame */
+
+typedef struct
+{
+    unsigned long *slots;
+    unsigned long size;              /* a power of 2 */
+    unsigned long count;
+}
+SQOFSSET;
+
+/* walks a frame list in either direction */
+
+typedef struct
+{
+    SQFILE *sq;
+    unsigned long next;              /* offset of the next frame, or 0 */
+    int backwards;                   /* follow prev_frame instead of next_frame */
+    unsigned long count;             /* frames returned so far */
+    SQOFSSET seen;                   /* ... and where they were */
+}
+SQITER;
+
+/* return codes */
+
+#define SQ_OK    0  /* success */
+#define SQ_END   1  /* no more frames in the list */
+#define SQ_EOFS  2  /* frame offset lies outside the file */
+#define SQ_EID   3  /* frame has a bad frame_id */
+#define SQ_ELEN  4  /* message extends past the end of the file */
+#define SQ_EBASE 5  /* file is too short to hold an SQBASE */
+#define SQ_ELOOP 6  /* frame list comes back to a frame it has been to */
+
+void sq_decode_base(SQBASE *x, const unsigned char *buf);
+void sq_decode_frame(SQFRAME *x, const unsigned char *buf);
+void sq_decode_xmsg(SQXMSG *x, const unsigned char *buf);
+
+SQFILE *sq_open(const char *filename);
+void sq_close(SQFILE *sq);
+const unsigned char *sq_read(SQFILE *sq, unsigned long ofs, unsigned long len);
+int sq_read_base(SQFILE *sq, SQBASE *x);
+
+void sq_iter_init(SQITER *it, SQFILE *sq, unsigned long ofs, int backwards);
+int sq_iter_next(SQITER *it, SQMSG *m);
+void sq_iter_free(SQITER *it);
+int sq_read_frame(SQFILE *sq, unsigned long ofs, SQMSG *m);
+int sq_check_msg(SQFILE *sq, const SQMSG *m);
+int sq_read_xmsg(SQFILE *sq, SQMSG *m);
+int sq_read_msg(SQFILE *sq, SQMSG *m);
+int sq_xmsg_plausible(const SQXMSG *x);
+
+unsigned long sq_hash(const char *name);
+unsigned long sq_index_hash(const SQXMSG *x);
+
+void sq_names(const char *name, char **sqd_fn, char **sqi_fn);
+
+void sq_set_init(SQOFSSET *set);
+int sq_set_add(SQOFSSET *set, unsigned long ofs);
+int sq_set_has(const SQOFSSET *set, unsigned long ofs);
+void sq_set_free(SQOFSSET *set);
+
+const char *sq_strerror(int rc);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,671 @@
+/*
+ *  squndel.c
+ *
+ *  Recovers deleted messages from the free frames of a Squish base.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  When Squish deletes a message it only marks the frame free and puts
+ *  it on the free list; the message stays where it was until the frame
+ *  is used again, and when neighbouring free frames are merged the
+ *  messages in the ones swallowed up stay too, frame header and all.
+ *  So each frame on the free list is looked at for a message at its
+ *  start, and the rest of it is searched for the frame ids of others.
+ *
+ *  Only headers are read to begin with: a message is a candidate if its
+ *  lengths fit inside the free frame and its XMSG is plausible (see
+ *  sq_xmsg_plausible()), and only candidates that also pass the date and
+ *  header filters are read whole and checked for a body that hasn't
+ *  been written over: control info that starts with a kludge, or is
+ *  empty.  The text isn't judged, as stored messages can have anything
+ *  after a nul in theirs too (squ2mbox stops at the nul).  A free copy
+ *  of a message that's still stored, as Squish leaves behind when it
+ *  moves a message that has grown, is skipped unless -a is given.
+ *
+ *  The messages recovered are listed, written to an mbox as squ2mbox
+ *  would, or with -r put back into the base in umsgid order.  Putting
+ *  them back rewrites the base with sqwrite.c, which packs it, so the
+ *  free frames that weren't recovered are gone afterwards.
+ */
+
+#define PROGRAM "squndel"
+#define VERSION "1.0"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+
+#include "squish.h"
+#include "buf.h"
+#include "sqdate.h"
+#include "sqorder.h"
+#include "mboxfmt.h"
+#include "filter.h"
+#include "outfile.h"
+#include "sqwrite.h"
+
+/* output is written in blocks of about this size */
+
+#define OUTPUT_BUFSIZE 65536
+
+typedef struct
+{
+    SQFILE *sq;
+    unsigned long *stored;           /* umsgids of the stored messages, sorted */
+    unsigned long stored_count;
+    SQFOUND *found;                  /* messages found in free frames */
+    unsigned long count;
+    unsigned long size;
+    unsigned long frames;            /* free frames walked */
+    unsigned long candidates;        /* messages with plausible headers */
+    unsigned long superseded;        /* ... that are copies of stored ones */
+    unsigned long filtered;          /* ... that didn't pass the filters */
+    unsigned long overwritten;       /* ... whose bodies were written over */
+    unsigned long repeats;           /* ... found twice */
+}
+UNDEL;
+
+static FILTER filter;
+static int dated = 0;
+static time_t since = -2147483647L - 1;
+static time_t until = 2147483647L;
+static int all = 0;
+
+static int cmp_ulong(const void *a, const void *b)
+{
+    unsigned long x, y;
+
+    x = *(const unsigned long *) a;
+    y = *(const unsigned long *) b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/*
+ *  Collects the umsgids of the stored messages.  Returns SQ_END, or the
+ *  error the frame list stopped at.
+ */
+
+static int read_stored(UNDEL *u, const SQBASE *sqb, unsigned long *err_ofs)
+{
+    SQITER it;
+    SQMSG m;
+    unsigned long size;
+    int rc;
+
+    size = 0;
+    sq_iter_init(&it, u->sq, sqb->first_frame, 0);
+
+    while ((rc = sq_iter_next(&it, &m)) == SQ_OK && (rc = sq_read_xmsg(u->sq, &m)) == SQ_OK)
+    {
+        if (u->stored_count == size)
+        {
+            size = size != 0 ? size * 2 : 1024;
+            u->stored = realloc(u->stored, sizeof *u->stored * size);
+            assert(u->stored != NULL);
+        }
+
+        u->stored[u->stored_count++] = m.xmsg.umsgid;
+    }
+
+    sq_iter_free(&it);
+    *err_ofs = m.ofs;
+
+    if (u->stored_count != 0)
+    {
+        qsort(u->stored, u->stored_count, sizeof *u->stored, cmp_ulong);
+    }
+
+    return rc;
+}
+
+static int is_stored(const UNDEL *u, unsigned long umsgid)
+{
+    return u->stored_count != 0 && bsearch(&umsgid, u->stored, u->stored_count,
+      sizeof *u->stored, cmp_ulong) != NULL;
+}
+
+/*
+ *  Returns the time the message in x was written, as squ2mbox has it, or
+ *  -1 if it doesn't say.
+ */
+
+static time_t written(const SQXMSG *x)
+{
+    time_t t;
+
+    return sqdate_written(x, &t) == 0 ? t : (time_t) -1;
+}
+
+/*
+ *  Returns 1 if the message read into m with sq_read_msg() looks as it
+ *  was written, or 0 if some of it has been written over.
+ */
+
+static int is_intact(const SQMSG *m)
+{
+    return m->ctl_len == 0 || m->ctl[0] == '\001' || m->ctl[0] == '\0';
+}
+
+/*
+ *  Looks for a message with its frame header at ofs, inside the free
+ *  frame that ends at end.  Returns where the message ends if it has a
+ *  plausible header, whether or not it's recovered, or 0 if it hasn't.
+ */
+
+static unsigned long consider(UNDEL *u, unsigned long ofs, unsigned long end)
+{
+    SQMSG m;
+    const SQFRAME *f;
+
+    if (sq_read_frame(u->sq, ofs, &m) != SQ_OK)
+    {
+        return 0;
+    }
+
+    f = &m.frame;
+
+    if (f->msg_len < SQXMSG_SIZE || f->ctrl_len > f->msg_len - SQXMSG_SIZE ||
+      f->msg_len > end - ofs - SQFRAME_SIZE || sq_read_xmsg(u->sq, &m) != SQ_OK ||
+      !sq_xmsg_plausible(&m.xmsg))
+    {
+        return 0;
+    }
+
+    u->candidates++;
+    end = ofs + SQFRAME_SIZE + f->msg_len;
+
+    if (!all && is_stored(u, m.xmsg.umsgid))
+    {
+        u->superseded++;
+        return end;
+    }
+
+    if (filter.count != 0 && !filter_match(&filter, &m.xmsg))
+    {
+        u->filtered++;
+        return end;
+    }
+
+    if (dated)
+    {
+        time_t t;
+
+        t = written(&m.xmsg);
+
+        if (t == (time_t) -1 || t < since || t > until)
+        {
+            u->filtered++;
+            return end;
+        }
+    }
+
+    if (sq_read_msg(u->sq, &m) != SQ_OK || !is_intact(&m))
+    {
+        u->overwritten++;
+        return end;
+    }
+
+    if (u->count == u->size)
+    {
+        u->size = u->size != 0 ? u->size * 2 : 256;
+        u->found = realloc(u->found, sizeof *u->found * u->size);
+        assert(u->found != NULL);
+    }
+
+    u->found[u->count].umsgid = m.xmsg.umsgid;
+    u->found[u->count].ofs = ofs;
+    u->count++;
+
+    return end;
+}
+
+/*
+ *  Looks for messages in the free frame in m: one at its start, and any
+ *  whose frame headers are inside it.
+ */
+
+static void search_frame(UNDEL *u, const SQMSG *m, SQOFS *hits)
+{
+    const unsigned char *data, *p, *stop;
+    unsigned long start, end, done, i;
+
+    end = m->ofs + SQFRAME_SIZE;
+    end += m->frame.frame_len < u->sq->size - end ? m->frame.frame_len : u->sq->size - end;
+
+    done = consider(u, m->ofs, end);
+    start = done != 0 ? done : m->ofs + SQFRAME_SIZE;
+
+    if (end - start < SQFRAME_SIZE + SQXMSG_SIZE)
+    {
+        return;
+    }
+
+    /* find the frame ids first; without a mapping, reading a message
+       would overwrite the data being searched */
+
+    data = sq_read(u->sq, start, end - start);
+
+    if (data == NULL)
+    {
+        return;
+    }
+
+    hits->count = 0;
+    p = data;
+    stop = data + (end - start) - (SQFRAME_SIZE + SQXMSG_SIZE) + 1;
+
+    while (p < stop && (p = memchr(p, 0x53, (size_t) (stop - p))) != NULL)
+    {
+        if (p[1] == 0x44 && p[2] == 0xae && p[3] == 0xaf)
+        {
+            sq_ofs_add(hits, start + (unsigned long) (p - data));
+        }
+
+        p++;
+    }
+
+    for (i = 0, done = 0; i < hits->count; i++)
+    {
+        unsigned long e;
+
+        if (hits->ofs[i] < done)
+        {
+            continue;
+        }
+
+        e = consider(u, hits->ofs[i], end);
+
+        if (e != 0)
+        {
+            done = e;
+        }
+    }
+}
+
+/*
+ *  Walks the free list.  Returns SQ_END, or the error it stopped at.
+ */
+
+static int walk_free(UNDEL *u, const SQBASE *sqb, unsigned long *err_ofs)
+{
+    SQITER it;
+    SQMSG m;
+    SQOFS hits;
+    int rc;
+
+    sq_ofs_init(&hits);
+    sq_iter_init(&it, u->sq, sqb->first_free_frame, 0);
+
+    while ((rc = sq_iter_next(&it, &m)) == SQ_OK)
+    {
+        u->frames++;
+        search_frame(u, &m, &hits);
+    }
+
+    sq_iter_free(&it);
+    *err_ofs = m.ofs;
+    sq_ofs_free(&hits);
+
+    return rc;
+}
+
+static void read_found(UNDEL *u, unsigned long i, SQMSG *m)
+{
+    /* these were read once already, so can't fail */
+
+    sq_read_frame(u->sq, u->found[i].ofs, m);
+    assert(sq_read_msg(u->sq, m) == SQ_OK);
+}
+
+static void list_found(UNDEL *u)
+{
+    SQDATE_CACHE dc;
+    unsigned long i;
+
+    sqdate_cache_init(&dc);
+
+    for (i = 0; i < u->count; i++)
+    {
+        SQMSG m;
+        char date[32];
+        time_t t;
+
+        sq_read_frame(u->sq, u->found[i].ofs, &m);
+        sq_read_xmsg(u->sq, &m);
+
+        t = written(&m.xmsg);
+
+        if (t != (time_t) -1)
+        {
+            sqdate_fmt_iso(&dc, t, date);
+        }
+        else
+        {
+            strcpy(date, "-");
+        }
+
+        printf("0x%08lx %lu %s  %s -> %s  %s\n", m.ofs, m.xmsg.umsgid, date, m.xmsg.from,
+          m.xmsg.to, m.xmsg.subj);
+    }
+}
+
+static int write_mbox(UNDEL *u, const char *filename)
+{
+    MBOXFMT fmt = { MBOX_UTF8, 0, PROGRAM " " VERSION, { 0 }, 0 };
+    SQDATE_CACHE dc;
+    OUTFILE *ofp;
+    BUF out;
+    time_t now;
+    unsigned long i;
+    int failed;
+
+    ofp = out_open(filename, "wb", OUT_RAW);
+
+    if (ofp == NULL)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for writing: %s\n", filename,
+          strerror(errno));
+        return -1;
+    }
+
+    now = time(NULL);
+    fmt.start = *gmtime(&now);
+    sqdate_cache_init(&dc);
+    buf_init(&out);
+    failed = 0;
+
+    for (i = 0; i < u->count && !failed; i++)
+    {
+        SQMSG m;
+
+        read_found(u, i, &m);
+        mbox_format(&out, &fmt, &m, i + 1, &dc);
+
+        if (out.len >= OUTPUT_BUFSIZE)
+        {
+            failed = out_write(ofp, out.data, out.len) != 0;
+            out.len = 0;
+        }
+    }
+
+    if (!failed && out.len != 0)
+    {
+        failed = out_write(ofp, out.data, out.len) != 0;
+    }
+
+    failed |= out_close(ofp) != 0;
+    buf_free(&out);
+
+    if (failed)
+    {
+        fprintf(stderr, PROGRAM ": Error writing `%s`: %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int add_msg(SQWRITER *w, SQFILE *sq, const SQMSG *m)
+{
+    const unsigned char *p;
+
+    p = sq_read(sq, m->ofs + SQFRAME_SIZE, m->frame.msg_len);
+
+    if (p == NULL)
+    {
+        errno = EIO;
+        return -1;
+    }
+
+    return sqw_add(w, &m->xmsg, p, m->frame.msg_len, m->frame.ctrl_len);
+}
+
+/*
+ *  Rewrites the base with the messages found put back among the stored
+ *  ones, in umsgid order.
+ */
+
+static int reinsert(UNDEL *u, const SQBASE *sqb, const char *sqd_fn, const char *sqi_fn)
+{
+    SQWRITER w;
+    SQITER it;
+    SQMSG m, f;
+    unsigned long i;
+    int rc;
+
+    if (sqw_open(&w, sqd_fn, sqi_fn, sqb) != 0)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s.tmp` for writing: %s\n", sqd_fn,
+          strerror(errno));
+        return -1;
+    }
+
+    i = 0;
+    sq_iter_init(&it, u->sq, sqb->first_frame, 0);
+
+    while ((rc = sq_iter_next(&it, &m)) == SQ_OK && (rc = sq_read_xmsg(u->sq, &m)) == SQ_OK)
+    {
+        for (; i < u->count && u->found[i].umsgid < m.xmsg.umsgid && rc == SQ_OK; i++)
+        {
+            sq_read_frame(u->sq, u->found[i].ofs, &f);
+            sq_read_xmsg(u->sq, &f);
+            rc = add_msg(&w, u->sq, &f);
+        }
+
+        if (rc != SQ_OK || add_msg(&w, u->sq, &m) != 0)
+        {
+            rc = -1;
+            break;
+        }
+    }
+
+    sq_iter_free(&it);
+
+    for (; i < u->count && rc == SQ_END; i++)
+    {
+        sq_read_frame(u->sq, u->found[i].ofs, &f);
+        sq_read_xmsg(u->sq, &f);
+
+        if (add_msg(&w, u->sq, &f) != 0)
+        {
+            rc = -1;
+        }
+    }
+
+    if (rc != SQ_END)
+    {
+        if (rc == -1)
+        {
+            fprintf(stderr, PROGRAM ": Error writing `%s.tmp`: %s\n", sqd_fn, strerror(errno));
+        }
+        else
+        {
+            fprintf(stderr, PROGRAM ": Frame at 0x%08lx: %s\n", m.ofs, sq_strerror(rc));
+        }
+
+        sqw_abort(&w);
+        return -1;
+    }
+
+    if (sqw_close(&w) != 0)
+    {
+        fprintf(stderr, PROGRAM ": Error writing `%s`: %s\n", sqd_fn, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int usage(void)
+{
+    fprintf(
+      stderr,
+      PROGRAM " " VERSION "\n"
+      "\n"
+      "Recovers deleted messages from the free frames of a Squish base.\n"
+      "Written by Andrew Clarke and released to the public domain.\n"
+      "\n"
+      "Usage: " PROGRAM " [options] base[.sqd]            List what can be recovered\n"
+      "       " PROGRAM " [options] base[.sqd] mboxfile   Write it to an mbox\n"
+      "       " PROGRAM " [options] -r base[.sqd]         Put it back in the base\n"
+      "\n"
+      "  -r           Put the messages back, rewriting the base; it's packed\n"
+      "               as it's rewritten, so anything not recovered is lost.\n"
+      "               Nothing else may use the base meanwhile\n"
+      "  -a           Include free copies of messages that are still stored;\n"
+      "               not with -r\n"
+      "  --since date Only messages written on or after this date\n"
+      "               (YYYY-MM-DD [HH:MM[:SS]])\n"
+      "  --until date ... and on or before this date\n"
+      "  --from pattern, --to pattern, --subj pattern, --orig addr,\n"
+      "  --dest addr, --attr flags\n"
+      "               Only messages whose headers match, as for squ2mbox\n"
+    );
+
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+    UNDEL u;
+    SQBASE sqb;
+    char *sqd_fn, *sqi_fn;
+    unsigned long err_ofs;
+    int put_back, rc;
+
+    put_back = 0;
+    filter_init(&filter);
+
+    while (argc > 1 && argv[1][0] == '-')
+    {
+        if (strcmp(argv[1], "-r") == 0 || strcmp(argv[1], "-a") == 0)
+        {
+            if (argv[1][1] == 'r')
+            {
+                put_back = 1;
+            }
+            else
+            {
+                all = 1;
+            }
+
+            argc--;
+            argv++;
+            continue;
+        }
+
+        if ((strcmp(argv[1], "--since") == 0 || strcmp(argv[1], "--until") == 0) && argc > 2)
+        {
+            int end;
+
+            end = argv[1][2] == 'u';
+
+            if (sqdate_parse(argv[2], end, end ? &until : &since) != 0)
+            {
+                fprintf(stderr, PROGRAM ": Bad date `%s`; use YYYY-MM-DD [HH:MM[:SS]]\n",
+                  argv[2]);
+                return EXIT_FAILURE;
+            }
+
+            dated = 1;
+        }
+        else if (strncmp(argv[1], "--", 2) == 0 && argc > 2 &&
+          (rc = filter_add(&filter, argv[1] + 2, argv[2])) != 1)
+        {
+            if (rc != 0)
+            {
+                fprintf(stderr, PROGRAM ": Bad %s pattern `%s`\n", argv[1], argv[2]);
+                return EXIT_FAILURE;
+            }
+        }
+        else
+        {
+            return usage();
+        }
+
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc < 2 || argc > 3 || (put_back && (argc != 2 || all)))
+    {
+        return usage();
+    }
+
+    sq_names(argv[1], &sqd_fn, &sqi_fn);
+
+    memset(&u, 0, sizeof u);
+    u.sq = sq_open(sqd_fn);
+
+    if (u.sq == NULL)
+    {
+        fprintf(stderr, PROGRAM ": Cannot open `%s` for reading: %s\n", sqd_fn, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (sq_read_base(u.sq, &sqb) != SQ_OK || sqb.sz_sqbase != SQBASE_SIZE ||
+      sqb.sz_sqhdr != SQFRAME_SIZE)
+    {
+        fprintf(stderr, PROGRAM ": `%s` is not a Squish base\n", sqd_fn);
+        return EXIT_FAILURE;
+    }
+
+    /* the stored messages are needed to spot copies, and to put the
+       others back among */
+
+    rc = read_stored(&u, &sqb, &err_ofs);
+
+    if (rc != SQ_END)
+    {
+        fprintf(stderr, PROGRAM ": Stored frame at 0x%08lx: %s; try sqfsck and sqsalvage\n",
+          err_ofs, sq_strerror(rc));
+        return EXIT_FAILURE;
+    }
+
+    rc = walk_free(&u, &sqb, &err_ofs);
+
+    if (rc != SQ_END)
+    {
+        fprintf(stderr, PROGRAM ": Free frame at 0x%08lx: %s; recovering what came before\n",
+          err_ofs, sq_strerror(rc));
+    }
+
+    u.repeats = sq_umsgid_order(u.found, &u.count);
+
+    fprintf(argc == 2 && !put_back ? stderr : stdout,
+      "%s: %lu free frames, %lu deleted messages found, %lu recovered\n"
+      "  %lu copies of stored messages, %lu filtered out, %lu written over, %lu repeats\n",
+      sqd_fn, u.frames, u.candidates, u.count, u.superseded, u.filtered, u.overwritten,
+      u.repeats);
+
+    rc = 0;
+
+    if (put_back)
+    {
+        if (u.count != 0)
+        {
+            rc = reinsert(&u, &sqb, sqd_fn, sqi_fn);
+        }
+    }
+    else if (argc == 3)
+    {
+        rc = write_mbox(&u, argv[2]);
+    }
+    else
+    {
+        list_found(&u);
+    }
+
+    sq_close(u.sq);
+    filter_free(&filter);
+    free(u.found);
+    free(u.stored);
+    free(sqi_fn);
+    free(sqd_fn);
+
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,345 @@
+/*
+ *  sqwrite.c
+ *
+ *  Writes a new Squish base, .sqd and .sqi, a message at a time.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ *
+ *  Messages are added in the order they're to have in the frame list,
+ *  each with its XMSG, control info and text as they lie on disk, and go
+ *  into frames exactly their size, one after another, so the new base
+ *  has no free frames and no slack.  Both files are written sequentially
+ *  through buffers of OUTPUT_BUFSIZE bytes; only the SQBASE and the last
+ *  frame's next_frame are gone back over by sqw_close().
+ *
+ *  The files are written as name.tmp, synced, and renamed into place by
+ *  sqw_close(), the .sqd first.  So an existing base is replaced only by
+ *  a complete one, and if the run is stopped between the two renames the
+ *  worst left behind is a stale .sqi, which sqd2sqi can rebuild.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include "sqwrite.h"
+
+/* output is written in blocks of about this size */
+
+#define OUTPUT_BUFSIZE 1048576
+
+static void encode_base(unsigned char *p, const SQBASE *x)
+{
+    memset(p, 0, SQBASE_SIZE);
+
+    put_us(p, x->sz_sqbase);
+    put_us(p + 2, x->rsvd1);
+    put_ul(p + 4, x->num_msg);
+    put_ul(p + 8, x->high_msg);
+    put_ul(p + 12, x->skip_msg);
+    put_ul(p + 16, x->high_water);
+    put_ul(p + 20, x->uid);
+    memcpy(p + 24, x->base, strlen(x->base));
+    put_ul(p + 104, x->first_frame);
+    put_ul(p + 108, x->last_frame);
+    put_ul(p + 112, x->first_free_frame);
+    put_ul(p + 116, x->last_free_frame);
+    put_ul(p + 120, x->end_frame);
+    put_ul(p + 124, x->max_msg);
+    put_us(p + 128, x->keep_days);
+    put_us(p + 130, x->sz_sqhdr);
+    memcpy(p + 132, x->rsvd2, sizeof x->rsvd2);
+}
+
+static char *tmp_name(const char *filename)
+{
+    char *tmp;
+
+    tmp = malloc(strlen(filename) + 5);
+    assert(tmp != NULL);
+    sprintf(tmp, "%s.tmp", filename);
+
+    return tmp;
+}
+
+static char *copy_str(const char *s)
+{
+    char *p;
+
+    p = malloc(strlen(s) + 1);
+    assert(p != NULL);
+    strcpy(p, s);
+
+    return p;
+}
+
+static void flush(SQWRITER *w, FILE *fp, BUF *b)
+{
+    if (b->len != 0 && w->failed == 0 && fwrite(b->data, b->len, 1, fp) != 1)
+    {
+        w->failed = errno != 0 ? errno : EIO;
+    }
+
+    b->len = 0;
+}
+
+static void free_writer(SQWRITER *w)
+{
+    buf_free(&w->out);
+    buf_free(&w->idx);
+    free(w->sqd_name);
+    free(w->sqi_name);
+    free(w->sqd_tmp);
+    free(w->sqi_tmp);
+}
+
+/*
+ *  Starts writing a base to sqd_name and sqi_name.  Its SQBASE is sqb
+ *  with the frame lists and message counts cleared; sqb may be NULL for a
+ *  blank one.  Returns 0, or -1 with errno set.
+ */
+
+int sqw_open(SQWRITER *w, const char *sqd_name, const char *sqi_name, const SQBASE *sqb)
+{
+    unsigned char p[SQBASE_SIZE];
+
+    memset(w, 0, sizeof *w);
+
+    if (sqb != NULL)
+    {
+        w->base = *sqb;
+    }
+
+    w->base.sz_sqbase = SQBASE_SIZE;
+    w->base.sz_sqhdr = SQFRAME_SIZE;
+    w->base.num_msg = 0;
+    w->base.high_msg = 0;
+    w->base.first_frame = 0;
+    w->base.last_frame = 0;
+    w->base.first_free_frame = 0;
+    w->base.last_free_frame = 0;
+    w->base.end_frame = SQBASE_SIZE;
+
+    if (w->base.uid == 0)
+    {
+        w->base.uid = 1;
+    }
+
+    w->sqd_name = copy_str(sqd_name);
+    w->sqi_name = copy_str(sqi_name);
+    w->sqd_tmp = tmp_name(sqd_name);
+    w->sqi_tmp = tmp_name(sqi_name);
+
+    buf_init(&w->out);
+    buf_init(&w->idx);
+
+    w->sqd = fopen(w->sqd_tmp, "wb");
+
+    if (w->sqd == NULL)
+    {
+        free_writer(w);
+        return -1;
+    }
+
+    w->sqi = fopen(w->sqi_tmp, "wb");
+
+    if (w->sqi == NULL)
+    {
+        int err;
+
+        err = errno;
+        fclose(w->sqd);
+        remove(w->sqd_tmp);
+        free_writer(w);
+        errno = err;
+        return -1;
+    }
+
+    /* a placeholder until sqw_close() knows what goes in it */
+
+    encode_base(p, &w->base);
+    buf_write(&w->out, p, SQBASE_SIZE);
+
+    return 0;
+}
+
+/*
+ *  Adds a message to the end of the frame list: its header x, decoded,
+ *  and msg, the msg_len bytes of its XMSG, control info and text as
+ *  stored, of which ctrl_len are control info.  Returns 0, or -1 with
+ *  errno set if the base would outgrow 4 GB or a write failed.
+ */
+
+int sqw_add(SQWRITER *w, const SQXMSG *x, const unsigned char *msg, unsigned long msg_len,
+  unsigned long ctrl_len)
+{
+    unsigned char p[SQFRAME_SIZE];
+    unsigned long ofs, next;
+
+    if (w->failed != 0)
+    {
+        errno = w->failed;
+        return -1;
+    }
+
+    ofs = w->base.end_frame;
+
+    if (msg_len > 0xffffffffUL - SQFRAME_SIZE - ofs)
+    {
+        errno = w->failed = EFBIG;
+        return -1;
+    }
+
+    next = ofs + SQFRAME_SIZE + msg_len;
+
+    put_ul(p, SQHDRID);
+    put_ul(p + 4, next);
+    put_ul(p + 8, w->last);
+    put_ul(p + 12, msg_len);
+    put_ul(p + 16, msg_len);
+    put_ul(p + 20, ctrl_len);
+    put_us(p + 24, FRAME_NORMAL);
+    put_us(p + 26, 0);
+
+    buf_write(&w->out, p, SQFRAME_SIZE);
+    buf_write(&w->out, msg, (size_t) msg_len);
+
+    put_ul(p, ofs);
+    put_ul(p + 4, x->umsgid);
+    put_ul(p + 8, sq_index_hash(x));
+    buf_write(&w->idx, p, SQIDX_SIZE);
+
+    if (w->base.first_frame == 0)
+    {
+        w->base.first_frame = ofs;
+    }
+
+    w->base.last_frame = ofs;
+    w->base.end_frame = next;
+    w->base.num_msg++;
+    w->base.high_msg++;
+
+    if (x->umsgid >= w->base.uid && x->umsgid != 0xffffffffUL)
+    {
+        w->base.uid = x->umsgid + 1;
+    }
+
+    w->last = ofs;
+
+    if (w->out.len >= OUTPUT_BUFSIZE)
+    {
+        flush(w, w->sqd, &w->out);
+    }
+
+    if (w->idx.len >= OUTPUT_BUFSIZE)
+    {
+        flush(w, w->sqi, &w->idx);
+    }
+
+    return w->failed == 0 ? 0 : -1;
+}
+
+static int finish(FILE *fp)
+{
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ *  Ends the last frame's list, writes the SQBASE, and renames the new
+ *  files into place, replacing any there already.  Returns 0, or -1 with
+ *  errno set, in which case the temporary files are removed.  Either way
+ *  w is done with.
+ */
+
+int sqw_close(SQWRITER *w)
+{
+    unsigned char p[SQBASE_SIZE];
+    int err;
+
+    flush(w, w->sqd, &w->out);
+    flush(w, w->sqi, &w->idx);
+
+    err = w->failed;
+
+    if (err == 0 && w->last != 0)
+    {
+        put_ul(p, 0);
+
+        if (fseek(w->sqd, (long) (w->last + 4), SEEK_SET) != 0 || fwrite(p, 4, 1, w->sqd) != 1)
+        {
+            err = errno;
+        }
+    }
+
+    if (err == 0)
+    {
+        encode_base(p, &w->base);
+
+        if (fseek(w->sqd, 0, SEEK_SET) != 0 || fwrite(p, SQBASE_SIZE, 1, w->sqd) != 1)
+        {
+            err = errno;
+        }
+    }
+
+    if (err == 0 && (finish(w->sqd) != 0 || finish(w->sqi) != 0))
+    {
+        err = errno;
+    }
+
+    if (fclose(w->sqd) != 0 && err == 0)
+    {
+        err = errno;
+    }
+
+    if (fclose(w->sqi) != 0 && err == 0)
+    {
+        err = errno;
+    }
+
+    if (err == 0 && rename(w->sqd_tmp, w->sqd_name) != 0)
+    {
+        err = errno;
+    }
+
+    if (err == 0 && rename(w->sqi_tmp, w->sqi_name) != 0)
+    {
+        err = errno;
+    }
+
+    if (err != 0)
+    {
+        remove(w->sqd_tmp);
+        remove(w->sqi_tmp);
+    }
+
+    free_writer(w);
+
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ *  Gives up on the base being written, removing the temporary files.
+ */
+
+void sqw_abort(SQWRITER *w)
+{
+    fclose(w->sqd);
+    fclose(w->sqi);
+    remove(w->sqd_tmp);
+    remove(w->sqi_tmp);
+    free_writer(w);
+}
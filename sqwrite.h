@@ -0,0 +1,48 @@
+/*
+ *  sqwrite.h
+ *
+ *  Writes a new Squish base, .sqd and .sqi, a message at a time.
+ *
+ *  Written by Andrew Clarke and released to the public domain.
+ */
+
+#ifndef __SQWRITE_H__
+#define __SQWRITE_H__
+
+#include <stdio.h>
+
+#include "squish.h"
+#include "buf.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef struct
+{
+    char *sqd_name;
+    char *sqi_name;
+    char *sqd_tmp;                   /* written here, and renamed by sqw_close() */
+    char *sqi_tmp;
+    FILE *sqd;
+    FILE *sqi;
+    BUF out;                         /* frames not written yet */
+    BUF idx;                         /* .sqi records not written yet */
+    SQBASE base;
+    unsigned long last;              /* the last frame added, or 0 */
+    int failed;                      /* errno of the first write that failed */
+}
+SQWRITER;
+
+int sqw_open(SQWRITER *w, const char *sqd_name, const char *sqi_name, const SQBASE *sqb);
+int sqw_add(SQWRITER *w, const SQXMSG *x, const unsigned char *msg, unsigned long msg_len,
+  unsigned long ctrl_len);
+int sqw_close(SQWRITER *w);
+void sqw_abort(SQWRITER *w);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif